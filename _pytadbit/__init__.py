@@ -109,6 +109,10 @@ def get_dependencies_version(dico=False):
 
 from pytadbit.hic_data             import HiC_data
 from pytadbit.tadbit               import tadbit, batch_tadbit
+from pytadbit.tadbit               import tadbit_nested
+from pytadbit.tadbit               import tadbit_shard, tadbit_merge
+from pytadbit.tadbit               import tadbit_stream
+from pytadbit.tadbit               import tadbit_mapped
 from pytadbit.chromosome           import Chromosome
 from pytadbit.experiment           import Experiment, load_experiment_from_reads
 from pytadbit.chromosome           import load_chromosome
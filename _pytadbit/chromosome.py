@@ -486,7 +486,7 @@ class Chromosome(object):
 
     def find_tad(self, experiments, name=None, n_cpus=1,
                  verbose=True, max_tad_size="max", heuristic=True,
-                 batch_mode=False, **kwargs):
+                 batch_mode=False, use_biases=False, **kwargs):
         """
         Call the :func:`pytadbit.tadbit.tadbit` function to calculate the
         position of Topologically Associated Domain boundaries
@@ -508,6 +508,9 @@ class Chromosome(object):
            found are stored under the name 'batch' plus a concatenation of the
            experiment names passed (e.g.: if experiments=['exp1', 'exp2'], the
            name would be: 'batch_exp1_exp2').
+        :param False use_biases: use the biases computed by
+           :func:`pytadbit.experiment.Experiment.normalize_hic` in the
+           likelihood, instead of the row sums (not in batch_mode)
 
         """
         experiments = experiments or self.experiments
@@ -556,6 +559,11 @@ class Chromosome(object):
             self.add_experiment(xpr)
             return
         for xpr in xprs:
+            if use_biases:
+                if not xpr.bias:
+                    raise Exception('ERROR: Experiment %s should be ' % (
+                        xpr.name) + 'normalized first\n')
+                kwargs['biases'] = [xpr.bias] * len(xpr.hic_data)
             result = tadbit(
                 xpr.hic_data,
                 remove=tuple([1 if i in xpr._zeros else 0 for i in
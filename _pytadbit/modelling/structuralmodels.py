@@ -13,7 +13,9 @@ from pytadbit.utils.extraviews      import tad_coloring
 from pytadbit.utils.extraviews      import tad_border_coloring
 from pytadbit.utils.extraviews      import color_residues
 from pytadbit.modelling.impmodel    import IMPmodel
-from pytadbit.centroid              import centroid_wrapper
+from pytadbit.centroid              import centroids_wrapper
+from pytadbit.contacts              import contact_map_wrapper
+from pytadbit.contacts              import interactions_wrapper
 from pytadbit.aligner3d             import aligner3d_wrapper
 from cPickle                        import load, dump
 from subprocess                     import Popen, PIPE
@@ -22,9 +24,11 @@ from numpy                          import median as np_median
 from numpy                          import mean as np_mean
 from numpy                          import std as np_std, log2
 from numpy                          import array, cross, dot, ma, isnan
-from numpy                          import histogram, linspace
+from numpy                          import histogram, linspace, where
+from numpy                          import frombuffer, int32
 from numpy.linalg                   import norm
 from scipy.cluster.hierarchy        import linkage, fcluster
+from scipy.spatial.distance         import squareform
 from scipy.stats                    import spearmanr, pearsonr, chisquare
 from scipy.stats                    import linregress
 from scipy.stats                    import normaltest, norm as sc_norm
@@ -32,8 +36,9 @@ from warnings                       import warn
 from string                         import uppercase as uc, lowercase as lc
 from random                         import random
 from os.path                        import exists
+from sys                            import stderr
 from pytadbit                       import get_dependencies_version
-from itertools                      import combinations
+from itertools                      import combinations, izip
 import uuid
 
 try:
@@ -244,7 +249,47 @@ class StructuralModels(object):
         raise IndexError(('Model with initial random number: %s, not found\n' +
                           '') % (rand_init))
 
-    def centroid_model(self, models=None, cluster=None, verbose=False):
+    def _group_averages(self, groups, procrustes=False, n_cpus=1):
+        """
+        Builds the average model and finds the centroid model of each group
+        of models in a single call (the coordinates of each model are passed
+        only once).
+
+        :param groups: list of lists of model indexes
+        :param False procrustes: superpose the models onto their average by
+           generalised Procrustes analysis (see :func:`average_model`)
+        :param 1 n_cpus: number of cpus to use
+
+        :returns: for each group, the index of its centroid model, the RMSD of
+           each of its models to the average (on the particles with data), and
+           the list of x, y and z coordinates of the average model
+        """
+        uniqs = sorted(set([m for group in groups for m in group]))
+        pos = dict([(m, i) for i, m in enumerate(uniqs)])
+        x = [self.__models[m]['x'] for m in uniqs]
+        y = [self.__models[m]['y'] for m in uniqs]
+        z = [self.__models[m]['z'] for m in uniqs]
+        results = centroids_wrapper(x, y, z, self._zeros, self.nloci,
+                                    len(uniqs),
+                                    [[pos[m] for m in group]
+                                     for group in groups],
+                                    int(procrustes), 100, 1e-3, n_cpus)
+        return [(uniqs[idx], rmsds, avg) for idx, rmsds, avg in results]
+
+    def _models_of(self, models=None, cluster=None):
+        """
+        Indexes of the given models, of the models of a cluster or of all the
+        models.
+        """
+        if models:
+            return [m if isinstance(m, int) else self[m]['index']
+                    if isinstance(m, str) else m['index'] for m in models]
+        if cluster > -1 and len(self.clusters) > 0:
+            return [self[str(m)]['index'] for m in self.clusters[cluster]]
+        return [m for m in self.__models]
+
+    def centroid_model(self, models=None, cluster=None, verbose=False,
+                       procrustes=False, n_cpus=1):
         """
         Estimates and returns the centroid model of a given group of models.
         
@@ -255,34 +300,50 @@ class StructuralModels(object):
            cluster number 'cluster'
         :param False verbose: prints the distance of each model to average model
            (in stderr)
+        :param False procrustes: the centroid is the closest model to the
+           average model computed by generalised Procrustes analysis (see
+           :func:`average_model`)
+        :param 1 n_cpus: number of cpus to use in the Procrustes analysis
 
         :returns: the centroid model of a given group of models (the most model
            representative)
         """
-        if models:
-            models = [m if isinstance(m, int) else self[m]['index']
-                      if isinstance(m, str) else m['index'] for m in models]
-        elif cluster > -1 and len(self.clusters) > 0:
-            models = [self[str(m)]['index'] for m in self.clusters[cluster]]
-        else:
-            models = [m for m in self.__models]
-        # remove particles with zeros from calculation
-        x = []
-        y = []
-        z = []
-        for model in xrange(len(models)):
-            x.append([self[model]['x'][i] for i in xrange(self.nloci)
-                      if self._zeros[i]])
-            y.append([self[model]['y'][i] for i in xrange(self.nloci)
-                      if self._zeros[i]])
-            z.append([self[model]['z'][i] for i in xrange(self.nloci)
-                      if self._zeros[i]])
-        zeros = tuple([True for _ in xrange(len(x[0]))])
-        idx = centroid_wrapper(x, y, z, zeros, len(x[0]), len(models),
-                               int(verbose), 0)
-        return models[idx]
-
-    def average_model(self, models=None, cluster=None, verbose=False):
+        models = self._models_of(models, cluster)
+        idx, rmsds, _ = self._group_averages([models], procrustes, n_cpus)[0]
+        if verbose:
+            for rmsd, model in sorted(zip(rmsds, models)):
+                stderr.write('%s rmsd2avg %s\n' % (model, rmsd))
+        return idx
+
+    def centroid_models(self, clusters=None, procrustes=False, n_cpus=1):
+        """
+        Estimates the centroid model of each cluster, all in a single pass.
+
+        :param None clusters: a dictionary with, as keys, the cluster number,
+           and as values the list of model names (by default
+           StructuralModels.clusters)
+        :param False procrustes: the centroids are the closest models to the
+           average models computed by generalised Procrustes analysis (see
+           :func:`average_model`)
+        :param 1 n_cpus: number of cpus to use
+
+        :returns: a dictionary with the index of the centroid model of each
+           cluster
+        """
+        clusters = clusters or self.clusters
+        keys = [c for c in clusters]
+        results = self._group_averages(
+            [self._models_of(clusters[c]) for c in keys], procrustes, n_cpus)
+        return dict([(c, idx) for c, (idx, _, _) in zip(keys, results)])
+
+    def _avgmodel(self, avg):
+        return IMPmodel((('x', avg[0]), ('y', avg[1]), ('z', avg[2]),
+                         ('rand_init', 'avg'), ('objfun', None),
+                         ('radius', float(self.resolution *
+                                          self._config['scale']) / 2)))
+
+    def average_model(self, models=None, cluster=None, verbose=False,
+                      procrustes=False, n_cpus=1):
         """
         Builds and returns an average model representing a given group of models
 
@@ -293,33 +354,43 @@ class StructuralModels(object):
            cluster number 'cluster'
         :param False verbose: prints the distance of each model to average model
            (in stderr)
+        :param False procrustes: by default, the models are superposed onto the
+           first one and averaged. With generalised Procrustes analysis they
+           are superposed onto their average, which is then updated, until it
+           converges
+        :param 1 n_cpus: number of cpus to use in the Procrustes analysis
 
         :returns: the average model of a given group of models (a new and
            ARTIFICIAL model)
 
         """
-        if models:
-            models = [m if isinstance(m, int) else self[m]['index']
-                      if isinstance(m, str) else m['index'] for m in models]
-        elif cluster > -1 and len(self.clusters) > 0:
-            models = [self[str(m)]['index'] for m in self.clusters[cluster]]
-        else:
-            models = [m for m in self.__models]
-        # remove particles with zeros from calculation
-        x = []
-        y = []
-        z = []
-        for model in xrange(len(models)):
-            x.append([self[model]['x'][i] for i in xrange(self.nloci)])
-            y.append([self[model]['y'][i] for i in xrange(self.nloci)])
-            z.append([self[model]['z'][i] for i in xrange(self.nloci)])
-        idx = centroid_wrapper(x, y, z, self._zeros, len(x[0]), len(models),
-                               int(verbose), 1)
-        avgmodel = IMPmodel((('x', idx[0]), ('y', idx[1]), ('z', idx[2]),
-                             ('rand_init', 'avg'), ('objfun', None),
-                             ('radius', float(self.resolution *
-                                              self._config['scale']) / 2)))
-        return avgmodel
+        models = self._models_of(models, cluster)
+        _, rmsds, avg = self._group_averages([models], procrustes, n_cpus)[0]
+        if verbose:
+            for rmsd, model in sorted(zip(rmsds, models)):
+                stderr.write('%s rmsd2avg %s\n' % (model, rmsd))
+        return self._avgmodel(avg)
+
+    def average_models(self, clusters=None, procrustes=False, n_cpus=1):
+        """
+        Builds an average model for each cluster, all in a single pass.
+
+        :param None clusters: a dictionary with, as keys, the cluster number,
+           and as values the list of model names (by default
+           StructuralModels.clusters)
+        :param False procrustes: use generalised Procrustes analysis (see
+           :func:`average_model`)
+        :param 1 n_cpus: number of cpus to use
+
+        :returns: a dictionary with the average model of each cluster (new and
+           ARTIFICIAL models)
+        """
+        clusters = clusters or self.clusters
+        keys = [c for c in clusters]
+        results = self._group_averages(
+            [self._models_of(clusters[c]) for c in keys], procrustes, n_cpus)
+        return dict([(c, self._avgmodel(avg))
+                     for c, (_, _, avg) in zip(keys, results)])
 
     def cluster_models(self, fact=0.75, dcutoff=None, method='mcl',
                        mcl_bin='mcl', tmp_file=None, verbose=True, n_cpus=1,
@@ -355,7 +426,8 @@ class StructuralModels(object):
         :param None tmp_file: path to a temporary file created during
            the clustering computation. Default will be created in /tmp/ folder
         :param True verbose: same as print StructuralModels.clusters
-        :param 1 n_cpus: number of cpus to use in MCL clustering
+        :param 1 n_cpus: number of cpus to use in the comparison of the models
+           and in MCL clustering
         :param mclargs: list with any other command line argument to be passed
            to mcl (i.e,: mclargs=['-pi', '10', '-I', '2.0'])
         :param False external: if True returns the cluster found instead of
@@ -368,8 +440,9 @@ class StructuralModels(object):
             ''.join([(uc + lc)[int(random() * 52)] for _ in xrange(4)]))
         if not dcutoff:
             dcutoff = int(1.5 * self.resolution * self._config['scale'])
-        scores = calc_eqv_rmsd(self.__models, self.nloci, self._zeros, dcutoff,
-                               what=what, normed=True)
+        scores, names = calc_eqv_rmsd(self.__models, self.nloci, self._zeros,
+                                      dcutoff, what=what, normed=True,
+                                      n_cpus=n_cpus)
         from distutils.spawn import find_executable
         if not find_executable(mcl_bin):
             print('\nWARNING: MCL not found in path using WARD clustering\n')
@@ -379,10 +452,8 @@ class StructuralModels(object):
             model['cluster'] = 'Singleton'
         if method == 'ward':
 
-            matrix = [[0.0 for _ in xrange(len(self))]
-                      for _ in xrange(len(self))]
-            for (i, j), score in scores.iteritems():
-                matrix[i][j] = score if score > fact * self.nloci else 0.0
+            matrix = squareform(where(scores > fact * self.nloci, scores, 0.0))
+            scores = squareform(scores)
             clust = linkage(matrix, method='ward')
             # score each possible cut in hierarchical clustering
             solutions = {}
@@ -412,10 +483,8 @@ class StructuralModels(object):
                     key=lambda x: self[str(x)]['objfun'])
         else:
             out_f = open(tmp_file, 'w')
-            uniqs = list(set([tuple(sorted((m1, m2))) for m1, m2 in scores]))
             cut = fact * (self.nloci - self._zeros.count(False))
-            for md1, md2 in uniqs:
-                score = scores[(md1, md2)]
+            for (md1, md2), score in izip(combinations(names, 2), scores):
                 if score >= cut:
                     out_f.write('model_%s\tmodel_%s\t%s\n' % (md1, md2, score))
             out_f.close()
@@ -532,10 +601,11 @@ class StructuralModels(object):
         return d
 
     def get_contact_matrix(self, models=None, cluster=None, cutoff=None,
-                           distance=False):
+                           distance=False, n_cpus=1):
         """
         Returns a matrix with the number of interactions observed below a given
-        cutoff distance.
+        cutoff distance (two particles at exactly the cutoff distance are in
+        contact).
 
         :param None models: if None (default) the contact matrix will be 
            computed using all the models. A list of numbers corresponding to a 
@@ -546,11 +616,16 @@ class StructuralModels(object):
            are in contact or not, default is 2 times resolution, times scale.
            Cutoff can also be a list of values, in wich case the returned object 
            will be a dictionnary of matrices (keys being square cutoffs)
-        :param False distance: returns the distance matrix of all_angles against 
-           all_angles particles instead of a contact_map matrix using the cutoff
+        :param False distance: deprecated and ignored (it never returned the
+           distance matrix)
+        :param 1 n_cpus: number of cpus to use
 
-        :returns: matrix frequency of interaction
+        :returns: matrix frequency of interaction (a numpy array, nan for the
+           particles without data)
         """
+        if distance:
+            warn('WARNING: the distance parameter of get_contact_matrix is ' +
+                 'deprecated and ignored', DeprecationWarning)
         if models:
             models = [m if isinstance(m, int) else self[m]['index']
                       if isinstance(m, str) else m['index'] for m in models]
@@ -562,28 +637,18 @@ class StructuralModels(object):
         if not isinstance(cutoff, list):
             cutoff = [cutoff]
             cutoff_list = False
-        cutoff.sort(reverse=True)
-        if not cutoff:
-            cutoff = [int(2 * self.resolution * self._config['scale'])]
-        cutoff = [c**2 for c in cutoff]
-        matrix = dict([(c, [[float('nan') for _ in xrange(self.nloci)]
-                            for _ in xrange(self.nloci)]) for c in cutoff])
-        wloci = [i for i in xrange(self.nloci) if self._zeros[i]]
+        cutoff = [c or int(2 * self.resolution * self._config['scale'])
+                  for c in cutoff]
         models = [self[mdl] for mdl in models]
-        for i, j in combinations(wloci, 2):
-            dists = self.__fast_square_3d_dist(i, j, models)
-            vals = dict([(c, 0) for c in cutoff])
-            for v in dists:
-                for c in cutoff:
-                    if v > c:
-                        # cutoffs are sorted so we do not need to check further
-                        break
-                    vals[c] += 1
-            for c in cutoff:
-                matrix[c][i][j] = matrix[c][j][i] = float(vals[c]) / len(models)  # * 100
+        # all the cutoffs at once, the matrices are not copied
+        matrices = frombuffer(contact_map_wrapper(
+            [mdl['x'] for mdl in models], [mdl['y'] for mdl in models],
+            [mdl['z'] for mdl in models], self._zeros, self.nloci,
+            len(models), cutoff, n_cpus)).reshape(
+                len(cutoff), self.nloci, self.nloci)
         if cutoff_list:
-            return matrix
-        return matrix.values()[0]
+            return dict([(c**2, m) for c, m in zip(cutoff, matrices)])
+        return matrices[0]
 
     def define_best_models(self, nbest):
         """
@@ -634,7 +699,8 @@ class StructuralModels(object):
         :param None tmp_file: path to a temporary file created during
            the clustering computation. Default will be created in /tmp/ folder
         :param True verbose: same as print StructuralModels.clusters
-        :param 1 n_cpus: number of cpus to use in MCL clustering
+        :param 1 n_cpus: number of cpus to use in the comparison of the models
+           and in MCL clustering
         :param mclargs: list with any other command line argument to be passed
            to mcl (i.e,: mclargs=['-pi', '10', '-I', '2.0'])
         :param 10 n_best_clusters: number of clusters to represent
@@ -789,13 +855,16 @@ class StructuralModels(object):
                       '(cutoff=%s nm)') % (
                           n_best_clusters, dcutoff), size='x-large')
         if represent_models:
+            if represent_models == 'centroid':
+                centroids = self.centroid_models(
+                    dict([(i + 1, clusters[i + 1])
+                          for i in range(1, n_best_clusters)]))
             for i in range(1, n_best_clusters):
                 ax = fig.add_subplot(n_best_clusters, n_best_clusters,
                                      i, projection='3d')
                 ax.set_title('Cluster #%s' % (i + 1), color='blue')
                 if represent_models == 'centroid':
-                    mdl = self[self.centroid_model(
-                        models=[m for m in clusters[i + 1]])]['index']
+                    mdl = self[centroids[i + 1]]['index']
                 else:
                     if represent_models != 'best':
                         warn("WARNING: represent_model value should be one of" +
@@ -1103,23 +1172,15 @@ class StructuralModels(object):
                                             ylabel=ylabel, title=title)
 
     def _get_interactions(self, models, cutoff):
-        interactions = [[] for _ in xrange(self.nloci)]
         if not cutoff:
             cutoff = int(2 * self.resolution * self._config['scale'])
-        cutoff2 = cutoff**2
-        for i in xrange(self.nloci):
-            for m in models:
-                val = 0
-                mdl = self[m]
-                for j in xrange(self.nloci):
-                    if i == j:
-                        continue
-                    val += ((mdl['x'][i] - mdl['x'][j])**2 +
-                            (mdl['y'][i] - mdl['y'][j])**2 +
-                            (mdl['z'][i] - mdl['z'][j])**2) < cutoff2
-                    # val += self.__square_3d_dist(i + 1, j + 1, models=[m])[0] < cutoff2
-                interactions[i].append(val)
-        return interactions
+        models = [self[m] for m in models]
+        counts = frombuffer(interactions_wrapper(
+            [mdl['x'] for mdl in models], [mdl['y'] for mdl in models],
+            [mdl['z'] for mdl in models], self.nloci, len(models),
+            [cutoff]), dtype=int32).reshape(len(models), self.nloci)
+        # for each particle, the number of interactions in each model
+        return counts.T.tolist()
 
     def interactions(self, models=None, cluster=None, cutoff=None,
                      steps=(1, 2, 3, 4, 5), axe=None, error=False,
@@ -1185,7 +1246,7 @@ class StructuralModels(object):
 
     def model_consistency(self, cutoffs=None, models=None,
                           cluster=None, axe=None, savefig=None, savedata=None,
-                          plot=True):
+                          plot=True, n_cpus=1):
         """
         Plots the particle consistency, over a given set of models, vs the
         modeled region bins. The consistency is a measure of the variability
@@ -1213,6 +1274,7 @@ class StructuralModels(object):
         :param None savedata: path to a file where to save the consistency data
            generated (1 column per cutoff + 1 for particle number).
         :param True plot: e.g. only saves data. No plotting done
+        :param 1 n_cpus: number of cpus to use in the comparison of the models
 
         """
         models = self._get_models(models, cluster)
@@ -1223,10 +1285,9 @@ class StructuralModels(object):
                        int(1.0 * self.resolution * self._config['scale']),
                        int(1.5 * self.resolution * self._config['scale']),
                        int(2.0 * self.resolution * self._config['scale']))
-        consistencies = {}
-        for cut in cutoffs:
-            consistencies[cut] = calc_consistency(models, self.nloci,
-                                                  self._zeros, cut)
+        # all the cutoffs at once
+        consistencies = dict(zip(cutoffs, calc_consistency(
+            models, self.nloci, self._zeros, list(cutoffs), n_cpus)))
         # write consistencies to file
         if savedata:
             out = open(savedata, 'w')
@@ -1652,7 +1713,7 @@ class StructuralModels(object):
         """
         if not cutoff:
             cutoff = int(2 * self.resolution * self._config['scale'])
-        if contact_matrix:
+        if contact_matrix is not None:
             model_matrix = contact_matrix
         else:
             model_matrix = self.get_contact_matrix(models=models, cluster=cluster,
@@ -2176,16 +2237,6 @@ class StructuralModels(object):
                 (mdl['z'][part1] - mdl['z'][part2])**2
                 for mdl in models]
     
-    def __fast_square_3d_dist(self, part1, part2, models):
-        """
-        same as median_3d_dist, but return the square of the distance instead
-        we know what we are doing.
-        """
-        return [(mdl['x'][part1] - mdl['x'][part2])**2 +
-                (mdl['y'][part1] - mdl['y'][part2])**2 +
-                (mdl['z'][part1] - mdl['z'][part2])**2
-                for mdl in models]
-
     def objective_function_model(self, model, log=False, smooth=True, axe=None,
                                  savefig=None):
         """
@@ -2413,8 +2464,9 @@ class StructuralModels(object):
             fil['restr'] = '[]'
         fil['cluster'] = '[' + ','.join(['[' + ','.join(self.clusters[c]) + ']'
                                          for c in self.clusters]) + ']'
+        centroids = self.centroid_models()
         fil['centroid'] = '[' + ','.join(
-            [self[self.centroid_model(cluster=c)]['rand_init']
+            [self[centroids[c]]['rand_init']
              for c in self.clusters]) + ']'
         fil['len_hic_data'] = len(self._original_data)
         try:
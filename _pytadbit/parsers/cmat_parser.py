@@ -0,0 +1,123 @@
+"""
+18 Oct 2026
+
+Binary container of binned contact matrices (see src/tadbit_cmat.h). The
+counts are stored by diagonal with an index of blocks, so that any region or
+band is read directly from the memory-mapped file.
+"""
+
+from os.path                 import isfile
+from array                   import array
+from collections             import OrderedDict
+from pytadbit                import HiC_data
+from pytadbit.tadbit_py      import _cmat_write_wrapper, _cmat_info_wrapper
+from pytadbit.tadbit_py      import _cmat_fetch_wrapper, _cmat_diagonal_wrapper
+
+CMAT_MAGIC = 'TADBITCM'
+
+
+def is_cmat(fname):
+    """
+    :param fname: path to a file
+
+    :returns: True if the file is a contact-matrix container
+    """
+    if not isfile(fname):
+        return False
+    with open(fname, 'rb') as handler:
+        return handler.read(len(CMAT_MAGIC)) == CMAT_MAGIC
+
+
+def write_cmat(hic_data, fname, band=None, block=4096, compress=True):
+    """
+    Writes a Hi-C matrix to a contact-matrix container, with its chromosomes,
+    resolution and biases (if normalized).
+
+    :param hic_data: HiC_data object (the matrix is considered symmetric)
+    :param fname: path to the output file
+    :param None band: number of diagonals to store (the counts further from
+       the diagonal are dropped). By default all the diagonals are stored
+    :param 4096 block: number of counts per block of the diagonals. Reading a
+       region of a compressed container decompresses the blocks crossing it
+    :param True compress: compress the blocks
+    """
+    size = len(hic_data)
+    counts = tuple(int(hic_data.get(i * size + j, 0))
+                   for i in xrange(size) for j in xrange(size))
+    chromosomes = ([(crm, hic_data.chromosomes[crm])
+                    for crm in hic_data.chromosomes]
+                   if hic_data.chromosomes else [])
+    bias = (tuple(float(hic_data.bias.get(i, 0)) for i in xrange(size))
+            if hic_data.bias else None)
+    _cmat_write_wrapper(fname, counts, size, band or 0, block, int(compress),
+                        hic_data.resolution if hic_data.resolution > 1 else 0,
+                        chromosomes, bias)
+
+
+def write_raw_matrix(hic_data, fname):
+    """
+    Writes a Hi-C matrix as n x n integers in the native byte order, the
+    format mapped in memory by :func:`pytadbit.tadbit.tadbit_mapped`.
+
+    :param hic_data: HiC_data object
+    :param fname: path to the output file
+    """
+    with open(fname, 'wb') as handler:
+        array('i', hic_data.get_as_tuple()).tofile(handler)
+
+
+def read_cmat(fname, focus=None):
+    """
+    Reads a contact-matrix container, or only a region of it (the rest of the
+    file is not read).
+
+    :param fname: path to the container
+    :param None focus: a tuple with the (start, end) position of the desired
+       region (start, starting at 1, and both start and end are inclusive), or
+       a chromosome name
+
+    :returns: HiC_data object of the region, with its biases if the container
+       has them
+    """
+    size, _, resolution, chroms, bias = _cmat_info_wrapper(fname)
+    if focus is None:
+        beg, end = 0, size
+    elif isinstance(focus, tuple):
+        beg, end = focus[0] - 1, focus[1]
+    else:
+        try:
+            beg, siz = [(f, s) for c, f, s in chroms if c == focus][0][:2]
+        except IndexError:
+            raise KeyError('ERROR: chromosome %s not in %s' % (focus, fname))
+        end = beg + siz
+    if not 0 <= beg < end <= size:
+        raise IndexError('ERROR: region out of the matrix (%d bins)' % size)
+    nbins = end - beg
+    counts = _cmat_fetch_wrapper(fname, beg, end - 1, beg, end - 1)
+    # the chromosomes inside the region
+    chromosomes = OrderedDict()
+    sections = {}
+    for crm, first, siz in chroms:
+        for i in xrange(max(first, beg), min(first + siz, end)):
+            chromosomes[crm] = chromosomes.get(crm, 0) + 1
+            sections[(crm, i - first)] = i - beg
+    hic_data = HiC_data([(i, counts[i]) for i in xrange(nbins**2)
+                         if counts[i]], nbins,
+                        chromosomes=chromosomes or None,
+                        dict_sec=sections or None,
+                        resolution=resolution or 1, symmetricized=False)
+    if bias:
+        hic_data.bias = dict([(i - beg, bias[i]) for i in xrange(beg, end)])
+    return hic_data
+
+
+def read_cmat_diagonal(fname, dist):
+    """
+    Reads one diagonal of a contact-matrix container.
+
+    :param fname: path to the container
+    :param dist: distance of the diagonal, in bins, to the main diagonal
+
+    :returns: list of the counts (i, i + dist)
+    """
+    return list(_cmat_diagonal_wrapper(fname, dist))
@@ -8,6 +8,7 @@ from math                    import sqrt, isnan
 from pytadbit.parsers.gzopen import gzopen
 from collections             import OrderedDict
 from pytadbit                import HiC_data
+from pytadbit.parsers.cmat_parser import is_cmat, read_cmat
 
 HIC_DATA = True
 
@@ -287,8 +288,10 @@ def read_matrix(things, parser=None, hic=True, resolution=1, **kwargs):
     Read and checks a matrix from a file (using
     :func:`pytadbit.parser.hic_parser.autoreader`) or a list.
 
-    :param things: might be either a file name, a file handler or a list of
-        list (all with same length)
+    :param things: might be either a file name (tab-separated matrix or
+        contact-matrix container, see
+        :func:`pytadbit.parsers.cmat_parser.write_cmat`), a file handler or a
+        list of list (all with same length)
     :param None parser: a parser function that returns a tuple of lists
        representing the data matrix,
        with this file example.tsv:
@@ -331,6 +334,8 @@ def read_matrix(things, parser=None, hic=True, resolution=1, **kwargs):
                                      chromosomes=chromosomes,
                                      resolution=resolution,
                                      symmetricized=sym, masked=masked))
+        elif isinstance(thing, str) and is_cmat(thing):
+            matrices.append(read_cmat(thing))
         elif isinstance(thing, str):
             try:
                 matrix, size, header, masked, sym = parser(gzopen(thing))
@@ -2,9 +2,17 @@
 24 Oct 2012
 """
 
-from os                           import path, listdir
+from os                           import path, listdir, fstat
 from pytadbit.parsers.hic_parser  import read_matrix
 from pytadbit.tadbit_py           import _tadbit_wrapper
+from pytadbit.tadbit_py           import _tadbit_bias_wrapper
+from pytadbit.tadbit_py           import _tadbit_focus_wrapper
+from pytadbit.tadbit_py           import _tadbit_nested_wrapper
+from pytadbit.tadbit_py           import _tadbit_multires_wrapper
+from pytadbit.tadbit_py           import _tadbit_stream_wrapper
+from pytadbit.tadbit_py           import _tadbit_shard_wrapper
+from pytadbit.tadbit_py           import _tadbit_merge_wrapper
+from pytadbit.tadbit_py           import _tadbit_mapped_wrapper
 from math                         import isnan, sqrt
 from scipy.sparse.csr             import csr_matrix
 from scipy.stats                  import mannwhitneyu
@@ -12,7 +20,8 @@ import numpy as np
 
 
 def tadbit(x, remove=None, n_cpus=1, verbose=True,
-           max_tad_size="max", no_heuristic=0, use_topdom=False, topdom_window=5, **kwargs):
+           max_tad_size="max", no_heuristic=0, use_topdom=False, topdom_window=5,
+           coarse_factor=1, biases=None, focus=None, **kwargs):
     """
     The TADbit algorithm works on raw chromosome interaction count data.
     The normalization is neither necessary nor recommended,
@@ -38,12 +47,33 @@ def tadbit(x, remove=None, n_cpus=1, verbose=True,
        columns to remove (if None only columns with a 0 in the diagonal will be
        removed)
     :param 1 n_cpus: The number of CPUs to allocate to TADbit. If
-       n_cpus='max' the total number of CPUs will be used
+       n_cpus='max' the total number of CPUs will be used (those available
+       to the process, within the CPU quota of its cgroup). The threads are
+       bound to CPUs if the environment variable TADBIT_PIN_THREADS is set
+       to 1
     :param auto max_tad_size: an integer defining maximum size of TAD. Default
        (auto or max) defines it as the number of rows/columns
     :param False no_heuristic: whether to use or not some heuristics
     :param False use_topdom: whether to use TopDom algorithm to find tads or not (http://www.ncbi.nlm.nih.gov/pubmed/26704975, http://zhoulab.usc.edu/TopDom/)
     :param 5 topdom_window: the window size for topdom algorithm
+    :param 1 coarse_factor: if greater than 1, TADs are first searched in a
+       matrix binned coarse_factor times coarser, and the search at the
+       original resolution is restricted to the neighborhood of the projected
+       boundaries (replaces the heuristic, max_tad_size and no_heuristic are
+       ignored)
+    :param None biases: precomputed biases of the rows/columns (e.g. ICE
+       biases from :func:`pytadbit.utils.hic_filtering.iterative`), used
+       in the likelihood instead of the row sums. Either one bias vector
+       (list or dictionary bin -> bias) per matrix, or a single one if
+       only one matrix is given. Bins without a positive bias are removed.
+       Use 'none' to segment without bias. Not compatible with
+       coarse_factor
+    :param None focus: tuple with the first and last bins of a region to
+       segment alone. The likelihood of the TADs of the region accounts for
+       their contacts with the rest of the matrix, but only the region is
+       segmented (the rest of the matrix is not copied). The TADs are
+       returned in the coordinates of the whole matrix. Not compatible with
+       coarse_factor
     :param False get_weights: either to return the weights corresponding to the
        Hi-C count (weights are a normalization dependent of the count of each
        columns)
@@ -55,33 +85,54 @@ def tadbit(x, remove=None, n_cpus=1, verbose=True,
     nums = [hic_data for hic_data in read_matrix(x, one=False)]
 
     if not use_topdom:
-        size = len(nums[0])
-        nums = [num.get_as_tuple() for num in nums]
-        if not remove:
-            # if not given just remove columns with zero in diagonal
-            remove = tuple([0 if nums[0][i*size+i] else 1 for i in xrange(size)])
-        n_cpus = n_cpus if n_cpus != 'max' else 0
-        max_tad_size = size if max_tad_size in ["max", "auto"] else max_tad_size
-        _, nbks, passages, _, _, bkpts = \
-           _tadbit_wrapper(nums,             # list of lists of Hi-C data
-                           remove,           # list of columns marking filtered
-                           size,             # size of one row/column
-                           len(nums),        # number of matrices
-                           n_cpus,           # number of threads
-                           int(verbose),     # verbose 0/1
-                           max_tad_size,     # max_tad_size
-                           kwargs.get('ntads', -1) + 1,
-                           int(no_heuristic),# heuristic 0/1
-                           )
-
-        breaks = [i for i in xrange(size) if bkpts[i + nbks * size] == 1]
-        scores = [p for p in passages if p > 0]
-
-        result = {'start': [], 'end'  : [], 'score': []}
-        for brk in xrange(len(breaks)+1):
-            result['start'].append((breaks[brk-1] + 1) if brk > 0 else 0)
-            result['end'  ].append(breaks[brk] if brk < len(breaks) else size - 1)
-            result['score'].append(scores[brk] if brk < len(breaks) else None)
+        nums, remove, size, n_cpus, max_tad_size = _prepare_input(
+            nums, remove, n_cpus, max_tad_size)
+        if focus:
+            if coarse_factor > 1:
+                raise Exception('ERROR: focus is not compatible with ' +
+                                'coarse_factor\n')
+            beg, end = focus
+            bias_model = 0 if biases is None else (
+                2 if biases == 'none' else 1)
+            _, nbks, passages, _, _, bkpts = \
+               _tadbit_focus_wrapper(nums, remove, size, len(nums), n_cpus,
+                                     int(verbose), max_tad_size,
+                                     kwargs.get('ntads', -1) + 1,
+                                     int(no_heuristic), bias_model,
+                                     _prepare_biases(biases, size, len(nums))
+                                     if bias_model == 1 else None, beg, end)
+            result = _format_result(end - beg + 1, nbks, passages, bkpts)
+            result['start'] = [s + beg for s in result['start']]
+            result['end'  ] = [e + beg for e in result['end'  ]]
+            return result
+        if biases is not None:
+            if coarse_factor > 1:
+                raise Exception('ERROR: biases are not compatible with ' +
+                                'coarse_factor\n')
+            _, nbks, passages, _, _, bkpts = \
+               _tadbit_bias_wrapper(nums, remove, size, len(nums), n_cpus,
+                                    int(verbose), max_tad_size,
+                                    kwargs.get('ntads', -1) + 1,
+                                    int(no_heuristic),
+                                    _prepare_biases(biases, size, len(nums)))
+        elif coarse_factor > 1:
+            _, nbks, passages, _, _, bkpts = \
+               _tadbit_multires_wrapper(nums, remove, size, len(nums), n_cpus,
+                                        int(verbose), coarse_factor,
+                                        kwargs.get('ntads', -1) + 1)
+        else:
+            _, nbks, passages, _, _, bkpts = \
+               _tadbit_wrapper(nums,             # list of lists of Hi-C data
+                               remove,           # list of columns marking filtered
+                               size,             # size of one row/column
+                               len(nums),        # number of matrices
+                               n_cpus,           # number of threads
+                               int(verbose),     # verbose 0/1
+                               max_tad_size,     # max_tad_size
+                               kwargs.get('ntads', -1) + 1,
+                               int(no_heuristic),# heuristic 0/1
+                               )
+        result = _format_result(size, nbks, passages, bkpts)
     else:
         result = {'start': [], 'end'  : [], 'score': [], 'tag': []}
 
@@ -104,6 +155,224 @@ def tadbit(x, remove=None, n_cpus=1, verbose=True,
     return result
 
 
+def tadbit_nested(x, max_level=2, remove=None, n_cpus=1, verbose=True,
+                  max_tad_size="max", no_heuristic=0, biases=None, **kwargs):
+    """
+    Hierarchical version of :func:`tadbit`. The TADs are called as in
+    :func:`tadbit`, then each TAD is segmented again into sub-TADs (and so
+    on, down to max_level levels). The bias of the whole matrix is used at
+    every level, so that the likelihood of the TAD interiors computed at one
+    level is reused by the next ones.
+
+    :param x: same as in :func:`tadbit`
+    :param 2 max_level: number of levels of the boundary tree (1 for the
+       TADs only)
+    :param None remove: same as in :func:`tadbit`
+    :param 1 n_cpus: same as in :func:`tadbit`
+    :param auto max_tad_size: same as in :func:`tadbit`
+    :param False no_heuristic: same as in :func:`tadbit`
+    :param None biases: same as in :func:`tadbit`
+
+    :returns: the boundary tree as a dictionary with the 'start', 'end',
+       'score', 'level' and 'parent' of each TAD (lists sorted by level,
+       with the sub-TADs of a TAD consecutive). 'parent' is the index of
+       the enclosing TAD (None for the first level), and the 'score' of the
+       last sub-TAD of a TAD is None
+    """
+    nums = [hic_data for hic_data in read_matrix(x, one=False)]
+    nums, remove, size, n_cpus, max_tad_size = _prepare_input(
+        nums, remove, n_cpus, max_tad_size)
+    bias_model = 0 if biases is None else (2 if biases == 'none' else 1)
+    _, tree = _tadbit_nested_wrapper(
+        nums, remove, size, len(nums), n_cpus, int(verbose), max_tad_size,
+        kwargs.get('ntads', -1) + 1, int(no_heuristic), bias_model,
+        _prepare_biases(biases, size, len(nums)) if bias_model == 1 else None,
+        max_level)
+    # node 0 is the whole matrix
+    starts, ends, parents, levels, scores = [field[1:] for field in tree]
+    return {'start' : starts,
+            'end'   : ends,
+            'score' : [s or None for s in scores],
+            'level' : levels,
+            'parent': [p - 1 if p > 0 else None for p in parents]}
+
+
+def tadbit_stream(x, window=500, overlap=100, remove=None, n_cpus=1,
+                  n_windows=1, verbose=True, max_tad_size="max", no_heuristic=0):
+    """
+    Segment a whole chromosome by overlapping windows. The matrices are read
+    from disk row by row and each window is segmented with the TADbit
+    algorithm as soon as it is read, so that the memory needed is bounded by
+    the size of the windows. The boundaries found in the overlaps are
+    reconciled by dynamic programming.
+
+    :param x: path to a tab-separated matrix of interaction counts (or to a
+       contact-matrix container, see
+       :func:`pytadbit.parsers.cmat_parser.write_cmat`), or a list of such
+       paths for replicated experiments
+    :param 500 window: number of bins of the windows
+    :param 100 overlap: number of bins shared by consecutive windows
+    :param None remove: a python list of booleans mapping positively columns
+       to remove (if None only columns with a 0 in the diagonal will be
+       removed)
+    :param 1 n_cpus: The number of CPUs to allocate to TADbit. If
+       n_cpus='max' the total number of CPUs will be used
+    :param 1 n_windows: number of windows segmented in parallel (the CPUs
+       are shared among them)
+    :param auto max_tad_size: an integer defining maximum size of TAD. Default
+       (auto or max) defines it as the size of the windows
+    :param False no_heuristic: whether to use or not some heuristics
+
+    :returns: the same as :func:`tadbit`
+    """
+    paths = [x] if isinstance(x, str) else list(x)
+    n_cpus = n_cpus if n_cpus != 'max' else 0
+    max_tad_size = window if max_tad_size in ["max", "auto"] else max_tad_size
+    size, passages, bkpts = _tadbit_stream_wrapper(
+        paths, tuple(remove) if remove else None, window, overlap, n_cpus,
+        n_windows, int(verbose), max_tad_size, int(no_heuristic))
+    return _format_result(size, 0, passages, bkpts)
+
+
+def tadbit_shard(x, shard, n_shards, outfile, remove=None, n_cpus=1,
+                 verbose=True, max_tad_size="max", no_heuristic=0):
+    """
+    Compute one shard of the slice log-likelihoods of :func:`tadbit` and
+    write it to a file. The slices are split by bands of diagonals of
+    similar cost, so that the shards can be computed by independent
+    processes (or on different machines) and assembled with
+    :func:`tadbit_merge`.
+
+    :param x: same as in :func:`tadbit`
+    :param shard: index of the shard to compute (from 0 to n_shards - 1)
+    :param n_shards: total number of shards
+    :param outfile: path to the shard file to write
+    :param None remove: same as in :func:`tadbit`
+    :param 1 n_cpus: same as in :func:`tadbit`
+    :param auto max_tad_size: same as in :func:`tadbit`
+    :param False no_heuristic: same as in :func:`tadbit`
+
+    :returns: the path to the shard file
+    """
+    nums = [hic_data for hic_data in read_matrix(x, one=False)]
+    nums, remove, size, n_cpus, max_tad_size = _prepare_input(
+        nums, remove, n_cpus, max_tad_size)
+    if _tadbit_shard_wrapper(nums, remove, size, len(nums), n_cpus,
+                             int(verbose), max_tad_size, int(no_heuristic),
+                             shard, n_shards, outfile):
+        raise IOError('ERROR: could not compute shard %d of %d\n' % (
+            shard, n_shards))
+    return outfile
+
+
+def tadbit_merge(x, shard_files, remove=None, n_cpus=1, verbose=True,
+                 max_tad_size="max", no_heuristic=0, **kwargs):
+    """
+    Assemble the shard files written by :func:`tadbit_shard` and finish the
+    segmentation. Slices missing from the shards are computed locally, and
+    the result is identical to that of :func:`tadbit` called with the same
+    arguments.
+
+    :param x: same as in :func:`tadbit`
+    :param shard_files: list of paths to the shard files
+    :param None remove: same as in :func:`tadbit`
+    :param 1 n_cpus: same as in :func:`tadbit`
+    :param auto max_tad_size: same as in :func:`tadbit`
+    :param False no_heuristic: same as in :func:`tadbit`
+
+    :returns: the same as :func:`tadbit`
+    """
+    nums = [hic_data for hic_data in read_matrix(x, one=False)]
+    nums, remove, size, n_cpus, max_tad_size = _prepare_input(
+        nums, remove, n_cpus, max_tad_size)
+    _, nbks, passages, _, _, bkpts = \
+       _tadbit_merge_wrapper(nums, remove, size, len(nums), n_cpus,
+                             int(verbose), max_tad_size,
+                             kwargs.get('ntads', -1) + 1, int(no_heuristic),
+                             list(shard_files))
+    return _format_result(size, nbks, passages, bkpts)
+
+
+def tadbit_mapped(x, remove=None, n_cpus=1, verbose=True, max_tad_size="max",
+                  no_heuristic=0, biases=None, **kwargs):
+    """
+    Version of :func:`tadbit` for matrices too large to be loaded. The
+    matrices are mapped in memory and read in place by the C code, so that
+    they are neither parsed nor copied (the rows/columns removed are skipped
+    when reading them).
+
+    :param x: path to a matrix written with
+       :func:`pytadbit.parsers.cmat_parser.write_raw_matrix` (or an open
+       file descriptor of it), or a list of such paths for replicated
+       experiments
+    :param None remove: same as in :func:`tadbit`
+    :param 1 n_cpus: same as in :func:`tadbit`
+    :param auto max_tad_size: same as in :func:`tadbit`
+    :param False no_heuristic: same as in :func:`tadbit`
+    :param None biases: same as in :func:`tadbit`
+
+    :returns: the same as :func:`tadbit`
+    """
+    files = [x] if isinstance(x, (str, int)) else list(x)
+    nbytes = (fstat(files[0]).st_size if isinstance(files[0], int)
+              else path.getsize(files[0]))
+    size = int(round(sqrt(nbytes / 4)))
+    n_cpus = n_cpus if n_cpus != 'max' else 0
+    max_tad_size = 0 if max_tad_size in ["max", "auto"] else max_tad_size
+    bias_model = 0 if biases is None else (2 if biases == 'none' else 1)
+    nbks = kwargs.get('ntads', -1) + 1
+    _, nbks, passages, _, _, bkpts = _tadbit_mapped_wrapper(
+        files, tuple(remove) if remove else None, n_cpus, int(verbose),
+        max_tad_size, nbks, int(no_heuristic), bias_model,
+        _prepare_biases(biases, size, len(files)) if bias_model == 1 else None)
+    return _format_result(size, nbks, passages, bkpts)
+
+
+def _prepare_input(nums, remove, n_cpus, max_tad_size):
+    """
+    Convert the parsed Hi-C data into the arguments of the C wrappers.
+    """
+    size = len(nums[0])
+    nums = [num.get_as_tuple() for num in nums]
+    if not remove:
+        # if not given just remove columns with zero in diagonal
+        remove = tuple([0 if nums[0][i*size+i] else 1 for i in xrange(size)])
+    n_cpus = n_cpus if n_cpus != 'max' else 0
+    max_tad_size = size if max_tad_size in ["max", "auto"] else max_tad_size
+    return nums, remove, size, n_cpus, max_tad_size
+
+
+def _prepare_biases(biases, size, n_mat):
+    """
+    Convert the biases given to :func:`tadbit` into one tuple of floats per
+    matrix (bins without bias get 0 and are removed by the C code).
+    """
+    if biases == 'none':
+        return None
+    if isinstance(biases, dict) or not hasattr(biases[0], '__iter__'):
+        biases = [biases] * n_mat
+    if len(biases) != n_mat:
+        raise Exception('ERROR: one bias vector is needed per matrix\n')
+    return [tuple(float(bias.get(i, 0)) if isinstance(bias, dict)
+                  else float(bias[i]) for i in xrange(size))
+            for bias in biases]
+
+
+def _format_result(size, nbks, passages, bkpts):
+    """
+    Convert the output of the C wrappers into a dictionary of TADs.
+    """
+    breaks = [i for i in xrange(size) if bkpts[i + nbks * size] == 1]
+    scores = [p for p in passages if p > 0]
+
+    result = {'start': [], 'end'  : [], 'score': []}
+    for brk in xrange(len(breaks)+1):
+        result['start'].append((breaks[brk-1] + 1) if brk > 0 else 0)
+        result['end'  ].append(breaks[brk] if brk < len(breaks) else size - 1)
+        result['score'].append(scores[brk] if brk < len(breaks) else None)
+    return result
+
+
 def batch_tadbit(directory, parser=None, **kwargs):
     """
     Use tadbit on directories of data files.
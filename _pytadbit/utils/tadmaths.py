@@ -185,7 +185,8 @@ def calinski_harabasz(scores, clusters):
     elements (models in this case).
 
     :param scores: a dict with, as keys, a tuple with a pair of models; and, as
-       value, the distance between these models.
+       value, the distance between these models (or a square matrix of the
+       distances, indexed by model).
     :param clusters: a dict with, as key, the cluster number, and as value a
        list of models
     :param nmodels: total number of models
@@ -6,7 +6,6 @@
 
 from pytadbit.eqv_rms_drms import rmsdRMSD_wrapper
 from pytadbit.consistency import consistency_wrapper
-from itertools import combinations
 import numpy as np
 from math import pi, sqrt, cos, sin, acos
 
@@ -283,22 +282,37 @@ def angle_between_3_points(point1, point2, point3):
     return g
 
 
-def calc_consistency(models, nloci, zeros, dcutoff=200):
-    combines = list(combinations(models, 2))
-    parts = [0 for _ in xrange(nloci)]
-    for pm in consistency_wrapper([model['x'] for model in models],
-                                  [model['y'] for model in models],
-                                  [model['z'] for model in models],
-                                  zeros,
-                                  nloci, dcutoff, range(len(models)),
-                                  len(models)):
-        for i, p in enumerate(pm):
-            parts[i] += p
-    return [float(p)/len(combines) * 100 for p in parts]
+def calc_consistency(models, nloci, zeros, dcutoff=200, n_cpus=1):
+    """
+    Percentage of the pairs of models in which each particle is in equivalent
+    position (closer than dcutoff once the models superposed).
+
+    :param models: list of models
+    :param nloci: number of particles per model
+    :param zeros: tuple of True/False, the particles to superpose
+    :param 200 dcutoff: distance cutoff (nm), or list of cutoffs. Each pair of
+       models is superposed only once for all the cutoffs
+    :param 1 n_cpus: number of cpus to use
+
+    :returns: the list of the consistency of each particle, or one such list
+       for each cutoff if dcutoff is a list
+    """
+    cutoffs = dcutoff if isinstance(dcutoff, (list, tuple)) else [dcutoff]
+    npairs = len(models) * (len(models) - 1) / 2
+    counts = consistency_wrapper([model['x'] for model in models],
+                                 [model['y'] for model in models],
+                                 [model['z'] for model in models],
+                                 zeros, nloci, cutoffs, range(len(models)),
+                                 len(models), n_cpus)
+    consistencies = [[float(p) / npairs * 100 for p in parts]
+                     for parts in counts]
+    if cutoffs is dcutoff:
+        return consistencies
+    return consistencies[0]
 
 
 def calc_eqv_rmsd(models, nloci, zeros, dcutoff=200, one=False, what='score',
-                  normed=True):
+                  normed=True, n_cpus=1):
     """
     Calculates the RMSD, dRMSD, the number of equivalent positions and a score
     combining these three measures. The measure are done between a group of
@@ -315,8 +329,14 @@ def calc_eqv_rmsd(models, nloci, zeros, dcutoff=200, one=False, what='score',
        'drmsd' or 'eqv'
     :param True normed: normalize result by maximum value (only applies to rmsd
        and drmsd)
+    :param 1 n_cpus: number of threads computing the pairwise comparisons (0
+       for all the CPUs). The result does not depend on it
 
-    :returns: a score of each pairwise comparison according to:
+    :returns: a condensed array (float32) with the value of each pairwise
+       comparison, in the order of :func:`scipy.spatial.distance.squareform`
+       (i.e. the pairs (0, 1), (0, 2) ... (0, n-1), (1, 2) ...), and the list
+       of the models, such that the ith model of the pairs is the ith element
+       of this list. The score is:
 
        .. math::
                                      
@@ -324,7 +344,8 @@ def calc_eqv_rmsd(models, nloci, zeros, dcutoff=200, one=False, what='score',
                                          {RMSD_i / max(RMSD)}
 
        where :math:`eqvs_i` is the number of equivalent position for the ith
-       pairwise model comparison.
+       pairwise model comparison. With one=True, only the dRMSD of the two
+       models is returned.
        
     """
     what = what.lower()
@@ -342,8 +363,11 @@ def calc_eqv_rmsd(models, nloci, zeros, dcutoff=200, one=False, what='score',
     zeros = tuple([True for _ in xrange(len(x[0]))])
     scores = rmsdRMSD_wrapper(x, y, z, zeros, len(zeros),
                               dcutoff, range(len(models)), len(models),
-                              int(one), what, int(normed))
-    return scores
+                              int(one), what, int(normed), n_cpus)
+    if one:
+        return scores
+    # the values are wrapped, not copied
+    return np.frombuffer(scores[0], dtype=np.float32), scores[1]
 
 
 def dihedral(a, b, c, d, e):
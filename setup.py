@@ -95,8 +95,9 @@ def main():
     pytadbit_module = Extension('pytadbit.tadbit_py',
                                 language = "c",
                                 sources=['src/tadbit_py.c'],
+                                libraries=['z'],
                                 extra_compile_args=['-std=c99'])
-    # OLD c module to find TADs
+    # c module to find TADs with the interface of the old stand-alone engine
     pytadbit_module_old = Extension('pytadbit.tadbitalone_py',
                                     language = "c",
                                     sources=['src/tadbit_alone_py.c'],
@@ -105,8 +106,8 @@ def main():
     eqv_rmsd_module = Extension('pytadbit.eqv_rms_drms',
                                 language = "c++",
                                 sources=['src/3d-lib/eqv_rms_drms_py.cpp',
-                                         'src/3d-lib/matrices.cc',
                                          'src/3d-lib/3dStats.cpp',
+                                         'src/3d-lib/ensemble.cpp',
                                          'src/3d-lib/align.cpp'],
                                 extra_compile_args=["-ffast-math"])
     # c++ module to align a pair of 3D models
@@ -114,8 +115,8 @@ def main():
                                  language = "c++",
                                  runtime_library_dirs=['3d-lib/'],
                                  sources=['src/3d-lib/align_py.cpp',
-                                          'src/3d-lib/matrices.cc',
                                           'src/3d-lib/3dStats.cpp',
+                                          'src/3d-lib/ensemble.cpp',
                                           'src/3d-lib/align.cpp'],
                                  extra_compile_args=["-ffast-math"])
     # c++ module to align and calculate consistency of a group of 3D models
@@ -123,8 +124,8 @@ def main():
                                    language = "c++",
                                    runtime_library_dirs=['3d-lib/'],
                                    sources=['src/3d-lib/consistency_py.cpp',
-                                            'src/3d-lib/matrices.cc',
                                             'src/3d-lib/3dStats.cpp',
+                                            'src/3d-lib/ensemble.cpp',
                                             'src/3d-lib/align.cpp'],
                                    extra_compile_args=["-ffast-math"])
     # c++ module to get centroid of a group of 3D models
@@ -132,8 +133,17 @@ def main():
                                 language = "c++",
                                 runtime_library_dirs=['3d-lib/'],
                                 sources=['src/3d-lib/centroid_py.cpp',
-                                         'src/3d-lib/matrices.cc',
                                          'src/3d-lib/3dStats.cpp',
+                                         'src/3d-lib/ensemble.cpp',
+                                         'src/3d-lib/align.cpp'],
+                                extra_compile_args=["-ffast-math"])
+    # c++ module to get the contacts between the particles of 3D models
+    contacts_module = Extension('pytadbit.contacts',
+                                language = "c++",
+                                runtime_library_dirs=['3d-lib/'],
+                                sources=['src/3d-lib/contacts_py.cpp',
+                                         'src/3d-lib/3dStats.cpp',
+                                         'src/3d-lib/ensemble.cpp',
                                          'src/3d-lib/align.cpp'],
                                 extra_compile_args=["-ffast-math"])
 
@@ -193,7 +203,8 @@ def main():
         author_email = 'serra.francois@gmail.com',
         ext_modules  = [pytadbit_module, pytadbit_module_old,
                         eqv_rmsd_module, centroid_module,
-                        consistency_module, aligner3d_module],
+                        consistency_module, aligner3d_module,
+                        contacts_module],
         package_dir  = {'pytadbit': PATH + '/_pytadbit'},
         packages     = ['pytadbit', 'pytadbit.parsers', 'pytadbit.tools',
                         'pytadbit.boundary_aligner', 'pytadbit.utils',
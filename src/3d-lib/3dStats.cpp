@@ -1,161 +1,876 @@
-#include <sstream>
-#include <map>
-#include <set>
 #include <math.h>
 #include "align.h"
 #include <cstring>
+#include <algorithm>
+#include <new>
+#include <pthread.h>
+#include <unistd.h>
+#include "3dStats.h"
 
 // #include <iostream>
 using namespace std;
 
-float distance(float* p1, float* p2) {
-  float x, y, z;
-
-  x = p1[0] - p2[0];
-  y = p1[1] - p2[1];
-  z = p1[2] - p2[2];
-  
-  return sqrt(x*x + y*y + z*z);
-}
-
-float ddistance(float* p1, float* p2) {
-  float x, y, z;
-
-  x = p1[0] - p2[0];
-  y = p1[1] - p2[1];
-  z = p1[2] - p2[2];
-  
-  return x*x + y*y + z*z;
-}
 
+// Rotation 'rot' of the centered model 'm' onto model 'ref' (see
+// 'centerModels'), and add the rotated model to the average model
+// 'avg'. 'ref' itself is added as it is.
+void avgCoord(ensemble *ens, const inertia *in, int ref, int m, int *zeros,
+	      double *rot, int avg) {
+  int size = ens->size;
+  float *ax = ens_x(ens, avg), *ay = ens_y(ens, avg), *az = ens_z(ens, avg);
+  const float *x = ens_x(ens, m), *y = ens_y(ens, m), *z = ens_z(ens, m);
 
-void avgCoord(map<string, float**>::iterator it1, map<string, float**>::iterator it2,
-	      int *zeros, int size, set<string> modelList, bool add_first, float** avg) {
-  bool is_in; 
-
-  align(it2->second, it1->second, zeros, size);
-  // PStruct
-  if(add_first) {
-    // cout << it2->first << endl;
-    for (int i=0; i < size; i++) {
-      avg[i][0] += it1->second[i][0];
-      avg[i][1] += it1->second[i][1];
-      avg[i][2] += it1->second[i][2];
-    }
+  if (m == ref) {
+    rot[0] = rot[4] = rot[8] = 1.;
+    rot[1] = rot[2] = rot[3] = rot[5] = rot[6] = rot[7] = 0.;
   }
-  is_in = modelList.find(it2->first) != modelList.end();
-  if(!is_in) {
-    // cout << it2->first << endl;
-    for (int i=0; i < size; i++) {
-      avg[i][0] += it2->second[i][0];
-      avg[i][1] += it2->second[i][1];
-      avg[i][2] += it2->second[i][2];
-    }
-   modelList.insert(it2->first);
+  else {
+    rotation(ens, in, m, ref, zeros, rot);
+  }
+  // PStruct
+  float r0 = rot[0], r1 = rot[1], r2 = rot[2], r3 = rot[3], r4 = rot[4];
+  float r5 = rot[5], r6 = rot[6], r7 = rot[7], r8 = rot[8];
+  for (int i=0; i < size; i++) {
+    ax[i] += r0*x[i] + r1*y[i] + r2*z[i];
+    ay[i] += r3*x[i] + r4*y[i] + r5*z[i];
+    az[i] += r6*x[i] + r7*y[i] + r8*z[i];
   }
 }
 
 
-void rmsdRMSD(float** xyzA, float** xyzB, int *zeros, int size, float thres, 
-	      int &eqv, float &rms, float &drms) {
+// Number of equivalent positions (closer than 'thres2', squared) and
+// RMSD of model 'a' rotated by 'rot' and model 'b'.
+static void eqvRMS(const ensemble *ens, int a, int b, const double *rot,
+		   float thres2, int &eqv, float &rms) {
+  int size = ens->size;
+  const float *xa = ens_x(ens, a), *ya = ens_y(ens, a), *za = ens_z(ens, a);
+  const float *xb = ens_x(ens, b), *yb = ens_y(ens, b), *zb = ens_z(ens, b);
+  float r0 = rot[0], r1 = rot[1], r2 = rot[2], r3 = rot[3], r4 = rot[4];
+  float r5 = rot[5], r6 = rot[6], r7 = rot[7], r8 = rot[8];
   float dist;
-  int last;
-  dist = .0;
   rms = 0.;
-  drms = .0;
   eqv = 0;
-  last = size - 1;
-  thres *= thres;
 
-  align(xyzA, xyzB, zeros, size);
-  // PStruct
+  for (int i=0; i < size; i++) {
+    float dx = r0*xa[i] + r1*ya[i] + r2*za[i] - xb[i];
+    float dy = r3*xa[i] + r4*ya[i] + r5*za[i] - yb[i];
+    float dz = r6*xa[i] + r7*ya[i] + r8*za[i] - zb[i];
+    dist = dx*dx + dy*dy + dz*dz;
+    eqv += dist < thres2;
+    rms += dist;
+  }
+  rms = sqrt(rms / size);
+}
 
-  // rmsd last particle in the model since loop1 stops at the second last
-  dist = ddistance(xyzA[last],xyzB[last]);
 
-  // cout <<"end"<<endl;
-  //dist = distance(xyzn[last],xyzB[last]) * distance(xyzn[last],xyzB[last]);
-  if (dist < thres) eqv++;
-  rms += dist;
-  // rmsd remaining particles
+// Distances between the particles of model 'm', stored in 'dmat' as a
+// packed upper triangle (the pair (i, j), i < j, at 'PAIR_INDEX(i, j,
+// size)').
+void distanceMatrix(const ensemble *ens, int m, float *dmat) {
+  int size = ens->size;
+  const float *x = ens_x(ens, m), *y = ens_y(ens, m), *z = ens_z(ens, m);
+
   for (int i=0; i < size-1; i++) {
-    dist = ddistance(xyzA[i], xyzB[i]);
-    //dist = distance(xyzn[i],xyzB[i]) * distance(xyzn[i],xyzB[i]);
-    if (dist < thres) eqv++;
-    rms += dist;
-    // drmsd
+    float *d = dmat + PAIR_INDEX(i, i+1, size);
     for (int j=i+1; j < size; j++) {
-	dist = distance(xyzA[i],xyzA[j]) - distance(xyzB[i],xyzB[j]);
-	drms += dist*dist;
+      float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+      d[j-i-1] = sqrtf(dx*dx + dy*dy + dz*dz);
     }
   }
-  drms = sqrt(drms / (size*(size-1)/2));
-  rms  = sqrt(rms / size);
 }
 
 
-void consistency(float** xyzA, float** xyzB, int *zeros, int size, float thres, 
-		 int * &cons_list) {
-  float dist;
-  int last;
-  dist = .0;
-  last = size - 1;
-  thres *= thres;
-  align(xyzA, xyzB, zeros, size);
-  // PStruct
+// dRMSD of two models of 'size' particles from their distance matrices
+// (see 'distanceMatrix'). It does not depend on the superposition of
+// the models. The sum is split in 'DRMSD_LANES' independent partial
+// sums, which the compiler maps on the SIMD registers.
+#define DRMSD_LANES 16
+float drmsd(const float *da, const float *db, int size) {
+  size_t n = (size_t) size * (size - 1) / 2;
+  size_t nv = n - n % DRMSD_LANES;
+  float acc[DRMSD_LANES];
+  size_t i;
+  int l;
+  double sum = 0.;
 
-  // rmsd last particle in the model since loop1 stops at the second last
-  dist = ddistance(xyzA[last],xyzB[last]);
+  for (l = 0; l < DRMSD_LANES; l++)
+    acc[l] = 0.;
+  for (i = 0; i < nv; i += DRMSD_LANES)
+    for (l = 0; l < DRMSD_LANES; l++) {
+      float d = da[i+l] - db[i+l];
+      acc[l] += d*d;
+    }
+  for (; i < n; i++) {
+    float d = da[i] - db[i];
+    sum += d*d;
+  }
+  for (l = 0; l < DRMSD_LANES; l++)
+    sum += acc[l];
+  return sqrt(sum / n);
+}
+
+
+// Consistency of the centered models 'a' and 'b' (see 'centerModels'),
+// superposed once for all the 'ncuts' cutoffs: 'counts[c * size + i]'
+// is incremented if the particle 'i' of both models is closer than
+// the squared cutoff 'thres2[c]'.
+void consistency(const ensemble *ens, const inertia *in, int a, int b,
+		 int *zeros, int ncuts, const float *thres2, int *counts) {
+  int size = ens->size;
+  double rot[9];
+  rotation(ens, in, a, b, zeros, rot);
+  // PStruct
+  const float *xa = ens_x(ens, a), *ya = ens_y(ens, a), *za = ens_z(ens, a);
+  const float *xb = ens_x(ens, b), *yb = ens_y(ens, b), *zb = ens_z(ens, b);
+  float r0 = rot[0], r1 = rot[1], r2 = rot[2], r3 = rot[3], r4 = rot[4];
+  float r5 = rot[5], r6 = rot[6], r7 = rot[7], r8 = rot[8];
 
-  if (dist < thres) cons_list[last]++;
-  // eqv remaining particles
-  // cout <<"start"<<endl;
   for (int i=0; i < size; i++) {
-    dist = ddistance(xyzA[i],xyzB[i]);
-    if (dist < thres) {
-	cons_list[i]=1;
-    }else{cons_list[i]=0;}
+    float dx = r0*xa[i] + r1*ya[i] + r2*za[i] - xb[i];
+    float dy = r3*xa[i] + r4*ya[i] + r5*za[i] - yb[i];
+    float dz = r6*xa[i] + r7*ya[i] + r8*za[i] - zb[i];
+    float dist = dx*dx + dy*dy + dz*dz;
+    for (int c=0; c < ncuts; c++)
+      counts[c * size + i] += dist < thres2[c];
   }
 }
 
 
-// void findCenrtroid (map<string, float**>::iterator it1, float** avg, int size, map<string, float> dist2Centroid ) {
-float findCenrtroid (map<string, float**>::iterator it1, float** avg, int size) {
-  float dist, rms;
-  dist = .0;
-  rms = .0;  
+// RMSD of model 'm' rotated by 'rot' to the average model 'avg' (see
+// 'avgCoord'), over the particles with nonzero 'zeros'.
+float findCenrtroid (const ensemble *ens, int m, const double *rot, int avg,
+		     int *zeros) {
+  int size = ens->size;
+  const float *xa = ens_x(ens, avg), *ya = ens_y(ens, avg), *za = ens_z(ens, avg);
+  const float *x = ens_x(ens, m), *y = ens_y(ens, m), *z = ens_z(ens, m);
+  float r0 = rot[0], r1 = rot[1], r2 = rot[2], r3 = rot[3], r4 = rot[4];
+  float r5 = rot[5], r6 = rot[6], r7 = rot[7], r8 = rot[8];
+  float rms = .0;
+  int n = 0;
 
   // rmsd
   for (int i=0; i < size; i++) {
-    dist = ddistance(avg[i],it1->second[i]);
-    rms += dist;
+    float w = zeros[i] != 0;
+    float dx = xa[i] - (r0*x[i] + r1*y[i] + r2*z[i]);
+    float dy = ya[i] - (r3*x[i] + r4*y[i] + r5*z[i]);
+    float dz = za[i] - (r6*x[i] + r7*y[i] + r8*z[i]);
+    rms += w * (dx*dx + dy*dy + dz*dz);
+    n += zeros[i] != 0;
   }
-  rms = sqrt(rms / size);
+  rms = sqrt(rms / n);
 
   return rms;
 }
 
 
-float** populateMap(int size, float** xyz) {
-  float **tmpxyz;
+// Side (in models) of the tiles of pairs of 'pairwiseRmsdRMSD'.
+#define PAIR_TILE 32
+
+// Largest size of the distance matrices kept by 'pairwiseRmsdRMSD'.
+#define DMAT_CACHE_BYTES ((size_t) 1 << 30)
+
+typedef struct {
+  const ensemble *ens;
+  const inertia *in;
+  int *zeros;
+  float thres;
+  int what;
+  float *rmsds;
+  float *drmsds;
+  int *eqvs;
+  float *dmat;                 // Distance matrices of all the models
+                               // (NULL if they are computed by tile).
+  int tile;                    // Side of the tiles (in models).
+  int n_tasks;                 // Models or tiles of the upper triangle.
+  int *next_task;
+  int failed;                  // Set if a worker could not allocate
+                               // the distance matrices of its tiles.
+  pthread_mutex_t *lock;
+} pair_arg;
+
+
+// Next of the 'n_tasks' tasks shared by the workers (-1 if none left).
+static int next_task(pthread_mutex_t *lock, int *next, int n_tasks) {
+  int t;
+  pthread_mutex_lock(lock);
+  t = (*next)++;
+  pthread_mutex_unlock(lock);
+  return t < n_tasks ? t : -1;
+}
+
+
+void *dmat_worker(void *arg) {
+  pair_arg *myargs = (pair_arg *) arg;
+  size_t npd = (size_t) myargs->ens->size * (myargs->ens->size - 1) / 2;
+  int m;
+
+  while ((m = next_task(myargs->lock, myargs->next_task,
+                        myargs->n_tasks)) >= 0)
+    distanceMatrix(myargs->ens, m, myargs->dmat + m * npd);
+  return NULL;
+}
+
 
-  tmpxyz = new float*[size];
-  for(int i=0; i<size; i++) {
-    tmpxyz[i] = new float[3];
-    memset(tmpxyz[i], 0, 3*sizeof(float));
+void *pair_worker(void *arg) {
+  pair_arg *myargs = (pair_arg *) arg;
+  const ensemble *ens = myargs->ens;
+  int nmodels = ens->nmodels;
+  int size = ens->size;
+  int tile = myargs->tile;
+  int side = (nmodels + tile - 1) / tile;
+  size_t npd = (size_t) size * (size - 1) / 2;
+  float *tile_dmat = NULL;
+  const float *da, *db;
+  int t, ti, tj, j, jj, eqv;
+  float rms;
+  double rot[9];
+
+  // Distance matrices of the models of the current tile.
+  if ((myargs->what & PAIR_DRMSD) && myargs->dmat == NULL) {
+    tile_dmat = new (nothrow) float[2 * tile * npd];
+    if (tile_dmat == NULL) {
+      pthread_mutex_lock(myargs->lock);
+      myargs->failed = 1;
+      pthread_mutex_unlock(myargs->lock);
+      return NULL;
+    }
   }
-  for(int i=0; i<size; i++) {
-    for (int j=0; j<3; j++) {
-      tmpxyz[i][j] = xyz[i][j];
+
+  while ((t = next_task(myargs->lock, myargs->next_task,
+                        myargs->n_tasks)) >= 0) {
+    // Tiles are numbered row by row in the upper triangle.
+    for (ti = 0; t >= side - ti; ti++)
+      t -= side - ti;
+    tj = ti + t;
+    int jend = min(nmodels, (ti + 1) * tile);
+    int jjend = min(nmodels, (tj + 1) * tile);
+    if (tile_dmat != NULL) {
+      for (j = ti * tile; j < jend; j++)
+        distanceMatrix(ens, j, tile_dmat + (j - ti * tile) * npd);
+      if (tj != ti)
+        for (jj = tj * tile; jj < jjend; jj++)
+          distanceMatrix(ens, jj, tile_dmat +
+                         (tile + jj - tj * tile) * npd);
+    }
+    for (j = ti * tile; j < jend; j++) {
+      for (jj = max(j + 1, tj * tile); jj < jjend; jj++) {
+        size_t k = PAIR_INDEX(j, jj, nmodels);
+        if (myargs->what & PAIR_EQV) {
+          rotation(ens, myargs->in, j, jj, myargs->zeros, rot);
+          eqvRMS(ens, j, jj, rot, myargs->thres * myargs->thres, eqv, rms);
+          myargs->eqvs[k] = eqv;
+          if (myargs->what & PAIR_RMSD)
+            myargs->rmsds[k] = rms;
+        }
+        else if (myargs->what & PAIR_RMSD) {
+          // no rotation of the coordinates
+          myargs->rmsds[k] = centeredRMSD(ens, myargs->in, j, jj,
+                                          myargs->zeros);
+        }
+        if (myargs->what & PAIR_DRMSD) {
+          if (tile_dmat == NULL) {
+            da = myargs->dmat + j * npd;
+            db = myargs->dmat + jj * npd;
+          }
+          else {
+            da = tile_dmat + (j - ti * tile) * npd;
+            db = tile_dmat + (tj == ti ? jj - tj * tile :
+                              tile + jj - tj * tile) * npd;
+          }
+          myargs->drmsds[k] = drmsd(da, db, size);
+        }
+      }
     }
   }
 
-  return tmpxyz;
+  delete[] tile_dmat;
+  return NULL;
+}
+
+
+// Run 'fn' on 'n_threads' threads, including the calling thread.
+static void run_workers(int n_threads, void *(*fn)(void *), void *arg) {
+  pthread_t *tid = new pthread_t[n_threads];
+  int i;
+
+  for (i = 1; i < n_threads; i++)
+    if (pthread_create(&tid[i], NULL, fn, arg))
+      break;
+  fn(arg);
+  while (--i > 0)
+    pthread_join(tid[i], NULL);
+  delete[] tid;
+}
+
+
+// Compare all the pairs of centered models of the ensemble (see
+// 'centerModels'), which are not modified. 'what' is a
+// combination of 'PAIR_RMSD', 'PAIR_DRMSD' and 'PAIR_EQV': only the
+// requested arrays are filled (the others can be NULL). The results
+// are condensed arrays indexed by 'PAIR_INDEX'.
+// The RMSD is computed without rotating the models unless the
+// equivalent positions are needed, and the dRMSD from the distance
+// matrices of the models, without any superposition. The matrices are
+// computed once (or once per tile of pairs if those of all the models
+// take more than 'DMAT_CACHE_BYTES'). The pairs are split in tiles of
+// 'PAIR_TILE' x 'PAIR_TILE' models processed by 'n_threads' threads
+// (all the CPUs if less than 1). The models are only read, so the
+// result does not depend on the number of threads. Returns 0, or -1
+// if the distance matrices of a tile could not be allocated (the
+// result is then incomplete).
+int pairwiseRmsdRMSD(const ensemble *ens, const inertia *in, int *zeros,
+		     float thres, int what, int n_threads, float *rmsds,
+		     float *drmsds, int *eqvs) {
+  int nmodels = ens->nmodels;
+  size_t npd = (size_t) ens->size * (ens->size - 1) / 2;
+  int tile = PAIR_TILE;
+  int side, n_tiles;
+  int next = 0;
+  pthread_mutex_t lock;
+
+  if (nmodels < 2)
+    return 0;
+  if (n_threads < 1)
+    n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_threads < 1)
+    n_threads = 1;
+
+  pthread_mutex_init(&lock, NULL);
+  pair_arg arg = {ens, in, zeros, thres, what, rmsds, drmsds, eqvs,
+		  NULL, tile, nmodels, &next, 0, &lock};
 
-  for (int i=0; i<size; i++) {
-    delete[] tmpxyz[i];
+  if ((what & PAIR_DRMSD) && nmodels > PAIR_TILE && npd > 0 &&
+      nmodels * npd * sizeof(float) <= DMAT_CACHE_BYTES) {
+    arg.dmat = new (nothrow) float[nmodels * npd];
+    if (arg.dmat != NULL)
+      run_workers(min(n_threads, nmodels), &dmat_worker, &arg);
   }
-  delete[] tmpxyz;
+  // Smaller tiles if the distance matrices of the tiles of all the
+  // threads do not fit either.
+  if ((what & PAIR_DRMSD) && arg.dmat == NULL && npd > 0) {
+    size_t fit = DMAT_CACHE_BYTES / (2 * npd * sizeof(float) * n_threads);
+    tile = (int) max((size_t) 1, min((size_t) PAIR_TILE, fit));
+  }
+
+  side = (nmodels + tile - 1) / tile;
+  n_tiles = side * (side + 1) / 2;
+  next = 0;
+  arg.tile = tile;
+  arg.n_tasks = n_tiles;
+  run_workers(min(n_threads, n_tiles), &pair_worker, &arg);
+
+  delete[] arg.dmat;
+  pthread_mutex_destroy(&lock);
+  return arg.failed ? -1 : 0;
+}
+
+
+// Particles per task of the update of the average model in
+// 'procrustesAverage'.
+#define GPA_CHUNK 256
+
+typedef struct {
+  ensemble *ens;
+  const inertia *in;
+  int *zeros;
+  int nmembers;
+  const int *members;
+  int avg;
+  double *rots;
+  float *rmsds;                // RMSD to the average (NULL if not needed).
+  int n_tasks;
+  int *next_task;
+  pthread_mutex_t *lock;
+} gpa_arg;
+
+
+// Rotation of each member onto the average model.
+void *gpa_rotation_worker(void *arg) {
+  gpa_arg *myargs = (gpa_arg *) arg;
+  int t;
 
+  while ((t = next_task(myargs->lock, myargs->next_task,
+                        myargs->n_tasks)) >= 0) {
+    int m = myargs->members[t];
+    double *rot = myargs->rots + 9 * t;
+    rotation(myargs->ens, myargs->in, m, myargs->avg, myargs->zeros, rot);
+    if (myargs->rmsds != NULL)
+      myargs->rmsds[t] = findCenrtroid(myargs->ens, m, rot, myargs->avg,
+                                       myargs->zeros);
+  }
+  return NULL;
+}
+
+
+// Average of the rotated members, by chunks of 'GPA_CHUNK' particles
+// summed over the members always in the same order.
+void *gpa_mean_worker(void *arg) {
+  gpa_arg *myargs = (gpa_arg *) arg;
+  ensemble *ens = myargs->ens;
+  int nmembers = myargs->nmembers;
+  int avg = myargs->avg;
+  float *ax = ens_x(ens, avg), *ay = ens_y(ens, avg), *az = ens_z(ens, avg);
+  int c, i, t;
+
+  while ((c = next_task(myargs->lock, myargs->next_task,
+                        myargs->n_tasks)) >= 0) {
+    int beg = c * GPA_CHUNK;
+    int end = min(ens->size, beg + GPA_CHUNK);
+    for (i = beg; i < end; i++)
+      ax[i] = ay[i] = az[i] = 0.;
+    for (t = 0; t < nmembers; t++) {
+      int m = myargs->members[t];
+      const float *x = ens_x(ens, m), *y = ens_y(ens, m), *z = ens_z(ens, m);
+      const double *rot = myargs->rots + 9 * t;
+      float r0 = rot[0], r1 = rot[1], r2 = rot[2], r3 = rot[3], r4 = rot[4];
+      float r5 = rot[5], r6 = rot[6], r7 = rot[7], r8 = rot[8];
+      for (i = beg; i < end; i++) {
+        ax[i] += r0*x[i] + r1*y[i] + r2*z[i];
+        ay[i] += r3*x[i] + r4*y[i] + r5*z[i];
+        az[i] += r6*x[i] + r7*y[i] + r8*z[i];
+      }
+    }
+    for (i = beg; i < end; i++) {
+      ax[i] /= nmembers;
+      ay[i] /= nmembers;
+      az[i] /= nmembers;
+    }
+  }
+  return NULL;
 }
 
+
+// Generalised Procrustes average of the 'nmembers' centered models
+// listed in 'members' (see 'centerModels'), stored in model 'avg'.
+// Starting from the first member, all the members are superposed onto
+// the average, which is then replaced by the mean of the superposed
+// members, until it moves by less than 'tol' (RMS over the particles)
+// or after 'max_iter' iterations. The members are not modified: 'rots'
+// gets the rotation of each member onto the final average and 'rmsds'
+// their RMSD to it (in the order of 'members'). Each step is split
+// among 'n_threads' threads (all the CPUs if less than 1), and its
+// result does not depend on their number. Returns the number of
+// iterations.
+int procrustesAverage(ensemble *ens, inertia *in, int *zeros, int nmembers,
+		      const int *members, int avg, int max_iter, float tol,
+		      int n_threads, double *rots, float *rmsds) {
+  int size = ens->size;
+  int n_chunks = (size + GPA_CHUNK - 1) / GPA_CHUNK;
+  float *ax = ens_x(ens, avg), *ay = ens_y(ens, avg), *az = ens_z(ens, avg);
+  float *prev;
+  int next;
+  int iter;
+  int i;
+  pthread_mutex_t lock;
+
+  if (n_threads < 1)
+    n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_threads < 1)
+    n_threads = 1;
+
+  pthread_mutex_init(&lock, NULL);
+  gpa_arg arg = {ens, in, zeros, nmembers, members, avg, rots, NULL,
+		 nmembers, &next, &lock};
+
+  // the first member is the initial average
+  prev = new float[3 * ens->ld];
+  memcpy(ens_x(ens, avg), ens_x(ens, members[0]),
+	 3 * ens->ld * sizeof(float));
+  in[avg] = in[members[0]];
+
+  for (iter = 0; iter < max_iter; ) {
+    memcpy(prev, ax, 3 * ens->ld * sizeof(float));
+    next = 0;
+    arg.n_tasks = nmembers;
+    run_workers(min(n_threads, nmembers), &gpa_rotation_worker, &arg);
+    next = 0;
+    arg.n_tasks = n_chunks;
+    run_workers(min(n_threads, n_chunks), &gpa_mean_worker, &arg);
+    // rounding errors may move the average away from the origin
+    centerModel(ens, avg, zeros, in + avg);
+    iter++;
+
+    double shift = 0.;
+    const float *px = prev, *py = prev + ens->ld, *pz = prev + 2 * ens->ld;
+    for (i = 0; i < size; i++) {
+      float dx = ax[i] - px[i], dy = ay[i] - py[i], dz = az[i] - pz[i];
+      shift += dx*dx + dy*dy + dz*dz;
+    }
+    if (sqrt(shift / size) < tol)
+      break;
+  }
+  delete[] prev;
+
+  // superposition onto the final average
+  next = 0;
+  arg.n_tasks = nmembers;
+  arg.rmsds = rmsds;
+  run_workers(min(n_threads, nmembers), &gpa_rotation_worker, &arg);
+
+  pthread_mutex_destroy(&lock);
+  return iter;
+}
+
+
+typedef struct {
+  ensemble *ens;
+  const inertia *in;
+  int *zeros;
+  const int *start;
+  const int *members;
+  int avg;
+  float *rmsds;
+  int n_tasks;
+  int *next_task;
+  pthread_mutex_t *lock;
+} group_arg;
+
+
+// Member of the group the closest to its average.
+static int closestMember(int nmembers, const int *members, const float *rmsds) {
+  int c = 0;
+  for (int t = 1; t < nmembers; t++)
+    if (rmsds[t] < rmsds[c])
+      c = t;
+  return members[c];
+}
+
+
+// Average of each group, with its members superposed onto the first
+// one (see 'avgCoord').
+void *group_worker(void *arg) {
+  group_arg *myargs = (group_arg *) arg;
+  ensemble *ens = myargs->ens;
+  int size = ens->size;
+  int g, t;
+
+  while ((g = next_task(myargs->lock, myargs->next_task,
+                        myargs->n_tasks)) >= 0) {
+    int nmembers = myargs->start[g + 1] - myargs->start[g];
+    const int *members = myargs->members + myargs->start[g];
+    float *rmsds = myargs->rmsds + myargs->start[g];
+    int avg = myargs->avg + g;
+    double *rots = new double[9 * nmembers];
+    float *ax = ens_x(ens, avg), *ay = ens_y(ens, avg), *az = ens_z(ens, avg);
+
+    for (t = 0; t < nmembers; t++)
+      avgCoord(ens, myargs->in, members[0], members[t], myargs->zeros,
+               rots + 9 * t, avg);
+    for (int i = 0; i < size; i++) {
+      ax[i] /= nmembers;
+      ay[i] /= nmembers;
+      az[i] /= nmembers;
+    }
+    for (t = 0; t < nmembers; t++)
+      rmsds[t] = findCenrtroid(ens, members[t], rots + 9 * t, avg,
+                               myargs->zeros);
+    delete[] rots;
+  }
+  return NULL;
+}
+
+
+// Average model of each of the 'ngroups' groups of centered models
+// (see 'centerModels'). The members of group 'g' are 'members[start[g]]'
+// to 'members[start[g + 1] - 1]', and its average is stored in model
+// 'avg + g' (zeroed). The members are superposed onto the first one
+// of their group, or, if 'procrustes' is set, onto their average by
+// generalised Procrustes analysis (see 'procrustesAverage'). 'rmsds'
+// gets the RMSD of each member to the average of its group (in the
+// order of 'members'), and 'centroids' the member of each group that
+// is the closest to it. The groups are split among 'n_threads'
+// threads (all the CPUs if less than 1), or each Procrustes analysis.
+void groupAverages(ensemble *ens, inertia *in, int *zeros, int ngroups,
+		   const int *start, const int *members, int avg,
+		   int procrustes, int max_iter, float tol, int n_threads,
+		   float *rmsds, int *centroids) {
+  int next = 0;
+  int g;
+  pthread_mutex_t lock;
+
+  if (n_threads < 1)
+    n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_threads < 1)
+    n_threads = 1;
+
+  if (procrustes) {
+    for (g = 0; g < ngroups; g++) {
+      int nmembers = start[g + 1] - start[g];
+      double *rots = new double[9 * nmembers];
+      procrustesAverage(ens, in, zeros, nmembers, members + start[g], avg + g,
+			max_iter, tol, n_threads, rots, rmsds + start[g]);
+      delete[] rots;
+    }
+  }
+  else {
+    pthread_mutex_init(&lock, NULL);
+    group_arg arg = {ens, in, zeros, start, members, avg, rmsds, ngroups,
+		     &next, &lock};
+    run_workers(min(n_threads, ngroups), &group_worker, &arg);
+    pthread_mutex_destroy(&lock);
+  }
+
+  for (g = 0; g < ngroups; g++)
+    centroids[g] = closestMember(start[g + 1] - start[g], members + start[g],
+				 rmsds + start[g]);
+}
+
+
+typedef struct {
+  const ensemble *ens;
+  const inertia *in;
+  int *zeros;
+  int ncuts;
+  const float *thres2;
+  int *counts;
+  int n_tasks;
+  int *next_task;
+  pthread_mutex_t *lock;
+} cons_arg;
+
+
+// Consistency of the pairs of a model with the next ones, counted
+// apart by each thread and added to the total at the end.
+void *cons_worker(void *arg) {
+  cons_arg *myargs = (cons_arg *) arg;
+  const ensemble *ens = myargs->ens;
+  size_t ncounts = (size_t) myargs->ncuts * ens->size;
+  int *counts = new int[ncounts]();
+  int j, jj;
+
+  while ((j = next_task(myargs->lock, myargs->next_task,
+                        myargs->n_tasks)) >= 0)
+    for (jj = j + 1; jj < ens->nmodels; jj++)
+      consistency(ens, myargs->in, j, jj, myargs->zeros, myargs->ncuts,
+                  myargs->thres2, counts);
+
+  pthread_mutex_lock(myargs->lock);
+  for (size_t k = 0; k < ncounts; k++)
+    myargs->counts[k] += counts[k];
+  pthread_mutex_unlock(myargs->lock);
+  delete[] counts;
+  return NULL;
+}
+
+
+// Consistency of all the pairs of centered models of the ensemble (see
+// 'centerModels'), for each of the 'ncuts' distance 'cutoffs':
+// 'counts[c * size + i]' gets the number of pairs of models in which
+// the particle 'i' is closer than 'cutoffs[c]' once superposed. Each
+// pair is superposed once for all the cutoffs. The pairs are split
+// among 'n_threads' threads (all the CPUs if less than 1).
+void pairwiseConsistency(const ensemble *ens, const inertia *in, int *zeros,
+			 int ncuts, const float *cutoffs, int n_threads,
+			 int *counts) {
+  float *thres2 = new float[ncuts];
+  int next = 0;
+  pthread_mutex_t lock;
+
+  for (int c = 0; c < ncuts; c++)
+    thres2[c] = cutoffs[c] * cutoffs[c];
+  memset(counts, 0, (size_t) ncuts * ens->size * sizeof(int));
+  if (n_threads < 1)
+    n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_threads < 1)
+    n_threads = 1;
+
+  pthread_mutex_init(&lock, NULL);
+  cons_arg arg = {ens, in, zeros, ncuts, thres2, counts, ens->nmodels - 1,
+		  &next, &lock};
+  if (ens->nmodels > 1)
+    run_workers(min(n_threads, ens->nmodels - 1), &cons_worker, &arg);
+  pthread_mutex_destroy(&lock);
+  delete[] thres2;
+}
+
+
+typedef struct {
+  const ensemble *ens;
+  int *zeros;
+  int ncuts;
+  const float *thres2;         // Squared cutoffs.
+  int strict;                  // Exclude the distances equal to a cutoff.
+  int *pair_counts;
+  int *particle_counts;
+  int n_tasks;
+  int *next_task;
+  pthread_mutex_t *lock;
+} contact_arg;
+
+
+// Contacts of model 'm', found with a uniform grid of cubic cells (a
+// 'cell list') at least as large as the largest cutoff: the particles
+// within it are in the same cell or in neighbouring ones. The
+// cells are sized to hold about one particle each, so that the models
+// much larger than the cutoff do not need more cells than particles.
+// The particles are sorted by cell in 'order', with the ones of cell
+// 'c' from 'cstart[c]' to 'cstart[c + 1] - 1'.
+static void modelContacts(const contact_arg *myargs, int m, int *pair_counts) {
+  const ensemble *ens = myargs->ens;
+  int size = ens->size;
+  int ncuts = myargs->ncuts;
+  const float *thres2 = myargs->thres2;
+  int strict = myargs->strict;
+  const float *x = ens_x(ens, m), *y = ens_y(ens, m), *z = ens_z(ens, m);
+  int *zeros = myargs->zeros;
+  float lo[3] = {0., 0., 0.}, hi[3] = {0., 0., 0.};
+  float max2 = 0.;
+  float side;
+  int dim[3];
+  int n = 0;
+  int c, i, j, k;
+
+  for (c = 0; c < ncuts; c++)
+    max2 = max(max2, thres2[c]);
+  for (i = 0; i < size; i++) {
+    if (!zeros[i])
+      continue;
+    float p[3] = {x[i], y[i], z[i]};
+    for (k = 0; k < 3; k++) {
+      if (!n || p[k] < lo[k])
+        lo[k] = p[k];
+      if (!n || p[k] > hi[k])
+        hi[k] = p[k];
+    }
+    n++;
+  }
+  if (n < 2 || max2 <= 0.)
+    return;
+
+  double volume = 1.;
+  for (k = 0; k < 3; k++)
+    volume *= (double) (hi[k] - lo[k]) + sqrt(max2);
+  side = max((float) sqrt(max2), (float) cbrt(volume / n));
+  size_t ncells = 1;
+  for (k = 0; k < 3; k++) {
+    dim[k] = (int) ((hi[k] - lo[k]) / side) + 1;
+    ncells *= dim[k];
+  }
+
+  // particles sorted by cell
+  int *cell = new int[size];
+  int *cstart = new int[ncells + 1]();
+  int *order = new int[n];
+  for (i = 0; i < size; i++) {
+    if (!zeros[i])
+      continue;
+    int cx = min(dim[0] - 1, (int) ((x[i] - lo[0]) / side));
+    int cy = min(dim[1] - 1, (int) ((y[i] - lo[1]) / side));
+    int cz = min(dim[2] - 1, (int) ((z[i] - lo[2]) / side));
+    cell[i] = (cz * dim[1] + cy) * dim[0] + cx;
+    cstart[cell[i] + 1]++;
+  }
+  for (size_t l = 0; l < ncells; l++)
+    cstart[l + 1] += cstart[l];
+  int *fill = new int[ncells];
+  memcpy(fill, cstart, ncells * sizeof(int));
+  for (i = 0; i < size; i++)
+    if (zeros[i])
+      order[fill[cell[i]]++] = i;
+  delete[] fill;
+
+  int *pcounts = myargs->particle_counts;
+  size_t npairs = (size_t) size * (size - 1) / 2;
+  for (i = 0; i < size; i++) {
+    if (!zeros[i])
+      continue;
+    int cx = cell[i] % dim[0];
+    int cy = cell[i] / dim[0] % dim[1];
+    int cz = cell[i] / dim[0] / dim[1];
+    for (int nz = max(0, cz - 1); nz <= min(dim[2] - 1, cz + 1); nz++)
+      for (int ny = max(0, cy - 1); ny <= min(dim[1] - 1, cy + 1); ny++)
+        for (int nx = max(0, cx - 1); nx <= min(dim[0] - 1, cx + 1); nx++) {
+          int nc = (nz * dim[1] + ny) * dim[0] + nx;
+          for (int t = cstart[nc]; t < cstart[nc + 1]; t++) {
+            j = order[t];
+            if (j <= i)
+              continue;
+            float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+            float dist = dx*dx + dy*dy + dz*dz;
+            if (dist > max2)
+              continue;
+            for (c = 0; c < ncuts; c++) {
+              if (dist > thres2[c] || (strict && dist == thres2[c]))
+                continue;
+              if (pair_counts != NULL)
+                pair_counts[c * npairs + PAIR_INDEX(i, j, size)]++;
+              if (pcounts != NULL) {
+                int *pc = pcounts + ((size_t) c * ens->nmodels + m) * size;
+                pc[i]++;
+                pc[j]++;
+              }
+            }
+          }
+        }
+  }
+  delete[] cell;
+  delete[] cstart;
+  delete[] order;
+}
+
+
+// Contacts of the models, with the pairs counted apart by each thread
+// and added to the total at the end.
+void *contact_worker(void *arg) {
+  contact_arg *myargs = (contact_arg *) arg;
+  const ensemble *ens = myargs->ens;
+  size_t ncounts = (size_t) myargs->ncuts * ens->size * (ens->size - 1) / 2;
+  int *pair_counts = NULL;
+  int m;
+
+  if (myargs->pair_counts != NULL)
+    pair_counts = new int[ncounts]();
+  while ((m = next_task(myargs->lock, myargs->next_task,
+                        myargs->n_tasks)) >= 0)
+    modelContacts(myargs, m, pair_counts);
+
+  if (pair_counts != NULL) {
+    pthread_mutex_lock(myargs->lock);
+    for (size_t k = 0; k < ncounts; k++)
+      myargs->pair_counts[k] += pair_counts[k];
+    pthread_mutex_unlock(myargs->lock);
+    delete[] pair_counts;
+  }
+  return NULL;
+}
+
+
+// Contacts between the particles with nonzero 'zeros' of each model of
+// the ensemble, for each of the 'ncuts' distance 'cutoffs' (at a
+// distance lower than the cutoff if 'strict', lower than or equal to
+// it otherwise), found with a cell list (see 'modelContacts') in about
+// linear time in the number of particles. 'pair_counts[c *
+// npairs + PAIR_INDEX(i, j, size)]' gets the number of models in which
+// the particles 'i' and 'j' are in contact for cutoff 'c', and
+// 'particle_counts[(c * nmodels + m) * size + i]' the number of
+// particles in contact with 'i' in model 'm' (either can be NULL). The
+// models are split among 'n_threads' threads (all the CPUs if less
+// than 1).
+void contactCounts(const ensemble *ens, int *zeros, int ncuts,
+		   const float *cutoffs, int strict, int n_threads,
+		   int *pair_counts, int *particle_counts) {
+  size_t npairs = (size_t) ens->size * (ens->size - 1) / 2;
+  float *thres2 = new float[ncuts];
+  int next = 0;
+  pthread_mutex_t lock;
+
+  for (int c = 0; c < ncuts; c++)
+    thres2[c] = cutoffs[c] * cutoffs[c];
+  if (pair_counts != NULL)
+    memset(pair_counts, 0, ncuts * npairs * sizeof(int));
+  if (particle_counts != NULL)
+    memset(particle_counts, 0,
+	   (size_t) ncuts * ens->nmodels * ens->size * sizeof(int));
+  if (n_threads < 1)
+    n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_threads < 1)
+    n_threads = 1;
+
+  pthread_mutex_init(&lock, NULL);
+  contact_arg arg = {ens, zeros, ncuts, thres2, strict, pair_counts,
+		     particle_counts, ens->nmodels, &next, &lock};
+  if (ens->nmodels > 0)
+    run_workers(min(n_threads, ens->nmodels), &contact_worker, &arg);
+  pthread_mutex_destroy(&lock);
+  delete[] thres2;
+}
@@ -1,25 +1,52 @@
 /* @(#)3dStats.h
  */
 
-#include <sstream>
-#include <map>
-#include <set>
+#include "ensemble.h"
+#include "align.h"
 using namespace std;
 
 #ifndef _3DSTATS_H
 #define _3DSTATS_H 1
 
-
-extern void avgCoord(map<string, float**>::iterator it1, map<string, float**>::iterator it2,
-		     int *zeros, int size, set<string> modelList, bool add_first, float** avg);
-extern void rmsdRMSD(float** xyzA, float** xyzB, int *zeros, int size, float thres, 
-		     int &eqv, float &rms, float &drms);
-extern void consistency(float** xyzA, float** xyzB, int *zeros, int size, float thres, 
-			int * &cons_list);
-
-
-extern float findCenrtroid (map<string, float**>::iterator it1, float** avg, int size);
-extern float** populateMap(int size, float** xyz);
+// Index of the pair ('i', 'j'), 'i' < 'j', in the condensed arrays of
+// the pairs of 'n' models (the order of 'scipy.spatial.distance').
+#define PAIR_INDEX(i, j, n) \
+  ((size_t) (i) * (n) - ((size_t) (i) * ((i) + 1)) / 2 + (j) - (i) - 1)
+
+// Measures of 'pairwiseRmsdRMSD'.
+#define PAIR_RMSD  1
+#define PAIR_DRMSD 2
+#define PAIR_EQV   4
+
+
+extern void avgCoord(ensemble *ens, const inertia *in, int ref, int m,
+		     int *zeros, double *rot, int avg);
+extern void consistency(const ensemble *ens, const inertia *in, int a, int b,
+			int *zeros, int ncuts, const float *thres2,
+			int *counts);
+extern void distanceMatrix(const ensemble *ens, int m, float *dmat);
+extern float drmsd(const float *da, const float *db, int size);
+
+extern int pairwiseRmsdRMSD(const ensemble *ens, const inertia *in,
+			    int *zeros, float thres, int what, int n_threads,
+			    float *rmsds, float *drmsds, int *eqvs);
+extern void pairwiseConsistency(const ensemble *ens, const inertia *in,
+				int *zeros, int ncuts, const float *cutoffs,
+				int n_threads, int *counts);
+extern void contactCounts(const ensemble *ens, int *zeros, int ncuts,
+			  const float *cutoffs, int strict, int n_threads,
+			  int *pair_counts, int *particle_counts);
+
+
+extern float findCenrtroid (const ensemble *ens, int m, const double *rot,
+			    int avg, int *zeros);
+extern int procrustesAverage(ensemble *ens, inertia *in, int *zeros,
+			     int nmembers, const int *members, int avg,
+			     int max_iter, float tol, int n_threads,
+			     double *rots, float *rmsds);
+extern void groupAverages(ensemble *ens, inertia *in, int *zeros, int ngroups,
+			  const int *start, const int *members, int avg,
+			  int procrustes, int max_iter, float tol,
+			  int n_threads, float *rmsds, int *centroids);
 
 #endif /* _3DSTATS_H */
-
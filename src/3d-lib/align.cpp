@@ -1,196 +1,316 @@
-#include "matrices.h"
+#include <math.h>
+#include <stddef.h>
+#include "align.h"
 // #include <iostream>
 // using namespace std;
+
+#define QCP_EVALPREC 1e-11
+#define QCP_EIGVPREC 1e-6
+#define QCP_MAXITER  50
+
 // Set origin to center of mass
-void massCenter(float** xyz, int *zeros, int size) {
+void massCenter(float *x, float *y, float *z, int *zeros, int size) {
   float xm, ym, zm;
   xm = ym = zm = 0.;
   int i;
   int subsize=0;
 
   for( i = 0; i < size; i++ ) {
-    if (zeros[i]==0)
-      continue;
-    subsize ++;
-    xm += xyz[i][0];
-    ym += xyz[i][1];
-    zm += xyz[i][2];
+    float w = zeros[i] != 0;
+    subsize += zeros[i] != 0;
+    xm += w * x[i];
+    ym += w * y[i];
+    zm += w * z[i];
   }
   xm /= subsize;
   ym /= subsize;
   zm /= subsize;
   for( i = 0; i < size; i++ ) {
-    xyz[i][0] -= xm;
-    xyz[i][1] -= ym;
-    xyz[i][2] -= zm;
+    x[i] -= xm;
+    y[i] -= ym;
+    z[i] -= zm;
   }
 }
 
 
-void align(float** xyzA, float** xyzB, int *zeros, int size){
-  massCenter(xyzA, zeros, size);
-  massCenter(xyzB, zeros, size);
-  // PStruct
-  //  double dist;
-  double u[4][4];
-  double omega[7][7]; // 7 to use fortran like notation in loops
-  double o[7][7]; // eigen vector SET BY EIGEN
-  double ha[4][4];
-  double ka[4][4];
-  double r[4][4]; // rotation
-  double op[4];
-  double s;
-  double det;
-
-  double d [6+1]; // eigen val SET BY EIGEN and not used...
-
-  // =====  Allocate rotated structure
-  double (*xyzn)[3] = new double [size][3];
-
-  // ===== Compute rotation matrix
-  int i;
-  for (i = 1; i <= 3; i++) {
-    for (int j = 1;  j <= 3; j++) {
-      u[i][j] = 0.0;
-      //o[i][j] = 0.0;
-      ha[i][j] = 0; //
-      ka[i][j] = 0; //
-      r[i][j] = 0; //
-    }
-    d[i] = 0.;
+// Optimal superposition by the quaternion characteristic polynomial
+// (QCP) method (Theobald 2005, Liu et al. 2010). 'M' is the inner
+// product matrix of the centered coordinates, M[i][j] = sum_k b_k[i] *
+// a_k[j] ('B' is the reference), and 'E0' half the sum of their
+// squared norms. The largest eigenvalue of the 4x4 key matrix is found
+// by Newton iterations on its characteristic polynomial (no Jacobi
+// sweeps) and returned: the minimal sum of squared deviations is
+// 2*(E0 - eigenvalue). If 'rot' is not NULL, it is set to the rotation
+// of 'A' onto 'B' (row-major), built from the eigenvector of the key
+// matrix (a proper rotation, never a reflection).
+double superpose(const double M[3][3], double E0, double *rot) {
+  double Sxx = M[0][0], Sxy = M[0][1], Sxz = M[0][2];
+  double Syx = M[1][0], Syy = M[1][1], Syz = M[1][2];
+  double Szx = M[2][0], Szy = M[2][1], Szz = M[2][2];
+
+  double Sxx2 = Sxx*Sxx, Syy2 = Syy*Syy, Szz2 = Szz*Szz;
+  double Sxy2 = Sxy*Sxy, Syz2 = Syz*Syz, Sxz2 = Sxz*Sxz;
+  double Syx2 = Syx*Syx, Szy2 = Szy*Szy, Szx2 = Szx*Szx;
+
+  double SyzSzymSyySzz2 = 2.0*(Syz*Szy - Syy*Szz);
+  double Sxx2Syy2Szz2Syz2Szy2 = Syy2 + Szz2 - Sxx2 + Syz2 + Szy2;
+
+  // Coefficients of the characteristic polynomial (the cubic term is 0
+  // and the quartic term is 1).
+  double C2 = -2.0 * (Sxx2 + Syy2 + Szz2 + Sxy2 + Syx2 + Sxz2 + Szx2 +
+                      Syz2 + Szy2);
+  double C1 = 8.0 * (Sxx*Syz*Szy + Syy*Szx*Sxz + Szz*Sxy*Syx -
+                     Sxx*Syy*Szz - Syz*Szx*Sxy - Szy*Syx*Sxz);
+
+  double SxzpSzx = Sxz + Szx, SyzpSzy = Syz + Szy, SxypSyx = Sxy + Syx;
+  double SyzmSzy = Syz - Szy, SxzmSzx = Sxz - Szx, SxymSyx = Sxy - Syx;
+  double SxxpSyy = Sxx + Syy, SxxmSyy = Sxx - Syy;
+  double Sxy2Sxz2Syx2Szx2 = Sxy2 + Sxz2 - Syx2 - Szx2;
+
+  double C0 = Sxy2Sxz2Syx2Szx2 * Sxy2Sxz2Syx2Szx2
+    + (Sxx2Syy2Szz2Syz2Szy2 + SyzSzymSyySzz2) *
+      (Sxx2Syy2Szz2Syz2Szy2 - SyzSzymSyySzz2)
+    + (-(SxzpSzx)*(SyzmSzy)+(SxymSyx)*(SxxmSyy-Szz)) *
+      (-(SxzmSzx)*(SyzpSzy)+(SxymSyx)*(SxxmSyy+Szz))
+    + (-(SxzpSzx)*(SyzpSzy)-(SxypSyx)*(SxxpSyy-Szz)) *
+      (-(SxzmSzx)*(SyzmSzy)-(SxypSyx)*(SxxpSyy+Szz))
+    + (+(SxypSyx)*(SyzpSzy)+(SxzpSzx)*(SxxmSyy+Szz)) *
+      (-(SxymSyx)*(SyzmSzy)+(SxzpSzx)*(SxxpSyy+Szz))
+    + (+(SxypSyx)*(SyzmSzy)+(SxzmSzx)*(SxxmSyy-Szz)) *
+      (-(SxymSyx)*(SyzpSzy)+(SxzmSzx)*(SxxpSyy-Szz));
+
+  // Newton iterations for the largest root.
+  double mxEigenV = E0;
+  for (int i = 0; i < QCP_MAXITER; i++) {
+    double oldg = mxEigenV;
+    double x2 = mxEigenV*mxEigenV;
+    double b = (x2 + C2)*mxEigenV;
+    double a = b + C1;
+    double delta = (a*mxEigenV + C0) / (2.0*x2*mxEigenV + b + a);
+    mxEigenV -= delta;
+    if (fabs(mxEigenV - oldg) < fabs(QCP_EVALPREC*mxEigenV))
+      break;
   }
-  // additional init PF TEST
-  for (i = 1; i <= 6; i++) {
-    for (int j = 1;  j <= 6; j++) {
-      o[i][j] = 0.0;
-      // omega done in original code later
+
+  if (rot == NULL)
+    return mxEigenV;
+
+  // Eigenvector of the key matrix from the columns of its adjoint.
+  double a11 = SxxpSyy + Szz - mxEigenV, a12 = SyzmSzy, a13 = -SxzmSzx;
+  double a14 = SxymSyx, a21 = SyzmSzy, a22 = SxxmSyy - Szz - mxEigenV;
+  double a23 = SxypSyx, a24 = SxzpSzx, a31 = a13, a32 = a23;
+  double a33 = Syy - Sxx - Szz - mxEigenV, a34 = SyzpSzy;
+  double a41 = a14, a42 = a24, a43 = a34, a44 = Szz - SxxpSyy - mxEigenV;
+  double a3344_4334 = a33*a44 - a43*a34, a3244_4234 = a32*a44 - a42*a34;
+  double a3243_4233 = a32*a43 - a42*a33, a3143_4133 = a31*a43 - a41*a33;
+  double a3144_4134 = a31*a44 - a41*a34, a3142_4132 = a31*a42 - a41*a32;
+  double q1 =  a22*a3344_4334 - a23*a3244_4234 + a24*a3243_4233;
+  double q2 = -a21*a3344_4334 + a23*a3144_4134 - a24*a3143_4133;
+  double q3 =  a21*a3244_4234 - a22*a3144_4134 + a24*a3142_4132;
+  double q4 = -a21*a3243_4233 + a22*a3143_4133 - a23*a3142_4132;
+  double qsqr = q1*q1 + q2*q2 + q3*q3 + q4*q4;
+
+  // The first column is degenerate if the eigenvalue is (nearly)
+  // multiple: try the other columns.
+  if (qsqr < QCP_EIGVPREC) {
+    q1 =  a12*a3344_4334 - a13*a3244_4234 + a14*a3243_4233;
+    q2 = -a11*a3344_4334 + a13*a3144_4134 - a14*a3143_4133;
+    q3 =  a11*a3244_4234 - a12*a3144_4134 + a14*a3142_4132;
+    q4 = -a11*a3243_4233 + a12*a3143_4133 - a13*a3142_4132;
+    qsqr = q1*q1 + q2*q2 + q3*q3 + q4*q4;
+
+    if (qsqr < QCP_EIGVPREC) {
+      double a1324_1423 = a13*a24 - a14*a23, a1224_1422 = a12*a24 - a14*a22;
+      double a1223_1322 = a12*a23 - a13*a22, a1124_1421 = a11*a24 - a14*a21;
+      double a1123_1321 = a11*a23 - a13*a21, a1122_1221 = a11*a22 - a12*a21;
+
+      q1 =  a42*a1324_1423 - a43*a1224_1422 + a44*a1223_1322;
+      q2 = -a41*a1324_1423 + a43*a1124_1421 - a44*a1123_1321;
+      q3 =  a41*a1224_1422 - a42*a1124_1421 + a44*a1122_1221;
+      q4 = -a41*a1223_1322 + a42*a1123_1321 - a43*a1122_1221;
+      qsqr = q1*q1 + q2*q2 + q3*q3 + q4*q4;
+
+      if (qsqr < QCP_EIGVPREC) {
+        q1 =  a32*a1324_1423 - a33*a1224_1422 + a34*a1223_1322;
+        q2 = -a31*a1324_1423 + a33*a1124_1421 - a34*a1123_1321;
+        q3 =  a31*a1224_1422 - a32*a1124_1421 + a34*a1122_1221;
+        q4 = -a31*a1223_1322 + a32*a1123_1321 - a33*a1122_1221;
+        qsqr = q1*q1 + q2*q2 + q3*q3 + q4*q4;
+
+        if (qsqr < QCP_EIGVPREC) {
+          // The structures are already superposed (or degenerate).
+          rot[0] = rot[4] = rot[8] = 1.0;
+          rot[1] = rot[2] = rot[3] = rot[5] = rot[6] = rot[7] = 0.0;
+          return mxEigenV;
+        }
+      }
     }
-    d[i] = 0.;
-    op[i] = 0.;
   }
+
+  double normq = sqrt(qsqr);
+  q1 /= normq;
+  q2 /= normq;
+  q3 /= normq;
+  q4 /= normq;
+
+  double a2 = q1*q1, x2 = q2*q2, y2 = q3*q3, z2 = q4*q4;
+  double xy = q2*q3, az = q1*q4, zx = q4*q2, ay = q1*q3;
+  double yz = q3*q4, ax = q1*q2;
+
+  rot[0] = a2 + x2 - y2 - z2;
+  rot[1] = 2*(xy + az);
+  rot[2] = 2*(zx - ay);
+  rot[3] = 2*(xy - az);
+  rot[4] = a2 - x2 + y2 - z2;
+  rot[5] = 2*(yz + ax);
+  rot[6] = 2*(zx + ay);
+  rot[7] = 2*(yz - ax);
+  rot[8] = a2 - x2 - y2 + z2;
+
+  return mxEigenV;
+}
+
+
+// Center model 'm' of the ensemble on the particles with nonzero
+// 'zeros' and store its inner products in 'in'.
+void centerModel(ensemble *ens, int m, int *zeros, inertia *in) {
+  int size = ens->size;
+  float *x = ens_x(ens, m), *y = ens_y(ens, m), *z = ens_z(ens, m);
+  double G = 0., Gall = 0.;
+  int n = 0;
+
+  massCenter(x, y, z, zeros, size);
+  for (int k = 0; k < size; k++) {
+    double g = x[k]*x[k] + y[k]*y[k] + z[k]*z[k];
+    Gall += g;
+    G += (zeros[k] != 0) * g;
+    n += zeros[k] != 0;
+  }
+  in->n = n;
+  in->G = G;
+  in->Gall = Gall;
+}
+
+
+// Center all the models of the ensemble (see 'centerModel'), with
+// their inner products in 'in' (one per model). The pairs of models
+// are then compared without modifying them (see 'rotation',
+// 'centeredRMSD').
+void centerModels(ensemble *ens, int *zeros, inertia *in) {
+  for (int m = 0; m < ens->nmodels; m++)
+    centerModel(ens, m, zeros, in + m);
+}
+
+
+// Inner product matrix of the superposed particles of the centered
+// models 'a' and 'b' (see 'superpose'), and over all the particles in
+// 'Mall' if not NULL.
+static void crossCovariance(const ensemble *ens, int a, int b, int *zeros,
+                            double M[3][3], double Mall[3][3]) {
+  int size = ens->size;
+  const float *xa = ens_x(ens, a), *ya = ens_y(ens, a), *za = ens_z(ens, a);
+  const float *xb = ens_x(ens, b), *yb = ens_y(ens, b), *zb = ens_z(ens, b);
+  double Sxx = 0., Sxy = 0., Sxz = 0., Syx = 0., Syy = 0., Syz = 0.;
+  double Szx = 0., Szy = 0., Szz = 0.;
   int k;
-  // cout << "skipping " << flush;
+
   for (k = 0; k < size; k++) {
-    if (zeros[k]==0){
-      // cout << k << " " << zeros[k] << " " << flush;
-      continue;
-    }
-    u[1][1] = u[1][1] + xyzA[k][0] * xyzB[k][0];
-    u[1][2] = u[1][2] + xyzA[k][0] * xyzB[k][1];
-    u[1][3] = u[1][3] + xyzA[k][0] * xyzB[k][2];
-    u[2][1] = u[2][1] + xyzA[k][1] * xyzB[k][0];
-    u[2][2] = u[2][2] + xyzA[k][1] * xyzB[k][1];
-    u[2][3] = u[2][3] + xyzA[k][1] * xyzB[k][2];
-    u[3][1] = u[3][1] + xyzA[k][2] * xyzB[k][0];
-    u[3][2] = u[3][2] + xyzA[k][2] * xyzB[k][1];
-    u[3][3] = u[3][3] + xyzA[k][2] * xyzB[k][2];
+    double w = zeros[k] != 0;
+    double ax = w * xa[k], ay = w * ya[k], az = w * za[k];
+    Sxx += xb[k]*ax; Sxy += xb[k]*ay; Sxz += xb[k]*az;
+    Syx += yb[k]*ax; Syy += yb[k]*ay; Syz += yb[k]*az;
+    Szx += zb[k]*ax; Szy += zb[k]*ay; Szz += zb[k]*az;
   }
-  // cout << endl << flush;
-
-  det = u[1][1] * u[2][2] * u[3][3] +
-        u[1][2] * u[2][3] * u[3][1] +
-        u[1][3] * u[2][1] * u[3][2] -
-        u[1][3] * u[2][2] * u[3][1] -
-        u[1][1] * u[2][3] * u[3][2] -
-        u[1][2] * u[2][1] * u[3][3];
-
-  //cout << "DET= " << det << endl << flush;
-  for (i = 1; i <= 6; i++) {
-    for (int j = 1; j <= 6; j++) {
-      omega[i][j] = 0.0;
-    }
-  }
-  for (i = 1; i <= 3; i ++) {
-    for (int j = 4; j <= 6; j++) {
-      omega[i][j] = u[i][j-3];
-    }
-  }
-  for (i = 4; i <= 6; i++) {
-    for (int j = 1; j <= 3; j++) {
-      omega[i][j] = u[j][i-3];
-    }
+  M[0][0] = Sxx; M[0][1] = Sxy; M[0][2] = Sxz;
+  M[1][0] = Syx; M[1][1] = Syy; M[1][2] = Syz;
+  M[2][0] = Szx; M[2][1] = Szy; M[2][2] = Szz;
+  if (Mall == NULL)
+    return;
+
+  Sxx = Sxy = Sxz = Syx = Syy = Syz = Szx = Szy = Szz = 0.;
+  for (k = 0; k < size; k++) {
+    double ax = xa[k], ay = ya[k], az = za[k];
+    Sxx += xb[k]*ax; Sxy += xb[k]*ay; Sxz += xb[k]*az;
+    Syx += yb[k]*ax; Syy += yb[k]*ay; Syz += yb[k]*az;
+    Szx += zb[k]*ax; Szy += zb[k]*ay; Szz += zb[k]*az;
   }
+  Mall[0][0] = Sxx; Mall[0][1] = Sxy; Mall[0][2] = Sxz;
+  Mall[1][0] = Syx; Mall[1][1] = Syy; Mall[1][2] = Syz;
+  Mall[2][0] = Szx; Mall[2][1] = Szy; Mall[2][2] = Szz;
+}
 
-  // eigen sets o (eigen vector) and d (eigen val)
-  eigen(omega,o,d,6);
 
-  // o values set by eigen used below
-  // d not used
-  for (k=1; k<=3; k++) {
-    for (i = 1; i<=3; i++) {
-      ha[i][k] = o[i][k];
-      ka[i][k] = o[i + 3][k];
-    }
-  }
+// Rotation 'rot' (row-major) of the centered model 'a' onto 'b' (see
+// 'centerModels'). Only the 3x3 inner product matrix of the pair is
+// computed; the models are not modified.
+void rotation(const ensemble *ens, const inertia *in, int a, int b,
+              int *zeros, double *rot) {
+  double M[3][3];
 
-  for (k = 1; k<=3; k++) {
-    s = 0.;
-    for (i = 1; i<=3; i++) {
-      s += ha[i][k] * ha[i][k] ;
-    }
-    s = sqrt(s);
-    for (i = 1; i<=3; i++) {
-      ha[i][k] = ha[i][k]/s;
-    }
-  }
-  for (k = 1; k <= 3; k++) {
-    s = 0.0;
-    for (i = 1; i<=3; i++) {
-      s += ka[i][k]* ka[i][k];
-    }
-    s = sqrt(s);
-    for (i = 1; i <= 3; i++) {
-      ka[i][k] = ka[i][k]/s;
-    }
-  }
+  crossCovariance(ens, a, b, zeros, M, NULL);
+  superpose(M, (in[a].G + in[b].G) / 2.0, rot);
+}
 
-  op[1] = ha[2][1] * ha[3][2]-ha[3][1] * ha[2][2];
-  op[2] = ha[3][1] * ha[1][2]-ha[1][1] * ha[3][2];
-  op[3] = ha[1][1] * ha[2][2]-ha[2][1] * ha[1][2];
-  s = op[1] * ha[1][3] + op[2] * ha[2][3] + op[3] * ha[3][3];
-  if(s < 0.) {
-    for (k=1; k <= 3; k++) {
-      ha[k][3] = -ha[k][3];
-    }
-  }
-  op[1] = ka[2][1] * ka[3][2]-ka[3][1] * ka[2][2];
-  op[2] = ka[3][1] * ka[1][2]-ka[1][1] * ka[3][2];
-  op[3] = ka[1][1] * ka[2][2]-ka[2][1] * ka[1][2];
-  s = op[1] * ka[1][3] + op[2] * ka[2][3] + op[3] * ka[3][3];
 
+// Rotate model 'a' of the ensemble onto model 'b', superposing the
+// particles with nonzero 'zeros' (both models are centered on them).
+void align(ensemble *ens, int a, int b, int *zeros){
+  int size = ens->size;
+  float *xa = ens_x(ens, a), *ya = ens_y(ens, a), *za = ens_z(ens, a);
+  float *xb = ens_x(ens, b), *yb = ens_y(ens, b), *zb = ens_z(ens, b);
+  double M[3][3];
+  double GA = 0., GB = 0.;
+  double r[9]; // rotation
+  int k;
 
-  if(det > 0.) {
-    if(s < 0.) {
-      for (k = 1; k<=3; k++) {
-	ka[k][3] = -ka[k][3];
-      }
-    }
-  }
-  else {
-    if(s > 0.0) {
-      for (k = 1; k<=3; k++) {
-	ka[k][3] = -ka[k][3];
-      }
-    }
+  massCenter(xa, ya, za, zeros, size);
+  massCenter(xb, yb, zb, zeros, size);
+  // PStruct
+  for (k = 0; k < size; k++) {
+    double w = zeros[k] != 0;
+    GA += w * (xa[k]*xa[k] + ya[k]*ya[k] + za[k]*za[k]);
+    GB += w * (xb[k]*xb[k] + yb[k]*yb[k] + zb[k]*zb[k]);
   }
+  crossCovariance(ens, a, b, zeros, M, NULL);
+  superpose(M, (GA + GB) / 2.0, r);
 
-  k = 1;
-  if(det < 0.) k = -1;
-  // rotation matrix
-  for (i = 1; i<=3; i++) {
-    for (int j = 1; j<=3; j++) {
-      r[i][j] = ka[i][1] * ha[j][1] + ka[i][2] * ha[j][2] + k * ka[i][3] * ha[j][3];
-    }
+  for (k = 0; k < size; k++) {
+    float x = xa[k], y = ya[k], z = za[k];
+    xa[k] = r[0]*x + r[1]*y + r[2]*z;
+    ya[k] = r[3]*x + r[4]*y + r[5]*z;
+    za[k] = r[6]*x + r[7]*y + r[8]*z;
   }
+}
 
-  for (i=0; i < size; i++) {
-    xyzn[i][0]=r[1][1]*xyzA[i][0]+r[1][2]*xyzA[i][1]+r[1][3]*xyzA[i][2];
-    xyzn[i][1]=r[2][1]*xyzA[i][0]+r[2][2]*xyzA[i][1]+r[2][3]*xyzA[i][2];
-    xyzn[i][2]=r[3][1]*xyzA[i][0]+r[3][2]*xyzA[i][1]+r[3][3]*xyzA[i][2];
-    xyzA[i][0] = xyzn[i][0];
-    xyzA[i][1] = xyzn[i][1];
-    xyzA[i][2] = xyzn[i][2];
-  }
 
-  if (xyzn) delete [] xyzn;
+// RMSD of all the particles of the centered models 'a' and 'b' (see
+// 'centerModels') after superposition on the particles with nonzero
+// 'zeros', without rotating them. If all the particles are superposed
+// it follows from the eigenvalue of 'superpose' alone, otherwise from
+// the rotation and the inner products of all the particles.
+float centeredRMSD(const ensemble *ens, const inertia *in, int a, int b,
+                   int *zeros) {
+  int size = ens->size;
+  double M[3][3], Mall[3][3];
+  double E0 = (in[a].G + in[b].G) / 2.0;
+  double msd;
+
+  if (in[a].n == size) {
+    crossCovariance(ens, a, b, zeros, M, NULL);
+    msd = 2.0 * (E0 - superpose(M, E0, NULL));
+  }
+  else {
+    double r[9];
+    crossCovariance(ens, a, b, zeros, M, Mall);
+    superpose(M, E0, r);
+    // sum_k |R a_k - b_k|^2 = GA + GB - 2 * sum_ij R_ij * sum_k b_k[i] a_k[j]
+    double tr = 0.;
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        tr += r[3*i+j] * Mall[i][j];
+    msd = in[a].Gall + in[b].Gall - 2.0 * tr;
+  }
+  if (msd < 0.)
+    msd = 0.;
+  return sqrt(msd / size);
 }
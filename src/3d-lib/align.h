@@ -4,7 +4,24 @@
 #ifndef _ALIGN_H
 #define _ALIGN_H 1
 
-extern void align(float** xyzA, float** xyzB, int *zeros, int size);
+#include "ensemble.h"
+
+// Inner products of a centered model (see 'centerModels').
+typedef struct {
+  int n;                       // Number of superposed particles.
+  double G;                    // Sum of their squared norms.
+  double Gall;                 // Same, over all the particles.
+} inertia;
+
+extern void massCenter(float *x, float *y, float *z, int *zeros, int size);
+extern double superpose(const double M[3][3], double E0, double *rot);
+extern void centerModel(ensemble *ens, int m, int *zeros, inertia *in);
+extern void centerModels(ensemble *ens, int *zeros, inertia *in);
+extern void rotation(const ensemble *ens, const inertia *in, int a, int b,
+		     int *zeros, double *rot);
+extern float centeredRMSD(const ensemble *ens, const inertia *in, int a, int b,
+			  int *zeros);
+extern void align(ensemble *ens, int a, int b, int *zeros);
 
 #endif /* _ALIGN_H */
 
@@ -32,51 +32,44 @@ static PyObject* aligner3d_wrapper(PyObject* self, PyObject* args)
 			&py_xs2, &py_ys2, &py_zs2, &py_zeros, &size))
     return NULL;
  
-  float **xyz1;
-  float **xyz2;
+  ensemble *ens;
   int zeros[size];
   int i;
 
  
-  xyz1 = new float*[size];
-  xyz2 = new float*[size];
-  for(int i=0; i<size; i++) {
-    xyz1[i] = new float[3];
-    memset(xyz1[i], 0, 3*sizeof(float));
-    xyz2[i] = new float[3];
-    memset(xyz2[i], 0, 3*sizeof(float));
-  }
+  // model 0 is the reference, model 1 is aligned onto it
+  ens = new_ensemble(2, size);
+  if (ens == NULL)
+    return PyErr_NoMemory();
+  float *x1 = ens_x(ens, 0), *y1 = ens_y(ens, 0), *z1 = ens_z(ens, 0);
+  float *x2 = ens_x(ens, 1), *y2 = ens_y(ens, 1), *z2 = ens_z(ens, 1);
 
 
   for (i=0; i<size; i++){
-    zeros[i]   = PyObject_IsTrue(PyTuple_GET_ITEM(py_zeros, i));
-    xyz1[i][0] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_xs1, i));
-    xyz1[i][1] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_ys1, i));
-    xyz1[i][2] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_zs1, i));
-    xyz2[i][0] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_xs2, i));
-    xyz2[i][1] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_ys2, i));
-    xyz2[i][2] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_zs2, i));
+    zeros[i] = PyObject_IsTrue(PyTuple_GET_ITEM(py_zeros, i));
+    x1[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_xs1, i));
+    y1[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_ys1, i));
+    z1[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_zs1, i));
+    x2[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_xs2, i));
+    y2[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_ys2, i));
+    z2[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(py_zs2, i));
   }
 
-  align(xyz2, xyz1, zeros, size);
+  align(ens, 1, 0, zeros);
 
   // give it to me
   PyObject * py_result = NULL;
   PyObject * py_subresult = NULL;
   py_result = PyList_New(3);
   for (int j = 0; j < 3; ++j) {
+    const float *c = x2 + (size_t) j * ens->ld;
     py_subresult = PyList_New(size);
     for (int i = 0; i < size; ++i) {
-      PyList_SetItem(py_subresult, i, PyFloat_FromDouble(xyz2[i][j]));
+      PyList_SetItem(py_subresult, i, PyFloat_FromDouble(c[i]));
     }
     PyList_SetItem(py_result, j, py_subresult);
   }
-  for (int i=0; i<size; i++) {
-    delete[] xyz1[i];
-    delete[] xyz2[i];
-  }
-  delete[] xyz1;
-  delete[] xyz2;
+  free_ensemble(ens);
   
   return py_result;
 }
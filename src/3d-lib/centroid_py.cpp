@@ -1,6 +1,7 @@
 #include "Python.h"
 #include "3dStats.h"
 #include <iostream>
+#include <algorithm>
 // #include <string>
 // using namespace std;
 // cout << "START" << endl << flush;
@@ -20,6 +21,49 @@ number of equivalent positions, the RMSD and the dRMSD.\n\
 ");
 
 
+// Ensemble of the models of the Python lists of coordinates, followed
+// by 'navg' (zeroed) models for the averages.
+static ensemble *readModels(PyObject *py_xs, PyObject *py_ys, PyObject *py_zs,
+			    int nmodels, int size, int navg)
+{
+  ensemble *ens = new_ensemble(nmodels + navg, size);
+  if (ens == NULL)
+    return NULL;
+  for (int j=0; j<nmodels; j++){
+    float *x = ens_x(ens, j), *y = ens_y(ens, j), *z = ens_z(ens, j);
+    for (int i=0; i<size; i++){
+      x[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_xs, j), i));
+      y[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_ys, j), i));
+      z[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_zs, j), i));
+    }
+  }
+  return ens;
+}
+
+
+// Orders the models by their RMSD to the average.
+struct byRmsd {
+  const float *rmsds;
+  byRmsd(const float *r) : rmsds(r) {}
+  bool operator()(int a, int b) const { return rmsds[a] < rmsds[b]; }
+};
+
+
+// List of the x, y and z lists of coordinates of model 'm'.
+static PyObject *modelCoords(const ensemble *ens, int m)
+{
+  PyObject *py_result = PyList_New(3);
+  for (int j=0; j<3; j++){
+    const float *c = ens_x(ens, m) + (size_t) j * ens->ld;
+    PyObject *py_subresult = PyList_New(ens->size);
+    for (int i=0; i<ens->size; i++)
+      PyList_SET_ITEM(py_subresult, i, PyFloat_FromDouble(c[i]));
+    PyList_SET_ITEM(py_result, j, py_subresult);
+  }
+  return py_result;
+}
+
+
 static PyObject* centroid_wrapper(PyObject* self, PyObject* args)
 {
   PyObject *py_xs;
@@ -31,133 +75,199 @@ static PyObject* centroid_wrapper(PyObject* self, PyObject* args)
   int verbose;
   int getavg;
 
-  if (!PyArg_ParseTuple(args, "OOOOiiii", &py_xs, &py_ys, &py_zs, &py_zeros, &size, 
+  if (!PyArg_ParseTuple(args, "OOOOiiii", &py_xs, &py_ys, &py_zs, &py_zeros, &size,
 			&nmodels, &verbose, &getavg))
     return NULL;
- 
-  float **xyz;
+  if (nmodels < 1) {
+    PyErr_SetString(PyExc_ValueError, "at least one model is needed");
+    return NULL;
+  }
+
+  ensemble *ens;
   int zeros[size];
   int i;
   int j;
-  int numP;
-  float dist2Avg;
-  map<string, float**>::iterator it1;
-  map<string, float**>::iterator it2;
-  map<float, string>::iterator it3;
-  float **avg;
-  bool add_first;
-  map<float, string> dist2Centroid;
-  set<string> modelList;
-  string modelId;
-  ostringstream tmpStr;
-
+  int avg;
+  int centroid;
 
   for (i=0; i<size; i++)
     zeros[i] = PyObject_IsTrue(PyTuple_GET_ITEM(py_zeros, i));
 
-  //map<string, float**> xyzlist;
-  map<string, float**> xyzlist;
-  
-  xyz = new float*[size];
+  // the models, followed by the average model
+  ens = readModels(py_xs, py_ys, py_zs, nmodels, size, 1);
+  if (ens == NULL)
+    return PyErr_NoMemory();
+  avg = nmodels;
 
-  for(int i=0; i<size; i++) {
-    xyz[i] = new float[3];
-    memset(xyz[i], 0, 3*sizeof(float));
-  }
+  // a single group with all the models, rotated onto the first one
+  inertia *in = new inertia[nmodels + 1];
+  int *members = new int[nmodels];
+  float *rmsds = new float[nmodels];
+  int start[2] = {0, nmodels};
+  for (j=0; j<nmodels; j++)
+    members[j] = j;
+  centerModels(ens, zeros, in);
+  groupAverages(ens, in, zeros, 1, start, members, avg, 0, 0, 0., 1, rmsds,
+		&centroid);
 
-  avg = new float*[size];
-  for(int i=0; i<size; i++) {
-    avg[i] = new float[3];
-    memset(avg[i], 0, 3*sizeof(float));
+  if (verbose){
+    // closest models first
+    stable_sort(members, members + nmodels, byRmsd(rmsds));
+    for (j=0; j<nmodels; j++)
+      cerr << members[j] << " rmsd2avg " << rmsds[members[j]] << endl;
   }
+  delete[] in;
+  delete[] members;
+  delete[] rmsds;
 
-  for (j=0; j<nmodels; j++){
-    for (i=0; i<size; i++){
-      xyz[i][0] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_xs, j), i));
-      xyz[i][1] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_ys, j), i));
-      xyz[i][2] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_zs, j), i));
-    }
-    tmpStr.str("");
-    tmpStr.clear();
-    tmpStr << j;
-    modelId = tmpStr.str();
-    // cout << modelId << " model id "  << xyz[1][0]<<" "<<xyz[1][1]<<" "<<xyz[1][2]<<endl;
-    xyzlist.insert(make_pair(modelId, populateMap(size, xyz)));
-  }
+  // give it to me
+  PyObject *py_result;
+  if (getavg)
+    py_result = modelCoords(ens, avg);
+  else
+    py_result = PyInt_FromLong(centroid);
+  free_ensemble(ens);
+  return py_result;
+}
 
-  numP = 1; 
-  add_first = 1;
-  it1=xyzlist.begin();
-  for ((it2=it1)++; it2!=xyzlist.end(); it2++) {
-    //cout << it1->first << " " << it2->first << endl;
-    // avgCoord(it1->second, it2->second, size, avg);
-    avgCoord(it1, it2, zeros, size, modelList, add_first, avg);
-    add_first = 0;
-    numP++;
-    // cout << "\n";
-  }
 
-  for (int i = 0; i < size; ++i) {
-    for (int j = 0; j < 3; ++j) {
-      avg[i][j] /= numP;
-    }
-    // cout << "   p" << i << " " << i << " " << avg[i][0] << " " << avg[i][1] << " " << avg[i][2]  << endl;
-  }
+/* The function doc string */
+PyDoc_STRVAR(centroids_wrapper__doc__,
+"From lists of xyz positions of models, build the average model and find the\n\
+centroid model of each group of models, all in one call.\n\
+   :param xs: list of the lists of x coordinates of each model.\n\
+   :param ys: list of the lists of y coordinates of each model.\n\
+   :param zs: list of the lists of z coordinates of each model.\n\
+   :param zeros: tuple of True/False, the particles to superpose.\n\
+   :param size: number of particles per model.\n\
+   :param nmodels: number of models passed\n\
+   :param groups: list of the lists of the indexes (in xs) of the models of\n\
+      each group\n\
+   :param procrustes: if 1, the models of each group are superposed onto\n\
+      their average by generalised Procrustes analysis, updating the average\n\
+      until it converges; otherwise they are superposed onto the first model\n\
+      of their group\n\
+   :param max_iter: maximum number of iterations of the Procrustes analysis\n\
+   :param tol: the average model is converged when it moves by less than\n\
+      tol (nm, RMS over the particles)\n\
+   :param 1 n_threads: number of threads (all the CPUs if 0)\n\
+\n\
+   :returns: for each group, the index of its centroid model (the closest to\n\
+      its average), the list of the RMSD of each model of the group to the\n\
+      average, and a list for each x, y, z coordinates, representing the\n\
+      average model\n\
+");
 
-  for (it1=xyzlist.begin(); it1!=xyzlist.end(); it1++) {
-    dist2Avg = findCenrtroid(it1, avg, size);
-    dist2Centroid.insert(make_pair(dist2Avg, it1->first));
-  }
 
-  if (verbose){
-    for (it3=dist2Centroid.begin(); it3!=dist2Centroid.end(); it3++) {
-      cerr << it3->second << " rmsd2avg " << it3->first << endl;
+static PyObject* centroids_wrapper(PyObject* self, PyObject* args)
+{
+  PyObject *py_xs;
+  PyObject *py_ys;
+  PyObject *py_zs;
+  PyObject *py_zeros;
+  PyObject *py_groups;
+  int size;
+  int nmodels;
+  int procrustes;
+  int max_iter;
+  float tol;
+  int n_threads = 1;
+
+  if (!PyArg_ParseTuple(args, "OOOOiiOiif|i", &py_xs, &py_ys, &py_zs,
+			&py_zeros, &size, &nmodels, &py_groups, &procrustes,
+			&max_iter, &tol, &n_threads))
+    return NULL;
+
+  ensemble *ens;
+  int zeros[size];
+  int ngroups = PyList_GET_SIZE(py_groups);
+  int i;
+  int g;
+  int t;
+
+  // members of all the groups, one after the other
+  int *start = new int[ngroups + 1];
+  start[0] = 0;
+  for (g=0; g<ngroups; g++) {
+    int nmembers = PyList_GET_SIZE(PyList_GET_ITEM(py_groups, g));
+    if (nmembers < 1) {
+      delete[] start;
+      PyErr_SetString(PyExc_ValueError, "empty group of models");
+      return NULL;
+    }
+    start[g + 1] = start[g] + nmembers;
+  }
+  int *members = new int[start[ngroups]];
+  for (g=0; g<ngroups; g++) {
+    PyObject *py_group = PyList_GET_ITEM(py_groups, g);
+    for (t=0; t<start[g + 1] - start[g]; t++) {
+      int m = PyInt_AsLong(PyList_GET_ITEM(py_group, t));
+      if (m < 0 || m >= nmodels) {
+	delete[] start;
+	delete[] members;
+	PyErr_SetString(PyExc_IndexError, "model index out of range");
+	return NULL;
+      }
+      members[start[g] + t] = m;
     }
   }
 
-  for (int i=0; i<size; i++) {
-    delete[] xyz[i];
+  for (i=0; i<size; i++)
+    zeros[i] = PyObject_IsTrue(PyTuple_GET_ITEM(py_zeros, i));
+
+  // the models, followed by the average model of each group
+  ens = readModels(py_xs, py_ys, py_zs, nmodels, size, ngroups);
+  if (ens == NULL) {
+    delete[] start;
+    delete[] members;
+    return PyErr_NoMemory();
   }
-  delete[] xyz;
 
-  // give it to me
+  inertia *in = new inertia[nmodels + ngroups];
+  float *rmsds = new float[start[ngroups]];
+  int *centroids = new int[ngroups];
 
-  if (getavg){
-    PyObject * py_result = NULL;
-    PyObject * py_subresult = NULL;
-    py_result = PyList_New(3);
-    i=0;
-    for (int j = 0; j < 3; ++j) {
-      py_subresult = PyList_New(size);
-      for (int i = 0; i < size; ++i) {
-	PyList_SetItem(py_subresult, i, PyFloat_FromDouble(avg[i][j]));
-      }
-      PyList_SetItem(py_result, j, py_subresult);
-    }
-    for (int i=0; i<size; i++) {
-      delete[] avg[i];
-    }
-    delete[] avg;
-    
-    return py_result;
+  Py_BEGIN_ALLOW_THREADS
+  centerModels(ens, zeros, in);
+  groupAverages(ens, in, zeros, ngroups, start, members, nmodels, procrustes,
+		max_iter, tol, n_threads, rmsds, centroids);
+  Py_END_ALLOW_THREADS
+
+  // give it to me
+  PyObject *py_result = PyList_New(ngroups);
+  for (g=0; g<ngroups; g++) {
+    PyObject *py_rmsds = PyList_New(start[g + 1] - start[g]);
+    for (t=start[g]; t<start[g + 1]; t++)
+      PyList_SET_ITEM(py_rmsds, t - start[g], PyFloat_FromDouble(rmsds[t]));
+    PyList_SET_ITEM(py_result, g,
+		    Py_BuildValue("(iNN)", centroids[g], py_rmsds,
+				  modelCoords(ens, nmodels + g)));
   }
 
-  return PyInt_FromLong(atoi(dist2Centroid.begin()->second.c_str()));
+  free_ensemble(ens);
+  delete[] in;
+  delete[] start;
+  delete[] members;
+  delete[] rmsds;
+  delete[] centroids;
+
+  return py_result;
 }
 
 
- 
 static PyMethodDef centroidMethods[] =
   {
-    {"centroid_wrapper", centroid_wrapper, METH_VARARGS, 
+    {"centroid_wrapper", centroid_wrapper, METH_VARARGS,
     centroid_wrapper__doc__},
+    {"centroids_wrapper", centroids_wrapper, METH_VARARGS,
+    centroids_wrapper__doc__},
     {NULL, NULL, 0, NULL}
   };
 
 PyMODINIT_FUNC
- 
+
 initcentroid(void)
 {
-  (void) Py_InitModule3("centroid", centroidMethods, 
+  (void) Py_InitModule3("centroid", centroidMethods,
 			"Functions to get the centroid of a given group of models.");
 }
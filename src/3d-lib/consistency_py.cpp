@@ -7,148 +7,118 @@
 
 /* The function doc string */
 PyDoc_STRVAR(consistency_wrapper__doc__,
-"From 2 lists of xyz positions, and a given threshold (nm), return the \n\
-number of equivalent positions, the RMSD and the dRMSD.\n\
-   :param xyz_a: first list of tuples of (x, y, z ) coordinates.\n\
-   :param xyz_b: second list of tuples of (x, y, z ) coordinates.\n\
-   :param dcutoff: distance cutoff to consider 2 particles as equivalent \n\
-      in position (nm)\n\
+"From lists of xyz positions of models, and a list of distance cutoffs (nm),\n\
+count for each particle the number of pairs of models in which it is in\n\
+equivalent position. Each pair of models is superposed only once.\n\
+   :param xs: list of the lists of x coordinates of each model.\n\
+   :param ys: list of the lists of y coordinates of each model.\n\
+   :param zs: list of the lists of z coordinates of each model.\n\
+   :param zeros: tuple of True/False, the particles to superpose.\n\
+   :param size: number of particles per model.\n\
+   :param dcutoffs: list of distance cutoffs to consider 2 particles as \n\
+      equivalent in position (nm)\n\
+   :param models: list of the names of the models\n\
    :param nmodels: number of models passed\n\
+   :param 1 n_threads: number of threads (all the CPUs if 0)\n\
 \n\
-   :returns: a list with the number of equivalent positions, the RMSD and \n\
-      the dRMSD, of the alignment. If consistency is True, returns list of \n\
-      0 or 1 if a given particle is in equivalent position in both strands.\n\
+   :returns: for each cutoff, the list of the number of pairs of models in \n\
+      which each particle is in equivalent position.\n\
 ");
 
-float maximumValue(float *vals, int size)
-{
-  float max = vals[0];
-  for(int i = 1; i<size; i++)
-    if(vals[i] > max)
-      max = vals[i];
-  return max;
-}
-
 static PyObject* consistency_wrapper(PyObject* self, PyObject* args)
 {
-  PyObject **py_xs;
-  PyObject **py_ys;
-  PyObject **py_zs;
+  PyObject *py_xs;
+  PyObject *py_ys;
+  PyObject *py_zs;
   PyObject *py_zeros;
-  PyObject **py_models;
+  PyObject *py_cutoffs;
+  PyObject *py_models;
   int size;
   int nmodels;
-  float thres;
+  int n_threads = 1;
   //cout << "START" << endl << flush;
- 
-  if (!PyArg_ParseTuple(args, "OOOOifOi", &py_xs, &py_ys, &py_zs, &py_zeros, &size, 
-			&thres, &py_models, &nmodels))
+
+  if (!PyArg_ParseTuple(args, "OOOOiOOi|i", &py_xs, &py_ys, &py_zs, &py_zeros,
+			&size, &py_cutoffs, &py_models, &nmodels, &n_threads))
     return NULL;
- 
-  float ***xyzn;
+
+  ensemble *ens;
   int zeros[size];
-  int   *cons_list;
-  int **scores;
+  int *counts;
+  int ncuts;
+  int c;
   int i;
   int j;
-  int jj;
-  int k;
-  int msize;
   //cout << "START1" << endl << flush;
 
+  py_cutoffs = PySequence_Fast(py_cutoffs, "dcutoffs should be a list");
+  if (py_cutoffs == NULL)
+    return NULL;
+  ncuts = PySequence_Fast_GET_SIZE(py_cutoffs);
+  float cutoffs[ncuts];
+  for (c=0; c<ncuts; c++)
+    cutoffs[c] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(py_cutoffs, c));
+  Py_DECREF(py_cutoffs);
+  if (PyErr_Occurred())
+    return NULL;
+
   for (i=0; i<size; i++)
     zeros[i] = PyObject_IsTrue(PyTuple_GET_ITEM(py_zeros, i));
 
-  msize = nmodels*(nmodels-1)/2;
-  xyzn = new float **[nmodels];
-  for (i=0;i<nmodels;i++)
-    xyzn[i] = new float *[size];
+  ens = new_ensemble(nmodels, size);
+  if (ens == NULL)
+    return PyErr_NoMemory();
   //cout << "START2" << endl << flush;
 
 
   for (j=0; j<nmodels; j++){
+    float *x = ens_x(ens, j), *y = ens_y(ens, j), *z = ens_z(ens, j);
     for (i=0; i<size; i++){
-      xyzn[j][i] = new float[3];
-      memset(xyzn[j][i], 0, 3*sizeof(float));
-      xyzn[j][i][0] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_xs, j ), i));
-      xyzn[j][i][1] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_ys, j ), i));
-      xyzn[j][i][2] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_zs, j ), i));
+      x[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_xs, j ), i));
+      y[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_ys, j ), i));
+      z[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_zs, j ), i));
     }
   }
   //cout << "START3" << endl << flush;
-  scores = new int*[msize];
-
-  k = 0;
-  for (j=0; j<nmodels-1; j++){
-    for (jj=j+1; jj<nmodels; jj++){
-      cons_list = new int[size];
-      scores[k] = new int[size];
-      consistency(xyzn[j], xyzn[jj], zeros, size, thres, cons_list);
-      scores[k] = cons_list;
-      k++;
-      // scores[j+jj-1] = cons_list;
-    }
-  }
+  counts = new int[(size_t) ncuts*size];
+  inertia *in = new inertia[nmodels];
+
+  Py_BEGIN_ALLOW_THREADS
+  centerModels(ens, zeros, in);
+  pairwiseConsistency(ens, in, zeros, ncuts, cutoffs, n_threads, counts);
+  Py_END_ALLOW_THREADS
 
   //cout << "START4" << endl << flush;
   PyObject * py_result = NULL;
   PyObject * py_subresult = NULL;
-  py_result = PyList_New(msize);
-  k = 0;
-  for (j=0; j<nmodels; j++){
-    for (jj=j+1; jj<nmodels; jj++){
-	py_subresult = PyList_New(size);
-	for (i=0; i<size; i++)
-	  PyList_SetItem(py_subresult, i, PyInt_FromLong(scores[k][i]));
-	PyList_SetItem(py_result,k , py_subresult);
-	k++;
-    }
+  py_result = PyList_New(ncuts);
+  for (c=0; c<ncuts; c++){
+    py_subresult = PyList_New(size);
+    for (i=0; i<size; i++)
+      PyList_SET_ITEM(py_subresult, i, PyInt_FromLong(counts[(size_t) c*size + i]));
+    PyList_SET_ITEM(py_result, c, py_subresult);
   }
 
   // free
-  delete[] cons_list;
-  //cout << "START5" << endl << flush;
-  for (int j=0; j<nmodels; j++){
-    for (int i=0; i<size; i++)
-      delete[] xyzn[j][i];
-    delete[] xyzn[j];
-  }
-  delete[] xyzn;
-  
-  for (int i=0; i<msize-1; i++){
-    //cout << i << " "<<msize<<endl << flush;
-    delete[] scores[i];
-  }
-  //cout << "START6" << endl << flush;
-  delete[] scores;
-
-  //cout << "START7" << endl << flush;
-  //cout << "START5" << endl << flush;
-  Py_DECREF(py_xs);
-  //cout << "START5" << endl << flush;
-  Py_DECREF(py_ys);
-  Py_DECREF(py_zs);
-  Py_DECREF(py_models);
-  Py_CLEAR(py_xs);
-  Py_CLEAR(py_ys);
-  Py_CLEAR(py_zs);
-  Py_CLEAR(py_models);
-  
+  free_ensemble(ens);
+  delete[] in;
+  delete[] counts;
+
   // give it to me
   return py_result;
 }
- 
+
 static PyMethodDef ConsistencyMethods[] =
   {
-    {"consistency_wrapper", consistency_wrapper, METH_VARARGS, 
+    {"consistency_wrapper", consistency_wrapper, METH_VARARGS,
     consistency_wrapper__doc__},
     {NULL, NULL, 0, NULL}
   };
 
 PyMODINIT_FUNC
- 
+
 initconsistency(void)
 {
-  (void) Py_InitModule3("consistency", ConsistencyMethods, 
+  (void) Py_InitModule3("consistency", ConsistencyMethods,
 			"Functions to compaire two Chromatin strands.");
 }
@@ -0,0 +1,235 @@
+#include "Python.h"
+#include "3dStats.h"
+// #include <iostream>
+// using namespace std;
+
+// cout << "START" << endl << flush;
+
+
+// Ensemble of the models of the Python lists of coordinates.
+static ensemble *readModels(PyObject *py_xs, PyObject *py_ys, PyObject *py_zs,
+			    int nmodels, int size)
+{
+  ensemble *ens = new_ensemble(nmodels, size);
+  if (ens == NULL)
+    return NULL;
+  for (int j=0; j<nmodels; j++){
+    float *x = ens_x(ens, j), *y = ens_y(ens, j), *z = ens_z(ens, j);
+    for (int i=0; i<size; i++){
+      x[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_xs, j), i));
+      y[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_ys, j), i));
+      z[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_zs, j), i));
+    }
+  }
+  return ens;
+}
+
+
+// Distance cutoffs of a Python sequence, in 'cutoffs' (new array).
+static int readCutoffs(PyObject *py_cutoffs, float **cutoffs)
+{
+  py_cutoffs = PySequence_Fast(py_cutoffs, "cutoffs should be a list");
+  if (py_cutoffs == NULL)
+    return -1;
+  int ncuts = PySequence_Fast_GET_SIZE(py_cutoffs);
+  *cutoffs = new float[ncuts];
+  for (int c=0; c<ncuts; c++)
+    (*cutoffs)[c] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(py_cutoffs, c));
+  Py_DECREF(py_cutoffs);
+  if (PyErr_Occurred()) {
+    delete[] *cutoffs;
+    return -1;
+  }
+  return ncuts;
+}
+
+
+/* The function doc string */
+PyDoc_STRVAR(contact_map_wrapper__doc__,
+"From lists of xyz positions of models, and a list of distance cutoffs (nm),\n\
+compute the frequency of contact of each pair of particles, for all the\n\
+cutoffs at once.\n\
+   :param xs: list of the lists of x coordinates of each model.\n\
+   :param ys: list of the lists of y coordinates of each model.\n\
+   :param zs: list of the lists of z coordinates of each model.\n\
+   :param zeros: tuple of True/False, the particles to consider.\n\
+   :param size: number of particles per model.\n\
+   :param nmodels: number of models passed\n\
+   :param cutoffs: list of distance cutoffs, two particles are in contact \n\
+      if their distance is lower than or equal to the cutoff (nm)\n\
+   :param 1 n_threads: number of threads (all the CPUs if 0)\n\
+\n\
+   :returns: a bytearray with, for each cutoff, the dense size x size \n\
+      matrix (float64, row-major) of the fraction of models in which each\n\
+      pair of particles is in contact (nan in the diagonal and for the\n\
+      particles not considered).\n\
+");
+
+
+static PyObject* contact_map_wrapper(PyObject* self, PyObject* args)
+{
+  PyObject *py_xs;
+  PyObject *py_ys;
+  PyObject *py_zs;
+  PyObject *py_zeros;
+  PyObject *py_cutoffs;
+  int size;
+  int nmodels;
+  int n_threads = 1;
+
+  if (!PyArg_ParseTuple(args, "OOOOiiO|i", &py_xs, &py_ys, &py_zs, &py_zeros,
+			&size, &nmodels, &py_cutoffs, &n_threads))
+    return NULL;
+
+  ensemble *ens;
+  int zeros[size];
+  float *cutoffs;
+  int *counts;
+  double *matrix;
+  int ncuts;
+  int c;
+  int i;
+  int j;
+
+  ncuts = readCutoffs(py_cutoffs, &cutoffs);
+  if (ncuts < 0)
+    return NULL;
+  for (i=0; i<size; i++)
+    zeros[i] = PyObject_IsTrue(PyTuple_GET_ITEM(py_zeros, i));
+
+  // the result, filled in place
+  size_t npairs = (size_t) size * (size - 1) / 2;
+  PyObject *py_matrix = PyByteArray_FromStringAndSize(
+      NULL, (size_t) ncuts * size * size * sizeof(double));
+  if (py_matrix == NULL) {
+    delete[] cutoffs;
+    return NULL;
+  }
+  matrix = (double *) PyByteArray_AS_STRING(py_matrix);
+
+  ens = readModels(py_xs, py_ys, py_zs, nmodels, size);
+  if (ens == NULL) {
+    delete[] cutoffs;
+    Py_DECREF(py_matrix);
+    return PyErr_NoMemory();
+  }
+  counts = new int[ncuts * npairs];
+
+  Py_BEGIN_ALLOW_THREADS
+  contactCounts(ens, zeros, ncuts, cutoffs, 0, n_threads, counts, NULL);
+  for (c=0; c<ncuts; c++){
+    double *mc = matrix + (size_t) c * size * size;
+    const int *cc = counts + c * npairs;
+    for (i=0; i<size; i++){
+      mc[(size_t) i * size + i] = Py_NAN;
+      for (j=i+1; j<size; j++){
+	double v = Py_NAN;
+	if (zeros[i] && zeros[j])
+	  v = (double) cc[PAIR_INDEX(i, j, size)] / nmodels;
+	mc[(size_t) i * size + j] = mc[(size_t) j * size + i] = v;
+      }
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  // free
+  free_ensemble(ens);
+  delete[] cutoffs;
+  delete[] counts;
+
+  // give it to me
+  return py_matrix;
+}
+
+
+/* The function doc string */
+PyDoc_STRVAR(interactions_wrapper__doc__,
+"From lists of xyz positions of models, and a list of distance cutoffs (nm),\n\
+count the particles in contact with each particle of each model.\n\
+   :param xs: list of the lists of x coordinates of each model.\n\
+   :param ys: list of the lists of y coordinates of each model.\n\
+   :param zs: list of the lists of z coordinates of each model.\n\
+   :param size: number of particles per model.\n\
+   :param nmodels: number of models passed\n\
+   :param cutoffs: list of distance cutoffs, two particles are in contact \n\
+      if their distance is lower than the cutoff (nm)\n\
+   :param 1 n_threads: number of threads (all the CPUs if 0)\n\
+\n\
+   :returns: a bytearray with, for each cutoff and each model, the number \n\
+      of particles in contact with each particle (int32, cutoffs x models \n\
+      x particles).\n\
+");
+
+
+static PyObject* interactions_wrapper(PyObject* self, PyObject* args)
+{
+  PyObject *py_xs;
+  PyObject *py_ys;
+  PyObject *py_zs;
+  PyObject *py_cutoffs;
+  int size;
+  int nmodels;
+  int n_threads = 1;
+
+  if (!PyArg_ParseTuple(args, "OOOiiO|i", &py_xs, &py_ys, &py_zs, &size,
+			&nmodels, &py_cutoffs, &n_threads))
+    return NULL;
+
+  ensemble *ens;
+  int zeros[size];
+  float *cutoffs;
+  int ncuts;
+  int i;
+
+  ncuts = readCutoffs(py_cutoffs, &cutoffs);
+  if (ncuts < 0)
+    return NULL;
+  // all the particles
+  for (i=0; i<size; i++)
+    zeros[i] = 1;
+
+  // the result, filled in place
+  PyObject *py_counts = PyByteArray_FromStringAndSize(
+      NULL, (size_t) ncuts * nmodels * size * sizeof(int));
+  if (py_counts == NULL) {
+    delete[] cutoffs;
+    return NULL;
+  }
+
+  ens = readModels(py_xs, py_ys, py_zs, nmodels, size);
+  if (ens == NULL) {
+    delete[] cutoffs;
+    Py_DECREF(py_counts);
+    return PyErr_NoMemory();
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  contactCounts(ens, zeros, ncuts, cutoffs, 1, n_threads, NULL,
+		(int *) PyByteArray_AS_STRING(py_counts));
+  Py_END_ALLOW_THREADS
+
+  // free
+  free_ensemble(ens);
+  delete[] cutoffs;
+
+  // give it to me
+  return py_counts;
+}
+
+
+static PyMethodDef contactsMethods[] =
+  {
+    {"contact_map_wrapper", contact_map_wrapper, METH_VARARGS,
+    contact_map_wrapper__doc__},
+    {"interactions_wrapper", interactions_wrapper, METH_VARARGS,
+    interactions_wrapper__doc__},
+    {NULL, NULL, 0, NULL}
+  };
+
+PyMODINIT_FUNC
+
+initcontacts(void)
+{
+  (void) Py_InitModule3("contacts", contactsMethods,
+			"Functions to find the contacts between the particles of 3D models.");
+}
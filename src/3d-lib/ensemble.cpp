@@ -0,0 +1,32 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ensemble.h"
+
+// Allocate an ensemble with all the coordinates set to 0 (NULL if
+// the memory cannot be allocated).
+ensemble *new_ensemble(int nmodels, int size) {
+  ensemble *ens = new ensemble;
+  size_t n;
+  void *buf;
+
+  ens->nmodels = nmodels;
+  ens->size = size;
+  ens->ld = ((size + ENS_ALIGN - 1) / ENS_ALIGN) * ENS_ALIGN;
+  n = (size_t) 3 * nmodels * ens->ld;
+  if (n == 0) n = ENS_ALIGN;
+  if (posix_memalign(&buf, ENS_ALIGN * sizeof(float), n * sizeof(float))) {
+    delete ens;
+    return NULL;
+  }
+  memset(buf, 0, n * sizeof(float));
+  ens->xyz = (float *) buf;
+  return ens;
+}
+
+
+void free_ensemble(ensemble *ens) {
+  if (ens == NULL)
+    return;
+  free(ens->xyz);
+  delete ens;
+}
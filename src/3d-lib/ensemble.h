@@ -0,0 +1,39 @@
+/* @(#)ensemble.h
+ */
+
+#ifndef _ENSEMBLE_H
+#define _ENSEMBLE_H 1
+
+#include <stddef.h>
+
+// Alignment (in floats) of the planes of the models.
+#define ENS_ALIGN 16
+
+// Coordinates of 'nmodels' models of 'size' particles, in one buffer.
+// Each model is stored as 3 consecutive planes of 'ld' floats (all the
+// x, then all the y, then all the z) so that the kernels read the
+// particles with unit stride. 'ld' is 'size' rounded up to 'ENS_ALIGN'
+// and the buffer is aligned on 64 bytes, so every plane is aligned.
+// The padding is zero.
+typedef struct {
+  int nmodels;
+  int size;
+  int ld;
+  float *xyz;
+} ensemble;
+
+extern ensemble *new_ensemble(int nmodels, int size);
+extern void free_ensemble(ensemble *ens);
+
+// Planes of model 'm'.
+static inline float *ens_x(const ensemble *ens, int m) {
+  return ens->xyz + (size_t) 3 * m * ens->ld;
+}
+static inline float *ens_y(const ensemble *ens, int m) {
+  return ens->xyz + ((size_t) 3 * m + 1) * ens->ld;
+}
+static inline float *ens_z(const ensemble *ens, int m) {
+  return ens->xyz + ((size_t) 3 * m + 2) * ens->ld;
+}
+
+#endif /* _ENSEMBLE_H */
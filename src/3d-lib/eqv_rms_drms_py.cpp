@@ -7,22 +7,34 @@
 
 /* The function doc string */
 PyDoc_STRVAR(rmsdRMSD_wrapper__doc__,
-"From 2 lists of xyz positions, and a given threshold (nm), return the \n\
-number of equivalent positions, the RMSD and the dRMSD.\n\
-   :param xyz_a: first list of tuples of (x, y, z ) coordinates.\n\
-   :param xyz_b: second list of tuples of (x, y, z ) coordinates.\n\
+"From lists of xyz positions of models, and a given threshold (nm), compare \n\
+all the pairs of models by the number of equivalent positions, the RMSD, the \n\
+dRMSD or a score combining them.\n\
+   :param xs: list of the lists of x coordinates of each model.\n\
+   :param ys: list of the lists of y coordinates of each model.\n\
+   :param zs: list of the lists of z coordinates of each model.\n\
+   :param zeros: tuple of True/False, the particles to superpose.\n\
+   :param size: number of particles per model.\n\
    :param dcutoff: distance cutoff to consider 2 particles as equivalent \n\
       in position (nm)\n\
+   :param models: list of the names of the models\n\
    :param nmodels: number of models passed\n\
+   :param one: if 1, return the dRMSD of the first 2 models only\n\
+   :param what: the measure to compute, 'rmsd', 'drmsd', 'eqv' or 'score'\n\
+   :param normed: normalize the RMSD or dRMSD by their maximum value\n\
+   :param 1 n_threads: number of threads computing the pairs of models (all\n\
+      the CPUs if 0)\n\
 \n\
-   :returns: a list with the number of equivalent positions, the RMSD and \n\
-      the dRMSD, of the alignment.\n\
+   :returns: a bytearray with the value of each pair of models as float32,\n\
+      in the condensed order of scipy.spatial.distance (pairs (0, 1), (0, 2)\n\
+      ... (1, 2) ...), and the list of the names of the models, such that\n\
+      the i-th model of the pairs is models[i]. With 'one', the dRMSD.\n\
 ");
 
-float maximumValue(float *vals, int size)
+float maximumValue(float *vals, size_t size)
 {
   float max = vals[0];
-  for(int i = 1; i<size; i++)
+  for(size_t i = 1; i<size; i++)
     if(vals[i] > max)
       max = vals[i];
   return max;
@@ -30,180 +42,141 @@ float maximumValue(float *vals, int size)
 
 static PyObject* rmsdRMSD_wrapper(PyObject* self, PyObject* args)
 {
-  PyObject **py_xs;
-  PyObject **py_ys;
-  PyObject **py_zs;
+  PyObject *py_xs;
+  PyObject *py_ys;
+  PyObject *py_zs;
   PyObject *py_zeros;
-  PyObject **py_models;
+  PyObject *py_models;
   int size;
   int one;
   int nmodels;
   float thres;
   char *what;
   int normed;
-  // cout << "START" << endl << flush;
+  int n_threads = 1;
  
-  if (!PyArg_ParseTuple(args, "OOOOifOiisi", &py_xs, &py_ys, &py_zs, &py_zeros, 
-			&size, &thres, &py_models, &nmodels, &one, &what, &normed))
+  if (!PyArg_ParseTuple(args, "OOOOifOiisi|i", &py_xs, &py_ys, &py_zs, &py_zeros, 
+			&size, &thres, &py_models, &nmodels, &one, &what, &normed,
+			&n_threads))
     return NULL;
  
-  float ***xyzn;
+  ensemble *ens;
   int zeros[size];
-  float *nrmsds;
-  float *drmsds;
-  float *scores;
+  float *nrmsds = NULL;
+  float *drmsds = NULL;
+  int *eqvs = NULL;
+  float *values;
   float max_normed;
+  int pairs_what;
   int i;
   int j;
-  int jj;
-  int k;
-  int msize;
-  float rms = 0;
-  float drms = 0;
-  int   eqv = 0;
-  // cout << "START" << endl << flush;
+  int err;
+  size_t k;
+  size_t msize;
 
-  msize = nmodels*(nmodels-1)/2;
-  xyzn = new float **[nmodels];
-  for (i=0;i<nmodels;i++)
-    xyzn[i] = new float *[size];
-  nrmsds = new float[msize];
-  drmsds = new float[msize];
-  scores = new float[msize];
-  // cout << "START" << endl << flush;
+  if (one)
+    nmodels = 2;
+  // only the measures needed by the result
+  if (one || strcmp(what,"drmsd")==0)
+    pairs_what = PAIR_DRMSD;
+  else if (strcmp(what,"rmsd")==0)
+    pairs_what = PAIR_RMSD;
+  else if (strcmp(what,"eqv")==0)
+    pairs_what = PAIR_EQV;
+  else if (strcmp(what,"score")==0)
+    pairs_what = PAIR_RMSD | PAIR_DRMSD | PAIR_EQV;
+  else {
+    PyErr_SetString(PyExc_ValueError,
+		    "what should be 'rmsd', 'drmsd', 'eqv' or 'score'");
+    return NULL;
+  }
 
+  msize = (size_t) nmodels*(nmodels-1)/2;
+  // the result, filled in place
+  PyObject *py_values = PyByteArray_FromStringAndSize(NULL,
+						      msize * sizeof(float));
+  if (py_values == NULL)
+    return NULL;
+  values = (float *) PyByteArray_AS_STRING(py_values);
 
+  ens = new_ensemble(nmodels, size);
+  if (ens == NULL) {
+    Py_DECREF(py_values);
+    return PyErr_NoMemory();
+  }
   for (i=0; i<size; i++)
     zeros[i] = PyObject_IsTrue(PyTuple_GET_ITEM(py_zeros, i));
-
-  PyObject * py_result = NULL;
-  PyObject * py_subresult = NULL;
-  py_result = PyDict_New();
   for (j=0; j<nmodels; j++){
+    float *x = ens_x(ens, j), *y = ens_y(ens, j), *z = ens_z(ens, j);
     for (i=0; i<size; i++){
-      xyzn[j][i] = new float[3];
-      memset(xyzn[j][i], 0, 3*sizeof(float));
-      xyzn[j][i][0] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_xs, j ), i));
-      xyzn[j][i][1] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_ys, j ), i));
-      xyzn[j][i][2] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_zs, j ), i));
+      x[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_xs, j ), i));
+      y[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_ys, j ), i));
+      z[i] = PyFloat_AS_DOUBLE(PyList_GET_ITEM(PyList_GET_ITEM(py_zs, j ), i));
     }
   }
-  // cout << "START2" << endl << flush;
 
-  k = 0;
-  for (j=0; j<nmodels; j++){
-    for (jj=j+1; jj<nmodels; jj++){
-      rms = 0;
-      drms = 0;
-      eqv = 0;
-      rmsdRMSD(xyzn[j], xyzn[jj], zeros, size, thres, eqv, rms, drms);
-      nrmsds[k] = rms;
-      drmsds[k] = drms;
-      scores[k] = eqv * drms / rms;
-      // cout << j<<" " <<jj<<" " <<eqv<<" " <<drms<<" " <<rms<<" "<<scores[k]<< endl << flush;
-      k++;
+  // a single measure is computed directly in the result
+  if (pairs_what == PAIR_RMSD)
+    nrmsds = values;
+  else if (pairs_what == PAIR_DRMSD)
+    drmsds = values;
+  else {
+    eqvs = new int[msize];
+    if (pairs_what & PAIR_RMSD) {
+      nrmsds = new float[msize];
+      drmsds = new float[msize];
     }
   }
-  // cout << "START5" << endl << flush;
-  if (one){
-    // free
-    for (int j=0; j<nmodels; j++){
-      for (int i=0; i<size; i++){
-	delete[] xyzn[j][i];
-      }
-      delete[] xyzn[j];
-    }
-    delete[] xyzn;
-    
-    // give it to me
-    return PyFloat_FromDouble(drmsds[0]);
-  }
+  inertia *in = new inertia[nmodels];
 
-  if (strcmp(what,"rmsd")==0){
-    k=0;
-    max_normed = maximumValue(nrmsds, msize);
-    for (j=0; j<nmodels; j++){
-      for (jj=j+1; jj<nmodels; jj++){
-	if (normed)
-	  py_subresult = PyFloat_FromDouble(1-nrmsds[k]/max_normed);
-	else
-	  py_subresult = PyFloat_FromDouble(nrmsds[k]);
-	PyDict_SetItem(py_result, PyTuple_Pack(2, PyList_GET_ITEM(py_models, j ), PyList_GET_ITEM(py_models, jj)), py_subresult);
-	PyDict_SetItem(py_result, PyTuple_Pack(2, PyList_GET_ITEM(py_models, jj), PyList_GET_ITEM(py_models, j )), py_subresult);
-	k++;
-      }
-    }
-  }else if (strcmp(what,"drmsd")==0){
-    k=0;
-    max_normed = maximumValue(drmsds, msize);
-    for (j=0; j<nmodels; j++){
-      for (jj=j+1; jj<nmodels; jj++){
-	if (normed)
-	  py_subresult = PyFloat_FromDouble(1-drmsds[k]/max_normed);
-	else
-	  py_subresult = PyFloat_FromDouble(drmsds[k]);
-	PyDict_SetItem(py_result, PyTuple_Pack(2, PyList_GET_ITEM(py_models, j ), PyList_GET_ITEM(py_models, jj)), py_subresult);
-	PyDict_SetItem(py_result, PyTuple_Pack(2, PyList_GET_ITEM(py_models, jj), PyList_GET_ITEM(py_models, j )), py_subresult);
-	k++;
-      }
-    }
-  }else if (strcmp(what,"eqv")==0){
-    k=0;
-    for (j=0; j<nmodels; j++){
-      for (jj=j+1; jj<nmodels; jj++){
-	py_subresult = PyFloat_FromDouble(scores[k] * nrmsds[k] / drmsds[k]);
-	PyDict_SetItem(py_result, PyTuple_Pack(2, PyList_GET_ITEM(py_models, j ), PyList_GET_ITEM(py_models, jj)), py_subresult);
-	PyDict_SetItem(py_result, PyTuple_Pack(2, PyList_GET_ITEM(py_models, jj), PyList_GET_ITEM(py_models, j )), py_subresult);
-	k++;
-      }
-    }
-  }else if (strcmp(what,"score")==0){
-    // cout << "START6" << endl << flush;
+  Py_BEGIN_ALLOW_THREADS
+  centerModels(ens, zeros, in);
+  err = pairwiseRmsdRMSD(ens, in, zeros, thres, pairs_what, n_threads,
+			 nrmsds, drmsds, eqvs);
+
+  if (err){
+    // incomplete result
+  }else if (pairs_what == PAIR_EQV){
+    for (k=0; k<msize; k++)
+      values[k] = eqvs[k];
+  }else if ((pairs_what & PAIR_EQV) && msize > 0){
+    // score
     max_normed = maximumValue(nrmsds, msize) / maximumValue(drmsds, msize);
-    // cout << "START7" << endl << flush;
-    k=0;
-    for (j=0; j<nmodels; j++){
-      for (jj=j+1; jj<nmodels; jj++){
-	py_subresult = PyFloat_FromDouble(scores[k] * max_normed);
-	// py_subresult = PyFloat_FromDouble(scores[k]);
-	// cout << " " << j << " "<<jj<<" "<<scores[k] << " " << scores[k] * max_normed << " " << max_normed<<endl << flush;
-	PyDict_SetItem(py_result, PyTuple_Pack(2, PyList_GET_ITEM(py_models, j ), PyList_GET_ITEM(py_models, jj)), py_subresult);
-	PyDict_SetItem(py_result, PyTuple_Pack(2, PyList_GET_ITEM(py_models, jj), PyList_GET_ITEM(py_models, j )), py_subresult);
-	k++;
-      }
-    }
+    for (k=0; k<msize; k++)
+      values[k] = eqvs[k] * drmsds[k] / nrmsds[k] * max_normed;
+  }else if (normed && !one && msize > 0){
+    max_normed = maximumValue(values, msize);
+    for (k=0; k<msize; k++)
+      values[k] = 1 - values[k] / max_normed;
   }
-  // cout << "START8" << endl << flush;
+  Py_END_ALLOW_THREADS
 
   // free
-  // cout << "START5" << endl << flush;
-  delete[] drmsds;
-  // cout << "START5" << endl << flush;
-  delete[] nrmsds;
-// cout << "START5" << endl << flush;
-  delete[] scores;
-// cout << "START5" << endl << flush;
-  for (int j=0; j<nmodels; j++){
-    for (int i=0; i<size; i++){
-      delete[] xyzn[j][i];
-    }
-    delete[] xyzn[j];
+  free_ensemble(ens);
+  delete[] in;
+  if (eqvs != NULL) {
+    delete[] eqvs;
+    delete[] nrmsds;
+    delete[] drmsds;
+  }
+  if (err) {
+    Py_DECREF(py_values);
+    return PyErr_NoMemory();
   }
-// cout << "START5" << endl << flush;
-  delete[] xyzn;
-// cout << "START5" << endl << flush;
-  Py_DECREF(py_xs);
-// cout << "START5" << endl << flush;
-  Py_DECREF(py_ys);
-  Py_DECREF(py_zs);
-  Py_DECREF(py_models);
-  Py_CLEAR(py_xs);
-  Py_CLEAR(py_ys);
-  Py_CLEAR(py_zs);
-  Py_CLEAR(py_models);
-  
+
   // give it to me
-  return py_result;
+  if (one){
+    PyObject *py_drms = PyFloat_FromDouble(values[0]);
+    Py_DECREF(py_values);
+    return py_drms;
+  }
+  PyObject *py_names = PyList_New(nmodels);
+  for (j=0; j<nmodels; j++){
+    PyObject *py_name = PyList_GET_ITEM(py_models, j);
+    Py_INCREF(py_name);
+    PyList_SET_ITEM(py_names, j, py_name);
+  }
+  return Py_BuildValue("(NN)", py_values, py_names);
 }
  
 static PyMethodDef Eqv_rms_drmsMethods[] =
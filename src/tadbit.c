@@ -1,14 +1,19 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "tadbit.h"
 #include <stdint.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Global variables. //
 
-int *_cache_index;
-int _max_cache_index;
-int n_processed;              // Number of slices processed so far.
-int n_to_process;             // Total number of slices to process.
-int taskQ_i;                  // Index used for task queue.
-pthread_mutex_t tadbit_lock;  // Mutex to access task queue.
+// The state of the task queues is in the worker arguments, so
+// independent runs of 'tadbit' can happen concurrently (only the
+// lookup table of 'fastlog' is shared, and it is read-only once
+// initialized).
 
 #ifndef M_LN2
 #define M_LN2 0.69314718055994530942
@@ -22,7 +27,6 @@ typedef union
     int64_t  si;
 } fi_t;
 
-static const uint64_t fastlog_exp_mask = 0x7ff0000000000000;
 static const uint64_t fastlog_man_mask = 0x000fffffffffffff;
 
 
@@ -30,12 +34,23 @@ double* fastlog_lookup  = NULL;
 uint64_t fastlog_man_offset = 0;
 
 
+static pthread_mutex_t fastlog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
 void fastlog_init(int prec)
 {
     if (prec < 1 || prec > 52) {
         abort();
     }
 
+    // The table is shared by concurrent runs: it is built only once
+    // and never freed while in use.
+    pthread_mutex_lock(&fastlog_lock);
+    if (fastlog_lookup != NULL && fastlog_man_offset == 52 - prec) {
+        pthread_mutex_unlock(&fastlog_lock);
+        return;
+    }
+
     free(fastlog_lookup);
 
     uint64_t n = 1 << prec; // 2^prec
@@ -52,6 +67,7 @@ void fastlog_init(int prec)
         y.ui = ((uint64_t) 1023 << 52) | (x << fastlog_man_offset);
         fastlog_lookup[x] = log(y.f);
     }
+    pthread_mutex_unlock(&fastlog_lock);
 
 }
 
@@ -62,6 +78,39 @@ void fastlog_free()
 }
 
 
+// Log-gamma terms 'lgamma(c+1)' of the counts 'c' below
+// 'LGAMMA_TABLE_SIZE', for the runs that do not store them (see
+// 'tadbit_map_data'). Shared like the table of 'fastlog'.
+#define LGAMMA_TABLE_SIZE (1 << 16)
+double* lgamma_lookup = NULL;
+static pthread_mutex_t lgamma_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Side of the tiles of the symmetry check of 'tadbit_map_data'.
+#define SYM_TILE 64
+
+
+void lgamma_init()
+{
+    pthread_mutex_lock(&lgamma_lock);
+    if (lgamma_lookup == NULL) {
+        double *table = malloc(LGAMMA_TABLE_SIZE * sizeof(double));
+        if (table == NULL) {
+            abort();
+        }
+        int c;
+        for (c = 0 ; c < LGAMMA_TABLE_SIZE ; c++) table[c] = lgamma(c+1);
+        lgamma_lookup = table;
+    }
+    pthread_mutex_unlock(&lgamma_lock);
+}
+
+
+static inline double lgamma_count(const int c)
+{
+    return c >= 0 && c < LGAMMA_TABLE_SIZE ? lgamma_lookup[c] : lgamma(c+1);
+}
+
+
 double fastlog(double x)
 {
     fi_t y;
@@ -72,6 +121,127 @@ double fastlog(double x)
     return M_LN2 * (double) exp + fastlog_lookup[man];
 }
 
+
+// Placement of the worker threads. //
+
+int
+tadbit_cpu_count(void)
+{
+// SYNOPSIS:
+//   Number of CPUs available to the process: the CPUs of its affinity
+//   mask, limited by the CPU quota of its cgroup (v2 'cpu.max' or v1
+//   'cpu.cfs_quota_us', as mounted in containers), so that a job
+//   limited to 4 CPUs on a large node does not start one thread per
+//   CPU of the node.
+//
+// RETURN:
+//   The number of CPUs (at least 1).
+//
+
+   int n = 1;
+   #ifdef _SC_NPROCESSORS_ONLN
+      n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+   #endif
+
+   #ifdef __linux__
+   cpu_set_t set;
+   if (!sched_getaffinity(0, sizeof(cpu_set_t), &set)) n = CPU_COUNT(&set);
+
+   long quota = -1;
+   long period = 0;
+   char buf[32];
+   FILE *f = fopen("/sys/fs/cgroup/cpu.max", "r");
+   if (f != NULL) {
+      if (fscanf(f, "%31s %ld", buf, &period) == 2 && strcmp(buf, "max")) {
+         quota = atol(buf);
+      }
+      fclose(f);
+   }
+   else if ((f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r"))) {
+      if (fscanf(f, "%ld", &quota) != 1) quota = -1;
+      fclose(f);
+      f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+      if (f != NULL) {
+         if (fscanf(f, "%ld", &period) != 1) period = 0;
+         fclose(f);
+      }
+   }
+   if (quota > 0 && period > 0) {
+      const long q = (quota + period - 1) / period;
+      if (q < n) n = (int) q;
+   }
+   #endif
+
+   return n < 1 ? 1 : n;
+
+}
+
+
+static int
+pinned_workers(void)
+{
+// SYNOPSIS:
+//   Whether the workers are bound to CPUs (environment variable
+//   'TADBIT_PIN_THREADS' set to a non-zero value).
+//
+   const char *pin = getenv("TADBIT_PIN_THREADS");
+   return pin != NULL && atoi(pin) != 0;
+}
+
+
+int
+create_worker(
+  pthread_t *tid,
+  const int i,
+  const int n_workers,
+  void *(*fn)(void *),
+  void *arg
+){
+// SYNOPSIS:
+//   Start worker 'i' of a pool of 'n_workers' threads. If the workers
+//   are pinned (see 'pinned_workers'), worker 'i' is bound to the
+//   'i'-th share of the CPUs of the calling thread. Consecutive
+//   workers get consecutive CPUs, so with the usual numbering of the
+//   CPUs the workers of neighbouring bands (see 'init_llikmat') share
+//   a NUMA node, and nested pools (the windows of 'tadbit_stream')
+//   split the CPUs of their parent instead of competing for them.
+//
+// RETURN:
+//   The error code of 'pthread_create'.
+//
+
+   #ifdef __linux__
+   cpu_set_t parent;
+   if (pinned_workers() && !pthread_getaffinity_np(pthread_self(),
+            sizeof(cpu_set_t), &parent)) {
+      int cpus[CPU_SETSIZE];
+      int n_cpus = 0;
+      int c;
+      for (c = 0 ; c < CPU_SETSIZE ; c++) {
+         if (CPU_ISSET(c, &parent)) cpus[n_cpus++] = c;
+      }
+      // With more workers than CPUs, some workers share a CPU.
+      const int lo = BAND_START(i % n_workers, n_workers, n_cpus);
+      int hi = BAND_START(i % n_workers + 1, n_workers, n_cpus);
+      if (hi <= lo) hi = lo+1;
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (c = lo ; c < hi ; c++) CPU_SET(cpus[c], &set);
+
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
+      const int err = pthread_create(tid, &attr, fn, arg);
+      pthread_attr_destroy(&attr);
+      return err;
+   }
+   #endif
+
+   return pthread_create(tid, NULL, fn, arg);
+
+}
+
+
 // Convenience function to erase tadbit_output data structure //
 void
 destroy_tadbit_output(
@@ -87,260 +257,110 @@ destroy_tadbit_output(
    return;
 }
 
-
 void
-fg(
-  // input //
-  const int    n,
-  const int    i_,
-  const int    _i,
-  const int    j_,
-  const int    _j,
-  const int    diag,
-  const int    *k,
-  //const double *d,
-  const int    *dp,
-  const double *w,
-  const double a,
-  const double b,
-  const double da,
-  const double db,
-        double *c,
-  // output //
-        double *f,
-        double *g
-){
-// SYNOPSIS:                                                            
-//   Subroutine of 'll' that computes 'f' and 'g' for Newton-Raphson    
-//   cycles.                                                            
-//                                                                      
-// ARGUMENTS:                                                           
-//   See the function 'll' for the description of 'n', 'i_', '_i',      
-//      'j_', '_j', 'diag', 'k', 'dp', and 'w'.
-//   'a': parameter 'a' of the Poisson regression (see 'poiss_reg').    
-//   'b': parameter 'b' of the Poisson regression (see 'poiss_reg').    
-//   'da': computed differential of 'a' (see 'poiss_reg').              
-//   'db': computed differential of 'b' (see 'poiss_reg').              
-//        -- output arguments --                                        
-//   'f': first function to zero, recomputed by the routine.            
-//   'g': second function to zero, recomputed by the routine.           
-//   'c': address of an array of double for caching.                    
-//                                                                      
-// RETURN:                                                              
-//   'void'                                                             
-//                                                                      
-// SIDE-EFFECTS:                                                        
-//   Update 'f' and 'g' in place.                                       
-//                                                                      
-
-   // 'tmp' is a computation intermediate that will be the return
-   // value of 'exp'. This can call '__slowexp' which on 64-bit machines
-   // can return a long double (causing segmentation fault if 'tmp' is
-   // declared as long).
-   long double tmp;
-   int i;
-   int j;
-   int i_low = i_;
-   int i_high = -1;
-   int j_low = diag ? j_+1 : j_;
-   int j_high = _j+1;
-   int index;
-
-   *f = 0.0; *g = 0.0;
-   // Initialize cache.
-   for (index = 0 ; index < _max_cache_index ; index++) c[index] = NAN;
-
-   for (j = j_low ; j < j_high ; j++) {
-      i_high = diag ? j : _i+1;
-      for (i = i_low ; i < i_high ; i++) {
-         // Retrieve value of the exponential from cache.
-         index = _cache_index[i+j*n];
-         if (c[index] != c[index]) {
-            //c[index] = exp(a+da+(b+db)*d[i+j*n]);
-        	//c[index] = exp(a+da+(b+db)*log(abs(dp[i]-dp[j])));
-        	c[index] = exp(a+da+(b+db)*fastlog(abs(dp[i]-dp[j])));
-         }
-         //tmp  =  w[i+j*n] * c[index] - k[i+j*n];
-         tmp  =  w[i]*w[j] * c[index] - k[i+j*n];
-         *f  +=  tmp;
-         //*g  +=  tmp * d[i+j*n];
-         //*g  +=  tmp * log(abs(dp[i]-dp[j]));
-         *g  +=  tmp * fastlog(abs(dp[i]-dp[j]));
-      }
+destroy_tadbit_tree(
+   tadbit_tree *tree
+)
+{
+   if (tree->n_nodes > 0) {
+      free(tree->start);
+      free(tree->end);
+      free(tree->parent);
+      free(tree->level);
+      free(tree->score);
    }
+   free(tree);
 
    return;
-
 }
 
-double
-ll(
-  const int    n,
+
+static inline int
+max_dist(
+  const int    *dp,
   const int    i_,
   const int    _i,
   const int    j_,
-  const int    _j,
-  const int    diag,
-  const int    *k,
-  //const double *d,
-  const int    *dp,
-  const double *w,
-  const double *lg,
-        double *c
+  const int    _j
 ){
-// SYNOPSIS:                                                            
-//   The fitted model (by maximum likelihood) is Poisson with lambda    
-//   paramter such that lambda = w * exp(a + b*d). So the full          
-//   log-likelihood of the model is the sum of terms                    
-//                                                                      
-//      - w_i exp(a + b*d_i) + k_i(log(w_i) + a + b*d_i) - log(k_i!)    
-//                                                                      
-// ARGUMENTS:                                                           
-//   'n': row/column number of the counts.                              
-//   'i_': first value of index i (row).                                
-//   '_i': last value of index i (row).                                 
-//   'j_': first value of index j (column).                             
-//   '_j': last value of index j (column).                              
-//   'diag': whether the block is half-diagonal (middle block).         
-//   'k': raw hiC counts.                                               
-//   'dp': array with the index of columns that are not removed.
-//   'w': array of row and column (by symmetry) sums. Weights measuring hiC bias are w[i]*w[j]
-//   'lg': log-gamma terms.                                             
-//   'c': address of an array of double for caching.                    
-//                                                                      
-// RETURN:                                                              
-//   The maximum log-likelihood of a block of hiC data.                 
-//                                                                      
-
-   // For slices at the border of the hiC matrix, the top or bottom
-   // blocks have 0 height. Returning 0.0 makes the summation at
-   // the line labelled "slice ll summation" still valid.
-   if ((i_ >= _i) || (j_ >= _j)) return 0.0;
-   // For slices of length 2, the diagonal block has only 1 value,
-   // which creates an infinite loop (because there are two parameters
-   // to fit). Return NAN because estimation is impossible.
-   if ((_i < i_+2) || (_j < j_+2)) return NAN;
-
-   int i;
-   int j;
-   int i_low = i_;
-   int i_high = -1;
-   int j_low = diag ? j_+1 : j_;
-   int j_high = _j+1;
-   int index;
-   int iter = 0;
-   double denom;
-   double oldgrad;
-   double f = INFINITY;
-   double g = INFINITY;
-   double a = 0.0;
-   double b = 0.0;
-   double da = 0.0;
-   double db = 0.0;
-   double dfda = 0.0;
-   double dfdb = 0.0;
-   double dgda = 0.0;
-   double dgdb = 0.0;
-   // See the comment about 'tmp' in 'fg'.
-   long double tmp; 
-
-   fg(n, i_, _i, j_, _j, diag, k, dp, w, a, b, da, db, c, &f, &g);
-   //fg(n, i_, _i, j_, _j, diag, k, w, a, b, da, db, c, &f, &g);
-	  if((j_+_j*n)==40) {
-	          	 printf("lilmat");
-	           }
-   //printf("f:%f",f);
-      //printf("g:%f",g);
-
-   // Newton-Raphson until gradient function is less than TOLERANCE.
-   // The gradient function is the square norm 'f*f + g*g'.
-   while ((oldgrad = f*f + g*g) > TOLERANCE && iter++ < MAXITER) {
-
-      for (index = 0 ; index < _max_cache_index ; index++) c[index] = NAN;
-      // Compute the derivatives.
-      dfda = dfdb = dgda = dgdb = 0.0;
-
-      for (j = j_low ; j < j_high ; j++) {
-         i_high = diag ? j : _i+1;
-         for (i = i_low ; i < i_high ; i++) {
-            index = _cache_index[i+j*n];
-            // Retrieve value of the exponential from cache.
-            if (c[index] != c[index]) { // ERROR.
-               //c[index] = exp(a+b*d[i+j*n]);
-               //c[index] = exp(a+b*log(abs(dp[i]-dp[j])));
-            	c[index] = exp(a+b*fastlog(abs(dp[i]-dp[j])));
-            }
-            //tmp   =   w[i+j*n] * c[index];
-            tmp   =   w[i]*w[j] * c[index];
-            dfda +=   tmp;
-            //tmp  *=   d[i+j*n];
-            //tmp  *=   log(abs(dp[i]-dp[j]));
-            tmp  *=   fastlog(abs(dp[i]-dp[j]));
-            dgda +=   tmp;
-            //tmp  *=   d[i+j*n];
-            //tmp  *=   log(abs(dp[i]-dp[j]));
-            tmp  *=   fastlog(abs(dp[i]-dp[j]));
-            dgdb +=   tmp;
-         }
-      }
-      dfdb = dgda;
-
-      denom = dfdb*dgda - dfda*dgdb;
-      da = (f*dgdb - g*dfdb) / denom;
-      db = (g*dfda - f*dgda) / denom;
-
-      fg(n, i_, _i, j_, _j, diag, k, dp, w, a, b, da, db, c, &f, &g);
-      //fg(n, i_, _i, j_, _j, diag, k, w, a, b, da, db, c, &f, &g);
-
-      // Traceback if we are not going down the gradient. Cut the
-      // length of the steps in half until this step goes down
-      // the gradient.
-      for (i = 0 ; (i < 20) && (f*f + g*g > oldgrad) ; i++) {
-         da /= 2;
-         db /= 2;
-         fg(n, i_, _i, j_, _j, diag, k, dp, w, a, b, da, db, c, &f, &g);
-         //fg(n, i_, _i, j_, _j, diag, k, w, a, b, da, db, c, &f, &g);
-      }
-
-      // Update 'a' and 'b'.
-      a += da;
-      b += db;
-
-   }
-
-   if (iter >= MAXITER) {
-      // Something probably went wrong. Return NAN.
-      return NAN;
-   }
-
-   // Compute log-likelihood (using 'dfda').
-   double llik = 0.0;
-
-   // The last call to 'fg' has set the cache to the right values.
-   // No need to reset the cache.
-   for (j = j_low ; j < j_high ; j++) {
-      i_high = diag ? j : _i+1;
-      for (i = i_low ; i < i_high ; i++) {
-         index = _cache_index[i+j*n];
-         // Retrieve value of the exponential from cache.
-         //llik += c[index] + k[i+j*n]*(a+b*d[i+j*n]) - lg[i+j*n];
-         //llik += c[index] + k[i+j*n]*(a+b*log(abs(dp[i]-dp[j]))) - lg[i+j*n];
-         llik += c[index] + k[i+j*n]*(a+b*fastlog(abs(dp[i]-dp[j]))) - lg[i+j*n];
-
-      }
-   }
+// SYNOPSIS:
+//   Largest distance (in bins of the original matrix) between a row
+//   and a column of a block. Used to size the cache of 'll' and 'fg'.
+//
+   const int d1 = abs(dp[_j]-dp[i_]);
+   const int d2 = abs(dp[_i]-dp[j_]);
+   return d1 > d2 ? d1 : d2;
+}
 
-   return llik;
+// Slice log-likelihood, instantiated once per bias model and layout
+// of the counts (see 'tadbit_llik.h'). 'fg' and 'll' use the product
+// of the bias vectors, 'fg_nobias' and 'll_nobias' ignore them. The
+// '_mapped' instances read the input matrices in place (see
+// 'tadbit_map_data'): 'n' is then their row/column number, the
+// rows/columns are mapped by 'dp' and 'lg' is not used.
+#define OBS(k, i, j) (k)[(i)+(j)*n]
+#define LGAMMA(lg, k, i, j) (lg)[(i)+(j)*n]
+
+#define LLIK_NAME(f) f
+#define BIAS(w, i, j) ((w)[i]*(w)[j])
+#include "tadbit_llik.h"
+#undef LLIK_NAME
+#undef BIAS
+
+#define LLIK_NAME(f) f##_nobias
+#define BIAS(w, i, j) 1.0
+#include "tadbit_llik.h"
+#undef LLIK_NAME
+#undef BIAS
+
+#undef OBS
+#undef LGAMMA
+#define OBS(k, i, j) (k)[dp[i]+(size_t) dp[j]*n]
+#define LGAMMA(lg, k, i, j) lgamma_count(OBS(k, i, j))
+
+#define LLIK_NAME(f) f##_mapped
+#define BIAS(w, i, j) ((w)[i]*(w)[j])
+#include "tadbit_llik.h"
+#undef LLIK_NAME
+#undef BIAS
+
+#define LLIK_NAME(f) f##_mapped_nobias
+#define BIAS(w, i, j) 1.0
+#include "tadbit_llik.h"
+#undef LLIK_NAME
+#undef BIAS
+
+#undef OBS
+#undef LGAMMA
 
+int
+cmp_bound(
+  const void *a,
+  const void *b
+){
+// SYNOPSIS:
+//   Sort 'dp_bound' by decreasing bound.
+//
+   const double x = ((const dp_bound *) a)->bound;
+   const double y = ((const dp_bound *) b)->bound;
+   return (x < y) - (x > y);
 }
 
+
 void *
 fill_DP(
   void *arg
 ){
 // SYNOPSIS:                                                            
 //   Thread function to compute the values of the dynamic programming   
-//   'DPwalk' for a given number of breaks (value of 'nbreaks').        
+//   'DPupdate' for a given number of breaks (value of 'nbreaks').      
+//   In incremental mode, only the start points of the slices added    
+//   since the previous update and the start points that follow an end  
+//   of 'old_llik' that has changed are examined. Otherwise, if the     
+//   bounds 'blkmax' are given, the start points are visited by blocks  
+//   of decreasing bound and the blocks whose bound is below the best   
+//   value found are pruned (the result is the same because the sum of  
+//   the bounds is an upper bound of the candidates, even rounded).     
 //                                                                      
 // PARAMETERS:                                                          
 //   'arg': arguments for a thread (see header file).                   
@@ -349,67 +369,143 @@ fill_DP(
 //   'void *'                                                           
 //                                                                      
 // SIDE-EFFECTS:                                                        
-//   Update 'old_llik', 'new_llik' and 'new_bkpt_list' in place.        
+//   Update 'new_llik', 'new_bkpt' and 'new_changed' in place.          
 //                                                                      
 
    dpworker_arg *myargs = (dpworker_arg *) arg;
    const int n = myargs->n;
    const double *llikmat = (const double *) myargs->llikmat;
-   double *old_llik = (double *) myargs->old_llik;
+   const double *old_llik = (const double *) myargs->old_llik;
    double *new_llik = (double *) myargs->new_llik;
+   int *new_bkpt = (int *) myargs->new_bkpt;
    const int nbreaks = myargs->nbreaks;
-   int *new_bkpt_list = (int *) myargs->new_bkpt_list;
-   const int *old_bkpt_list = (const int *) myargs->old_bkpt_list;
-
+   const int *changed = myargs->changed;
+   const int *added_start = myargs->added_start;
+   const int *added = myargs->added;
+   char *new_changed = myargs->new_changed;
+   const int nb = myargs->nb;
+   const double *blkmax = myargs->blkmax;
+   const double *oldmax = myargs->oldmax;
+   int *taskQ_i = myargs->taskQ_i;
+   pthread_mutex_t *lock = myargs->lock;
+
+   int b;
    int i;
+   int p;
+
+   dp_bound *order = blkmax && !myargs->incremental ?
+      (dp_bound *) malloc(nb * sizeof(dp_bound)) : NULL;
 
    while (1) {
-      pthread_mutex_lock(&tadbit_lock);
-      if (taskQ_i > n-1) {
+      pthread_mutex_lock(lock);
+      if (*taskQ_i > n-1) {
          // Task queue is empty. Exit loop and return
-         pthread_mutex_unlock(&tadbit_lock);
+         pthread_mutex_unlock(lock);
          break;
       }
       // A task gives an end point 'j'.
-      int j = taskQ_i;
-      taskQ_i++;
-      pthread_mutex_unlock(&tadbit_lock);
-
-      new_llik[j] = -INFINITY;
-      int new_bkpt = -1;
+      int j = *taskQ_i;
+      (*taskQ_i)++;
+      pthread_mutex_unlock(lock);
+
+      if (order != NULL) {
+         // Start points 'i' from 'lo' to 'hi'.
+         const int lo = 3 * nbreaks;
+         const int hi = j-4;
+         int nc = 0;
+         for (b = lo / DP_BLOCK ; hi >= lo && b <= hi / DP_BLOCK ; b++) {
+            const double bound = oldmax[b] + blkmax[b+j*nb];
+            // No candidate of the block is defined if it is -INFINITY.
+            if (bound > -INFINITY) {
+               order[nc].bound = bound;
+               order[nc++].block = b;
+            }
+         }
+         qsort(order, nc, sizeof(dp_bound), cmp_bound);
+
+         double best = -INFINITY;
+         int bkpt = -1;
+         for (p = 0 ; p < nc && !(order[p].bound < best) ; p++) {
+            const int i0 = order[p].block * DP_BLOCK;
+            const int i1 = i0 + DP_BLOCK - 1;
+            // The blocks are not visited in order, so ties go to the
+            // first start point explicitly.
+            for (i = i0 < lo ? lo : i0 ; i <= i1 && i <= hi ; i++) {
+               double tmp = old_llik[i-1] + llikmat[i+j*n];
+               if (tmp > best || (tmp == best && i-1 < bkpt)) {
+                  best = tmp;
+                  bkpt = i-1;
+               }
+            }
+         }
+         new_llik[j] = best;
+         new_bkpt[j] = bkpt;
+         new_changed[j] = 1;
+         continue;
+      }
 
-      // Cycle over start point 'i'.
-      for (i = 3 * nbreaks ; i < j-3 ; i++) {
+      if (!myargs->incremental) {
+         double best = -INFINITY;
+         int bkpt = -1;
+         // Cycle over start point 'i'.
+         for (i = 3 * nbreaks ; i < j-3 ; i++) {
+            // If NAN the following condition evaluates to false.
+            double tmp = old_llik[i-1] + llikmat[i+j*n];
+            if (tmp > best) {
+               best = tmp;
+               bkpt = i-1;
+            }
+         }
+         // No need to use mutex because 'j' is different for every thread.
+         new_llik[j] = best;
+         new_bkpt[j] = bkpt;
+         new_changed[j] = 1;
+         continue;
+      }
 
-         // If NAN the following condition evaluates to false.
+      // The slices are only added, so the new optimum is the maximum
+      // of the previous one and of the new candidates. Ties go to the
+      // first start point as in the full computation.
+      double best = new_llik[j];
+      int bkpt = new_bkpt[j];
+      for (p = added_start[j] ; p < added_start[j+1] ; p++) {
+         i = added[p];
+         if (i < 3 * nbreaks || i > j-4) continue;
          double tmp = old_llik[i-1] + llikmat[i+j*n];
-         if (tmp > new_llik[j]) {
-            new_llik[j] = tmp;
-            new_bkpt = i-1;
+         if (tmp > best || (tmp == best && i-1 < bkpt)) {
+            best = tmp;
+            bkpt = i-1;
          }
       }
-
-      // Update breakpoint list (skip if log-lik is undefined).
-      // No need to use mutex because 'j' is different for every thread.
-      if (new_llik[j] > -INFINITY) {
-         for (i = 0 ; i < n ; i++) {
-            new_bkpt_list[j+i*n] = old_bkpt_list[new_bkpt+i*n];
+      for (p = 0 ; p < myargs->n_changed ; p++) {
+         i = changed[p]+1;
+         if (i < 3 * nbreaks) continue;
+         if (i > j-4) break;
+         double tmp = old_llik[i-1] + llikmat[i+j*n];
+         if (tmp > best || (tmp == best && i-1 < bkpt)) {
+            best = tmp;
+            bkpt = i-1;
          }
-         new_bkpt_list[j+new_bkpt*n] = 1;
       }
+      new_changed[j] = best != new_llik[j];
+      new_llik[j] = best;
+      new_bkpt[j] = bkpt;
    }
 
+   free(order);
    return NULL;
 
 }
 
 void
-DPwalk(
+DPupdate(
   // input //
   const double *llikmat,
+  const char *skip,
   const int n,
   const int MAXBREAKS,
   int n_threads,
+  dp_table *table,
   // output //
   double *mllik,
   int *breakpoints
@@ -417,11 +513,19 @@ DPwalk(
 // SYNOPSIS:                                                            
 //   Dynamic programming algorithm to compute the most likely position  
 //   of breakpoints given a matrix of slice maximum log-likelihood.     
+//   The values of the previous call are kept in 'table'. If the only   
+//   change of 'llikmat' since then is the addition of the slices       
+//   marked 0 in 'skip', only the cells of the table that depend on     
+//   them are updated.                                                  
 //                                                                      
 // PARAMETERS:                                                          
 //   '*llikmat': matrix of maximum log-likelihood values.               
+//   '*skip': 0 for the slices added since the previous call, or NULL   
+//        to recompute the whole table.                                 
 //   'n': row/col number of 'llikmat'.                                  
 //   'MAXBREAKS': The maximum number of breakpoints.                    
+//   'table': dynamic programming table with at least 'MAXBREAKS'       
+//        lines ('nlayers' must be 0 on first call).                    
 //        -- output arguments --                                        
 //   '*mllik': maximum log-likelihood of the segmentations.             
 //   '*breakpoints': optimal breakpoints per number of breaks.          
@@ -430,44 +534,81 @@ DPwalk(
 //   'void'                                                             
 //                                                                      
 // SIDE-EFFECTS:                                                        
-//   Update 'breakpoints' in place.                                     
+//   Update 'table', 'mllik' and 'breakpoints' in place.                
 //                                                                      
 
    int i;
+   int j;
    int nbreaks;
 
-   double new_llik[n];
-   double old_llik[n];
+   const int nvalid = skip ? table->nlayers : 0;
 
-   // Breakpoint lists. The first index (row) is the end of the slice,
-   // the second is 1 if this position is an end (breakpoint).
-   // These must be allocated from the heap because 'n' can be large.
-   int *new_bkpt_list = (int *) malloc(n*n * sizeof(int));
-   int *old_bkpt_list = (int *) malloc(n*n * sizeof(int));
+   // Ends whose log-likelihood has changed on the previous line.
+   char *old_changed = (char *) malloc(n * sizeof(char));
+   char *new_changed = (char *) malloc(n * sizeof(char));
+   int *changed = (int *) malloc(n * sizeof(int));
 
-   // Initializations.
    // 'breakpoints' is a 'n' x 'MAXBREAKS' array. The first index (row)
    // is 1 if there is a breakpoint at that location, the second index
    // (column) is the number of breakpoints.
    for (i = 0 ; i < n*MAXBREAKS ; i++) breakpoints[i] = 0;
-
-   for (i = 0 ; i < n*n ; i++) {
-      new_bkpt_list[i] = 0;
-      old_bkpt_list[i] = 0;
+   for (i = 0 ; i < MAXBREAKS ; i++) mllik[i] = NAN;
+
+   // Slices added since the previous call, compressed by column.
+   int *added_start = (int *) malloc((n+1) * sizeof(int));
+   int *added = NULL;
+   added_start[0] = 0;
+   for (j = 0 ; j < n ; j++) {
+      added_start[j+1] = added_start[j];
+      if (nvalid == 0) continue;
+      for (i = 0 ; i < j ; i++) {
+         if (!skip[i+j*n] && !isnan(llikmat[i+j*n])) added_start[j+1]++;
+      }
+   }
+   if (nvalid > 0) {
+      added = (int *) malloc((added_start[n]+1) * sizeof(int));
+      for (j = 0 ; j < n ; j++) {
+         int p = added_start[j];
+         for (i = 0 ; i < j ; i++) {
+            if (!skip[i+j*n] && !isnan(llikmat[i+j*n])) added[p++] = i;
+         }
+      }
    }
 
-   for (i = 0 ; i < MAXBREAKS ; i++) {
-      mllik[i] = NAN;
+   // The first line contains the log-likelihood of segments starting
+   // at index 0.
+   for (j = 0 ; j < n ; j++) {
+      double tmp = llikmat[j*n];
+      new_changed[j] = nvalid == 0 ||
+         (!isnan(tmp) && (isnan(table->llik[j]) || tmp != table->llik[j]));
+      table->llik[j] = tmp;
+      table->bkpt[j] = -1;
    }
 
-   // Initialize 'old_llik' to the first line of 'llikmat' containing
-   // the log-likelihood of segments starting at index 0.
-   for (i = 0 ; i < n ; i++) {
-      old_llik[i] = llikmat[i*n];
-      new_llik[i] = -INFINITY;
+   // Upper bounds of the slices of each column by block of start
+   // points, for the lines computed from scratch (see 'fill_DP'). They
+   // cost about as much as one line, so they are only computed if
+   // they serve at least two lines.
+   const int nb = (n + DP_BLOCK-1) / DP_BLOCK;
+   double *blkmax = NULL;
+   double *oldmax = NULL;
+   if (MAXBREAKS - (nvalid > 1 ? nvalid : 1) > 1) {
+      blkmax = (double *) malloc((size_t) nb*n * sizeof(double));
+      oldmax = (double *) malloc(nb * sizeof(double));
+      for (i = 0 ; i < nb*n ; i++) blkmax[i] = -INFINITY;
+      for (j = 0 ; j < n ; j++)
+      for (i = 0 ; i < j ; i++) {
+         // If NAN the following condition evaluates to false.
+         if (llikmat[i+j*n] > blkmax[i/DP_BLOCK+j*nb]) {
+            blkmax[i/DP_BLOCK+j*nb] = llikmat[i+j*n];
+         }
+      }
    }
 
-   int err = pthread_mutex_init(&tadbit_lock, NULL);
+   // Task queue.
+   int taskQ_i;
+   pthread_mutex_t lock;
+   int err = pthread_mutex_init(&lock, NULL);
    if (err) {
       fprintf(stderr, "error initializing mutex (%d)\n", err);
       return;
@@ -476,11 +617,15 @@ DPwalk(
    dpworker_arg arg = {
       .n = n,
       .llikmat = llikmat,
-      .old_llik = old_llik,
-      .new_llik = new_llik,
-      .nbreaks = 1,
-      .new_bkpt_list = new_bkpt_list,
-      .old_bkpt_list = old_bkpt_list,
+      .nb = nb,
+      .blkmax = blkmax,
+      .oldmax = oldmax,
+      .changed = changed,
+      .added_start = added_start,
+      .added = added,
+      .new_changed = new_changed,
+      .taskQ_i = &taskQ_i,
+      .lock = &lock,
    };
 
    pthread_t *tid = (pthread_t *) malloc(n_threads * sizeof(pthread_t));
@@ -488,16 +633,47 @@ DPwalk(
    // Dynamic programming.
    for (nbreaks = 1 ; nbreaks < MAXBREAKS ; nbreaks++) {
 
-      arg.nbreaks = nbreaks;
-      // Update breakpoint lists.
-      for (i = 0 ; i < n*n ; i++) {
-         old_bkpt_list[i] = new_bkpt_list[i];
+      double *new_llik = table->llik + nbreaks*n;
+      int *new_bkpt = table->bkpt + nbreaks*n;
+
+      char *tmp = old_changed;
+      old_changed = new_changed;
+      new_changed = tmp;
+      arg.new_changed = new_changed;
+      arg.n_changed = 0;
+      for (i = 0 ; i < n ; i++) {
+         if (old_changed[i]) changed[arg.n_changed++] = i;
+         new_changed[i] = 0;
+      }
+
+      // End points that cannot be reached with 'nbreaks' breaks keep
+      // the values of the previous line.
+      for (j = 0 ; j < 3 * nbreaks + 2 && j < n ; j++) {
+         new_llik[j] = new_llik[j-n];
+         new_bkpt[j] = -1;
+         new_changed[j] = old_changed[j];
       }
+
+      arg.old_llik = new_llik - n;
+      arg.new_llik = new_llik;
+      arg.new_bkpt = new_bkpt;
+      arg.nbreaks = nbreaks;
+      arg.incremental = nbreaks < nvalid;
       taskQ_i = 3 * nbreaks + 2;
 
+      if (blkmax != NULL && !arg.incremental) {
+         // Start point 'i' follows the end 'i-1' of the previous line.
+         for (i = 0 ; i < nb ; i++) oldmax[i] = -INFINITY;
+         for (i = 1 ; i < n ; i++) {
+            if (arg.old_llik[i-1] > oldmax[i/DP_BLOCK]) {
+               oldmax[i/DP_BLOCK] = arg.old_llik[i-1];
+            }
+         }
+      }
+
       for (i = 0 ; i < n_threads ; i++) tid[i] = 0;
       for (i = 0 ; i < n_threads ; i++) {
-         err = pthread_create(&(tid[i]), NULL, &fill_DP, &arg);
+         err = create_worker(&(tid[i]), i, n_threads, &fill_DP, &arg);
          if (err) {
             fprintf(stderr, "error creating thread (%d)\n", err);
             return;
@@ -512,126 +688,498 @@ DPwalk(
       // Update full log-likelihoods.
       mllik[nbreaks] = new_llik[n-1];
 
-      // Record breakpoints.
-      for (i = 0 ; i < n ; i++) {
-         old_llik[i] = new_llik[i];
-         breakpoints[i+nbreaks*n] = new_bkpt_list[n-1+i*n];
+      // Record breakpoints by walking back the table.
+      for (i = nbreaks, j = n-1 ; i > 0 ; i--) {
+         int prev = table->bkpt[j+i*n];
+         if (prev < 0) continue;
+         breakpoints[prev+nbreaks*n] = 1;
+         j = prev;
       }
 
    }
 
+   // The lines beyond 'MAXBREAKS' are not up to date anymore.
+   table->nlayers = MAXBREAKS;
+
+   pthread_mutex_destroy(&lock);
    free(tid);
-   free(new_bkpt_list);
-   free(old_bkpt_list);
+   free(added_start);
+   free(added);
+   free(old_changed);
+   free(new_changed);
+   free(changed);
+   free(blkmax);
+   free(oldmax);
 
    return;
 
 }
 
-void *
-fill_llikmat(
-   void *arg
+void
+DPwalk(
+  // input //
+  const double *llikmat,
+  const int n,
+  const int MAXBREAKS,
+  int n_threads,
+  // output //
+  double *mllik,
+  int *breakpoints
 ){
 // SYNOPSIS:                                                            
-//   Compute the log-likelihood of the slices. The element (i,j) of     
-//   the matrix 'llikmat' will contain the log-likelihood  of the       
-//   slice starting at i and ending at j. the matrix is initialized     
-//   with nan because not all elements will be computed. The lower      
-//   triangular part is left out.                                       
+//   Dynamic programming algorithm to compute the most likely position  
+//   of breakpoints given a matrix of slice maximum log-likelihood      
+//   (single call to 'DPupdate' with a temporary table).                
 //                                                                      
 // PARAMETERS:                                                          
-//   'arg': thread arguments (see header file for definition).          
+//   '*llikmat': matrix of maximum log-likelihood values.               
+//   'n': row/col number of 'llikmat'.                                  
+//   'MAXBREAKS': The maximum number of breakpoints.                    
+//        -- output arguments --                                        
+//   '*mllik': maximum log-likelihood of the segmentations.             
+//   '*breakpoints': optimal breakpoints per number of breaks.          
 //                                                                      
 // RETURN:                                                              
 //   'void'                                                             
 //                                                                      
 // SIDE-EFFECTS:                                                        
-//   Update 'llikmat' in place.                                         
+//   Update 'breakpoints' in place.                                     
 //                                                                      
 
-   llworker_arg *myargs = (llworker_arg *) arg;
-   const int n = myargs->n;
-   const int m = myargs->m;
-   const int **k = (const int **) myargs->k;
-   //const double *d = (const double*) myargs->d;
-   const int *dp = (const int*) myargs->dp;
-   const double **w = (const double **) myargs->w;
-   const double **lg= (const double **) myargs->lg;
-   const char *skip = (const char *) myargs->skip;
-   double *llikmat = myargs->llikmat;
-   const int verbose = myargs->verbose;
-
-   int i;
-   int j;
-   int l;
-
-   // Cache to speed up computation. Get the max of '_cache_index'
-   // in order to allocate the right size.
-   double *c= (double *) malloc(_max_cache_index * sizeof(double));
-   for (i = 0 ; i < _max_cache_index ; i++) c[i] = 0.0;
+   dp_table table = {
+      .n = n,
+      .nlayers = 0,
+      .llik = (double *) malloc(n*MAXBREAKS * sizeof(double)),
+      .bkpt = (int *) malloc(n*MAXBREAKS * sizeof(int)),
+   };
 
-   int job_index;
-   
-   // Break out of the loop when task queue is empty.
-   while (1) {
+   DPupdate(llikmat, NULL, n, MAXBREAKS, n_threads, &table, mllik,
+         breakpoints);
 
-      pthread_mutex_lock(&tadbit_lock);
-      while ((taskQ_i < n*n) && (skip[taskQ_i] > 0)) {
-         // Fast forward to the next job.
-         taskQ_i++;
-      }
-      if (taskQ_i >= n*n) {
-         // Task queue is empty. Exit loop and return
-         pthread_mutex_unlock(&tadbit_lock);
-         break;
-      }
-      job_index = taskQ_i;
-      taskQ_i++;
-      pthread_mutex_unlock(&tadbit_lock);
+   free(table.llik);
+   free(table.bkpt);
 
-      // Compute the log-likelihood of slice '(i,j)'.
-      i = job_index % n;
-      j = job_index / n;
+}
 
-      // Make sure that slices have minimum width 3.
-      int cornered = (i == 1) || (i == 2) || (j == n-2) || (j == n-3);
-      int slice_too_thin = (j-i) < 2;
-      if (cornered || slice_too_thin) continue;
+void *
+fill_suffix(
+  void *arg
+){
+// SYNOPSIS:                                                            
+//   Thread function to compute the backward pass of 'DPconfidence',    
+//   i.e. the maximum log-likelihood of TADs 'layer' to 'nTADs'-1       
+//   given that TAD 'layer' starts at a given position.                 
+//                                                                      
+// PARAMETERS:                                                          
+//   'arg': arguments for a thread (see header file).                   
+//                                                                      
+// RETURN:                                                              
+//   'void *'                                                           
+//                                                                      
+// SIDE-EFFECTS:                                                        
+//   Update line 'layer' of 'suffix' in place.                          
+//                                                                      
 
-      // Distinct parts of the array, no lock needed.
-      llikmat[i+j*n] = 0.0;
-      for (l = 0 ; l < m ; l++) {
-         // LABEL: slice ll summation.
-         llikmat[i+j*n] +=
-            ll(n,   0, i-1, i, j, 0, k[l], dp, w[l], lg[l], c) / 2 +
-        	ll(n,   i,   j, i, j, 1, k[l], dp, w[l], lg[l], c) +
-        	ll(n, j+1, n-1, i, j, 0, k[l], dp, w[l], lg[l], c) / 2;
-            //ll(n,   0, i-1, i, j, 0, k[l], d, w[l], lg[l], c) / 2 +
-            //ll(n,   i,   j, i, j, 1, k[l], d, w[l], lg[l], c) +
-            //ll(n, j+1, n-1, i, j, 0, k[l], d, w[l], lg[l], c) / 2;
+   cfworker_arg *myargs = (cfworker_arg *) arg;
+   const int n = myargs->n;
+   const double *llikmat = myargs->llikmat;
+   const int layer = myargs->layer;
+   const double *next = myargs->suffix + (layer+1)*(n+1);
+   double *line = myargs->suffix + layer*(n+1);
+   int *taskQ_i = myargs->taskQ_i;
+   pthread_mutex_t *lock = myargs->lock;
+
+   // The first TAD starts at 0 and has no minimum size, the others
+   // follow the constraints of 'fill_DP'.
+   const int last = layer ? n-1 : 0;
+   const int min_size = layer ? 4 : 0;
 
+   int j;
 
+   while (1) {
+      pthread_mutex_lock(lock);
+      if (*taskQ_i > last) {
+         pthread_mutex_unlock(lock);
+         break;
       }
+      // A task gives a start point 'i'.
+      int i = *taskQ_i;
+      (*taskQ_i)++;
+      pthread_mutex_unlock(lock);
 
-      n_processed++;
-      if (verbose) {
-         fprintf(stderr, "computing likelihood (%0.f%% done)\r",
-            99 * n_processed / (float) n_to_process);
+      double best = -INFINITY;
+      for (j = i + min_size ; j < n ; j++) {
+         // If NAN the following condition evaluates to false.
+         double tmp = llikmat[i+j*n] + next[j+1];
+         if (tmp > best) best = tmp;
       }
+      line[i] = best;
    }
 
-   free(c);
    return NULL;
 
 }
 
-void
-allocate_heur_job(
-  char *skip,
-  const int i0,
-  const int j0,
-  const int n
-){
+void *
+fill_confidence(
+  void *arg
+){
+// SYNOPSIS:                                                            
+//   Thread function to compute the forward pass of 'DPconfidence'.     
+//   For every end point 'j' of TAD 'layer', the best start point is    
+//   tracked as in 'fill_DP' and every position enclosed in the TAD     
+//   is scored with the best segmentation that does not break there.    
+//                                                                      
+// PARAMETERS:                                                          
+//   'arg': arguments for a thread (see header file).                   
+//                                                                      
+// RETURN:                                                              
+//   'void *'                                                           
+//                                                                      
+// SIDE-EFFECTS:                                                        
+//   Update 'new_llik' and 'alt_llik' in place.                         
+//                                                                      
+
+   cfworker_arg *myargs = (cfworker_arg *) arg;
+   const int n = myargs->n;
+   const double *llikmat = myargs->llikmat;
+   const int layer = myargs->layer;
+   const double *next = myargs->suffix + (layer+1)*(n+1);
+   const double *old_llik = myargs->old_llik;
+   double *new_llik = myargs->new_llik;
+   int *taskQ_i = myargs->taskQ_i;
+   pthread_mutex_t *lock = myargs->lock;
+
+   int i;
+   int b;
+
+   // Thread-local copy of 'alt_llik' merged at the end.
+   double *alt_llik = (double *) malloc(n * sizeof(double));
+   for (i = 0 ; i < n ; i++) alt_llik[i] = -INFINITY;
+
+   while (1) {
+      pthread_mutex_lock(lock);
+      if (*taskQ_i > n-1) {
+         pthread_mutex_unlock(lock);
+         break;
+      }
+      // A task gives an end point 'j'.
+      int j = *taskQ_i;
+      (*taskQ_i)++;
+      pthread_mutex_unlock(lock);
+
+      const double suffix = next[j+1];
+
+      if (layer == 0) {
+         new_llik[j] = llikmat[j*n];
+         double tmp = new_llik[j] + suffix;
+         if (tmp > -INFINITY) {
+            for (b = 0 ; b < j ; b++) {
+               if (tmp > alt_llik[b]) alt_llik[b] = tmp;
+            }
+         }
+         continue;
+      }
+
+      // Running maximum over start points 'i' <= 'b'.
+      double best = -INFINITY;
+      for (i = 3 * layer ; i < j-3 ; i++) {
+         // If NAN the following condition evaluates to false.
+         double tmp = old_llik[i-1] + llikmat[i+j*n];
+         if (tmp > best) best = tmp;
+         if (best + suffix > alt_llik[i]) alt_llik[i] = best + suffix;
+      }
+      new_llik[j] = best;
+      for (b = j-3 > 3*layer ? j-3 : 3*layer ; b < j ; b++) {
+         if (best + suffix > alt_llik[b]) alt_llik[b] = best + suffix;
+      }
+   }
+
+   pthread_mutex_lock(lock);
+   for (i = 0 ; i < n ; i++) {
+      if (alt_llik[i] > myargs->alt_llik[i])
+         myargs->alt_llik[i] = alt_llik[i];
+   }
+   pthread_mutex_unlock(lock);
+
+   free(alt_llik);
+   return NULL;
+
+}
+
+double
+DPconfidence(
+  // input //
+  const double *llikmat,
+  const int n,
+  const int nbreaks,
+  int n_threads,
+  // output //
+  double *alt_llik
+){
+// SYNOPSIS:                                                            
+//   Dynamic programming algorithm to compute, for every position, the  
+//   maximum log-likelihood of the segmentations with 'nbreaks' breaks  
+//   that do not have a breakpoint at this position. A backward pass    
+//   computes the best log-likelihood of the last TADs from every       
+//   start point, and a forward pass identical to 'DPwalk' combines it  
+//   with the best first TADs around every TAD that encloses a given    
+//   position. The difference with the optimum is the log-likelihood    
+//   margin of the breakpoints of the optimal segmentation.             
+//                                                                      
+// PARAMETERS:                                                          
+//   '*llikmat': matrix of maximum log-likelihood values.               
+//   'n': row/col number of 'llikmat'.                                  
+//   'nbreaks': The number of breakpoints of the segmentations.         
+//        -- output arguments --                                        
+//   '*alt_llik': best log-likelihood without breakpoint per position.  
+//                                                                      
+// RETURN:                                                              
+//   The maximum log-likelihood of the segmentations with 'nbreaks'     
+//   breakpoints ('-INFINITY' if there is none).                        
+//                                                                      
+// SIDE-EFFECTS:                                                        
+//   Update 'alt_llik' in place.                                        
+//                                                                      
+
+   int i;
+   int layer;
+   const int nTADs = nbreaks + 1;
+
+   for (i = 0 ; i < n ; i++) alt_llik[i] = -INFINITY;
+
+   // 'suffix' is a ('nTADs'+1) x ('n'+1) array. Line 'l' contains the
+   // best log-likelihood of TADs 'l' to 'nTADs'-1 when TAD 'l' starts
+   // at a given position. The sentinel line 'nTADs' is 0 at 'n'.
+   double *suffix = (double *) malloc((nTADs+1)*(n+1) * sizeof(double));
+   for (i = 0 ; i < (nTADs+1)*(n+1) ; i++) suffix[i] = -INFINITY;
+   suffix[nTADs*(n+1)+n] = 0.0;
+
+   double *old_llik = (double *) malloc(n * sizeof(double));
+   double *new_llik = (double *) malloc(n * sizeof(double));
+   for (i = 0 ; i < n ; i++) new_llik[i] = -INFINITY;
+
+   // Task queue.
+   int taskQ_i;
+   pthread_mutex_t lock;
+   int err = pthread_mutex_init(&lock, NULL);
+   if (err) {
+      fprintf(stderr, "error initializing mutex (%d)\n", err);
+      free(suffix);
+      free(old_llik);
+      free(new_llik);
+      return NAN;
+   }
+
+   cfworker_arg arg = {
+      .n = n,
+      .llikmat = llikmat,
+      .nTADs = nTADs,
+      .layer = 0,
+      .suffix = suffix,
+      .old_llik = old_llik,
+      .new_llik = new_llik,
+      .alt_llik = alt_llik,
+      .taskQ_i = &taskQ_i,
+      .lock = &lock,
+   };
+
+   pthread_t *tid = (pthread_t *) malloc(n_threads * sizeof(pthread_t));
+
+   // Backward pass.
+   for (layer = nTADs-1 ; layer >= 0 ; layer--) {
+      arg.layer = layer;
+      taskQ_i = 3 * layer;
+      for (i = 0 ; i < n_threads ; i++) {
+         err = create_worker(&(tid[i]), i, n_threads, &fill_suffix, &arg);
+         if (err) {
+            fprintf(stderr, "error creating thread (%d)\n", err);
+            return NAN;
+         }
+      }
+      for (i = 0 ; i < n_threads ; i++) pthread_join(tid[i], NULL);
+   }
+
+   // Forward pass. The last TAD must end at 'n'-1.
+   for (layer = 0 ; layer < nTADs ; layer++) {
+      arg.layer = layer;
+      for (i = 0 ; i < n ; i++) old_llik[i] = new_llik[i];
+      taskQ_i = layer == nTADs-1 ? n-1 : (layer ? 3 * layer + 2 : 0);
+      for (i = 0 ; i < n_threads ; i++) {
+         err = create_worker(&(tid[i]), i, n_threads, &fill_confidence, &arg);
+         if (err) {
+            fprintf(stderr, "error creating thread (%d)\n", err);
+            return NAN;
+         }
+      }
+      for (i = 0 ; i < n_threads ; i++) pthread_join(tid[i], NULL);
+   }
+
+   double mllik = suffix[0];
+
+   pthread_mutex_destroy(&lock);
+   free(tid);
+   free(suffix);
+   free(old_llik);
+   free(new_llik);
+
+   return mllik;
+
+}
+
+void *
+fill_llikmat(
+   void *arg
+){
+// SYNOPSIS:                                                            
+//   Compute the log-likelihood of the slices. The element (i,j) of     
+//   the matrix 'llikmat' will contain the log-likelihood  of the       
+//   slice starting at i and ending at j. the matrix is initialized     
+//   with nan because not all elements will be computed. The lower      
+//   triangular part is left out. If 'first' and 'size' do not cover    
+//   the whole matrix, the slices are those of the sub-matrix (window)  
+//   and 'llikmat' has the dimension of the window. The flanking        
+//   blocks of the slices span the rows 'flank_first' to 'flank_last'.  
+//                                                                      
+// PARAMETERS:                                                          
+//   'arg': thread arguments (see header file for definition).          
+//                                                                      
+// RETURN:                                                              
+//   'void'                                                             
+//                                                                      
+// SIDE-EFFECTS:                                                        
+//   Update 'llikmat' in place.                                         
+//                                                                      
+
+   llworker_arg *myargs = (llworker_arg *) arg;
+   const int n = myargs->n;
+   const int m = myargs->m;
+   const int **k = (const int **) myargs->k;
+   //const double *d = (const double*) myargs->d;
+   const int *dp = (const int*) myargs->dp;
+   const double **w = (const double **) myargs->w;
+   const double **lg= (const double **) myargs->lg;
+   // Instance of 'll' for the bias model and the layout of the counts
+   // (see 'tadbit_llik.h').
+   const int nobias = myargs->bias_model == TADBIT_BIAS_NONE;
+   double (*llik)(const int, const int, const int, const int, const int,
+         const int, const int *, const int *, const double *,
+         const double *, double *) = myargs->N ?
+      (nobias ? ll_mapped_nobias : ll_mapped) : (nobias ? ll_nobias : ll);
+   const int nk = myargs->N ? myargs->N : n;
+   const int first = myargs->first;
+   const int size = myargs->size;
+   const int flank_first = myargs->flank_first;
+   const int flank_last = myargs->flank_last;
+   const char *skip = (const char *) myargs->skip;
+   double *llikmat = myargs->llikmat;
+   double *trimat = myargs->trimat;
+   const int verbose = myargs->verbose;
+   const int id = myargs->id;
+   const int n_bands = myargs->n_bands;
+   int *band_next = myargs->band_next;
+   const int *band_end = myargs->band_end;
+   int *n_processed = myargs->n_processed;
+   const int n_to_process = myargs->n_to_process;
+   pthread_mutex_t *lock = myargs->lock;
+
+   int b;
+   int i;
+   int j;
+   int l;
+
+   // Cache to speed up computation. The cache is indexed by the
+   // distance between the bins, so it has the span of the matrix.
+   const int cache_size = dp[n-1]-dp[0]+1;
+   double *c= (double *) malloc(cache_size * sizeof(double));
+   for (i = 0 ; i < cache_size ; i++) c[i] = 0.0;
+
+   int job_index;
+   
+   // Break out of the loop when task queue is empty.
+   while (1) {
+
+      // Take the next job of the band of the worker, whose part of
+      // 'llikmat' was first touched on the same CPUs (see
+      // 'init_llikmat'), then of the next bands once it is done.
+      job_index = -1;
+      pthread_mutex_lock(lock);
+      for (b = 0 ; b < n_bands && job_index < 0 ; b++) {
+         const int band = (id+b) % n_bands;
+         while ((band_next[band] < band_end[band]) &&
+                (skip[band_next[band]] > 0)) {
+            // Fast forward to the next job.
+            band_next[band]++;
+         }
+         if (band_next[band] < band_end[band]) {
+            job_index = band_next[band]++;
+         }
+      }
+      pthread_mutex_unlock(lock);
+      // Task queue is empty. Exit loop and return
+      if (job_index < 0) break;
+
+      // Compute the log-likelihood of slice '(i,j)' of the window.
+      i = first + job_index % size;
+      j = first + job_index / size;
+
+      // Make sure that slices have minimum width 3.
+      int cornered = (i == flank_first+1) || (i == flank_first+2) ||
+                     (j == flank_last-1) || (j == flank_last-2);
+      int slice_too_thin = (j-i) < 2;
+      if (cornered || slice_too_thin) continue;
+
+      // The triangle does not depend on the window, so it is computed
+      // only once if 'trimat' is kept.
+      double tri = trimat ? trimat[i+j*n] : NAN;
+      const int new_tri = isnan(tri);
+
+      // Distinct parts of the array, no lock needed.
+      llikmat[job_index] = 0.0;
+      if (new_tri) tri = 0.0;
+      for (l = 0 ; l < m ; l++) {
+         const double *wl = w ? w[l] : NULL;
+         const double *lgl = lg ? lg[l] : NULL;
+         const double top =
+            llik(nk, flank_first, i-1, i, j, 0, k[l], dp, wl, lgl, c) / 2;
+         const double bottom =
+            llik(nk, j+1, flank_last, i, j, 0, k[l], dp, wl, lgl, c) / 2;
+         if (!new_tri) {
+            llikmat[job_index] += top + bottom;
+            continue;
+         }
+         const double tri_l = llik(nk, i, j, i, j, 1, k[l], dp, wl, lgl, c);
+         tri += tri_l;
+         // LABEL: slice ll summation.
+         llikmat[job_index] += top + tri_l + bottom;
+            //ll(n,   0, i-1, i, j, 0, k[l], d, w[l], lg[l], c) / 2 +
+            //ll(n,   i,   j, i, j, 1, k[l], d, w[l], lg[l], c) +
+            //ll(n, j+1, n-1, i, j, 0, k[l], d, w[l], lg[l], c) / 2;
+      }
+      if (!new_tri) llikmat[job_index] += tri;
+      else if (trimat) trimat[i+j*n] = tri;
+
+      if (verbose) {
+         pthread_mutex_lock(lock);
+         (*n_processed)++;
+         fprintf(stderr, "computing likelihood (%0.f%% done)\r",
+            99 * *n_processed / (float) n_to_process);
+         pthread_mutex_unlock(lock);
+      }
+   }
+
+   free(c);
+   return NULL;
+
+}
+
+void
+allocate_heur_job(
+  char *skip,
+  const int i0,
+  const int j0,
+  const int n
+){
 // SYNOPSIS:                                                            
 //   Create or update thread jobs (used in pre-heuristic).
 //                                                                      
@@ -783,36 +1331,37 @@ enforce_symmetry
 }
 
 
-void
-tadbit
+int
+tadbit_prepare_data
 (
   // input //
   int **obs,
   char *remove,
   int n,
   const int m,
-  int n_threads,
-  const int verbose,
-  int max_tad_size,
-  const int nbrks,
-  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
   // output //
-  tadbit_output *seg
+  tadbit_state *st
 )
-// TODO: write synopsis.
+// SYNOPSIS:
+//   Remove the filtered rows/columns from the observations, compute
+//   the bias vectors of the model and the log-gamma terms and allocate
+//   the output of the run. No slice job is allocated ('skip' is set
+//   to 1) and 'llikmat' must be initialized with 'init_llikmat'.
+//
+// ARGUMENTS:
+//   See 'tadbit_bias' for the description of the input arguments.
+//        -- output arguments --
+//   'st': state of the run, allocated and filled by the routine.
+//
+// RETURN:
+//   0 on success, -1 if there are too few rows/columns after removal
+//   (in which case 'st' is not allocated).
+//
 {
 
-   // Get thread number if set to 0 (max).
-   if (n_threads < 1) {
-      #ifdef _SC_NPROCESSORS_ONLN
-         n_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
-      #else
-         n_threads = 1;
-      #endif
-   }
-
    const int N = n;   // Original size.
-   int err;           // Used for error checking.
 
    int i;
    int j;
@@ -836,6 +1385,13 @@ tadbit
    /*    } */
    /* } */
 
+   // Rows/columns without a valid bias cannot be modelled.
+   if (bias_model == TADBIT_BIAS_VECTORS) {
+      for (k = 0 ; k < m ; k++)
+      for (i = 0 ; i < N ; i++)
+         if (!(bias[k][i] > 0)) remove[i] = 1;
+   }
+
    // Update the dimension. 'N' is the original row/column number,
    // 'n' is the row/column number after removing rows and columns
    // with 0 on the diagonal.
@@ -843,35 +1399,21 @@ tadbit
       n -= remove[i];
    }
 
-//   double *init_dist = (double *) malloc(N*N * sizeof(double));
-//
-//   for (l = 0, i = 0; i < N ; i++) {
-//   for (j = 0; j < N ; j++) {
-//      init_dist[l] = log(abs(i-j));
-//      l++;
-//   }
-//   }
    fastlog_init(16);
 
    // Exit if there are too few rows/columns after removal.
    if (n < 6) {
-      // Signal failure.
-      seg->maxbreaks = -1;
       // Clean before exit.
-      //free(init_dist);
       free(remove);
       // Bye-bye.
-      return;
+      return -1;
    }
 
    const int MAXBREAKS = n/5;
 
-   _cache_index = (int *) malloc(n*n * sizeof(int));
-   _max_cache_index = N+1;
    // Allocate and copy.
    double **log_gamma  = (double **) malloc(m * sizeof(double *));
    int    **new_obs    = (int **) malloc(m * sizeof(int *));
-   //double *dist = (double *) malloc(n*n * sizeof(double));
    int *dp = (int *) malloc(n * sizeof(int));
    for (k = 0 ; k < m ; k++) {
       l = i0 = 0;
@@ -884,351 +1426,2465 @@ tadbit
     	  }
 		  for (i = 0 ; i < N ; i++) {
 			 if (remove[i] || remove[j]) continue;
-			 _cache_index[l] = i > j ? i-j : j-i;
 			 log_gamma [k][l] = lgamma(obs[k][i+j*N]+1);
 			 new_obs[k][l]    = obs[k][i+j*N];
-			 //dist[l] = init_dist[i+j*N];
 			 l++;
 		  }
       }
    }
-   /* fprintf(stderr, "WEIGHTS FROM INSIDE ME "); */
-   /* for (i = 0; i < 50; i++) */
-   /*   fprintf(stderr, "%f ", weights[0][i]); */
-   /* fprintf(stderr, "\n"); */
 
    // We will not need the initial observations any more.
-   //free(init_dist);
    obs = new_obs;
 
    // Make sure the data is symmetric.
    enforce_symmetry(obs, n, m);
 
 
-   // Compute row/column sums (identical by symmetry).
-   double **rowsums = (double **) malloc(m * sizeof(double *));
-   for (k = 0 ; k < m ; k++) {
-      rowsums[k] = (double *) malloc(n * sizeof(double));
-      for (i = 0 ; i < n ; i++) rowsums[k][i] = 0.0;
+   // Bias vectors: row/column sums (identical by symmetry) or
+   // external biases compacted like the observations.
+   double **w = NULL;
+   if (bias_model != TADBIT_BIAS_NONE) {
+      w = (double **) malloc(m * sizeof(double *));
+      for (k = 0 ; k < m ; k++) {
+         w[k] = (double *) malloc(n * sizeof(double));
+         for (i = 0 ; i < n ; i++) w[k][i] = 0.0;
+      }
    }
 
-   for (k = 0 ; k < m ; k++)
-   for (i = 0 ; i < n ; i++)
-   for (j = 0 ; j < n ; j++)
-      rowsums[k][i] += obs[k][i+j*n];
-
-   // compute the weights.
-//   double **weights = (double **) malloc(m * sizeof(double *));
-//   for (k = 0 ; k < m ; k++) {
-//      weights[k] = (double *) malloc(n*n * sizeof(double));
-//      for (i = 0 ; i < n*n ; i++) weights[k][i] = 0.0;
-//      // Compute product.
-//      for (j = 0 ; j < n ; j++) {
-//      for (i = 0 ; i < n ; i++) {
-//         weights[k][i+j*n] = rowsums[k][i]*rowsums[k][j];
-//      }
-//      }
-//   }
-
-   // We don't need the row/column sums any more.
-   //for (l = 0 ; l < m ; l++) free(rowsums[l]);
-   //free(rowsums);
+   if (bias_model == TADBIT_BIAS_ROWSUMS) {
+      for (k = 0 ; k < m ; k++)
+      for (i = 0 ; i < n ; i++)
+      for (j = 0 ; j < n ; j++)
+         w[k][i] += obs[k][i+j*n];
+   }
+   else if (bias_model == TADBIT_BIAS_VECTORS) {
+      for (k = 0 ; k < m ; k++)
+      for (i = 0 ; i < n ; i++)
+         w[k][i] = bias[k][dp[i]];
+   }
 
    double *mllik = (double *) malloc(MAXBREAKS * sizeof(double));
    int *bkpts = (int *) malloc(MAXBREAKS*n * sizeof(int));
+   // Set to NAN by the workers (see 'init_llikmat').
    double *llikmat = (double *) malloc(n*n * sizeof(double));
-   for (i = 0 ; i < n*n ; i++)
-      llikmat[i] = NAN;
 
    // 'skip' will contain only 0 or 1 and can be stored as 'char'.
    char *skip = (char *) malloc(n*n * sizeof(char));
+   for (i = 0 ; i < n*n ; i++) skip[i] = 1;
+
+   st->N = N;
+   st->n = n;
+   st->m = m;
+   st->MAXBREAKS = MAXBREAKS;
+   st->remove = remove;
+   st->ld = n;
+   st->first = 0;
+   st->mapped = 0;
+   st->obs = obs;
+   st->log_gamma = log_gamma;
+   st->bias_model = bias_model;
+   st->bias = w;
+   st->dp = dp;
+   st->skip = skip;
+   st->llikmat = llikmat;
+   st->trimat = NULL;
+   st->mllik = mllik;
+   st->bkpts = bkpts;
+
+   return 0;
 
-   // Use the heuristic by default (hence the name of the parameter).
-   // The parameter 'max_tad_size' is needed only in case the heuristic
-   // is not used.
-   if (do_not_use_heuristic) {
-      for (j = 0 ; j < n ; j++)
-      for (i = 0 ; i < n ; i++)
-         // Also sets the lower triangular part of 'skip'.
-         skip[i+j*n] = (i >= j) || ((j-i) > max_tad_size) ? 1 : 0;
+}
+
+
+int
+tadbit_map_data
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  const int bias_model,
+  double **bias,
+  // output //
+  tadbit_state *st
+)
+// SYNOPSIS:
+//   Version of 'tadbit_prepare_data' that reads the matrices in place
+//   (e.g. mapped in memory with 'map_tadbit_matrix'). They are neither
+//   copied nor modified: the removed rows/columns are skipped through
+//   the index map 'dp' and the log-gamma terms are computed from the
+//   counts, so only the pages of the matrices that are read are loaded.
+//   Asymmetric matrices cannot be symmetrized in place, so they are
+//   compacted by 'tadbit_prepare_data' instead.
+//
+// ARGUMENTS:
+//   See 'tadbit_bias' for the description of the input arguments.
+//        -- output arguments --
+//   'st': state of the run, allocated and filled by the routine.
+//
+// RETURN:
+//   0 on success, -1 if there are too few rows/columns after removal
+//   (in which case 'st' is not allocated).
+//
+{
+
+   const int N = n;   // Original size.
+
+   int i;
+   int j;
+   int k;
+
+   // Rows/columns without a valid bias cannot be modelled.
+   if (bias_model == TADBIT_BIAS_VECTORS) {
+      for (k = 0 ; k < m ; k++)
+      for (i = 0 ; i < N ; i++)
+         if (!(bias[k][i] > 0)) remove[i] = 1;
    }
-   else {
-      if (verbose) {
-         fprintf(stderr, "running pre-heuristic\n");
-      }
-
-      for (i = 0 ; i < n*n ; i++) skip[i] = 1;
-
-      // 'S[i+j*n]' is the weighted sum of reads within the triangle
-      // defined by ('i','j') in the upper triangular matrix of
-      // observations.
-      double *S = (double *) malloc(n*n * sizeof(double));
-      for (i = 0 ; i < n*n ; i++) S[i] = 0.0;
-      for (j = 1 ; j < n ; j++) {
-      for (i = 0 ; i < n-j ; i++) {
-         double weighted_value = 0.0;
-         for (l = 0 ; l < m ; l++) {
-        	weighted_value += obs[l][i+(i+j)*n]/(rowsums[l][i]*rowsums[l][(i+j)]);
-            //weighted_value += obs[l][i+(i+j)*n]/weights[l][i+(i+j)*n];
-         }
-         S[i+(i+j)*n] = S[i+(i+j-1)*n] + S[i+1+(i+j)*n] -
-            S[i+1+(i+j-1)*n] + weighted_value;
-      }
-      }
-
-      double *heur_score = (double *) malloc(n*n * sizeof(double));
-      for (i = 0 ; i < n*n ; i++) heur_score[i] = NAN;
-      for (j = 1 ; j < n ; j++)
-      for (i = 0 ; i < j ; i++)
-    	  heur_score[i+j*n] = log(S[i+j*n]);
-
-      // Use dynamic programming to find approximate break points.
-      // The matrix 'mllik' is used only to make the function call valid
-      // (it is updated in place, but the value is disregarded), and
-      // the heuristic score 'heur_score' plays the role of the
-      // log-likelihood 'llikmat'.
-      DPwalk(heur_score, n, MAXBREAKS, n_threads, mllik, bkpts);
-
-      free(heur_score);
-      free(S);
-
-      // Create a thread job for each approximate TAD.
-      for (i = 0 ; i < n*n ; i++) skip[i] = 1;
-      for (j = 1 ; j < MAXBREAKS ; j++) {
-         i0 = 0;
-         for (i = 0 ; i < n ; i++) {
-            if (bkpts[i+j*n]) {
-               allocate_heur_job(skip, i0, i, n);
-               i0 = i+1;
+
+   // Only the rows/columns that are not removed must be symmetric.
+   // The check goes by tiles of 'SYM_TILE' x 'SYM_TILE' so that the
+   // element (i,j) and its transpose are both read in contiguous runs
+   // of the columns, instead of one page per element on the transposed
+   // side. The matrices are still read once in full.
+   int symmetric = 1;
+   int i0;
+   int j0;
+   for (k = 0 ; k < m && symmetric ; k++)
+   for (j0 = 0 ; j0 < N && symmetric ; j0 += SYM_TILE)
+   for (i0 = j0 ; i0 < N && symmetric ; i0 += SYM_TILE) {
+      const int jend = j0+SYM_TILE < N ? j0+SYM_TILE : N;
+      const int iend = i0+SYM_TILE < N ? i0+SYM_TILE : N;
+      for (j = j0 ; j < jend && symmetric ; j++) {
+         if (remove[j]) continue;
+         for (i = i0 > j+1 ? i0 : j+1 ; i < iend ; i++) {
+            if (!remove[i] &&
+                  obs[k][i+(size_t) j*N] != obs[k][j+(size_t) i*N]) {
+               symmetric = 0;
+               break;
             }
          }
       }
+   }
+   if (!symmetric) {
+      return tadbit_prepare_data(obs, remove, n, m, bias_model, bias, st);
+   }
 
-      // Erase the lower triangular part of 'skip'.
-      for (j = 0 ; j < n ; j++)
-      for (i = j ; i < n ; i++)
-         skip[i+j*n] = 1;
-
-      // Allocate estimation of the log likelihood for all small
-      // TADs (less than 3 bins).
-      for (j = 6 ; j < n ; j++)
-      for (i = j-6 ; i < j-3 ; i++)
-         skip[i+j*n] = 0;
+   for (i = 0 ; i < N ; i++) {
+      n -= remove[i];
+   }
 
-      // Allocate jobs at the ends of the chromosomes/units because
-      // these regions are a bit noisier.
-      for (j = 1 ; j < 51 ; j++)
-      for (i = 0 ; i < j-3 ; i++)
-         if (i < n && j < n) skip[i+j*n] = 0;
-      for (j = n-51 ; j < n ; j++)
-      for (i = n-51 ; i < j-3 ; i++)
-         if (i > 0 && j > 0) skip[i+j*n] = 0;
+   fastlog_init(16);
+   lgamma_init();
 
-      // Reset lower triangular part of 'skip'.
-      for (j = 0 ; j < n ; j++)
-      for (i = j ; i < n ; i++)
-         skip[i+j*n] = 1;
+   // Exit if there are too few rows/columns after removal.
+   if (n < 6) {
+      free(remove);
+      return -1;
+   }
 
-   } // End of pre-heuristic.
+   const int MAXBREAKS = n/5;
 
+   // Index map of the rows/columns that are not removed.
+   int *dp = (int *) malloc(n * sizeof(int));
+   for (i = 0, j = 0 ; j < N ; j++) {
+      if (!remove[j]) dp[i++] = j;
+   }
 
-   // Allocate 'tid'.
-   pthread_t *tid = (pthread_t *) malloc(n_threads * sizeof(pthread_t));
+   int **mapped_obs = (int **) malloc(m * sizeof(int *));
+   for (k = 0 ; k < m ; k++) mapped_obs[k] = obs[k];
+
+   // Bias vectors (see 'tadbit_prepare_data'). The row sums are
+   // accumulated column by column, in the same order.
+   double **w = NULL;
+   if (bias_model != TADBIT_BIAS_NONE) {
+      w = (double **) malloc(m * sizeof(double *));
+      for (k = 0 ; k < m ; k++) {
+         w[k] = (double *) malloc(n * sizeof(double));
+         for (i = 0 ; i < n ; i++) w[k][i] = 0.0;
+      }
+   }
 
-   llworker_arg arg = {
+   if (bias_model == TADBIT_BIAS_ROWSUMS) {
+      for (k = 0 ; k < m ; k++)
+      for (j = 0 ; j < n ; j++) {
+         const int *col = obs[k] + (size_t) dp[j]*N;
+         for (i = 0 ; i < n ; i++) w[k][i] += col[dp[i]];
+      }
+   }
+   else if (bias_model == TADBIT_BIAS_VECTORS) {
+      for (k = 0 ; k < m ; k++)
+      for (i = 0 ; i < n ; i++)
+         w[k][i] = bias[k][dp[i]];
+   }
+
+   double *mllik = (double *) malloc(MAXBREAKS * sizeof(double));
+   int *bkpts = (int *) malloc((size_t) MAXBREAKS*n * sizeof(int));
+   // Set to NAN by the workers (see 'init_llikmat').
+   double *llikmat = (double *) malloc((size_t) n*n * sizeof(double));
+
+   char *skip = (char *) malloc((size_t) n*n * sizeof(char));
+   size_t l;
+   for (l = 0 ; l < (size_t) n*n ; l++) skip[l] = 1;
+
+   st->N = N;
+   st->n = n;
+   st->m = m;
+   st->MAXBREAKS = MAXBREAKS;
+   st->remove = remove;
+   st->ld = n;
+   st->first = 0;
+   st->mapped = 1;
+   st->obs = mapped_obs;
+   st->log_gamma = NULL;
+   st->bias_model = bias_model;
+   st->bias = w;
+   st->dp = dp;
+   st->skip = skip;
+   st->llikmat = llikmat;
+   st->trimat = NULL;
+   st->mllik = mllik;
+   st->bkpts = bkpts;
+
+   return 0;
+
+}
+
+
+int
+tadbit_focus_data
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  const int bias_model,
+  double **bias,
+  const int start,
+  const int end,
+  // output //
+  tadbit_state *st
+)
+// SYNOPSIS:
+//   Version of 'tadbit_prepare_data' for the segmentation of the
+//   region 'start'-'end'. Only the columns of the region are copied
+//   (with all the rows, for the flanking blocks of the slices), so
+//   the matrices can be much larger than the region (or memory
+//   mapped). The bias vectors are those of the whole matrices.
+//
+// ARGUMENTS:
+//   See 'tadbit_focus' for the description of the input arguments.
+//        -- output arguments --
+//   'st': state of the run, allocated and filled by the routine. The
+//      run has the dimension of the region.
+//
+// RETURN:
+//   0 on success, -1 if there are too few rows/columns in the region
+//   after removal (in which case 'st' is not allocated).
+//
+{
+
+   const int N = n;   // Original size.
+
+   int i;
+   int j;
+   int k;
+
+   if (start < 0 || end >= N || end < start) {
+      free(remove);
+      return -1;
+   }
+
+   // Rows/columns without a valid bias cannot be modelled.
+   if (bias_model == TADBIT_BIAS_VECTORS) {
+      for (k = 0 ; k < m ; k++)
+      for (i = 0 ; i < N ; i++)
+         if (!(bias[k][i] > 0)) remove[i] = 1;
+   }
+
+   // 'ld' is the number of rows that are not removed, 'first' the
+   // index of the first of them in the region and 'n' the number of
+   // rows/columns of the region.
+   int ld = 0;
+   int first = 0;
+   for (n = 0, i = 0 ; i < N ; i++) {
+      if (remove[i]) continue;
+      if (i < start) first++;
+      else if (i <= end) n++;
+      ld++;
+   }
+
+   fastlog_init(16);
+
+   // Exit if there are too few rows/columns after removal.
+   if (n < 6) {
+      free(remove);
+      return -1;
+   }
+
+   const int MAXBREAKS = n/5;
+
+   int *dp = (int *) malloc(ld * sizeof(int));
+   for (j = 0, i = 0 ; i < N ; i++) {
+      if (!remove[i]) dp[j++] = i;
+   }
+
+   // Copy the columns of the region.
+   double **log_gamma  = (double **) malloc(m * sizeof(double *));
+   int    **new_obs    = (int **) malloc(m * sizeof(int *));
+   int symmetric = 1;
+   for (k = 0 ; k < m ; k++) {
+      log_gamma[k] = (double *) malloc((size_t) ld*n * sizeof(double));
+      new_obs[k] = (int *) malloc((size_t) ld*n * sizeof(int));
+      for (j = 0 ; j < n ; j++) {
+         const int *col = obs[k] + (size_t) dp[first+j]*N;
+         for (i = 0 ; i < ld ; i++) {
+            log_gamma[k][i+(size_t) j*ld] = lgamma(col[dp[i]]+1);
+            new_obs[k][i+(size_t) j*ld] = col[dp[i]];
+            if (col[dp[i]] != obs[k][dp[first+j]+(size_t) dp[i]*N]) {
+               symmetric = 0;
+            }
+         }
+      }
+   }
+
+   // Make sure the data is symmetric (see 'enforce_symmetry').
+   if (!symmetric) {
+      fprintf(stderr, "input matrix not symmetric: symmetrizing\n");
+      for (k = 0 ; k < m ; k++)
+      for (j = 0 ; j < n ; j++)
+      for (i = 0 ; i < ld ; i++) {
+         if (i == first+j) continue;
+         new_obs[k][i+(size_t) j*ld] += obs[k][dp[first+j]+(size_t) dp[i]*N];
+      }
+   }
+
+   // Bias vectors: row sums of the whole (symmetrized) matrices or
+   // external biases.
+   double **w = NULL;
+   if (bias_model != TADBIT_BIAS_NONE) {
+      w = (double **) malloc(m * sizeof(double *));
+      for (k = 0 ; k < m ; k++) {
+         w[k] = (double *) malloc(ld * sizeof(double));
+         for (i = 0 ; i < ld ; i++) w[k][i] = 0.0;
+      }
+   }
+
+   if (bias_model == TADBIT_BIAS_ROWSUMS) {
+      // Column by column to read the matrices in order. The sum of
+      // the symmetrized row 'i' is the sum of row and column 'i'
+      // minus the diagonal.
+      for (k = 0 ; k < m ; k++)
+      for (j = 0 ; j < ld ; j++) {
+         const int *col = obs[k] + (size_t) dp[j]*N;
+         for (i = 0 ; i < ld ; i++) {
+            w[k][i] += col[dp[i]];
+            if (!symmetric && i != j) w[k][j] += col[dp[i]];
+         }
+      }
+   }
+   else if (bias_model == TADBIT_BIAS_VECTORS) {
+      for (k = 0 ; k < m ; k++)
+      for (i = 0 ; i < ld ; i++)
+         w[k][i] = bias[k][dp[i]];
+   }
+
+   double *mllik = (double *) malloc(MAXBREAKS * sizeof(double));
+   int *bkpts = (int *) malloc((size_t) MAXBREAKS*n * sizeof(int));
+   // Set to NAN by the workers (see 'init_llikmat').
+   double *llikmat = (double *) malloc((size_t) n*n * sizeof(double));
+
+   char *skip = (char *) malloc((size_t) n*n * sizeof(char));
+   size_t l;
+   for (l = 0 ; l < (size_t) n*n ; l++) skip[l] = 1;
+
+   // The output has the dimension of the region.
+   char *region_remove = (char *) malloc((end-start+1) * sizeof(char));
+   for (i = start ; i <= end ; i++) region_remove[i-start] = remove[i];
+   free(remove);
+
+   st->N = end-start+1;
+   st->n = n;
+   st->m = m;
+   st->MAXBREAKS = MAXBREAKS;
+   st->remove = region_remove;
+   st->ld = ld;
+   st->first = first;
+   st->mapped = 0;
+   st->obs = new_obs;
+   st->log_gamma = log_gamma;
+   st->bias_model = bias_model;
+   st->bias = w;
+   st->dp = dp;
+   st->skip = skip;
+   st->llikmat = llikmat;
+   st->trimat = NULL;
+   st->mllik = mllik;
+   st->bkpts = bkpts;
+
+   return 0;
+
+}
+
+
+void
+allocate_border_jobs(
+  char *skip,
+  const int n
+){
+// SYNOPSIS:
+//   Create the jobs for all small TADs and for the TADs at the ends
+//   of the chromosome/unit, which complete the approximate jobs of
+//   the pre-heuristic.
+//
+// PARAMETERS:
+//   'skip': the job matrix to update in place.
+//   'n': number of rows/columns of the hiC matrix (or 'skip').
+//
+// RETURN:
+//   'void'
+//
+// SIDE-EFFECTS:
+//   Update 'skip' in place.
+//
+
+   int i;
+   int j;
+
+   // Erase the lower triangular part of 'skip'.
+   for (j = 0 ; j < n ; j++)
+   for (i = j ; i < n ; i++)
+      skip[i+j*n] = 1;
+
+   // Allocate estimation of the log likelihood for all small
+   // TADs (less than 3 bins).
+   for (j = 6 ; j < n ; j++)
+   for (i = j-6 ; i < j-3 ; i++)
+      skip[i+j*n] = 0;
+
+   // Allocate jobs at the ends of the chromosomes/units because
+   // these regions are a bit noisier.
+   for (j = 1 ; j < 51 ; j++)
+   for (i = 0 ; i < j-3 ; i++)
+      if (i < n && j < n) skip[i+j*n] = 0;
+   for (j = n-51 ; j < n ; j++)
+   for (i = n-51 ; i < j-3 ; i++)
+      if (i > 0 && j > 0) skip[i+j*n] = 0;
+
+   // Reset lower triangular part of 'skip'.
+   for (j = 0 ; j < n ; j++)
+   for (i = j ; i < n ; i++)
+      skip[i+j*n] = 1;
+
+}
+
+
+// Count (i,j) of the matrix 'l' in 'fill_heur_score'.
+#define HEUR_OBS(l, i, j) (map ? obs[l][map[i]+(size_t) map[j]*ld] : \
+      obs[l][(i)+(j)*ld])
+
+void *
+fill_heur_score(
+  void *arg
+){
+// SYNOPSIS:                                                            
+//   Thread function to compute the pre-heuristic. The first pass       
+//   computes the weighted values of the matrix on the diagonals of     
+//   the band, the second pass the logarithm of the triangle sums on    
+//   the columns of the upper triangle (NAN out of the band).           
+//                                                                      
+// PARAMETERS:                                                          
+//   'arg': arguments for a thread (see header file).                   
+//                                                                      
+// RETURN:                                                              
+//   'void *'                                                           
+//                                                                      
+// SIDE-EFFECTS:                                                        
+//   Update 'S' (first pass) or 'heur_score' (second pass) in place.    
+//                                                                      
+
+   hrworker_arg *myargs = (hrworker_arg *) arg;
+   const int n = myargs->n;
+   const int m = myargs->m;
+   const int ld = myargs->ld;
+   const int **obs = myargs->obs;
+   const int *map = myargs->map;
+   const double **bias = myargs->bias;
+   double *S = myargs->S;
+   double *heur_score = myargs->heur_score;
+   const int band = myargs->band;
+   int *taskQ_i = myargs->taskQ_i;
+   pthread_mutex_t *lock = myargs->lock;
+
+   int i;
+   int l;
+
+   while (1) {
+      pthread_mutex_lock(lock);
+      if (*taskQ_i > (myargs->pass == 0 ? band : n-1)) {
+         // Task queue is empty. Exit loop and return
+         pthread_mutex_unlock(lock);
+         break;
+      }
+      // A task gives a diagonal 'd' (first pass) or a column 'd'
+      // (second pass).
+      int d = *taskQ_i;
+      (*taskQ_i)++;
+      pthread_mutex_unlock(lock);
+
+      if (myargs->pass == 1) {
+         double *col = heur_score + (size_t) d*n;
+         const int i0 = d > band ? d-band : 0;
+         for (i = 0 ; i < i0 ; i++) col[i] = NAN;
+         for (i = i0 ; i < d ; i++) col[i] = log(S[DIAG_OFFSET(d-i, n)+i]);
+         col[d] = NAN;
+         continue;
+      }
+
+      double *Sd = S + DIAG_OFFSET(d, n);
+      if (myargs->pass == 0 && myargs->bias_model == TADBIT_BIAS_NONE) {
+         for (i = 0 ; i < n-d ; i++) {
+            double weighted_value = 0.0;
+            for (l = 0 ; l < m ; l++) weighted_value += HEUR_OBS(l, i, i+d);
+            Sd[i] = weighted_value;
+         }
+      }
+      else if (myargs->pass == 0) {
+         for (i = 0 ; i < n-d ; i++) {
+            double weighted_value = 0.0;
+            for (l = 0 ; l < m ; l++) {
+               weighted_value +=
+                  HEUR_OBS(l, i, i+d)/(bias[l][i]*bias[l][i+d]);
+            }
+            Sd[i] = weighted_value;
+         }
+      }
+   }
+
+   return NULL;
+
+}
+
+void
+allocate_heuristic_jobs(
+  tadbit_state *st,
+  const int n_threads,
+  const int verbose,
+  const int max_tad_size
+){
+// SYNOPSIS:
+//   Pre-heuristic. Find approximate breakpoints by dynamic programming
+//   on the logarithm of the weighted sums of reads in the triangles
+//   of the matrix, and create jobs around the approximate TADs.
+//
+// PARAMETERS:
+//   'st': state of the run (see 'tadbit_prepare_data').
+//   'n_threads': number of threads to use.
+//   'verbose': whether to display progress.
+//   'max_tad_size': maximum size of the approximate TADs.
+//
+// RETURN:
+//   'void'
+//
+// SIDE-EFFECTS:
+//   Update 'st->skip' in place ('st->mllik' and 'st->bkpts' are used
+//   as scratch space).
+//
+
+   const int n = st->n;
+   const int m = st->m;
+   const int ld = st->ld;
+   const int MAXBREAKS = st->MAXBREAKS;
+   char *skip = st->skip;
+
+   int i;
+   int j;
+   int d;
+   int i0;
+
+   if (verbose) {
+      fprintf(stderr, "running pre-heuristic\n");
+   }
+
+   // The triangles are computed within the band of the TADs of size
+   // at most 'max_tad_size'.
+   const int band = max_tad_size > 0 && max_tad_size < n-1 ?
+      max_tad_size : n-1;
+
+   // 'S' is the weighted sum of reads within the triangle defined by
+   // ('i','i+d') in the upper triangular matrix of observations. It is
+   // stored by diagonal (see 'DIAG_OFFSET') so that the sums of a
+   // diagonal depend only on the two previous ones and can be
+   // computed in a single vectorizable sweep.
+   double *S = (double *) malloc(DIAG_OFFSET(band+1, n) * sizeof(double));
+   // Only the upper triangle of 'heur_score' is read by 'DPwalk', it
+   // is filled by the workers (second pass).
+   double *heur_score = (double *) malloc((size_t) n*n * sizeof(double));
+
+   int taskQ_i;
+   pthread_mutex_t lock;
+   int err = pthread_mutex_init(&lock, NULL);
+   if (err) {
+      fprintf(stderr, "error initializing mutex (%d)\n", err);
+      return;
+   }
+
+   // The heuristic is computed on the 'n' x 'n' block of the run.
+   const int **obs = (const int **) malloc(m * sizeof(int *));
+   const double **bias = st->bias ?
+      (const double **) malloc(m * sizeof(double *)) : NULL;
+   for (i = 0 ; i < m ; i++) {
+      obs[i] = st->mapped ? st->obs[i] : st->obs[i] + st->first;
+      if (bias) bias[i] = st->bias[i] + st->first;
+   }
+
+   hrworker_arg arg = {
       .n = n,
       .m = m,
-      .k = (const int **) obs,
-      //.d = dist,
-	  .dp = dp,
-      //.w = (const double **) weights,
-	  .w = (const double *) rowsums,
-      .lg = (const double **) log_gamma,
-      .skip = skip,
-      .llikmat = llikmat,
-      .verbose = verbose,
+      .band = band,
+      .ld = st->mapped ? st->N : ld,
+      .obs = obs,
+      .map = st->mapped ? st->dp : NULL,
+      .bias = bias,
+      .bias_model = st->bias_model,
+      .S = S,
+      .heur_score = heur_score,
+      .pass = 0,
+      .taskQ_i = &taskQ_i,
+      .lock = &lock,
+   };
+
+   pthread_t *tid = (pthread_t *) malloc(n_threads * sizeof(pthread_t));
+
+   // Weighted values of the matrix (in parallel over the diagonals).
+   taskQ_i = 1;
+   for (i = 0 ; i < n_threads ; i++) {
+      err = create_worker(&(tid[i]), i, n_threads, &fill_heur_score, &arg);
+      if (err) {
+         fprintf(stderr, "error creating thread (%d)\n", err);
+         return;
+      }
+   }
+   for (i = 0 ; i < n_threads ; i++) pthread_join(tid[i], NULL);
+
+   // Triangle sums: 'S[i,i+d] = S[i,i+d-1] + S[i+1,i+d] -
+   // S[i+1,i+d-1] + w[i,i+d]', the main diagonal is 0.
+   for (i = 0 ; i < n ; i++) S[i] = 0.0;
+   for (d = 1 ; d <= band ; d++) {
+      const double *prev = S + DIAG_OFFSET(d-1, n);
+      // The sums below the main diagonal are 0 as well.
+      const double *prev2 = d > 1 ? S + DIAG_OFFSET(d-2, n) : S;
+      double *Sd = S + DIAG_OFFSET(d, n);
+      for (i = 0 ; i < n-d ; i++)
+         Sd[i] = prev[i] + prev[i+1] - prev2[i+1] + Sd[i];
+   }
+
+   // Logarithm of the triangle sums (in parallel over the columns).
+   arg.pass = 1;
+   taskQ_i = 0;
+   for (i = 0 ; i < n_threads ; i++) {
+      err = create_worker(&(tid[i]), i, n_threads, &fill_heur_score, &arg);
+      if (err) {
+         fprintf(stderr, "error creating thread (%d)\n", err);
+         return;
+      }
+   }
+   for (i = 0 ; i < n_threads ; i++) pthread_join(tid[i], NULL);
+
+   pthread_mutex_destroy(&lock);
+   free(tid);
+   free(obs);
+   free(bias);
+
+   // Use dynamic programming to find approximate break points.
+   // The matrix 'mllik' is used only to make the function call valid
+   // (it is updated in place, but the value is disregarded), and
+   // the heuristic score 'heur_score' plays the role of the
+   // log-likelihood 'llikmat'.
+   DPwalk(heur_score, n, MAXBREAKS, n_threads, st->mllik, st->bkpts);
+
+   free(heur_score);
+   free(S);
+
+   // Create a thread job for each approximate TAD.
+   for (i = 0 ; i < n*n ; i++) skip[i] = 1;
+   for (j = 1 ; j < MAXBREAKS ; j++) {
+      i0 = 0;
+      for (i = 0 ; i < n ; i++) {
+         if (st->bkpts[i+j*n]) {
+            allocate_heur_job(skip, i0, i, n);
+            i0 = i+1;
+         }
+      }
+   }
+
+   allocate_border_jobs(skip, n);
+
+}
+
+
+void
+allocate_projected_jobs(
+  tadbit_state *st,
+  const tadbit_output *coarse,
+  const int factor
+){
+// SYNOPSIS:
+//   Create jobs around the TADs found at a coarser resolution (used
+//   instead of the pre-heuristic in 'tadbit_multires'). The bin 'I'
+//   of the coarse matrix spans the bins 'I*factor' to
+//   'I*factor+factor-1' of the original matrix, and the jobs are
+//   allocated for all the slices whose start and end are within
+//   half a coarse bin of the projected boundaries.
+//
+// PARAMETERS:
+//   'st': state of the run (see 'tadbit_prepare_data').
+//   'coarse': output of 'tadbit' on the coarse matrix.
+//   'factor': number of original bins per coarse bin.
+//
+// RETURN:
+//   'void'
+//
+// SIDE-EFFECTS:
+//   Update 'st->skip' in place.
+//
+
+   const int N = st->N;
+   const int n = st->n;
+   const int Nc = (N + factor-1) / factor;
+   const int radius = (factor+1) / 2;
+   char *skip = st->skip;
+
+   int i;
+   int j;
+   int l;
+   int i0;
+   int j0;
+   int shift;
+
+   // 'last[x]' is the index after removal of the last row/column
+   // before 'x' (included) in the original matrix.
+   int *last = (int *) malloc(N * sizeof(int));
+   for (l = -1, i = 0 ; i < N ; i++) {
+      if (!st->remove[i]) l++;
+      last[i] = l;
+   }
+
+   for (i = 0 ; i < n*n ; i++) skip[i] = 1;
+   for (shift = -10 ; shift < 11 ; shift++) {
+      const int layer = coarse->nbreaks_opt + shift;
+      if (layer < 0) continue;
+      if (layer > coarse->maxbreaks-1) break;
+      i0 = 0;
+      for (j = 0 ; j < Nc ; j++) {
+         // The last TAD ends with the matrix.
+         if (!coarse->bkpts[j+layer*Nc] && j < Nc-1) continue;
+         // Project the coarse TAD ('i0','j') on the original matrix.
+         j0 = (j+1)*factor-1 < N ? (j+1)*factor-1 : N-1;
+         const int start = last[i0*factor] + (st->remove[i0*factor] ? 1 : 0);
+         const int end = last[j0];
+         int a;
+         int b;
+         for (b = end-radius ; b <= end+radius ; b++)
+         for (a = start-radius ; a <= start+radius ; a++)
+            if (a >= 0 && b < n && a < b) skip[a+b*n] = 0;
+         i0 = j+1;
+      }
+   }
+
+   allocate_border_jobs(skip, n);
+
+   free(last);
+
+}
+
+
+void *
+first_touch(
+  void *arg
+){
+// SYNOPSIS:
+//   Thread function of 'init_llikmat': set band 'id' of 'llikmat' to
+//   NAN and copy the same columns of the observations and log-gamma
+//   terms if requested.
+//
+
+   ftworker_arg *myargs = (ftworker_arg *) arg;
+   const int n = myargs->n;
+   const int ld = myargs->ld;
+   const int j0 = BAND_START(myargs->id, myargs->n_bands, n);
+   const int j1 = BAND_START(myargs->id+1, myargs->n_bands, n);
+
+   int i;
+   int k;
+
+   for (i = j0*n ; i < j1*n ; i++) myargs->llikmat[i] = NAN;
+
+   if (myargs->obs == NULL || j1 <= j0) return NULL;
+   const size_t offset = (size_t) j0*ld;
+   const size_t len = (size_t) (j1-j0)*ld;
+   for (k = 0 ; k < myargs->m ; k++) {
+      memcpy(myargs->obs[k] + offset, myargs->old_obs[k] + offset,
+            len * sizeof(int));
+      memcpy(myargs->log_gamma[k] + offset,
+            myargs->old_log_gamma[k] + offset, len * sizeof(double));
+   }
+
+   return NULL;
+
+}
+
+
+void
+init_llikmat
+(
+  tadbit_state *st,
+  int n_threads
+)
+// SYNOPSIS:
+//   Set 'st->llikmat' to NAN (no slice computed) with 'n_threads'
+//   workers, each writing the band of columns whose slices are
+//   computed first by the worker of the same index in 'fill_window'.
+//   The pages of each band are thus allocated on the NUMA node of the
+//   CPUs that compute them (first touch). If the workers are pinned
+//   (see 'create_worker'), the compacted observations and log-gamma
+//   terms, which are read by all the workers, are also copied again
+//   by band, which spreads them over the nodes instead of leaving them
+//   on the node of the calling thread.
+//
+// SIDE-EFFECTS:
+//   Update 'st->llikmat' (and replace 'st->obs' and 'st->log_gamma')
+//   in place.
+//
+{
+
+   const int n = st->n;
+   const int m = st->m;
+   const int copy = pinned_workers() && !st->mapped;
+
+   int i;
+   int k;
+
+   if (n_threads < 1) n_threads = tadbit_cpu_count();
+   if (n_threads > n) n_threads = n;
+
+   int **obs = NULL;
+   double **log_gamma = NULL;
+   if (copy) {
+      obs = (int **) malloc(m * sizeof(int *));
+      log_gamma = (double **) malloc(m * sizeof(double *));
+      for (k = 0 ; k < m ; k++) {
+         obs[k] = (int *) malloc((size_t) st->ld*n * sizeof(int));
+         log_gamma[k] = (double *) malloc((size_t) st->ld*n * sizeof(double));
+      }
+   }
+
+   ftworker_arg arg = {
+      .n = n,
+      .ld = st->ld,
+      .m = m,
+      .n_bands = n_threads,
+      .llikmat = st->llikmat,
+      .obs = obs,
+      .old_obs = (const int **) st->obs,
+      .log_gamma = log_gamma,
+      .old_log_gamma = (const double **) st->log_gamma,
    };
 
-   err = pthread_mutex_init(&tadbit_lock, NULL);
-   if (err) {
-      fprintf(stderr, "error initializing mutex (%d)\n", err);
-      // Signal failure.
+   pthread_t *tid = (pthread_t *) malloc(n_threads * sizeof(pthread_t));
+   ftworker_arg *args =
+      (ftworker_arg *) malloc(n_threads * sizeof(ftworker_arg));
+   for (i = 0 ; i < n_threads ; i++) {
+      memcpy(args+i, &arg, sizeof(ftworker_arg));
+      args[i].id = i;
+      if (create_worker(&(tid[i]), i, n_threads, &first_touch, args+i)) {
+         // Do the band in this thread instead.
+         tid[i] = 0;
+         first_touch(args+i);
+      }
+   }
+   for (i = 0 ; i < n_threads ; i++) {
+      if (tid[i]) pthread_join(tid[i], NULL);
+   }
+   free(tid);
+   free(args);
+
+   if (copy) {
+      for (k = 0 ; k < m ; k++) {
+         free(st->obs[k]);
+         free(st->log_gamma[k]);
+      }
+      free(st->obs);
+      free(st->log_gamma);
+      st->obs = obs;
+      st->log_gamma = log_gamma;
+   }
+
+}
+
+
+void
+allocate_first_jobs
+(
+  tadbit_state *st,
+  const int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int do_not_use_heuristic
+)
+// SYNOPSIS:
+//   Create the first batch of slice jobs in 'st->skip', with or
+//   without the pre-heuristic (see 'tadbit_bias' for the description
+//   of the arguments).
+//
+{
+
+   int i;
+   int j;
+   const int n = st->n;
+
+   // Use the heuristic by default (hence the name of the parameter).
+   // The parameter 'max_tad_size' limits the first batch of slices in
+   // case the heuristic is not used, and the approximate TADs of the
+   // heuristic otherwise.
+   if (do_not_use_heuristic) {
+      for (j = 0 ; j < n ; j++)
+      for (i = 0 ; i < n ; i++)
+         // Also sets the lower triangular part of 'skip'.
+         st->skip[i+j*n] = (i >= j) || ((j-i) > max_tad_size) ? 1 : 0;
+   }
+   else {
+      allocate_heuristic_jobs(st, n_threads, verbose, max_tad_size);
+   }
+
+}
+
+
+int
+tadbit_prepare
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  int max_tad_size,
+  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
+  // output //
+  tadbit_state *st
+)
+// SYNOPSIS:
+//   First stage of 'tadbit'. Prepare the data (see
+//   'tadbit_prepare_data') and create the first batch of slice jobs
+//   in 'skip' (with or without the pre-heuristic).
+//
+// ARGUMENTS:
+//   See 'tadbit_bias' for the description of the input arguments.
+//        -- output arguments --
+//   'st': state of the run, allocated and filled by the routine.
+//
+// RETURN:
+//   0 on success, -1 if there are too few rows/columns after removal
+//   (in which case 'st' is not allocated).
+//
+{
+
+   // Get thread number if set to 0 (max).
+   if (n_threads < 1) n_threads = tadbit_cpu_count();
+
+   if (tadbit_prepare_data(obs, remove, n, m, bias_model, bias, st)) {
+      return -1;
+   }
+   init_llikmat(st, n_threads);
+
+   allocate_first_jobs(st, n_threads, verbose, max_tad_size,
+         do_not_use_heuristic);
+
+   return 0;
+
+}
+
+
+int
+fill_window
+(
+  tadbit_state *st,
+  const int first,
+  const int size,
+  const int crop,
+  char *skip,
+  double *llikmat,
+  int n_threads,
+  const int verbose
+)
+// SYNOPSIS:
+//   Compute the log-likelihood of the slices of the window of 'size'
+//   rows/columns starting at 'first' that are allocated in 'skip'
+//   and not already present in 'llikmat'.
+//
+// ARGUMENTS:
+//   'st': state of the run (see 'tadbit_prepare').
+//   'first': first row/column of the window (from 'st->first').
+//   'size': number of rows/columns of the window.
+//   'crop': whether the flanking blocks of the slices stop at the
+//      window or span all the rows of 'st->obs' (if there are at
+//      least 3 rows on that side of the window).
+//   'skip': job matrix of the window ('size' x 'size').
+//   'llikmat': log-likelihood matrix of the window.
+//   'n_threads': number of threads to use.
+//   'verbose': whether to display progress.
+//
+// RETURN:
+//   0 on success, the error code of 'pthread_create' otherwise.
+//
+// SIDE-EFFECTS:
+//   Update 'llikmat', 'skip' and 'st->trimat' in place.
+//
+{
+
+   int err;
+   int i;
+
+   if (n_threads < 1) n_threads = tadbit_cpu_count();
+
+   // Initialize task queue.
+   int n_to_process = 0;
+   for (i = 0 ; i < size*size ; i++) {
+      // Skip all computation done in previous cycles.
+      if (!isnan(llikmat[i])) skip[i] = 1;
+      n_to_process += (1-skip[i]);
+   }
+   int n_processed = 0;
+   int *band_next = (int *) malloc(n_threads * sizeof(int));
+   int *band_end = (int *) malloc(n_threads * sizeof(int));
+   for (i = 0 ; i < n_threads ; i++) {
+      band_next[i] = BAND_START(i, n_threads, size) * size;
+      band_end[i] = BAND_START(i+1, n_threads, size) * size;
+   }
+   pthread_mutex_t lock;
+   err = pthread_mutex_init(&lock, NULL);
+   if (err) {
+      fprintf(stderr, "error initializing mutex (%d)\n", err);
+      free(band_next);
+      free(band_end);
+      return err;
+   }
+
+   // The slices use the coordinates of the rows. Column 'j' of the
+   // run is stored at column 'j'-'st->first' of 'st->obs' (mapped
+   // runs read the input matrices through 'st->dp').
+   const int ld = st->ld;
+   const int lo = st->first + first;
+   const int hi = lo + size-1;
+   const int **k = (const int **) malloc(st->m * sizeof(int *));
+   const double **lg = st->mapped ? NULL :
+      (const double **) malloc(st->m * sizeof(double *));
+   for (i = 0 ; i < st->m ; i++) {
+      if (st->mapped) {
+         k[i] = st->obs[i];
+         continue;
+      }
+      k[i] = st->obs[i] - st->first*ld;
+      lg[i] = st->log_gamma[i] - st->first*ld;
+   }
+
+   llworker_arg arg = {
+      .n = ld,
+      .m = st->m,
+      .N = st->mapped ? st->N : 0,
+      .k = k,
+	  .dp = st->dp,
+      .w = (const double **) st->bias,
+      .bias_model = st->bias_model,
+      .lg = lg,
+      .first = lo,
+      .size = size,
+      // Flanking blocks of 1 or 2 rows cannot be fitted (see 'll'),
+      // so they are left out.
+      .flank_first = crop || lo < 3 ? lo : 0,
+      .flank_last = crop || hi > ld-4 ? hi : ld-1,
+      .skip = skip,
+      .llikmat = llikmat,
+      .trimat = st->trimat,
+      .verbose = verbose,
+      .n_bands = n_threads,
+      .band_next = band_next,
+      .band_end = band_end,
+      .n_processed = &n_processed,
+      .n_to_process = n_to_process,
+      .lock = &lock,
+   };
+
+   pthread_t *tid = (pthread_t *) malloc(n_threads * sizeof(pthread_t));
+   llworker_arg *args =
+      (llworker_arg *) malloc(n_threads * sizeof(llworker_arg));
+
+   // Instantiate threads and start running jobs.
+   for (i = 0 ; i < n_threads ; i++) tid[i] = 0;
+   for (i = 0 ; i < n_threads ; i++) {
+      memcpy(args+i, &arg, sizeof(llworker_arg));
+      args[i].id = i;
+      err = create_worker(&(tid[i]), i, n_threads, &fill_llikmat, args+i);
+      if (err) {
+         fprintf(stderr, "error creating thread (%d)\n", err);
+         // Let the running threads finish (the bands of the
+         // missing threads are taken by the others).
+         n_threads = i;
+         break;
+      }
+   }
+
+   // Wait for threads to return.
+   for (i = 0 ; i < n_threads ; i++) {
+      pthread_join(tid[i], NULL);
+   }
+   if (verbose && !err) {
+      fprintf(stderr, "computing likelihood (100%% done)\n");
+   }
+
+   pthread_mutex_destroy(&lock);
+   free(tid);
+   free(args);
+   free(band_next);
+   free(band_end);
+   free(k);
+   free(lg);
+   return err;
+
+}
+
+
+int
+tadbit_fill
+(
+  tadbit_state *st,
+  int n_threads,
+  const int verbose
+)
+// SYNOPSIS:
+//   Compute the log-likelihood of all the slices allocated in 'skip'
+//   and not already present in 'llikmat'.
+//
+// ARGUMENTS:
+//   'st': state of the run (see 'tadbit_prepare').
+//   'n_threads': number of threads to use.
+//   'verbose': whether to display progress.
+//
+// RETURN:
+//   0 on success, the error code of 'pthread_create' otherwise.
+//
+// SIDE-EFFECTS:
+//   Update 'st->llikmat' and 'st->skip' in place.
+//
+{
+
+   return fill_window(st, 0, st->n, 0, st->skip, st->llikmat, n_threads,
+         verbose);
+
+}
+
+
+void
+destroy_tadbit_state
+(
+  tadbit_state *st
+)
+// SYNOPSIS:
+//   Free the compacted data of a run. The output arrays 'llikmat',
+//   'mllik' and 'bkpts' are left alone because they may have been
+//   handed over to a 'tadbit_output'.
+//
+{
+
+   int k;
+
+   for (k = 0 ; k < st->m ; k++) {
+      // The input matrices of mapped runs belong to the caller.
+      if (!st->mapped) {
+         free(st->obs[k]);
+         free(st->log_gamma[k]);
+      }
+      if (st->bias) free(st->bias[k]);
+   }
+   free(st->obs);
+   free(st->log_gamma);
+   free(st->bias);
+   free(st->skip);
+   free(st->dp);
+   free(st->remove);
+   free(st->trimat);
+
+}
+
+
+int
+tadbit_optimize
+(
+  tadbit_state *st,
+  int n_threads,
+  const int verbose,
+  const int nbrks,
+  // output //
+  int *passages
+)
+// SYNOPSIS:
+//   Iterate between the computation of the slice log-likelihoods and
+//   the dynamic programming until the AIC stops improving, then
+//   compute the breakpoint confidence.
+//
+// ARGUMENTS:
+//   'st': state of the run (see 'tadbit_prepare'). Whatever is
+//      already present in 'st->llikmat' is not recomputed.
+//   See 'tadbit' for the description of the other arguments.
+//        -- output arguments --
+//   'passages': confidence of the breakpoints ('st->n' values).
+//
+// RETURN:
+//   The selected number of breaks, or -1 on error.
+//
+// SIDE-EFFECTS:
+//   Update 'st->llikmat', 'st->mllik' and 'st->bkpts' in place.
+//
+{
+
+   if (n_threads < 1) n_threads = tadbit_cpu_count();
+
+   const int n = st->n;
+   const int m = st->m;
+   const int MAXBREAKS = st->MAXBREAKS;
+   double *llikmat = st->llikmat;
+   double *mllik = st->mllik;
+   int *bkpts = st->bkpts;
+
+   int err;
+   int i;
+   int j;
+
+   int n_params;
+   int nbreaks_opt = 0;
+   double AIC = -INFINITY;
+   double newAIC = -DBL_MAX;
+
+   dp_table table = {
+      .n = n,
+      .nlayers = 0,
+      .llik = (double *) malloc(n*MAXBREAKS * sizeof(double)),
+      .bkpt = (int *) malloc(n*MAXBREAKS * sizeof(int)),
+   };
+
+   while (newAIC > AIC) {
+
+      if (verbose) {
+         fprintf(stderr, "starting new cycle\n");
+      }
+
+      AIC = newAIC;
+
+      err = tadbit_fill(st, n_threads, verbose);
+      if (err) {
+         free(table.llik);
+         free(table.bkpt);
+         return -1;
+      }
+
+      // The matrix 'llikmat' now contains the log-likelihood of the
+      // segments. The breakpoints are found by dynamic programming.
+      int maxbreaks = nbreaks_opt ? nbreaks_opt + 11 : MAXBREAKS;
+      if (maxbreaks > MAXBREAKS) maxbreaks = MAXBREAKS;
+      // Only the cells that depend on the slices computed in this
+      // cycle are updated after the first one.
+      DPupdate(llikmat, st->skip, n, maxbreaks, n_threads, &table,
+            mllik, bkpts);
+
+      // Get optimal number of breaks by AIC.
+      newAIC = -INFINITY;
+      for (nbreaks_opt = 1 ; nbreaks_opt < MAXBREAKS ; nbreaks_opt++) {
+         n_params = nbreaks_opt + m*(8 + nbreaks_opt*6);
+         if (newAIC > mllik[nbreaks_opt] - n_params) break;
+         newAIC = mllik[nbreaks_opt] - n_params;
+      }
+      nbreaks_opt -= 1;
+
+      allocate_new_jobs(st->skip, bkpts, MAXBREAKS, nbreaks_opt, n);
+
+   }
+
+   free(table.llik);
+   free(table.bkpt);
+
+   AIC = newAIC;
+
+   nbreaks_opt = nbrks ? (int) nbrks - 1 : nbreaks_opt;
+
+   // Compute breakpoint confidence from the log-likelihood margins.
+   // The confidence of a breakpoint is the difference between the
+   // optimal segmentation and the best segmentation with the same
+   // number of breaks that does not break there, in units of 'm*6'
+   // (the expected log-likelihood gain for adding a new TAD around the
+   // optimum log-likelihood). The score ranges from 1 to 10.
+   double *alt_llik = (double *) malloc(n * sizeof(double));
+   for (i = 0 ; i < n ; i++) passages[i] = 0;
+
+   if (nbreaks_opt > 0) {
+      double opt = DPconfidence(llikmat, n, nbreaks_opt, n_threads,
+            alt_llik);
+      for (j = 0 ; j < n ; j++) {
+         if (!bkpts[j+nbreaks_opt*n]) continue;
+         double margin = (opt - alt_llik[j]) / (m*6);
+         // No alternative segmentation (or undefined margin).
+         if (!(margin < 9)) passages[j] = 10;
+         else passages[j] = 1 + (margin > 0 ? (int) margin : 0);
+      }
+   }
+   free(alt_llik);
+
+   return nbreaks_opt;
+
+}
+
+
+void
+tadbit_resize
+(
+  tadbit_state *st,
+  const int nbreaks_opt,
+  int *passages,
+  // output //
+  tadbit_output *seg
+)
+// SYNOPSIS:
+//   Resize the output of 'tadbit_optimize' to the original dimension
+//   of the matrices.
+//
+// SIDE-EFFECTS:
+//   Fill 'seg', free 'passages' and free 'st'.
+//
+{
+
+   const int N = st->N;
+   const int n = st->n;
+   const int m = st->m;
+   const int MAXBREAKS = st->MAXBREAKS;
+   const char *remove = st->remove;
+   double *llikmat = st->llikmat;
+   int *bkpts = st->bkpts;
+
+   int i;
+   int j;
+   int k;
+   int l;
+
+   // Resize output to match original.
+   int *resized_bkpts = (int *) malloc((size_t) N*MAXBREAKS * sizeof(int));
+   int *resized_passages = (int *) malloc(N * sizeof(int));
+   size_t z;
+   for (z = 0 ; z < (size_t) N*MAXBREAKS ; z++) resized_bkpts[z] = 0;
+   for (i = 0 ; i < N ; i++) resized_passages[i] = 0;
+
+   for (l = 0, i = 0 ; i < N ; i++) {
+      if (remove[i]) continue;
+      resized_passages[i] = passages[l];
+      for (j = 0 ; j < MAXBREAKS ; j++)
+         resized_bkpts[i+(size_t) j*N] = bkpts[l+(size_t) j*n];
+      l++;
+   }
+
+   free(passages);
+   free(bkpts);
+
+   double *resized_llikmat = (double *) malloc((size_t) N*N * sizeof(double));
+   for (z = 0 ; z < (size_t) N*N ; z++) {
+      resized_llikmat[z] = NAN;
+   }
+
+   for (l = 0, i = 0 ; i < N ; i++) {
+      if (remove[i]) continue;
+      for (k = 0, j = 0 ; j < N ; j++) {
+         if (remove[j]) continue;
+         resized_llikmat[i+(size_t) j*N] = llikmat[l+(size_t) k*n];
+         k++;
+      }
+      l++;
+   }
+   free(llikmat);
+
+   destroy_tadbit_state(st);
+
+   // Update output struct.
+   seg->m = m;
+   seg->maxbreaks = MAXBREAKS;
+   seg->nbreaks_opt = nbreaks_opt;
+   seg->passages = resized_passages;
+   seg->llikmat = resized_llikmat;
+   seg->mllik = st->mllik;
+   seg->bkpts = resized_bkpts;
+
+   return;
+
+}
+
+
+void
+tadbit_segment
+(
+  tadbit_state *st,
+  int n_threads,
+  const int verbose,
+  const int nbrks,
+  // output //
+  tadbit_output *seg
+)
+// SYNOPSIS:
+//   Last stage of 'tadbit'. Find the optimal segmentation (see
+//   'tadbit_optimize') and resize the output to the original
+//   dimension.
+//
+// ARGUMENTS:
+//   'st': state of the run (see 'tadbit_prepare').
+//   See 'tadbit' for the description of the other arguments.
+//
+// SIDE-EFFECTS:
+//   Fill 'seg' and free 'st'.
+//
+{
+
+   int *passages = (int *) malloc(st->n * sizeof(int));
+   int nbreaks_opt = tadbit_optimize(st, n_threads, verbose, nbrks,
+         passages);
+   if (nbreaks_opt < 0) {
+      free(passages);
+      free(st->llikmat);
+      free(st->mllik);
+      free(st->bkpts);
+      destroy_tadbit_state(st);
+      seg->maxbreaks = -1;
+      return;
+   }
+
+   tadbit_resize(st, nbreaks_opt, passages, seg);
+
+}
+
+
+void
+tadbit
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  // output //
+  tadbit_output *seg
+)
+// SYNOPSIS:
+//   Find the optimal segmentation of the hiC matrices 'obs' into
+//   TADs, with the row sums as bias (see 'tadbit_bias').
+//
+{
+
+   tadbit_bias(obs, remove, n, m, n_threads, verbose, max_tad_size,
+         nbrks, do_not_use_heuristic, TADBIT_BIAS_ROWSUMS, NULL, seg);
+
+}
+
+void
+tadbit_bias
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
+  // output //
+  tadbit_output *seg
+)
+// SYNOPSIS:
+//   Find the optimal segmentation of the hiC matrices 'obs' into
+//   TADs. The run is split in 'tadbit_prepare' (compaction and
+//   allocation of the slice jobs) and 'tadbit_segment' (computation
+//   of the slice log-likelihoods, dynamic programming and AIC).
+//
+// ARGUMENTS:
+//   'obs': (m) linearized n x n matrices of raw hiC counts.
+//   'remove': rows/columns to leave out (freed by the routine).
+//   'n': row/column number of the matrices.
+//   'm': number of matrices (replicates).
+//   'n_threads': number of threads (0 for all the processors).
+//   'verbose': whether to display progress.
+//   'max_tad_size': maximum TAD size of the first batch of slices.
+//   'nbrks': number of breaks to return (0 for the optimal by AIC).
+//   'do_not_use_heuristic': whether to compute all the slices.
+//   'bias_model': one of 'TADBIT_BIAS_ROWSUMS', 'TADBIT_BIAS_VECTORS'
+//      or 'TADBIT_BIAS_NONE' (see header file).
+//   'bias': (m) bias vectors of length n for 'TADBIT_BIAS_VECTORS'
+//      (ignored otherwise). The rows/columns with a bias that is not
+//      positive are removed.
+//        -- output arguments --
+//   'seg': output struct. 'seg->maxbreaks' is -1 upon failure.
+//
+{
+
+   tadbit_state st;
+
+   if (tadbit_prepare(obs, remove, n, m, n_threads, verbose,
+            max_tad_size, do_not_use_heuristic, bias_model, bias, &st)) {
+      // Signal failure.
+      seg->maxbreaks = -1;
+      return;
+   }
+
+   tadbit_segment(&st, n_threads, verbose, nbrks, seg);
+
+   return;
+
+}
+
+
+void
+tadbit_focus
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
+  const int start,
+  const int end,
+  // output //
+  tadbit_output *seg
+)
+// SYNOPSIS:
+//   Version of 'tadbit_bias' that segments only the region of the
+//   rows/columns 'start' to 'end' of the matrices. The slices are
+//   those of the region, but their flanking blocks span the whole
+//   matrices (as in the segmentation of the whole matrices), and only
+//   the columns of the region are read, apart from the row sums (see
+//   'tadbit_focus_data').
+//
+// ARGUMENTS:
+//   See 'tadbit_bias' for the description of the common arguments.
+//   'start', 'end': first and last row/column of the region.
+//        -- output arguments --
+//   'seg': output struct with the dimension of the region.
+//      'seg->maxbreaks' is -1 upon failure.
+//
+{
+
+   if (n_threads < 1) n_threads = tadbit_cpu_count();
+
+   tadbit_state st;
+
+   if (tadbit_focus_data(obs, remove, n, m, bias_model, bias, start, end,
+            &st)) {
+      seg->maxbreaks = -1;
+      return;
+   }
+   init_llikmat(&st, n_threads);
+
+   allocate_first_jobs(&st, n_threads, verbose, max_tad_size,
+         do_not_use_heuristic);
+
+   tadbit_segment(&st, n_threads, verbose, nbrks, seg);
+
+   return;
+
+}
+
+
+void
+tadbit_mapped
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
+  // output //
+  tadbit_output *seg
+)
+// SYNOPSIS:
+//   Version of 'tadbit_bias' that reads the matrices in place instead
+//   of copying them without the removed rows/columns (see
+//   'tadbit_map_data'). The matrices are typically mapped in memory
+//   with 'map_tadbit_matrix', and they are not modified.
+//
+// ARGUMENTS:
+//   See 'tadbit_bias'.
+//
+{
+
+   if (n_threads < 1) n_threads = tadbit_cpu_count();
+
+   tadbit_state st;
+
+   if (tadbit_map_data(obs, remove, n, m, bias_model, bias, &st)) {
+      seg->maxbreaks = -1;
+      return;
+   }
+   init_llikmat(&st, n_threads);
+
+   allocate_first_jobs(&st, n_threads, verbose, max_tad_size,
+         do_not_use_heuristic);
+
+   tadbit_segment(&st, n_threads, verbose, nbrks, seg);
+
+   return;
+
+}
+
+
+int *
+map_tadbit_matrix_fd
+(
+  const int fd,
+  int *n
+)
+// SYNOPSIS:
+//   Map in memory (read-only) a matrix stored as 'n' x 'n' ints in the
+//   native byte order, in column-major order (as read by 'tadbit').
+//   The pages are loaded from the file as they are read.
+//
+// ARGUMENTS:
+//   'fd': file descriptor of the matrix (it can be closed after the
+//      call).
+//        -- output arguments --
+//   'n': number of rows/columns of the matrix.
+//
+// RETURN:
+//   The mapped matrix (see 'unmap_tadbit_matrix') or NULL on error.
+//
+{
+
+   struct stat sb;
+   if (fstat(fd, &sb)) {
+      fprintf(stderr, "cannot stat matrix file\n");
+      return NULL;
+   }
+
+   const size_t size = (size_t) sb.st_size;
+   const int N = (int) floor(sqrt((double) (size / sizeof(int))) + 0.5);
+   if (N < 1 || (size_t) N*N*sizeof(int) != size) {
+      fprintf(stderr, "matrix file is not a square matrix of ints\n");
+      return NULL;
+   }
+
+   void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "cannot map matrix file\n");
+      return NULL;
+   }
+
+   *n = N;
+   return (int *) map;
+
+}
+
+
+int *
+map_tadbit_matrix
+(
+  const char *path,
+  int *n
+)
+// SYNOPSIS:
+//   Version of 'map_tadbit_matrix_fd' that opens the file 'path'.
+//
+{
+
+   const int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "cannot open matrix file %s\n", path);
+      return NULL;
+   }
+   int *obs = map_tadbit_matrix_fd(fd, n);
+   close(fd);
+   return obs;
+
+}
+
+
+void
+unmap_tadbit_matrix
+(
+  int *obs,
+  const int n
+)
+// SYNOPSIS:
+//   Unmap a matrix mapped by 'map_tadbit_matrix'.
+//
+{
+   if (obs != NULL) munmap(obs, (size_t) n*n*sizeof(int));
+}
+
+
+int
+segment_nested
+(
+  tadbit_state *st,
+  const int start,
+  const int end,
+  int n_threads,
+  const int verbose,
+  // output //
+  int *ends,
+  int *scores
+)
+// SYNOPSIS:
+//   Find the optimal segmentation of the TAD 'start'-'end' into
+//   sub-TADs, as 'tadbit' would on the sub-matrix of the TAD but with
+//   the bias of the whole run. The slice model is then the same as in
+//   the whole run except for the contacts outside the TAD, so the
+//   triangle terms kept in 'st->trimat' are reused and only the
+//   rectangles (and the missing triangles) are computed. The number
+//   of sub-TADs is selected by AIC, as in 'tadbit_optimize', but one
+//   TAD (no break) is also a candidate.
+//
+// ARGUMENTS:
+//   'st': state of the run (see 'tadbit_optimize'), with 'trimat'.
+//   'start', 'end': first and last row/column of the TAD.
+//   'n_threads': number of threads to use.
+//   'verbose': whether to display progress.
+//        -- output arguments --
+//   'ends': last row/column of the sub-TADs.
+//   'scores': confidence of the breakpoints at 'ends' (0 for 'end').
+//
+// RETURN:
+//   The number of sub-TADs, or -1 on error.
+//
+// SIDE-EFFECTS:
+//   Update 'st->trimat' in place.
+//
+{
+
+   const int m = st->m;
+   const int ns = end-start+1;
+   const int MAXBREAKS = ns/5;
+
+   int i;
+   int j;
+
+   ends[0] = end;
+   scores[0] = 0;
+
+   // Too small to contain more than one TAD.
+   if (MAXBREAKS < 2) return 1;
+
+   // All the slices of the TAD are computed.
+   double *llikmat = (double *) malloc(ns*ns * sizeof(double));
+   char *skip = (char *) malloc(ns*ns * sizeof(char));
+   for (j = 0 ; j < ns ; j++)
+   for (i = 0 ; i < ns ; i++) {
+      llikmat[i+j*ns] = NAN;
+      skip[i+j*ns] = i >= j;
+   }
+   int err = fill_window(st, start, ns, 1, skip, llikmat, n_threads,
+         verbose);
+   free(skip);
+   if (err) {
+      free(llikmat);
+      return -1;
+   }
+
+   double *mllik = (double *) malloc(MAXBREAKS * sizeof(double));
+   int *bkpts = (int *) malloc(ns*MAXBREAKS * sizeof(int));
+   DPwalk(llikmat, ns, MAXBREAKS, n_threads, mllik, bkpts);
+   mllik[0] = llikmat[(ns-1)*ns];
+
+   // Same AIC as 'tadbit_optimize', starting from one TAD.
+   int nbreaks;
+   int nbreaks_opt = 0;
+   double AIC = mllik[0] - m*8;
+   for (nbreaks = 1 ; nbreaks < MAXBREAKS ; nbreaks++) {
+      int n_params = nbreaks + m*(8 + nbreaks*6);
+      if (!(mllik[nbreaks] - n_params > AIC)) break;
+      AIC = mllik[nbreaks] - n_params;
+      nbreaks_opt = nbreaks;
+   }
+
+   int n_sub = 1;
+   if (nbreaks_opt > 0) {
+      double *alt_llik = (double *) malloc(ns * sizeof(double));
+      double opt = DPconfidence(llikmat, ns, nbreaks_opt, n_threads,
+            alt_llik);
+      for (n_sub = 0, j = 0 ; j < ns-1 ; j++) {
+         if (!bkpts[j+nbreaks_opt*ns]) continue;
+         // See 'tadbit_optimize'.
+         double margin = (opt - alt_llik[j]) / (m*6);
+         ends[n_sub] = start+j;
+         scores[n_sub] = !(margin < 9) ? 10 :
+            1 + (margin > 0 ? (int) margin : 0);
+         n_sub++;
+      }
+      ends[n_sub] = end;
+      scores[n_sub] = 0;
+      n_sub++;
+      free(alt_llik);
+   }
+
+   free(llikmat);
+   free(mllik);
+   free(bkpts);
+
+   return n_sub;
+
+}
+
+
+void
+tadbit_nested
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
+  const int max_level,
+  // output //
+  tadbit_output *seg,
+  tadbit_tree *tree
+)
+// SYNOPSIS:
+//   Hierarchical version of 'tadbit_bias'. The matrices are first
+//   segmented as in 'tadbit_bias', then every TAD is segmented again
+//   into sub-TADs (see 'segment_nested'), down to 'max_level' levels.
+//   The bias is that of the whole run at all the levels, so the
+//   triangle terms of the slices computed at a level are reused by
+//   the next ones and only the contacts with the rest of the TAD are
+//   computed again.
+//
+// ARGUMENTS:
+//   See 'tadbit_bias' for the description of the common arguments.
+//   'max_level': number of levels of the tree (1 for the TADs only).
+//        -- output arguments --
+//   'seg': output of the first level (same as 'tadbit_bias').
+//   'tree': boundary tree (see header file), in the original
+//      coordinates. 'tree->n_nodes' is -1 upon failure.
+//
+{
+
+   int i;
+   int j;
+
+   tree->n_nodes = -1;
+
+   tadbit_state st;
+   if (tadbit_prepare(obs, remove, n, m, n_threads, verbose,
+            max_tad_size, do_not_use_heuristic, bias_model, bias, &st)) {
       seg->maxbreaks = -1;
-      // TODO: free memory before exit.
       return;
    }
 
-   int n_params;
-   int nbreaks_opt = 0;
-   double AIC = -INFINITY;
-   double newAIC = -DBL_MAX;
-
-   while (newAIC > AIC) {
-
-      if (verbose) {
-         fprintf(stderr, "starting new cycle\n");
-      }
-
-      AIC = newAIC;
+   const int N = st.N;
+   const int nc = st.n;
+   if (max_level > 1) {
+      st.trimat = (double *) malloc((size_t) nc*nc * sizeof(double));
+      size_t l;
+      for (l = 0 ; l < (size_t) nc*nc ; l++) st.trimat[l] = NAN;
+   }
+   int *passages = (int *) malloc(nc * sizeof(int));
+   int nbreaks_opt = tadbit_optimize(&st, n_threads, verbose, nbrks,
+         passages);
+   if (nbreaks_opt < 0) {
+      free(passages);
+      free(st.llikmat);
+      free(st.mllik);
+      free(st.bkpts);
+      destroy_tadbit_state(&st);
+      seg->maxbreaks = -1;
+      return;
+   }
 
-      // Initialize task queue.
-      n_to_process = 0;
-      for (i = 0 ; i < n*n ; i++) {
-         // Skip all computation done in previous cycles.
-         if (!isnan(llikmat[i])) skip[i] = 1;
-         n_to_process += (1-skip[i]);
-      }
-      n_processed = 0;
-      taskQ_i = 0;
-      
-      // Instantiate threads and start running jobs.
-      for (i = 0 ; i < n_threads ; i++) tid[i] = 0;
-      for (i = 0 ; i < n_threads ; i++) {
-         err = pthread_create(&(tid[i]), NULL, &fill_llikmat, &arg);
-         if (err) {
-            fprintf(stderr, "error creating thread (%d)\n", err);
+   // Nodes are stored level by level, and the children of a node are
+   // consecutive. Every level is a partition of the (compacted)
+   // matrix, so there are at most 'nc' nodes per level.
+   const int max_nodes = 1 + (max_level > 0 ? max_level : 0) * nc;
+   int *start = (int *) malloc(max_nodes * sizeof(int));
+   int *end = (int *) malloc(max_nodes * sizeof(int));
+   int *parent = (int *) malloc(max_nodes * sizeof(int));
+   int *level = (int *) malloc(max_nodes * sizeof(int));
+   int *score = (int *) malloc(max_nodes * sizeof(int));
+   int *ends = (int *) malloc(nc * sizeof(int));
+   int *scores = (int *) malloc(nc * sizeof(int));
+
+   start[0] = 0; end[0] = nc-1; parent[0] = -1; level[0] = 0; score[0] = 0;
+   int n_nodes = 1;
+
+   // First level from the optimal segmentation.
+   int n_sub = 0;
+   for (j = 0 ; j < nc-1 ; j++) {
+      if (!st.bkpts[j+nbreaks_opt*nc]) continue;
+      ends[n_sub] = j;
+      scores[n_sub++] = passages[j];
+   }
+   ends[n_sub] = nc-1;
+   scores[n_sub++] = 0;
+
+   int node;
+   for (node = 0 ; node < n_nodes ; node++) {
+      if (node > 0) {
+         if (level[node] >= max_level) break;
+         if (verbose) {
+            fprintf(stderr, "segmenting TAD %d-%d (level %d)\n",
+                  start[node], end[node], level[node]+1);
+         }
+         n_sub = segment_nested(&st, start[node], end[node], n_threads,
+               verbose, ends, scores);
+         if (n_sub < 0) {
+            free(start); free(end); free(parent); free(level); free(score);
+            free(ends); free(scores); free(passages);
             seg->maxbreaks = -1;
-            // TODO: free memory before exit.
             return;
          }
+         // A TAD without sub-TADs is a leaf.
+         if (n_sub < 2) continue;
       }
-
-      // Wait for threads to return.
-      for (i = 0 ; i < n_threads ; i++) {
-         pthread_join(tid[i], NULL);
+      if (max_level < 1) break;
+      for (i = 0 ; i < n_sub ; i++) {
+         start[n_nodes] = i ? ends[i-1]+1 : start[node];
+         end[n_nodes] = ends[i];
+         parent[n_nodes] = node;
+         level[n_nodes] = level[node]+1;
+         score[n_nodes] = scores[i];
+         n_nodes++;
       }
-      if (verbose) {
-         fprintf(stderr, "computing likelihood (100%% done)\n");
+   }
+
+   free(ends);
+   free(scores);
+
+   // Convert to the original coordinates. Removed rows/columns belong
+   // to the next TAD (as in the output of 'tadbit').
+   for (i = 0 ; i < n_nodes ; i++) {
+      start[i] = start[i] ? st.dp[start[i]-1]+1 : 0;
+      end[i] = end[i] < nc-1 ? st.dp[end[i]] : N-1;
+   }
+
+   tree->n_nodes = n_nodes;
+   tree->start = start;
+   tree->end = end;
+   tree->parent = parent;
+   tree->level = level;
+   tree->score = score;
+
+   tadbit_resize(&st, nbreaks_opt, passages, seg);
+
+   return;
+
+}
+
+
+void
+tadbit_multires
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int factor,
+  const int nbrks,
+  // output //
+  tadbit_output *seg
+)
+// SYNOPSIS:
+//   Coarse-to-fine version of 'tadbit'. The matrices are first binned
+//   'factor' times coarser and segmented with 'tadbit', then the
+//   breakpoints are projected on the original matrix. The first batch
+//   of jobs is allocated around the projected boundaries instead of
+//   using the pre-heuristic, and the rest of the run is identical.
+//
+// ARGUMENTS:
+//   See 'tadbit' for the description of the common arguments.
+//   'factor': number of bins merged in every coarse bin (if 'factor'
+//      is less than 2, the routine is equivalent to 'tadbit').
+//
+{
+
+   int i;
+   int j;
+   int k;
+
+   if (factor < 2) {
+      tadbit(obs, remove, n, m, n_threads, verbose, n, nbrks, 0, seg);
+      return;
+   }
+
+   // Bin the matrices. Filtered rows/columns are left out of the sums
+   // and the coarse bins that contain only filtered rows/columns are
+   // filtered as well.
+   const int N = n;
+   const int Nc = (N + factor-1) / factor;
+   int **coarse_obs = (int **) malloc(m * sizeof(int *));
+   char *coarse_remove = (char *) malloc(Nc * sizeof(char));
+   for (i = 0 ; i < Nc ; i++) coarse_remove[i] = 1;
+   for (i = 0 ; i < N ; i++) {
+      if (!remove[i]) coarse_remove[i/factor] = 0;
+   }
+   for (k = 0 ; k < m ; k++) {
+      coarse_obs[k] = (int *) malloc(Nc*Nc * sizeof(int));
+      for (i = 0 ; i < Nc*Nc ; i++) coarse_obs[k][i] = 0;
+      for (j = 0 ; j < N ; j++) {
+         if (remove[j]) continue;
+         for (i = 0 ; i < N ; i++) {
+            if (remove[i]) continue;
+            coarse_obs[k][i/factor+(j/factor)*Nc] += obs[k][i+j*N];
+         }
       }
+   }
 
-      // The matrix 'llikmat' now contains the log-likelihood of the
-      // segments. The breakpoints are found by dynamic programming.
-      int maxbreaks = nbreaks_opt ? nbreaks_opt + 11 : MAXBREAKS;
-      if (maxbreaks > MAXBREAKS) maxbreaks = MAXBREAKS;
-      DPwalk(llikmat, n, maxbreaks, n_threads, mllik, bkpts);
+   if (verbose) {
+      fprintf(stderr, "running coarse segmentation (%d bins)\n", Nc);
+   }
 
-      // Get optimal number of breaks by AIC.
-      newAIC = -INFINITY;
-      for (nbreaks_opt = 1 ; nbreaks_opt < MAXBREAKS ; nbreaks_opt++) {
-         n_params = nbreaks_opt + m*(8 + nbreaks_opt*6);
-         if (newAIC > mllik[nbreaks_opt] - n_params) break;
-         newAIC = mllik[nbreaks_opt] - n_params;
+   tadbit_output *coarse = (tadbit_output *) malloc(sizeof(tadbit_output));
+   tadbit(coarse_obs, coarse_remove, Nc, m, n_threads, verbose, Nc, 0, 0,
+         coarse);
+
+   for (k = 0 ; k < m ; k++) free(coarse_obs[k]);
+   free(coarse_obs);
+
+   // Fall back on the pre-heuristic if the coarse matrix is too small.
+   if (coarse->maxbreaks < 0) {
+      free(coarse);
+      tadbit(obs, remove, n, m, n_threads, verbose, n, nbrks, 0, seg);
+      return;
+   }
+
+   tadbit_state st;
+   if (tadbit_prepare_data(obs, remove, n, m, TADBIT_BIAS_ROWSUMS, NULL,
+            &st)) {
+      destroy_tadbit_output(coarse);
+      seg->maxbreaks = -1;
+      return;
+   }
+   init_llikmat(&st, n_threads);
+
+   allocate_projected_jobs(&st, coarse, factor);
+   destroy_tadbit_output(coarse);
+
+   tadbit_segment(&st, n_threads, verbose, nbrks, seg);
+
+   return;
+
+}
+
+
+void
+shard_diagonals
+(
+  const char *skip,
+  const int n,
+  const int shard,
+  const int n_shards,
+  int *first,
+  int *last
+)
+// SYNOPSIS:
+//   Split the jobs of 'skip' in 'n_shards' bands of consecutive
+//   diagonals of roughly equal cost, and return the band of the
+//   shard 'shard'. The cost of a slice is proportional to its width,
+//   so every job on diagonal 'd' is given the weight 'd+1'.
+//
+// ARGUMENTS:
+//   'skip': the job matrix.
+//   'n': number of rows/columns of 'skip'.
+//   'shard': index of the shard (from 0 to 'n_shards'-1).
+//   'n_shards': total number of shards.
+//        -- output arguments --
+//   'first': first diagonal of the shard.
+//   'last': last diagonal of the shard plus 1 (empty if 'first').
+//
+{
+
+   int i;
+   int d;
+
+   long long *weight = (long long *) malloc(n * sizeof(long long));
+   long long total = 0;
+   for (d = 0 ; d < n ; d++) {
+      weight[d] = 0;
+      for (i = 0 ; i < n-d ; i++)
+         if (!skip[i+(i+d)*n]) weight[d] += d+1;
+      total += weight[d];
+   }
+
+   // Diagonal 'd' belongs to the shard where the cumulated weight
+   // before 'd' falls. Every process computes the same split.
+   *first = *last = n;
+   long long cumul = 0;
+   for (d = 0 ; d < n ; d++) {
+      int s = total ? (int) (n_shards * cumul / total) : 0;
+      if (s > n_shards-1) s = n_shards-1;
+      if (s == shard && *first == n) *first = d;
+      if (s > shard) break;
+      cumul += weight[d];
+   }
+   *last = d;
+   if (*first == n) *last = n;
+
+   free(weight);
+
+}
+
+
+uint64_t
+shard_fingerprint
+(
+  int **obs,
+  const char *remove,
+  const int N,
+  const int m
+)
+// SYNOPSIS:
+//   Checksum (64-bit FNV-1a) of the input matrices and of the
+//   filtered rows/columns, so that 'tadbit_merge' only accepts the
+//   shards computed from the same input.
+//
+// ARGUMENTS:
+//   See 'tadbit' for the description of the arguments.
+//
+// RETURN:
+//   The checksum.
+//
+{
+
+   size_t i;
+   int k;
+   uint64_t h = 0xcbf29ce484222325ULL;
+
+   for (k = 0 ; k < m ; k++) {
+      const unsigned char *c = (const unsigned char *) obs[k];
+      for (i = 0 ; i < (size_t) N*N * sizeof(int) ; i++) {
+         h = (h ^ c[i]) * 0x100000001b3ULL;
       }
-      nbreaks_opt -= 1;
+   }
+   for (i = 0 ; i < (size_t) N ; i++) {
+      h = (h ^ (unsigned char) remove[i]) * 0x100000001b3ULL;
+   }
+
+   return h;
+
+}
+
+
+int
+tadbit_shard
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  int max_tad_size,
+  const int do_not_use_heuristic,
+  const int shard,
+  const int n_shards,
+  const char *outfile
+)
+// SYNOPSIS:
+//   Compute the slice log-likelihoods of one shard of the first
+//   batch of jobs of 'tadbit' and write them to 'outfile'. The job
+//   space is split by bands of diagonals (see 'shard_diagonals') so
+//   that independent processes can compute the shards in parallel.
+//   The shards are assembled by 'tadbit_merge'.
+//
+// ARGUMENTS:
+//   See 'tadbit' for the description of the common arguments.
+//   'shard': index of the shard to compute (from 0 to 'n_shards'-1).
+//   'n_shards': total number of shards.
+//   'outfile': path of the shard file to write.
+//
+// RETURN:
+//   0 on success, -1 otherwise.
+//
+{
 
-      allocate_new_jobs(skip, bkpts, MAXBREAKS, nbreaks_opt, n);
+   if (shard < 0 || shard >= n_shards) {
+      fprintf(stderr, "invalid shard %d of %d\n", shard, n_shards);
+      free(remove);
+      return -1;
+   }
 
+   const int N = n;
+   const uint64_t checksum = shard_fingerprint(obs, remove, N, m);
+   tadbit_state st;
+   if (tadbit_prepare(obs, remove, n, m, n_threads, verbose,
+            max_tad_size, do_not_use_heuristic, TADBIT_BIAS_ROWSUMS, NULL,
+            &st)) {
+      return -1;
    }
+   n = st.n;
 
-   AIC = newAIC;
+   int i;
+   int first;
+   int last;
+   shard_diagonals(st.skip, n, shard, n_shards, &first, &last);
 
-   pthread_mutex_destroy(&tadbit_lock);
-   free(skip);
-   free(tid);
-   free(_cache_index);
+   // Keep only the jobs of the band.
+   for (i = 0 ; i < n*n ; i++) {
+      int d = i/n - i%n;
+      if (d < first || d >= last) st.skip[i] = 1;
+   }
+   char *todo = (char *) malloc(n*n * sizeof(char));
+   int count = 0;
+   for (i = 0 ; i < n*n ; i++) {
+      todo[i] = !st.skip[i];
+      count += todo[i];
+   }
 
-   nbreaks_opt = nbrks ? (int) nbrks - 1 : nbreaks_opt;
+   if (verbose) {
+      fprintf(stderr, "shard %d of %d: diagonals %d to %d (%d slices)\n",
+            shard+1, n_shards, first, last-1, count);
+   }
 
-   // Compute breakpoint confidence by penalized dynamic progamming.
-   double *llikmatcpy = (double *) malloc (n*n * sizeof(double));
-   double *mllikcpy = (double *) malloc(MAXBREAKS * sizeof(double));
-   int *bkptscpy = (int *) malloc(n*MAXBREAKS * sizeof(int));
-   int *passages = (int *) malloc(n * sizeof(int));
-   for (i = 0 ; i < n*MAXBREAKS ; i++) bkptscpy[i] = bkpts[i];
-   for (i = 0 ; i < n*n ; i++) llikmatcpy[i] = llikmat[i];
-   for (i = 0 ; i < n ; i++) passages[i] = 0;
+   int err = tadbit_fill(&st, n_threads, verbose);
 
-   for (l = 0 ; l < 10 ; l++) {
-      i = 0;
-      for (j = 0 ; j < n ; j++) {
-         if (bkptscpy[j+nbreaks_opt*n]) {
-            // Apply a constant penalty every time a TAD is present
-            // in the final decomposition. The penalty is set to
-            // 'm*6' because it is the expected log-likelihood gain
-            // for adding a new TAD around the optimum log-likelihood.
-            llikmatcpy[i+j*n] -= m*6;
-            passages[j] += bkpts[j+nbreaks_opt*n];
-            i = j+1;
-         }
+   FILE *f = err ? NULL : fopen(outfile, "wb");
+   if (f == NULL) {
+      if (!err) fprintf(stderr, "cannot open shard file %s\n", outfile);
+      err = -1;
+   }
+   else {
+      // Header (with the parameters of the run and the checksum of
+      // the input), then one (index, log-likelihood) record per slice.
+      const int header[8] = {N, n, m, shard, n_shards, max_tad_size,
+         do_not_use_heuristic, TADBIT_BIAS_ROWSUMS};
+      fwrite(TADBIT_SHARD_MAGIC, 1, 8, f);
+      fwrite(header, sizeof(int), 8, f);
+      fwrite(&checksum, sizeof(uint64_t), 1, f);
+      fwrite(&count, sizeof(int), 1, f);
+      for (i = 0 ; i < n*n ; i++) {
+         if (!todo[i]) continue;
+         fwrite(&i, sizeof(int), 1, f);
+         fwrite(st.llikmat + i, sizeof(double), 1, f);
+      }
+      if (fclose(f)) {
+         fprintf(stderr, "error writing shard file %s\n", outfile);
+         err = -1;
       }
-      if (i < n) llikmatcpy[i+(n-1)*n] -= m*6;
-      DPwalk(llikmatcpy, n, nbreaks_opt+1, n_threads, mllikcpy, bkptscpy);
    }
-   free(llikmatcpy);
-   free(mllikcpy);
-   free(bkptscpy);
 
-   
-   // Resize output to match original.
-//   int p;
-//   double **resized_weights = (double **) malloc(m * sizeof(double *));
-//   for (l = 0 ; l < m ; l++) {
-//      resized_weights[l] = (double *) malloc(N*N * sizeof(double));
-//      for (i = 0 ; i < N*N ; i++) resized_weights[l][i] = 0.0;
-//   }
-//   for (k = 0 ; k < m ; k++) {
-//      for (l = 0, i = 0 ; i < N ; i++) {
-//         if (remove[i]) continue;
-//         for (p = 0, j = 0 ; j < N ; j++) {
-//            if (remove[j]) continue;
-//            resized_weights[k][i+j*N] = weights[k][l+p*n];
-//	    p++;
-//	 }
-//	 l++;
-//      }
-//   }
-
-   int *resized_bkpts = (int *) malloc(N*MAXBREAKS * sizeof(int));
-   int *resized_passages = (int *) malloc(N * sizeof(int));
-   for (i = 0 ; i < N*MAXBREAKS ; i++) resized_bkpts[i] = 0;
-   for (i = 0 ; i < N ; i++) resized_passages[i] = 0;
+   free(todo);
+   free(st.llikmat);
+   free(st.mllik);
+   free(st.bkpts);
+   destroy_tadbit_state(&st);
 
-   for (l = 0, i = 0 ; i < N ; i++) {
-      if (remove[i]) continue;
-      resized_passages[i] = passages[l];
-      for (j = 0 ; j < MAXBREAKS ; j++)
-         resized_bkpts[i+j*N] = bkpts[l+j*n];
-      l++;
+   return err ? -1 : 0;
+
+}
+
+
+int
+read_shard
+(
+  const char *path,
+  tadbit_state *st,
+  const int *param,
+  const uint64_t checksum,
+  char **seen,
+  int *n_shards
+)
+// SYNOPSIS:
+//   Read a shard file written by 'tadbit_shard' into 'st->llikmat'.
+//
+// ARGUMENTS:
+//   'path': path of the shard file.
+//   'st': state of the run prepared with the same input.
+//   'param': 'max_tad_size', 'do_not_use_heuristic' and bias model
+//      of the run.
+//   'checksum': fingerprint of the input (see 'shard_fingerprint').
+//   'seen': shards read so far (allocated with the first shard and
+//      updated in place).
+//   'n_shards': number of shards (set with the first shard).
+//
+// RETURN:
+//   0 on success, -1 otherwise.
+//
+{
+
+   char magic[8];
+   int header[8];
+   uint64_t sum;
+   int count;
+   int index;
+   double llik;
+
+   FILE *f = fopen(path, "rb");
+   if (f == NULL) {
+      fprintf(stderr, "cannot open shard file %s\n", path);
+      return -1;
+   }
+   // Shard files of older versions have another magic number.
+   if (fread(magic, 1, 8, f) != 8 ||
+         memcmp(magic, TADBIT_SHARD_MAGIC, 8) ||
+         fread(header, sizeof(int), 8, f) != 8 ||
+         fread(&sum, sizeof(uint64_t), 1, f) != 1 ||
+         fread(&count, sizeof(int), 1, f) != 1) {
+      fprintf(stderr, "%s is not a shard file of this version\n", path);
+      fclose(f);
+      return -1;
+   }
+   // The shard must come from the same input and parameters.
+   if (header[0] != st->N || header[1] != st->n || header[2] != st->m ||
+         header[3] < 0 || header[3] >= header[4] || header[4] > st->n ||
+         header[5] != param[0] || header[6] != param[1] ||
+         header[7] != param[2] || sum != checksum) {
+      fprintf(stderr, "shard file %s does not match the input\n", path);
+      fclose(f);
+      return -1;
+   }
+   if (*seen == NULL) {
+      *seen = (char *) calloc(header[4], sizeof(char));
+      if (*seen == NULL) {
+         fprintf(stderr, "cannot allocate memory for the shards\n");
+         fclose(f);
+         return -1;
+      }
+      *n_shards = header[4];
+   }
+   else if (header[4] != *n_shards) {
+      fprintf(stderr, "inconsistent number of shards (%s)\n", path);
+      fclose(f);
+      return -1;
+   }
+   if ((*seen)[header[3]]) {
+      fprintf(stderr, "shard %d read twice (%s)\n", header[3], path);
+      fclose(f);
+      return -1;
+   }
+   (*seen)[header[3]] = 1;
+
+   while (count-- > 0) {
+      if (fread(&index, sizeof(int), 1, f) != 1 ||
+            fread(&llik, sizeof(double), 1, f) != 1 ||
+            index < 0 || (size_t) index >= (size_t) st->n*st->n) {
+         fprintf(stderr, "truncated shard file %s\n", path);
+         fclose(f);
+         return -1;
+      }
+      st->llikmat[index] = llik;
    }
 
-   free(passages);
-   free(bkpts);
+   fclose(f);
+   return 0;
+
+}
+
+
+void
+tadbit_merge
+(
+  // input //
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int n_files,
+  char **shard_files,
+  // output //
+  tadbit_output *seg
+)
+// SYNOPSIS:
+//   Assemble the shard files written by 'tadbit_shard' and finish the
+//   run as 'tadbit' would (dynamic programming, AIC and breakpoint
+//   confidence). The slices of later AIC cycles and those missing
+//   from the shards are computed locally, so the output is identical
+//   to that of 'tadbit' called with the same arguments.
+//
+// ARGUMENTS:
+//   See 'tadbit' for the description of the common arguments.
+//   'n_files': number of shard files.
+//   'shard_files': paths of the shard files.
+//
+{
 
-   double *resized_llikmat = (double *) malloc(N*N * sizeof(double));
-   for (i = 0 ; i < N*N ; i++) {
-      resized_llikmat[i] = NAN;
+   const uint64_t checksum = shard_fingerprint(obs, remove, n, m);
+   const int param[3] = {max_tad_size, do_not_use_heuristic,
+      TADBIT_BIAS_ROWSUMS};
+   tadbit_state st;
+   if (tadbit_prepare(obs, remove, n, m, n_threads, verbose,
+            max_tad_size, do_not_use_heuristic, TADBIT_BIAS_ROWSUMS, NULL,
+            &st)) {
+      seg->maxbreaks = -1;
+      return;
    }
 
-   for (l = 0, i = 0 ; i < N ; i++) {
-      if (remove[i]) continue;
-      for (k = 0, j = 0 ; j < N ; j++) {
-         if (remove[j]) continue;
-         resized_llikmat[i+j*N] = llikmat[l+k*n];
-         k++;
+   int i;
+   int n_shards = 0;
+   char *seen = NULL;
+
+   for (i = 0 ; i < n_files ; i++) {
+      if (read_shard(shard_files[i], &st, param, checksum, &seen,
+               &n_shards)) {
+         free(seen);
+         free(st.llikmat);
+         free(st.mllik);
+         free(st.bkpts);
+         destroy_tadbit_state(&st);
+         seg->maxbreaks = -1;
+         return;
       }
-      l++;
    }
-   free(llikmat);
 
-   for (k = 0 ; k < m ; k++) {
-      free(new_obs[k]);
-      free(log_gamma[k]);
-   }
-   free(new_obs);
-   free(log_gamma);
-   //free(dist);
-   fastlog_free();
-   free(dp);
-   free(remove);
+   if (verbose) {
+      for (i = 0 ; i < n_shards ; i++) {
+         if (!seen[i]) {
+            fprintf(stderr, "shard %d missing: computing it locally\n", i);
+         }
+      }
+   }
+   free(seen);
 
-   // Update output struct.
-   seg->m = m;
-   seg->maxbreaks = MAXBREAKS;
-   seg->nbreaks_opt = nbreaks_opt;
-   seg->passages = resized_passages;
-   seg->llikmat = resized_llikmat;
-   seg->mllik = mllik;
-   seg->bkpts = resized_bkpts;
+   tadbit_segment(&st, n_threads, verbose, nbrks, seg);
 
    return;
 
@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <float.h>
 #include <assert.h>
+#include <string.h>
 #include <pthread.h>
 
 #ifndef _TADBIT_LOADED
@@ -14,30 +15,140 @@
 #define TOLERANCE 1e-6
 #define MAXITER 10000
 
+// Magic number of the shard files (see 'tadbit_shard'). It changes
+// with the format, so that older files are rejected.
+#define TADBIT_SHARD_MAGIC "TADBITS2"
+
+// Bias models of the slice likelihood. The expected count (i,j) is
+// proportional to 'w[i]*w[j]' where 'w' are the row sums of the matrix
+// or externally computed biases (e.g. ICE or KR), or it is not biased.
+#define TADBIT_BIAS_ROWSUMS 0
+#define TADBIT_BIAS_VECTORS 1
+#define TADBIT_BIAS_NONE 2
+
 typedef struct {
    const int n;
    const int m;
+   const int N;                // Row/column number of 'k' if the run
+                               // is mapped (0 if 'k' is compacted).
    const int **k;
    //const double *d;
    const int *dp;
-   //const double **w;
-   const double *w;
+   const double **w;
+   const int bias_model;
    const double **lg;
+   const int first;            // First row/column of the window.
+   const int size;             // Size of the window ('n' for all).
+   const int flank_first;      // Rows of the flanking blocks of
+   const int flank_last;       // the slices.
    const char *skip;
    double *llikmat;
+   double *trimat;             // Triangle terms (or NULL).
    const int verbose;
+   // The task queue is split in 'n_bands' bands of columns (see
+   // 'BAND_START'): worker 'id' takes the jobs of band 'id' first.
+   int id;
+   const int n_bands;
+   int *band_next;             // Next job of each band.
+   const int *band_end;        // End of the jobs of each band.
+   int *n_processed;           // Number of slices processed so far.
+   const int n_to_process;     // Total number of slices to process.
+   pthread_mutex_t *lock;      // Mutex to access task queue.
 } llworker_arg;
 
+// Number of start points per block of the bounds of 'fill_DP'.
+#define DP_BLOCK 16
+
+typedef struct {
+   double bound;
+   int block;
+} dp_bound;
+
 typedef struct {
    const int n;
    const double *llikmat;
-   double *old_llik;
+   const double *old_llik;
    double *new_llik;
+   int *new_bkpt;
    int nbreaks;
-   int *new_bkpt_list;
-   const int *old_bkpt_list;
+   int incremental;            // Whether to update the previous values.
+   const int nb;               // Number of blocks of start points.
+   const double *blkmax;       // Upper bound of the slices of each
+                               // block in each column (or NULL).
+   const double *oldmax;       // Upper bound of 'old_llik' in each
+                               // block.
+   const int *changed;         // Ends of 'old_llik' that have changed.
+   int n_changed;
+   const int *added_start;     // Slices added since the previous
+   const int *added;           // update (compressed by column).
+   char *new_changed;
+   int *taskQ_i;
+   pthread_mutex_t *lock;
 } dpworker_arg;
 
+typedef struct {
+   const int n;
+   const double *llikmat;
+   const int nTADs;            // Number of TADs of the segmentation.
+   int layer;                  // Index of the TAD being placed.
+   double *suffix;             // Best log-lik of the remaining TADs.
+   const double *old_llik;
+   double *new_llik;
+   double *alt_llik;           // Best log-lik without a given break.
+   int *taskQ_i;
+   pthread_mutex_t *lock;
+} cfworker_arg;
+
+
+
+typedef struct {
+   const int n;
+   const int m;
+   const int band;             // Largest diagonal to compute.
+   const int ld;               // Leading dimension of 'obs'.
+   const int **obs;
+   const int *map;             // Rows/columns of 'obs' if the run is
+                               // mapped (NULL if 'obs' is compacted).
+   const double **bias;
+   const int bias_model;
+   double *S;                  // Triangle sums stored by diagonal.
+   double *heur_score;
+   int pass;
+   int *taskQ_i;
+   pthread_mutex_t *lock;
+} hrworker_arg;
+
+typedef struct {
+   const int n;                // Columns of 'llikmat' and 'obs'.
+   const int ld;               // Leading dimension of 'obs'.
+   const int m;
+   const int n_bands;
+   int id;                     // Band written by the worker.
+   double *llikmat;
+   int **obs;                  // Copies of 'old_obs' (or NULL).
+   const int **old_obs;
+   double **log_gamma;
+   const double **old_log_gamma;
+} ftworker_arg;
+
+// First column of band 'b' of 'nb' equal bands of 'n' columns (the
+// band of the workers, see 'init_llikmat').
+#define BAND_START(b, nb, n) ((int) (((long) (b)*(n)) / (nb)))
+
+// Offset of diagonal 'd' in a upper triangular 'n' x 'n' matrix
+// stored by diagonal (main diagonal first).
+#define DIAG_OFFSET(d, n) ((d)*(n) - ((d)*((d)-1))/2)
+
+// Dynamic programming table of 'DPupdate'. Line 'l' of 'llik'
+// contains the best log-likelihood of the segmentations with 'l'
+// breaks ending at a given position, and line 'l' of 'bkpt' the end
+// of the previous TAD (-1 if the breakpoints are those of line 'l'-1).
+typedef struct {
+   int n;
+   int nlayers;                // Number of valid lines.
+   double *llik;
+   int *bkpt;
+} dp_table;
 
 
 // 'tadbit' output struct.
@@ -52,6 +163,51 @@ typedef struct {
 } tadbit_output;
 
 
+// Boundary tree of 'tadbit_nested'. Node 0 is the whole matrix, the
+// nodes of level 1 are the TADs and the nodes of the next levels are
+// the sub-TADs found inside the nodes of the previous level. The
+// nodes are sorted by level and the children of a node are
+// consecutive.
+typedef struct {
+   int n_nodes;
+   int *start;
+   int *end;
+   int *parent;                // -1 for the root.
+   int *level;
+   int *score;                 // Confidence of the boundary at 'end'
+                               // (0 if it is the end of the parent).
+} tadbit_tree;
+
+
+// State of a 'tadbit' run after removal of the filtered rows/columns.
+typedef struct {
+   int N;
+   int n;
+   int m;
+   int MAXBREAKS;
+   char *remove;
+   // The observations and the log-gamma terms have 'ld' rows (all
+   // the rows that are not removed) and the 'n' columns starting at
+   // 'first'. Unless the run is focused on a region (see
+   // 'tadbit_focus'), 'ld' is 'n' and 'first' is 0.
+   int ld;
+   int first;
+   int **obs;
+   double **log_gamma;
+   // Whether 'obs' are the input matrices, read in place through 'dp'
+   // ('log_gamma' is then NULL, see 'tadbit_map_data').
+   int mapped;
+   int bias_model;
+   double **bias;              // NULL for 'TADBIT_BIAS_NONE'.
+   int *dp;
+   char *skip;
+   double *llikmat;
+   double *trimat;             // Only for 'tadbit_nested' (not focused).
+   double *mllik;
+   int *bkpts;
+} tadbit_state;
+
+
 
 void
 tadbit(
@@ -71,8 +227,181 @@ tadbit(
 );
 
 
+void
+tadbit_bias(
+  /* input */
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
+  /* output */
+  tadbit_output *seg
+);
+
+
+void
+tadbit_focus(
+  /* input */
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
+  const int start,
+  const int end,
+  /* output */
+  tadbit_output *seg
+);
+
+
+void
+tadbit_mapped(
+  /* input */
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
+  /* output */
+  tadbit_output *seg
+);
+
+
+int *
+map_tadbit_matrix(
+  const char *path,
+  int *n
+);
+
+
+int *
+map_tadbit_matrix_fd(
+  const int fd,
+  int *n
+);
+
+
+void
+unmap_tadbit_matrix(
+  int *obs,
+  const int n
+);
+
+
+void
+tadbit_nested(
+  /* input */
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int bias_model,
+  double **bias,
+  const int max_level,
+  /* output */
+  tadbit_output *seg,
+  tadbit_tree *tree
+);
+
+
+void
+tadbit_multires(
+  /* input */
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int factor,
+  const int nbrks,
+  /* output */
+  tadbit_output *seg
+);
+
+
+int
+tadbit_shard(
+  /* input */
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int do_not_use_heuristic,
+  const int shard,
+  const int n_shards,
+  const char *outfile
+);
+
+
+void
+tadbit_merge(
+  /* input */
+  int **obs,
+  char *remove,
+  int n,
+  const int m,
+  int n_threads,
+  const int verbose,
+  const int max_tad_size,
+  const int nbrks,
+  const int do_not_use_heuristic,
+  const int n_files,
+  char **shard_files,
+  /* output */
+  tadbit_output *seg
+);
+
+
+int
+tadbit_cpu_count(void);
+
+
+int
+create_worker(
+  pthread_t *tid,
+  const int i,
+  const int n_workers,
+  void *(*fn)(void *),
+  void *arg
+);
+
+
 void
 destroy_tadbit_output(
    tadbit_output *seg
 );
+
+
+void
+destroy_tadbit_tree(
+   tadbit_tree *tree
+);
 #endif
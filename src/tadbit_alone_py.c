@@ -1,9 +1,14 @@
 
 // testing:
-// gcc -shared tadbit_py.c -I/usr/include/python2.7 -lm -lpthread -std=gnu99 -fPIC -g -O3 -Wall -o tadbit_py.so
+// gcc -shared tadbit_alone_py.c -I/usr/include/python2.7 -lm -lpthread -std=gnu99 -fPIC -g -O3 -Wall -o tadbitalone_py.so
+
+// The stand-alone engine has been merged into 'tadbit.c'. This module
+// keeps the interface of the old one: the columns to remove are the
+// ones with 0 in the diagonal of any matrix, and the weights (products
+// of the row sums) are returned with the segmentation.
 
 #include "Python.h"
-#include "tadbit_alone.c"
+#include "tadbit.c"
 
 /* The module doc string */
 PyDoc_STRVAR(tadbitalone_py__doc__,
@@ -11,7 +16,7 @@ PyDoc_STRVAR(tadbitalone_py__doc__,
 
 /* The function doc string */
 PyDoc_STRVAR(_tadbitalone_wrapper__doc__,
-"Run tadbit function in tadbitalone.c.\n\
+"Run tadbit function in tadbit.c and return the weights.\n\
     :argument obs: a python list of lists of floats, representing a list of linearized matrices.\n\
     :argument 0 n: number of rows or columns in the matrix\n\
     :argument 0 m: number of matrices\n\
@@ -24,23 +29,20 @@ PyDoc_STRVAR(_tadbitalone_wrapper__doc__,
 
 /* The wrapper to the underlying C function */
 static PyObject *_tadbitalone_wrapper (PyObject *self, PyObject *args){
-  PyObject **obs;
+  PyObject *obs;
   int n;
   int m;
   int n_threads;
-  const int verbose;
-  const int max_tad_size;
-  const int nbks;
-  const int do_not_use_heuristic;
-  /* output */
-  tadbit_alone_output *seg = (tadbit_alone_output *) malloc(sizeof(tadbit_alone_output));
+  int verbose;
+  int max_tad_size;
+  int nbks;
+  int do_not_use_heuristic;
 
   if (!PyArg_ParseTuple(args, "Oiiiiiii:tadbitalone", &obs, &n, &m, &n_threads, &verbose, &max_tad_size, &nbks, &do_not_use_heuristic))
     return NULL;
 
   // convert list of lists to pointer o pointers
-  // if something goes wrong, it is probably from there :S
-  int i, j;
+  int i, j, k;
   int ** list;
   list = malloc(m * sizeof(int*));
   for (i = 0 ; i < m ; i++ )
@@ -49,17 +51,50 @@ static PyObject *_tadbitalone_wrapper (PyObject *self, PyObject *args){
     for (j = 0 ; j < n*n ; j++)
       list[i][j] = PyInt_AS_LONG(PyTuple_GET_ITEM(PyList_GET_ITEM(obs, i), j));
 
-  // run tadbit
-  tadbit_alone(list, n, m, n_threads, verbose, max_tad_size, nbks, do_not_use_heuristic, seg);
+  // Remove line and column if 0 on the diagonal (of any matrix). Both
+  // copies are freed by the engine.
+  char *remove = (char *) malloc(n * sizeof(char));
+  char *remove_w = (char *) malloc(n * sizeof(char));
+  for (i = 0 ; i < n ; i++) {
+    remove[i] = 0;
+    for (k = 0 ; k < m ; k++)
+      if (list[k][i+i*n] < 1) remove[i] = 1;
+    remove_w[i] = remove[i];
+  }
+
+  // Weights: products of the row sums of the compacted matrices.
+  double **weights = malloc(m * sizeof(double *));
+  for (k = 0 ; k < m ; k++) {
+    weights[k] = malloc(n*n * sizeof(double));
+    for (i = 0 ; i < n*n ; i++) weights[k][i] = 0.0;
+  }
+  tadbit_state st;
+  if (!tadbit_prepare_data(list, remove_w, n, m, TADBIT_BIAS_ROWSUMS,
+                           NULL, &st)) {
+    for (k = 0 ; k < m ; k++)
+      for (j = 0 ; j < st.n ; j++)
+        for (i = 0 ; i < st.n ; i++)
+          weights[k][st.dp[i]+st.dp[j]*n] = st.bias[k][i]*st.bias[k][j];
+    free(st.llikmat);
+    free(st.mllik);
+    free(st.bkpts);
+    destroy_tadbit_state(&st);
+  }
 
-  // store each tadbit output
-  int       mbreaks     = seg->maxbreaks;
-  int       nbreaks_opt = seg->nbreaks_opt;
-  int    *  passages    = seg->passages;
-  double *  llikmat     = seg->llikmat;
-  double ** weights     = seg->weights;
-  double *  mllik       = seg->mllik;
-  int    *  bkpts       = seg->bkpts;
+  // run tadbit
+  tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+  tadbit(list, remove, n, m, n_threads, verbose, max_tad_size, nbks, do_not_use_heuristic, seg);
+  if (seg->maxbreaks < 0) {
+    for (k = 0 ; k < m ; k++) {
+      free(list[k]);
+      free(weights[k]);
+    }
+    free(list);
+    free(weights);
+    free(seg);
+    PyErr_SetString(PyExc_ValueError, "too few rows/columns after removal");
+    return NULL;
+  }
 
   // declare python objects to store lists
   PyObject * py_bkpts;
@@ -71,33 +106,20 @@ static PyObject *_tadbitalone_wrapper (PyObject *self, PyObject *args){
   PyObject * temp;
 
   // get bkpts
-  /* int dim = nbreaks_opt*n; */
-  const int MAXBREAKS = nbks ? nbks : n/5;
-  int dim = MAXBREAKS * n;
+  int dim = seg->maxbreaks * n;
   py_bkpts = PyList_New(dim);
   for(i = 0 ; i < dim; i++)
-    PyList_SetItem(py_bkpts, i, PyInt_FromLong(bkpts[i]));
-
-  /* This is to return directly the list of breaks found
-  j = 0;
-  py_bkpts = PyList_New(nbreaks_opt);
-  for(i = 0 ; i < n; i++){
-    if (bkpts[i+dim]==1){
-      PyList_SetItem(py_bkpts, j, PyInt_FromLong(i));
-      j++;
-    }
-  }
-  */
+    PyList_SetItem(py_bkpts, i, PyInt_FromLong(seg->bkpts[i]));
 
   // get passages
   py_passages = PyList_New(n);
   for(i = 0 ; i < n; i++)
-    PyList_SetItem(py_passages, i, PyFloat_FromDouble(passages[i]));
+    PyList_SetItem(py_passages, i, PyFloat_FromDouble(seg->passages[i]));
 
   // get llikmat
   py_llikmat = PyList_New(n*n);
   for(i = 0 ; i < n*n; i++)
-    PyList_SetItem(py_llikmat, i, PyFloat_FromDouble(llikmat[i]));
+    PyList_SetItem(py_llikmat, i, PyFloat_FromDouble(seg->llikmat[i]));
 
   // get weights
   py_weights = PyList_New(m);
@@ -110,15 +132,15 @@ static PyObject *_tadbitalone_wrapper (PyObject *self, PyObject *args){
   }
 
   // get mllik
-  py_mllik = PyList_New(mbreaks);
-  for(i = 0 ; i < mbreaks ; i++)
-    PyList_SetItem(py_mllik, i, PyFloat_FromDouble(mllik[i]));
+  py_mllik = PyList_New(seg->maxbreaks);
+  for(i = 0 ; i < seg->maxbreaks ; i++)
+    PyList_SetItem(py_mllik, i, PyFloat_FromDouble(seg->mllik[i]));
 
   // group results into a python list
   py_result = PyList_New(7);
 
-  PyList_SetItem(py_result, 0, PyInt_FromLong(mbreaks));
-  PyList_SetItem(py_result, 1, PyInt_FromLong(nbreaks_opt));
+  PyList_SetItem(py_result, 0, PyInt_FromLong(seg->maxbreaks));
+  PyList_SetItem(py_result, 1, PyInt_FromLong(seg->nbreaks_opt));
   PyList_SetItem(py_result, 2, py_passages);
   PyList_SetItem(py_result, 3, py_llikmat);
   PyList_SetItem(py_result, 4, py_mllik);
@@ -126,27 +148,13 @@ static PyObject *_tadbitalone_wrapper (PyObject *self, PyObject *args){
   PyList_SetItem(py_result, 6, py_weights);
 
   // free many things... no leaks here!!
-  // TODO: use 'destroy_tadbit_output'
-  free(seg);
-  free(passages);
-  free(llikmat);
-  int k;
+  destroy_tadbit_output(seg);
   for (k = 0 ; k < m ; k++){
-    //free(obs[k]);
     free(weights[k]);
     free(list[k]);
   }
-  //free(obs);
   free(weights);
   free(list);
-  free(mllik);
-  free(bkpts);
-  //free(py_bkpts);
-  //free(py_llikmat);
-  //free(py_mllik);
-  //free(py_result);
-  //free(py_passages);
-  //free(py_weights);
 
   return py_result;
 }
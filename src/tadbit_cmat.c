@@ -0,0 +1,424 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "tadbit_cmat.h"
+
+
+int
+is_tadbit_cmat(
+  const char *path
+){
+// SYNOPSIS:
+//   Check whether a file is a contact-matrix container (the file
+//   starts with 'TADBIT_CMAT_MAGIC').
+//
+
+   char magic[8];
+   FILE *f = fopen(path, "rb");
+   if (f == NULL) return 0;
+   const int is_cmat = fread(magic, 1, 8, f) == 8 &&
+      !memcmp(magic, TADBIT_CMAT_MAGIC, 8);
+   fclose(f);
+   return is_cmat;
+
+}
+
+
+int
+write_tadbit_cmat(
+  const char *path,
+  const int *obs,
+  const int n,
+  const int band,
+  const int block,
+  const int compressed,
+  const int resolution,
+  const int n_chrom,
+  const char **chrom_names,
+  const int *chrom_sizes,
+  const double *bias
+){
+// SYNOPSIS:
+//   Write a symmetric contact matrix to a container (see
+//   'tadbit_cmat.h' for the format).
+//
+// PARAMETERS:
+//   'path': path to the container.
+//   'obs': the counts (row 'i' starts at 'i*n'), only the upper
+//      triangle is read.
+//   'n': number of rows/columns of the matrix.
+//   'band': number of diagonals to store (all if not in 1 to 'n').
+//   'block': number of counts per block (4096 if not positive).
+//   'compressed': whether to compress the blocks.
+//   'resolution': size of the bins (bp, 0 if unknown).
+//   'n_chrom', 'chrom_names', 'chrom_sizes': chromosomes of the
+//      matrix, in order, and their number of bins (the sum must be
+//      'n', or 'n_chrom' is 0).
+//   'bias': bias of each row/column, or NULL.
+//
+// RETURN:
+//   0 on success, -1 if the file cannot be written.
+//
+
+   int i;
+   int d;
+   int b;
+
+   const int nd = band > 0 && band <= n ? band : n;
+   const int bs = block > 0 ? block : 4096;
+
+   int total = 0;
+   for (i = 0 ; i < n_chrom ; i++) total += chrom_sizes[i];
+   if (n < 1 || (n_chrom > 0 && total != n)) {
+      fprintf(stderr, "invalid dimensions for container %s\n", path);
+      return -1;
+   }
+
+   FILE *f = fopen(path, "wb");
+   if (f == NULL) {
+      fprintf(stderr, "cannot open container %s\n", path);
+      return -1;
+   }
+
+   tadbit_cmat_header header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, TADBIT_CMAT_MAGIC, 8);
+   header.version = TADBIT_CMAT_VERSION;
+   header.n = n;
+   header.band = nd;
+   header.block = bs;
+   header.compressed = compressed ? 1 : 0;
+   header.resolution = resolution;
+   header.n_chrom = n_chrom;
+   header.has_bias = bias != NULL;
+   header.data = sizeof(tadbit_cmat_header) +
+      n_chrom * sizeof(tadbit_cmat_chrom) +
+      (bias != NULL ? n * sizeof(double) : 0);
+   // The index is written after the data, the header is rewritten.
+   fwrite(&header, sizeof(header), 1, f);
+
+   for (total = 0, i = 0 ; i < n_chrom ; i++) {
+      tadbit_cmat_chrom chrom;
+      memset(&chrom, 0, sizeof(chrom));
+      strncpy(chrom.name, chrom_names[i], sizeof(chrom.name)-1);
+      chrom.first = total;
+      chrom.size = chrom_sizes[i];
+      total += chrom_sizes[i];
+      fwrite(&chrom, sizeof(chrom), 1, f);
+   }
+   if (bias != NULL) fwrite(bias, sizeof(double), n, f);
+
+   // Number of blocks of each diagonal.
+   int64_t *diag = (int64_t *) malloc((nd+1) * sizeof(int64_t));
+   diag[0] = 0;
+   for (d = 0 ; d < nd ; d++) diag[d+1] = diag[d] + (n-d + bs-1) / bs;
+   const int64_t nblocks = diag[nd];
+
+   int64_t *offset = (int64_t *) malloc((nblocks+1) * sizeof(int64_t));
+   int32_t *buffer = (int32_t *) malloc(bs * sizeof(int32_t));
+   uLongf bound = compressBound(bs * sizeof(int32_t));
+   Bytef *packed = (Bytef *) malloc(bound);
+
+   int err = 0;
+   int64_t k = 0;
+   offset[0] = 0;
+   for (d = 0 ; d < nd && !err ; d++) {
+      for (b = 0 ; b*bs < n-d ; b++, k++) {
+         const int first = b*bs;
+         const int size = n-d-first < bs ? n-d-first : bs;
+         for (i = 0 ; i < size ; i++) {
+            buffer[i] = obs[(size_t) (first+i)*n + first+i+d];
+         }
+         uLongf len = size * sizeof(int32_t);
+         const Bytef *out = (const Bytef *) buffer;
+         if (compressed) {
+            len = bound;
+            if (compress2(packed, &len, (const Bytef *) buffer,
+                     size * sizeof(int32_t), Z_DEFAULT_COMPRESSION) != Z_OK) {
+               err = 1;
+               break;
+            }
+            out = packed;
+         }
+         if (fwrite(out, 1, len, f) != len) {
+            err = 1;
+            break;
+         }
+         offset[k+1] = offset[k] + len;
+      }
+   }
+
+   if (!err) {
+      header.index = header.data + offset[nblocks];
+      if (fwrite(diag, sizeof(int64_t), nd+1, f) != nd+1 ||
+            fwrite(offset, sizeof(int64_t), nblocks+1, f) != nblocks+1 ||
+            fseek(f, 0, SEEK_SET) ||
+            fwrite(&header, sizeof(header), 1, f) != 1) {
+         err = 1;
+      }
+   }
+   if (fclose(f)) err = 1;
+   if (err) fprintf(stderr, "error writing container %s\n", path);
+
+   free(diag);
+   free(offset);
+   free(buffer);
+   free(packed);
+
+   return err ? -1 : 0;
+
+}
+
+
+tadbit_cmat *
+open_tadbit_cmat(
+  const char *path
+){
+// SYNOPSIS:
+//   Map a container in memory. Nothing is read until the counts
+//   are fetched, and the pages are shared by all the processes that
+//   map the same file.
+//
+// RETURN:
+//   The mapped container, or 'NULL' if the file cannot be mapped or
+//   is not a valid container.
+//
+
+   const int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "cannot open container %s\n", path);
+      return NULL;
+   }
+   struct stat sb;
+   if (fstat(fd, &sb) || sb.st_size < (off_t) sizeof(tadbit_cmat_header)) {
+      fprintf(stderr, "%s is not a container\n", path);
+      close(fd);
+      return NULL;
+   }
+   const size_t size = sb.st_size;
+   void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+   // The mapping stays valid after the file is closed.
+   close(fd);
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "cannot map container %s\n", path);
+      return NULL;
+   }
+
+   const char *base = (const char *) map;
+   const tadbit_cmat_header *header = (const tadbit_cmat_header *) map;
+   int valid = !memcmp(header->magic, TADBIT_CMAT_MAGIC, 8) &&
+      header->version == TADBIT_CMAT_VERSION &&
+      header->n > 0 && header->band > 0 && header->band <= header->n &&
+      header->block > 0 && header->n_chrom >= 0 &&
+      header->data >= (int64_t) (sizeof(tadbit_cmat_header) +
+            header->n_chrom * sizeof(tadbit_cmat_chrom) +
+            (header->has_bias ? header->n * sizeof(double) : 0)) &&
+      header->index >= header->data &&
+      header->index + (int64_t) ((header->band+1) * sizeof(int64_t)) <=
+            (int64_t) size;
+   if (valid) {
+      // The index must fit in the file and point inside the data.
+      const int64_t *diag = (const int64_t *) (base + header->index);
+      const int64_t nblocks = diag[header->band];
+      valid = diag[0] == 0 && nblocks > 0 && header->index +
+         (int64_t) ((header->band+1 + nblocks+1) * sizeof(int64_t)) <=
+         (int64_t) size && diag[header->band+1 + nblocks] ==
+         header->index - header->data;
+      const int64_t *offset = diag + header->band+1;
+      int64_t k;
+      for (k = 0 ; k < header->band && valid ; k++) {
+         valid = diag[k+1]-diag[k] ==
+            (header->n-k + header->block-1) / header->block;
+      }
+      if (valid) valid = offset[0] == 0;
+      for (k = 0 ; k < nblocks && valid ; k++) {
+         valid = offset[k] <= offset[k+1];
+      }
+      // Uncompressed diagonals are read in place.
+      for (k = 0 ; k < header->band && valid && !header->compressed ; k++) {
+         valid = offset[diag[k+1]]-offset[diag[k]] ==
+            (int64_t) ((header->n-k) * sizeof(int32_t));
+      }
+   }
+   if (!valid) {
+      fprintf(stderr, "%s is not a valid container\n", path);
+      munmap(map, size);
+      return NULL;
+   }
+
+   tadbit_cmat *cm = (tadbit_cmat *) malloc(sizeof(tadbit_cmat));
+   cm->n = header->n;
+   cm->band = header->band;
+   cm->block = header->block;
+   cm->compressed = header->compressed;
+   cm->resolution = header->resolution;
+   cm->n_chrom = header->n_chrom;
+   cm->chrom = (const tadbit_cmat_chrom *)
+      (base + sizeof(tadbit_cmat_header));
+   cm->bias = header->has_bias ? (const double *) (base +
+         sizeof(tadbit_cmat_header) +
+         header->n_chrom * sizeof(tadbit_cmat_chrom)) : NULL;
+   cm->diag = (const int64_t *) (base + header->index);
+   cm->offset = cm->diag + cm->band+1;
+   cm->data = base + header->data;
+   cm->map = map;
+   cm->size = size;
+
+   return cm;
+
+}
+
+
+void
+close_tadbit_cmat(
+  tadbit_cmat *cm
+){
+   munmap(cm->map, cm->size);
+   free(cm);
+}
+
+
+const int *
+tadbit_cmat_band(
+  const tadbit_cmat *cm,
+  const int d
+){
+// SYNOPSIS:
+//   Direct access to a diagonal of an uncompressed container (the
+//   blocks of a diagonal are contiguous).
+//
+// RETURN:
+//   A pointer to the 'n'-'d' counts of the diagonal 'd' in the
+//   mapping, or 'NULL' if the container is compressed or the
+//   diagonal is not stored.
+//
+
+   if (cm->compressed || d < 0 || d >= cm->band) return NULL;
+   return (const int *) (cm->data + cm->offset[cm->diag[d]]);
+
+}
+
+
+int
+tadbit_cmat_diagonal(
+  const tadbit_cmat *cm,
+  const int d,
+  const int first,
+  const int last,
+  int *out
+){
+// SYNOPSIS:
+//   Read the counts ('i','i'+'d') of a diagonal for 'i' = 'first' to
+//   'last', decompressing only the blocks that overlap them. The
+//   diagonals that are not stored are 0. Several threads can read
+//   the same container.
+//
+// RETURN:
+//   0 on success, -1 if the range is invalid or a block is corrupt.
+//
+
+   if (d < 0 || first < 0 || last >= cm->n-d || last < first) return -1;
+   if (d >= cm->band) {
+      memset(out, 0, (last-first+1) * sizeof(int));
+      return 0;
+   }
+
+   const int bs = cm->block;
+   const int64_t *offset = cm->offset + cm->diag[d];
+
+   if (!cm->compressed) {
+      memcpy(out, cm->data + offset[0] + first * sizeof(int32_t),
+            (last-first+1) * sizeof(int32_t));
+      return 0;
+   }
+
+   int32_t *buffer = (int32_t *) malloc(bs * sizeof(int32_t));
+   int b;
+   int err = 0;
+   for (b = first / bs ; b <= last / bs ; b++) {
+      const int start = b*bs;
+      const int size = cm->n-d-start < bs ? cm->n-d-start : bs;
+      uLongf len = size * sizeof(int32_t);
+      if (uncompress((Bytef *) buffer, &len,
+               (const Bytef *) (cm->data + offset[b]),
+               offset[b+1] - offset[b]) != Z_OK ||
+            len != size * sizeof(int32_t)) {
+         err = 1;
+         break;
+      }
+      const int lo = first > start ? first : start;
+      const int hi = last < start+size-1 ? last : start+size-1;
+      memcpy(out + lo-first, buffer + lo-start, (hi-lo+1) * sizeof(int32_t));
+   }
+   free(buffer);
+
+   return err ? -1 : 0;
+
+}
+
+
+int
+tadbit_cmat_fetch(
+  const tadbit_cmat *cm,
+  const int row0,
+  const int row1,
+  const int col0,
+  const int col1,
+  int *out
+){
+// SYNOPSIS:
+//   Read the counts of the rows 'row0' to 'row1' and columns 'col0'
+//   to 'col1' of a container (e.g. a region with 'row0' = 'col0' and
+//   'row1' = 'col1', or a set of whole rows). Only the stored
+//   diagonals that cross the rectangle are read.
+//
+// PARAMETERS:
+//        -- output arguments --
+//   'out': the counts, row by row ('(row1-row0+1)*(col1-col0+1)').
+//
+// RETURN:
+//   0 on success, -1 if the rectangle is invalid or a block is
+//   corrupt.
+//
+
+   if (row0 < 0 || col0 < 0 || row1 < row0 || col1 < col0 ||
+         row1 >= cm->n || col1 >= cm->n) return -1;
+
+   const int nrow = row1-row0+1;
+   const int ncol = col1-col0+1;
+   memset(out, 0, (size_t) nrow*ncol * sizeof(int));
+
+   int *buffer = (int *) malloc((nrow > ncol ? nrow : ncol) * sizeof(int));
+   int d;
+   int i;
+   int err = 0;
+   for (d = 0 ; d < cm->band && !err ; d++) {
+      // Above the diagonal: (i,i+d) for i in the rows and i+d in
+      // the columns.
+      int lo = row0 > col0-d ? row0 : col0-d;
+      int hi = row1 < col1-d ? row1 : col1-d;
+      if (lo <= hi) {
+         if (tadbit_cmat_diagonal(cm, d, lo, hi, buffer)) err = 1;
+         for (i = lo ; i <= hi && !err ; i++) {
+            out[(size_t) (i-row0)*ncol + i+d-col0] = buffer[i-lo];
+         }
+      }
+      if (d == 0 || err) continue;
+      // Below the diagonal: (j+d,j) for j in the columns and j+d in
+      // the rows.
+      lo = col0 > row0-d ? col0 : row0-d;
+      hi = col1 < row1-d ? col1 : row1-d;
+      if (lo <= hi) {
+         if (tadbit_cmat_diagonal(cm, d, lo, hi, buffer)) err = 1;
+         for (i = lo ; i <= hi && !err ; i++) {
+            out[(size_t) (i+d-row0)*ncol + i-col0] = buffer[i-lo];
+         }
+      }
+   }
+   free(buffer);
+
+   return err ? -1 : 0;
+
+}
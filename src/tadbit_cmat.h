@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _TADBIT_CMAT_LOADED
+#define _TADBIT_CMAT_LOADED
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+// Binary container of binned contact matrices. The matrix is
+// symmetric and stored by diagonal: diagonal 'd' holds the counts
+// (i,i+d) for i = 0 to n-d-1, and only the first 'band' diagonals
+// are stored (the counts further from the diagonal are 0). The
+// diagonals are cut in blocks of 'block' counts, each optionally
+// compressed with zlib, so that any band or region is read without
+// parsing and by decompressing only the blocks that overlap it.
+//
+// Layout (native byte order, offsets from the start of the file):
+//   header             'tadbit_cmat_header' (64 bytes)
+//   chromosomes        'n_chrom' x 'tadbit_cmat_chrom' (64 bytes each)
+//   biases             'n' doubles (if 'has_bias')
+//   data               the blocks, diagonal by diagonal
+//   index (at 'index') 'band'+1 int64: first block of each diagonal,
+//                      then nblocks+1 int64: offset of each block
+//                      from 'data' (the last is the size of 'data')
+#define TADBIT_CMAT_MAGIC "TADBITCM"
+#define TADBIT_CMAT_VERSION 1
+
+typedef struct {
+   char magic[8];
+   int32_t version;
+   int32_t n;                  // Number of bins.
+   int32_t band;               // Number of diagonals stored.
+   int32_t block;              // Counts per block.
+   int32_t compressed;
+   int32_t resolution;         // Size of the bins (bp).
+   int32_t n_chrom;
+   int32_t has_bias;
+   int64_t data;
+   int64_t index;
+   int64_t reserved;
+} tadbit_cmat_header;
+
+typedef struct {
+   char name[56];
+   int32_t first;              // First bin of the chromosome.
+   int32_t size;               // Number of bins.
+} tadbit_cmat_chrom;
+
+// Memory-mapped container (see 'open_tadbit_cmat'). All the pointers
+// point to the mapping.
+typedef struct {
+   int n;
+   int band;
+   int block;
+   int compressed;
+   int resolution;
+   int n_chrom;
+   const tadbit_cmat_chrom *chrom;
+   const double *bias;         // NULL if there are no biases.
+   const int64_t *diag;
+   const int64_t *offset;
+   const char *data;
+   void *map;
+   size_t size;
+} tadbit_cmat;
+
+
+int
+is_tadbit_cmat(
+  const char *path
+);
+
+
+int
+write_tadbit_cmat(
+  const char *path,
+  const int *obs,
+  const int n,
+  const int band,
+  const int block,
+  const int compressed,
+  const int resolution,
+  const int n_chrom,
+  const char **chrom_names,
+  const int *chrom_sizes,
+  const double *bias
+);
+
+
+tadbit_cmat *
+open_tadbit_cmat(
+  const char *path
+);
+
+
+void
+close_tadbit_cmat(
+  tadbit_cmat *cm
+);
+
+
+const int *
+tadbit_cmat_band(
+  const tadbit_cmat *cm,
+  const int d
+);
+
+
+int
+tadbit_cmat_diagonal(
+  const tadbit_cmat *cm,
+  const int d,
+  const int first,
+  const int last,
+  int *out
+);
+
+
+int
+tadbit_cmat_fetch(
+  const tadbit_cmat *cm,
+  const int row0,
+  const int row1,
+  const int col0,
+  const int col1,
+  int *out
+);
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif
@@ -0,0 +1,259 @@
+// Template of the slice log-likelihood 'll' and its subroutine 'fg'.
+// This file is included by 'tadbit.c' once per bias model and layout
+// of the counts, with the macros 'LLIK_NAME(f)' (name of the instance
+// of function 'f'), 'BIAS(w, i, j)' (bias of the count (i,j) given the
+// bias vector 'w'), 'OBS(k, i, j)' (count (i,j) of 'k') and
+// 'LGAMMA(lg, k, i, j)' (log-gamma term of the count (i,j)) defined.
+// The model is thus resolved at compile time and the inner loops have
+// no branching. There is no include guard on purpose.
+
+void
+LLIK_NAME(fg)(
+  // input //
+  const int    n,
+  const int    i_,
+  const int    _i,
+  const int    j_,
+  const int    _j,
+  const int    diag,
+  const int    *k,
+  //const double *d,
+  const int    *dp,
+  const double *w,
+  const double a,
+  const double b,
+  const double da,
+  const double db,
+        double *c,
+  // output //
+        double *f,
+        double *g
+){
+// SYNOPSIS:                                                            
+//   Subroutine of 'll' that computes 'f' and 'g' for Newton-Raphson    
+//   cycles.                                                            
+//                                                                      
+// ARGUMENTS:                                                           
+//   See the function 'll' for the description of 'n', 'i_', '_i',      
+//      'j_', '_j', 'diag', 'k', 'dp', and 'w'.
+//   'a': parameter 'a' of the Poisson regression (see 'poiss_reg').    
+//   'b': parameter 'b' of the Poisson regression (see 'poiss_reg').    
+//   'da': computed differential of 'a' (see 'poiss_reg').              
+//   'db': computed differential of 'b' (see 'poiss_reg').              
+//        -- output arguments --                                        
+//   'f': first function to zero, recomputed by the routine.            
+//   'g': second function to zero, recomputed by the routine.           
+//   'c': address of an array of double for caching.                    
+//                                                                      
+// RETURN:                                                              
+//   'void'                                                             
+//                                                                      
+// SIDE-EFFECTS:                                                        
+//   Update 'f' and 'g' in place.                                       
+//                                                                      
+
+   // 'tmp' is a computation intermediate that will be the return
+   // value of 'exp'. This can call '__slowexp' which on 64-bit machines
+   // can return a long double (causing segmentation fault if 'tmp' is
+   // declared as long).
+   long double tmp;
+   int i;
+   int j;
+   int i_low = i_;
+   int i_high = -1;
+   int j_low = diag ? j_+1 : j_;
+   int j_high = _j+1;
+   int index;
+
+   *f = 0.0; *g = 0.0;
+   // Initialize cache.
+   for (index = 0 ; index <= max_dist(dp, i_, _i, j_, _j) ; index++)
+      c[index] = NAN;
+
+   for (j = j_low ; j < j_high ; j++) {
+      i_high = diag ? j : _i+1;
+      for (i = i_low ; i < i_high ; i++) {
+         // Retrieve value of the exponential from cache.
+         index = abs(dp[i]-dp[j]);
+         if (c[index] != c[index]) {
+            //c[index] = exp(a+da+(b+db)*d[i+j*n]);
+        	//c[index] = exp(a+da+(b+db)*log(abs(dp[i]-dp[j])));
+        	c[index] = exp(a+da+(b+db)*fastlog(abs(dp[i]-dp[j])));
+         }
+         //tmp  =  w[i+j*n] * c[index] - k[i+j*n];
+         tmp  =  BIAS(w, i, j) * c[index] - OBS(k, i, j);
+         *f  +=  tmp;
+         //*g  +=  tmp * d[i+j*n];
+         //*g  +=  tmp * log(abs(dp[i]-dp[j]));
+         *g  +=  tmp * fastlog(abs(dp[i]-dp[j]));
+      }
+   }
+
+   return;
+
+}
+
+double
+LLIK_NAME(ll)(
+  const int    n,
+  const int    i_,
+  const int    _i,
+  const int    j_,
+  const int    _j,
+  const int    diag,
+  const int    *k,
+  //const double *d,
+  const int    *dp,
+  const double *w,
+  const double *lg,
+        double *c
+){
+// SYNOPSIS:                                                            
+//   The fitted model (by maximum likelihood) is Poisson with lambda    
+//   paramter such that lambda = w * exp(a + b*d). So the full          
+//   log-likelihood of the model is the sum of terms                    
+//                                                                      
+//      - w_i exp(a + b*d_i) + k_i(log(w_i) + a + b*d_i) - log(k_i!)    
+//                                                                      
+// ARGUMENTS:                                                           
+//   'n': row/column number of the counts (leading dimension of 'k'     
+//      and 'lg').                                                      
+//   'i_': first value of index i (row).                                
+//   '_i': last value of index i (row).                                 
+//   'j_': first value of index j (column).                             
+//   '_j': last value of index j (column).                              
+//   'diag': whether the block is half-diagonal (middle block).         
+//   'k': raw hiC counts.                                               
+//   'dp': array with the index of columns that are not removed (in
+//      mapped runs, the counts are read through it, see 'OBS').
+//   'w': bias vector (row sums or external biases). The bias of the
+//      count (i,j) is 'BIAS(w, i, j)'.
+//   'lg': log-gamma terms.                                             
+//   'c': address of an array of double for caching.                    
+//                                                                      
+// RETURN:                                                              
+//   The maximum log-likelihood of a block of hiC data.                 
+//                                                                      
+
+   // For slices at the border of the hiC matrix, the top or bottom
+   // blocks have 0 height. Returning 0.0 makes the summation at
+   // the line labelled "slice ll summation" still valid.
+   if ((i_ >= _i) || (j_ >= _j)) return 0.0;
+   // For slices of length 2, the diagonal block has only 1 value,
+   // which creates an infinite loop (because there are two parameters
+   // to fit). Return NAN because estimation is impossible.
+   if ((_i < i_+2) || (_j < j_+2)) return NAN;
+
+   int i;
+   int j;
+   int i_low = i_;
+   int i_high = -1;
+   int j_low = diag ? j_+1 : j_;
+   int j_high = _j+1;
+   int index;
+   int iter = 0;
+   double denom;
+   double oldgrad;
+   double f = INFINITY;
+   double g = INFINITY;
+   double a = 0.0;
+   double b = 0.0;
+   double da = 0.0;
+   double db = 0.0;
+   double dfda = 0.0;
+   double dfdb = 0.0;
+   double dgda = 0.0;
+   double dgdb = 0.0;
+   // See the comment about 'tmp' in 'fg'.
+   long double tmp; 
+   // The cache is indexed by the distance between the bins.
+   const int cache_size = max_dist(dp, i_, _i, j_, _j);
+
+   LLIK_NAME(fg)(n, i_, _i, j_, _j, diag, k, dp, w, a, b, da, db, c,
+         &f, &g);
+   //fg(n, i_, _i, j_, _j, diag, k, w, a, b, da, db, c, &f, &g);
+
+   // Newton-Raphson until gradient function is less than TOLERANCE.
+   // The gradient function is the square norm 'f*f + g*g'.
+   while ((oldgrad = f*f + g*g) > TOLERANCE && iter++ < MAXITER) {
+
+      for (index = 0 ; index <= cache_size ; index++) c[index] = NAN;
+      // Compute the derivatives.
+      dfda = dfdb = dgda = dgdb = 0.0;
+
+      for (j = j_low ; j < j_high ; j++) {
+         i_high = diag ? j : _i+1;
+         for (i = i_low ; i < i_high ; i++) {
+            index = abs(dp[i]-dp[j]);
+            // Retrieve value of the exponential from cache.
+            if (c[index] != c[index]) { // ERROR.
+               //c[index] = exp(a+b*d[i+j*n]);
+               //c[index] = exp(a+b*log(abs(dp[i]-dp[j])));
+            	c[index] = exp(a+b*fastlog(abs(dp[i]-dp[j])));
+            }
+            //tmp   =   w[i+j*n] * c[index];
+            tmp   =   BIAS(w, i, j) * c[index];
+            dfda +=   tmp;
+            //tmp  *=   d[i+j*n];
+            //tmp  *=   log(abs(dp[i]-dp[j]));
+            tmp  *=   fastlog(abs(dp[i]-dp[j]));
+            dgda +=   tmp;
+            //tmp  *=   d[i+j*n];
+            //tmp  *=   log(abs(dp[i]-dp[j]));
+            tmp  *=   fastlog(abs(dp[i]-dp[j]));
+            dgdb +=   tmp;
+         }
+      }
+      dfdb = dgda;
+
+      denom = dfdb*dgda - dfda*dgdb;
+      da = (f*dgdb - g*dfdb) / denom;
+      db = (g*dfda - f*dgda) / denom;
+
+      LLIK_NAME(fg)(n, i_, _i, j_, _j, diag, k, dp, w, a, b, da, db, c,
+            &f, &g);
+      //fg(n, i_, _i, j_, _j, diag, k, w, a, b, da, db, c, &f, &g);
+
+      // Traceback if we are not going down the gradient. Cut the
+      // length of the steps in half until this step goes down
+      // the gradient.
+      for (i = 0 ; (i < 20) && (f*f + g*g > oldgrad) ; i++) {
+         da /= 2;
+         db /= 2;
+         LLIK_NAME(fg)(n, i_, _i, j_, _j, diag, k, dp, w, a, b, da, db, c,
+               &f, &g);
+         //fg(n, i_, _i, j_, _j, diag, k, w, a, b, da, db, c, &f, &g);
+      }
+
+      // Update 'a' and 'b'.
+      a += da;
+      b += db;
+
+   }
+
+   if (iter >= MAXITER) {
+      // Something probably went wrong. Return NAN.
+      return NAN;
+   }
+
+   // Compute log-likelihood (using 'dfda').
+   double llik = 0.0;
+
+   // The last call to 'fg' has set the cache to the right values.
+   // No need to reset the cache.
+   for (j = j_low ; j < j_high ; j++) {
+      i_high = diag ? j : _i+1;
+      for (i = i_low ; i < i_high ; i++) {
+         index = abs(dp[i]-dp[j]);
+         // Retrieve value of the exponential from cache.
+         //llik += c[index] + k[i+j*n]*(a+b*d[i+j*n]) - lg[i+j*n];
+         //llik += c[index] + k[i+j*n]*(a+b*log(abs(dp[i]-dp[j]))) - lg[i+j*n];
+         llik += c[index] + OBS(k, i, j)*(a+b*fastlog(abs(dp[i]-dp[j]))) -
+            LGAMMA(lg, k, i, j);
+
+      }
+   }
+
+   return llik;
+
+}
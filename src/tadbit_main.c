@@ -0,0 +1,293 @@
+// Command line interface of the TADbit engine. The matrices are read
+// with the streamed reader of 'tadbit_stream.c' (plain or gzip files,
+// or containers of 'tadbit_cmat.c') and segmented with 'tadbit_focus' (the region is the whole matrix
+// unless specified otherwise).
+//
+// build: make tadbit
+
+#include <getopt.h>
+#include "tadbit.h"
+#include "tadbit_stream.h"
+
+// Magic number of the log-likelihood files written with '-l'.
+#define TADBIT_LLIK_MAGIC "TADBITLK"
+
+static const char *usage =
+"usage: tadbit [options] matrix [matrix ...]\n"
+"\n"
+"Find the TADs of tab-separated Hi-C count matrices (plain or gzip)\n"
+"or of contact-matrix containers.\n"
+"Several matrices are segmented together as replicates.\n"
+"\n"
+"options:\n"
+"  -o FILE       write the TADs to FILE (default: standard output)\n"
+"  -l FILE       write the slice log-likelihood matrix to FILE (binary:\n"
+"                \"" TADBIT_LLIK_MAGIC "\", the size N and the first bin of the\n"
+"                region as ints, then N x N doubles)\n"
+"  -t N          number of threads (default: 0, all the processors\n"
+"                available, within the CPU quota of the cgroup)\n"
+"  -p            bind the threads to CPUs (as TADBIT_PIN_THREADS=1)\n"
+"  -s N          maximum TAD size in bins (default: the matrix size)\n"
+"  -k N          number of TADs (default: the optimum)\n"
+"  -r START:END  segment only the bins START to END (1-based)\n"
+"  -b            use the biases stored in the containers\n"
+"  -H            do not use the heuristic\n"
+"  -v            display progress\n"
+"  -h            display this help\n";
+
+
+typedef struct {
+   const char *path;
+   int use_bias;
+   int n;
+   int *obs;
+   double *bias;
+} matrix_job;
+
+
+void *
+read_matrix_job(
+  void *arg
+){
+// SYNOPSIS:
+//   Thread function to read one of the matrices.
+//
+   matrix_job *job = (matrix_job *) arg;
+   job->obs = read_tadbit_matrix(job->path, &job->n);
+   if (job->obs == NULL || !job->use_bias) return NULL;
+
+   tadbit_cmat *cm = is_tadbit_cmat(job->path) ?
+      open_tadbit_cmat(job->path) : NULL;
+   if (cm != NULL && cm->bias != NULL) {
+      job->bias = (double *) malloc(cm->n * sizeof(double));
+      memcpy(job->bias, cm->bias, cm->n * sizeof(double));
+   }
+   else {
+      fprintf(stderr, "no biases in %s\n", job->path);
+   }
+   if (cm != NULL) close_tadbit_cmat(cm);
+   return NULL;
+}
+
+
+int
+write_tads(
+  const char *path,
+  const tadbit_output *seg,
+  const int n,
+  const int offset
+){
+// SYNOPSIS:
+//   Write the TADs of 'seg' as a tab-separated table (same columns
+//   as 'print_result_r' in Python, coordinates are 1-based).
+//
+// RETURN:
+//   0 on success, -1 if the file cannot be written.
+//
+
+   int i;
+   int tad = 1;
+   int start = 0;
+
+   FILE *f = path ? fopen(path, "w") : stdout;
+   if (f == NULL) {
+      fprintf(stderr, "cannot open output file %s\n", path);
+      return -1;
+   }
+
+   fprintf(f, "#\tstart\tend\tscore\n");
+   for (i = 0 ; i < n ; i++) {
+      if (i < n-1 && !seg->bkpts[i+seg->nbreaks_opt*n]) continue;
+      if (i < n-1) {
+         fprintf(f, "%d\t%d\t%d\t%d\n", tad++, offset+start+1, offset+i+1,
+               seg->passages[i]);
+      }
+      else {
+         fprintf(f, "%d\t%d\t%d\tNA\n", tad++, offset+start+1, offset+i+1);
+      }
+      start = i+1;
+   }
+
+   if (path && fclose(f)) {
+      fprintf(stderr, "error writing output file %s\n", path);
+      return -1;
+   }
+   return 0;
+
+}
+
+
+int
+write_llikmat(
+  const char *path,
+  const tadbit_output *seg,
+  const int n,
+  const int offset
+){
+// SYNOPSIS:
+//   Write the slice log-likelihood matrix of 'seg' ('NAN' for the
+//   slices that were not computed).
+//
+// RETURN:
+//   0 on success, -1 if the file cannot be written.
+//
+
+   FILE *f = fopen(path, "wb");
+   if (f == NULL) {
+      fprintf(stderr, "cannot open log-likelihood file %s\n", path);
+      return -1;
+   }
+   const int header[2] = {n, offset};
+   // A short write (e.g. a full disk) is an error.
+   int err = fwrite(TADBIT_LLIK_MAGIC, 1, 8, f) != 8 ||
+      fwrite(header, sizeof(int), 2, f) != 2 ||
+      fwrite(seg->llikmat, sizeof(double), (size_t) n*n, f) !=
+         (size_t) n*n;
+   if (fclose(f) || err) {
+      fprintf(stderr, "error writing log-likelihood file %s\n", path);
+      return -1;
+   }
+   return 0;
+
+}
+
+
+int
+main(
+  int argc,
+  char **argv
+){
+
+   const char *outfile = NULL;
+   const char *llikfile = NULL;
+   int n_threads = 0;
+   int max_tad_size = 0;
+   int ntads = 0;
+   int start = 0;
+   int end = 0;
+   int do_not_use_heuristic = 0;
+   int use_bias = 0;
+   int verbose = 0;
+
+   int i;
+   int k;
+   int c;
+
+   while ((c = getopt(argc, argv, "o:l:t:s:k:r:pbHvh")) != -1) {
+      switch (c) {
+         case 'o': outfile = optarg; break;
+         case 'l': llikfile = optarg; break;
+         case 't': n_threads = atoi(optarg); break;
+         case 's': max_tad_size = atoi(optarg); break;
+         case 'k': ntads = atoi(optarg); break;
+         case 'r':
+            if (sscanf(optarg, "%d:%d", &start, &end) != 2 ||
+                  start < 1 || end < start) {
+               fprintf(stderr, "invalid region %s\n", optarg);
+               return 1;
+            }
+            break;
+         case 'p': setenv("TADBIT_PIN_THREADS", "1", 1); break;
+         case 'b': use_bias = 1; break;
+         case 'H': do_not_use_heuristic = 1; break;
+         case 'v': verbose = 1; break;
+         case 'h': fputs(usage, stdout); return 0;
+         default: fputs(usage, stderr); return 1;
+      }
+   }
+
+   const int m = argc - optind;
+   if (m < 1) {
+      fputs(usage, stderr);
+      return 1;
+   }
+
+   // Read the matrices in parallel.
+   matrix_job *jobs = (matrix_job *) malloc(m * sizeof(matrix_job));
+   pthread_t *tid = (pthread_t *) malloc(m * sizeof(pthread_t));
+   for (k = 0 ; k < m ; k++) {
+      jobs[k].path = argv[optind+k];
+      jobs[k].use_bias = use_bias;
+      jobs[k].obs = NULL;
+      jobs[k].bias = NULL;
+      if (pthread_create(tid+k, NULL, &read_matrix_job, jobs+k)) {
+         // Read it in this thread instead.
+         tid[k] = 0;
+         read_matrix_job(jobs+k);
+      }
+   }
+   int err = 0;
+   for (k = 0 ; k < m ; k++) {
+      if (tid[k]) pthread_join(tid[k], NULL);
+      if (jobs[k].obs == NULL || (use_bias && jobs[k].bias == NULL)) err = 1;
+   }
+   free(tid);
+
+   const int n = err ? 0 : jobs[0].n;
+   for (k = 1 ; k < m && !err ; k++) {
+      if (jobs[k].n != n) {
+         fprintf(stderr, "matrix %s has %d rows instead of %d\n",
+               jobs[k].path, jobs[k].n, n);
+         err = 1;
+      }
+   }
+   if (!err && end > n) {
+      fprintf(stderr, "region %d:%d beyond the matrix (%d rows)\n",
+            start, end, n);
+      err = 1;
+   }
+   if (err) {
+      for (k = 0 ; k < m ; k++) {
+         free(jobs[k].obs);
+         free(jobs[k].bias);
+      }
+      free(jobs);
+      return 1;
+   }
+
+   int **obs = (int **) malloc(m * sizeof(int *));
+   double **bias = use_bias ? (double **) malloc(m * sizeof(double *)) : NULL;
+   for (k = 0 ; k < m ; k++) {
+      obs[k] = jobs[k].obs;
+      if (use_bias) bias[k] = jobs[k].bias;
+   }
+   free(jobs);
+
+   // Remove the rows/columns with 0 on the diagonal of the first
+   // matrix (as in Python).
+   char *remove = (char *) malloc(n * sizeof(char));
+   for (i = 0 ; i < n ; i++) remove[i] = obs[0][i+(size_t) i*n] == 0;
+
+   if (start == 0) {
+      start = 1;
+      end = n;
+   }
+   const int size = end-start+1;
+
+   tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+   tadbit_focus(obs, remove, n, m, n_threads, verbose,
+         max_tad_size > 0 ? max_tad_size : n, ntads, do_not_use_heuristic,
+         use_bias ? TADBIT_BIAS_VECTORS : TADBIT_BIAS_ROWSUMS, bias,
+         start-1, end-1, seg);
+
+   for (k = 0 ; k < m ; k++) {
+      free(obs[k]);
+      if (use_bias) free(bias[k]);
+   }
+   free(obs);
+   free(bias);
+
+   if (seg->maxbreaks < 0) {
+      fprintf(stderr, "too few rows/columns to segment\n");
+      free(seg);
+      return 1;
+   }
+
+   err = write_tads(outfile, seg, size, start-1);
+   if (!err && llikfile) err = write_llikmat(llikfile, seg, size, start-1);
+
+   destroy_tadbit_output(seg);
+
+   return err ? 1 : 0;
+
+}
@@ -4,6 +4,8 @@
 
 #include "Python.h"
 #include "tadbit.c"
+#include "tadbit_stream.c"
+#include "tadbit_cmat.c"
 
 /* The module doc string */
 PyDoc_STRVAR(tadbit_py__doc__,
@@ -24,26 +26,137 @@ PyDoc_STRVAR(_tadbit_wrapper__doc__,
     :returns: a python list with each\n");
 
 
-/* The wrapper to the underlying C function */
-static PyObject *_tadbit_wrapper (PyObject *self, PyObject *args){
-  PyObject **py_obs;
-  PyObject *py_remove;
-  int n;
-  int m;
-  int n_threads;
-  const int verbose;
-  const int max_tad_size;
-  const int nbks;
-  const int do_not_use_heuristic;
-  /* output */
-  tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+/* The function doc string */
+PyDoc_STRVAR(_tadbit_bias_wrapper__doc__,
+"Run tadbit_bias function in tadbit.c.\n\
+    Same arguments as _tadbit_wrapper, followed by:\n\
+    :argument biases: a python list of tuples of floats with the bias of each row/column of each matrix (rows/columns with a bias that is not positive are removed), or None to use no bias.\n\
+    :returns: a python list with each\n");
 
-  if (!PyArg_ParseTuple(args, "OOiiiiiii:tadbit", &py_obs, &py_remove, 
-			&n, &m, &n_threads, 
-			&verbose, &max_tad_size, &nbks, &do_not_use_heuristic))
-    return NULL;
-  // convert list of lists to pointer o pointers
-  // if something goes wrong, it is probably from there :S
+/* The function doc string */
+PyDoc_STRVAR(_tadbit_focus_wrapper__doc__,
+"Run tadbit_focus function in tadbit.c.\n\
+    Same arguments as _tadbit_wrapper, followed by:\n\
+    :argument 0 bias_model: 0 for the row sums, 1 for the given biases, 2 for no bias\n\
+    :argument biases: a python list of tuples of floats with the bias of each row/column of each matrix (None if bias_model is not 1).\n\
+    :argument start: first row/column of the region to segment\n\
+    :argument end: last row/column of the region to segment\n\
+    :returns: a python list with each (with the dimension of the region)\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_tadbit_nested_wrapper__doc__,
+"Run tadbit_nested function in tadbit.c.\n\
+    Same arguments as _tadbit_wrapper, followed by:\n\
+    :argument 0 bias_model: 0 for the row sums, 1 for the given biases, 2 for no bias\n\
+    :argument biases: a python list of tuples of floats with the bias of each row/column of each matrix (None if bias_model is not 1).\n\
+    :argument 2 max_level: number of levels of the boundary tree\n\
+    :returns: a python list with the result of _tadbit_wrapper and the boundary tree (lists of start, end, parent, level and score of the nodes)\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_tadbit_multires_wrapper__doc__,
+"Run tadbit_multires function in tadbit.c.\n\
+    :argument obs: a python list of lists of int, representing a list of linearized matrices.\n\
+    :argument remove: a python list of lists of booleans mapping positively columns to remove.\n\
+    :argument 0 n: number of rows or columns in the matrix\n\
+    :argument 0 m: number of matrices\n\
+    :argument 0 n_threads: number of threads to use\n\
+    :argument 0 verbose: whether to display more/less information about process\n\
+    :argument 4 factor: number of bins merged in the coarse matrix\n\
+    :argument 0 nbks: number of breaks to return (0 for the optimal)\n\
+    :returns: a python list with each\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_tadbit_stream_wrapper__doc__,
+"Run tadbit_stream function in tadbit_stream.c.\n\
+    :argument paths: a python list of paths to tab-separated matrices or containers.\n\
+    :argument remove: a python tuple of booleans mapping positively columns to remove (None to remove columns with 0 in the diagonal).\n\
+    :argument 500 window: number of bins of the windows\n\
+    :argument 100 overlap: number of bins shared by consecutive windows\n\
+    :argument 0 n_threads: number of threads to use\n\
+    :argument 1 n_windows: number of windows segmented in parallel\n\
+    :argument 0 verbose: whether to display more/less information about process\n\
+    :argument 0 max_tad_size: an integer defining maximum size of TAD.\n\
+    :argument 1 do_not_use_heuristic: whether to use or not some heuristics\n\
+    :returns: a python list with the size of the matrix, the confidence of the breakpoints and the breakpoints\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_tadbit_shard_wrapper__doc__,
+"Run tadbit_shard function in tadbit.c.\n\
+    :argument obs: a python list of lists of int, representing a list of linearized matrices.\n\
+    :argument remove: a python list of lists of booleans mapping positively columns to remove.\n\
+    :argument 0 n: number of rows or columns in the matrix\n\
+    :argument 0 m: number of matrices\n\
+    :argument 0 n_threads: number of threads to use\n\
+    :argument 0 verbose: whether to display more/less information about process\n\
+    :argument 0 max_tad_size: an integer defining maximum size of TAD. Default defines it to the number of rows/columns.\n\
+    :argument 1 do_not_use_heuristic: whether to use or not some heuristics\n\
+    :argument 0 shard: index of the shard to compute\n\
+    :argument 1 n_shards: total number of shards\n\
+    :argument outfile: path of the shard file to write\n\
+    :returns: 0 on success, -1 otherwise\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_tadbit_mapped_wrapper__doc__,
+"Run tadbit_mapped function in tadbit.c on matrices mapped in memory.\n\
+    :argument files: a python list of paths (or of file descriptors) to matrices written as n x n native ints.\n\
+    :argument remove: a python tuple of booleans mapping positively columns to remove (None to remove columns with 0 in the diagonal).\n\
+    :argument 0 n_threads: number of threads to use\n\
+    :argument 0 verbose: whether to display more/less information about process\n\
+    :argument 0 max_tad_size: an integer defining maximum size of TAD (0 for the number of rows/columns).\n\
+    :argument 0 nbks: number of breaks to return (0 for the optimal)\n\
+    :argument 1 do_not_use_heuristic: whether to use or not some heuristics\n\
+    :argument 0 bias_model: 0 for the row sums, 1 for the given biases, 2 for no bias\n\
+    :argument biases: a python list of tuples of floats with the bias of each row/column of each matrix (None if bias_model is not 1).\n\
+    :returns: a python list with each\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_tadbit_merge_wrapper__doc__,
+"Run tadbit_merge function in tadbit.c.\n\
+    Same arguments as _tadbit_wrapper, followed by a list of paths to\n\
+    the shard files written by _tadbit_shard_wrapper.\n\
+    :returns: a python list with each\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_cmat_write_wrapper__doc__,
+"Run write_tadbit_cmat function in tadbit_cmat.c.\n\
+    :argument path: path of the container to write.\n\
+    :argument obs: a python tuple of int, representing a linearized symmetric matrix.\n\
+    :argument 0 n: number of rows or columns in the matrix\n\
+    :argument 0 band: number of diagonals to store (0 for all)\n\
+    :argument 4096 block: number of counts per block\n\
+    :argument 1 compressed: whether to compress the blocks\n\
+    :argument 0 resolution: size of the bins\n\
+    :argument chromosomes: a python list of tuples with the name and the number of bins of each chromosome\n\
+    :argument biases: a python tuple of floats with the bias of each row/column, or None.\n\
+    :returns: None\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_cmat_info_wrapper__doc__,
+"Read the metadata of a container written by write_tadbit_cmat.\n\
+    :argument path: path of the container.\n\
+    :returns: a python list with the number of rows/columns, the number of diagonals stored, the resolution, the chromosomes (tuples with the name, first bin and number of bins) and the biases (or None)\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_cmat_fetch_wrapper__doc__,
+"Run tadbit_cmat_fetch function in tadbit_cmat.c.\n\
+    :argument path: path of the container.\n\
+    :argument row0: first row\n\
+    :argument row1: last row\n\
+    :argument col0: first column\n\
+    :argument col1: last column\n\
+    :returns: a python tuple with the counts, row by row\n");
+
+/* The function doc string */
+PyDoc_STRVAR(_cmat_diagonal_wrapper__doc__,
+"Run tadbit_cmat_diagonal function in tadbit_cmat.c.\n\
+    :argument path: path of the container.\n\
+    :argument d: the diagonal\n\
+    :returns: a python tuple with the counts (i,i+d) of the diagonal\n");
+
+
+/* convert list of lists to pointer o pointers */
+/* if something goes wrong, it is probably from there :S */
+static int **get_obs (PyObject *py_obs, int n, int m){
   int i, j;
   int **obs;
   obs = malloc(m * sizeof(int*));
@@ -52,16 +165,41 @@ static PyObject *_tadbit_wrapper (PyObject *self, PyObject *args){
   for (i = 0 ; i < m ; i++)
     for (j = 0 ; j < n*n ; j++)
       obs[i][j] = PyInt_AS_LONG(PyTuple_GET_ITEM(PyList_GET_ITEM(py_obs, i), j));
+  return obs;
+}
 
+static char *get_remove (PyObject *py_remove, int n){
+  int j;
   char *remove = (char *) malloc (n * sizeof(char));
   for (j = 0 ; j < n ; j++){
     remove[j] = PyInt_AS_LONG(PyTuple_GET_ITEM(py_remove, j)); // automatic casting into char
   }
+  return remove;
+}
 
-  // run tadbit
-  tadbit(obs, remove, n, m, n_threads, verbose, max_tad_size, nbks, do_not_use_heuristic, seg);
+static double **get_bias (PyObject *py_bias, int n, int m){
+  int i, j;
+  double **bias;
+  bias = malloc(m * sizeof(double*));
+  for (i = 0 ; i < m ; i++ )
+    bias[i] = malloc(n * sizeof(double));
+  for (i = 0 ; i < m ; i++)
+    for (j = 0 ; j < n ; j++)
+      bias[i][j] = PyFloat_AsDouble(PyTuple_GET_ITEM(PyList_GET_ITEM(py_bias, i), j));
+  return bias;
+}
 
-  // store each tadbit output
+static void free_obs (int **obs, int m){
+  int i;
+  for (i = 0 ; i < m ; i++){
+    free(obs[i]);
+  }
+  free(obs);
+}
+
+/* store each tadbit output in a python list */
+static PyObject *get_result (tadbit_output *seg, int n, int nbks){
+  int i;
 
   // declare python objects to store lists
   PyObject * py_bkpts;
@@ -102,21 +240,632 @@ static PyObject *_tadbit_wrapper (PyObject *self, PyObject *args){
   PyList_SetItem(py_result, 4, py_mllik);
   PyList_SetItem(py_result, 5, py_bkpts);
 
+  return py_result;
+}
+
+
+/* The wrapper to the underlying C function */
+static PyObject *_tadbit_wrapper (PyObject *self, PyObject *args){
+  PyObject **py_obs;
+  PyObject *py_remove;
+  int n;
+  int m;
+  int n_threads;
+  const int verbose;
+  const int max_tad_size;
+  const int nbks;
+  const int do_not_use_heuristic;
+  /* output */
+  tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+
+  if (!PyArg_ParseTuple(args, "OOiiiiiii:tadbit", &py_obs, &py_remove, 
+			&n, &m, &n_threads, 
+			&verbose, &max_tad_size, &nbks, &do_not_use_heuristic))
+    return NULL;
+  int **obs = get_obs((PyObject *) py_obs, n, m);
+  char *remove = get_remove(py_remove, n);
+
+  // run tadbit
+  tadbit(obs, remove, n, m, n_threads, verbose, max_tad_size, nbks, do_not_use_heuristic, seg);
+
+  PyObject * py_result = get_result(seg, n, nbks);
+
   // free many things... no leaks here!!
-  for (i = 0 ; i < m ; i++){
-    free(obs[i]);
+  free_obs(obs, m);
+  destroy_tadbit_output(seg);
+
+  return py_result;
+}
+
+/* The wrapper to tadbit_bias */
+static PyObject *_tadbit_bias_wrapper (PyObject *self, PyObject *args){
+  PyObject *py_obs;
+  PyObject *py_remove;
+  PyObject *py_bias;
+  int n;
+  int m;
+  int n_threads;
+  const int verbose;
+  const int max_tad_size;
+  const int nbks;
+  const int do_not_use_heuristic;
+  int k;
+  /* output */
+  tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+
+  if (!PyArg_ParseTuple(args, "OOiiiiiiiO:tadbit_bias", &py_obs, &py_remove,
+			&n, &m, &n_threads, &verbose, &max_tad_size, &nbks,
+			&do_not_use_heuristic, &py_bias))
+    return NULL;
+  int **obs = get_obs(py_obs, n, m);
+  char *remove = get_remove(py_remove, n);
+  double **bias = py_bias == Py_None ? NULL : get_bias(py_bias, n, m);
+
+  // run tadbit with the given biases (or without bias)
+  tadbit_bias(obs, remove, n, m, n_threads, verbose, max_tad_size, nbks,
+              do_not_use_heuristic,
+              bias ? TADBIT_BIAS_VECTORS : TADBIT_BIAS_NONE, bias, seg);
+
+  PyObject * py_result = get_result(seg, n, nbks);
+
+  free_obs(obs, m);
+  if (bias) {
+    for (k = 0 ; k < m ; k++) free(bias[k]);
+    free(bias);
+  }
+  destroy_tadbit_output(seg);
+
+  return py_result;
+}
+
+/* The wrapper to tadbit_focus */
+static PyObject *_tadbit_focus_wrapper (PyObject *self, PyObject *args){
+  PyObject *py_obs;
+  PyObject *py_remove;
+  PyObject *py_bias;
+  int n;
+  int m;
+  int n_threads;
+  const int verbose;
+  const int max_tad_size;
+  const int nbks;
+  const int do_not_use_heuristic;
+  const int bias_model;
+  const int start;
+  const int end;
+  int k;
+  /* output */
+  tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+
+  if (!PyArg_ParseTuple(args, "OOiiiiiiiiOii:tadbit_focus", &py_obs,
+			&py_remove, &n, &m, &n_threads, &verbose,
+			&max_tad_size, &nbks, &do_not_use_heuristic,
+			&bias_model, &py_bias, &start, &end))
+    return NULL;
+  int **obs = get_obs(py_obs, n, m);
+  char *remove = get_remove(py_remove, n);
+  double **bias = py_bias == Py_None ? NULL : get_bias(py_bias, n, m);
+
+  // run tadbit_focus
+  tadbit_focus(obs, remove, n, m, n_threads, verbose, max_tad_size, nbks,
+	       do_not_use_heuristic, bias_model, bias, start, end, seg);
+
+  free_obs(obs, m);
+  if (bias) {
+    for (k = 0 ; k < m ; k++) free(bias[k]);
+    free(bias);
+  }
+
+  if (seg->maxbreaks < 0) {
+    free(seg);
+    PyErr_SetString(PyExc_ValueError, "could not segment the region");
+    return NULL;
+  }
+
+  PyObject * py_result = get_result(seg, end-start+1, nbks);
+  destroy_tadbit_output(seg);
+
+  return py_result;
+}
+
+/* The wrapper to tadbit_nested */
+static PyObject *_tadbit_nested_wrapper (PyObject *self, PyObject *args){
+  PyObject *py_obs;
+  PyObject *py_remove;
+  PyObject *py_bias;
+  int n;
+  int m;
+  int n_threads;
+  const int verbose;
+  const int max_tad_size;
+  const int nbks;
+  const int do_not_use_heuristic;
+  const int bias_model;
+  const int max_level;
+  int i;
+  int k;
+  /* output */
+  tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+  tadbit_tree *tree = (tadbit_tree *) malloc(sizeof(tadbit_tree));
+
+  if (!PyArg_ParseTuple(args, "OOiiiiiiiiOi:tadbit_nested", &py_obs,
+			&py_remove, &n, &m, &n_threads, &verbose,
+			&max_tad_size, &nbks, &do_not_use_heuristic,
+			&bias_model, &py_bias, &max_level))
+    return NULL;
+  int **obs = get_obs(py_obs, n, m);
+  char *remove = get_remove(py_remove, n);
+  double **bias = py_bias == Py_None ? NULL : get_bias(py_bias, n, m);
+
+  // run tadbit_nested
+  tadbit_nested(obs, remove, n, m, n_threads, verbose, max_tad_size, nbks,
+		do_not_use_heuristic, bias_model, bias, max_level, seg, tree);
+
+  free_obs(obs, m);
+  if (bias) {
+    for (k = 0 ; k < m ; k++) free(bias[k]);
+    free(bias);
+  }
+
+  if (tree->n_nodes < 0) {
+    free(seg);
+    destroy_tadbit_tree(tree);
+    PyErr_SetString(PyExc_ValueError, "could not segment the matrices");
+    return NULL;
+  }
+
+  // get the nodes of the tree
+  int *fields[5] = {tree->start, tree->end, tree->parent, tree->level,
+		    tree->score};
+  PyObject * py_tree = PyList_New(5);
+  for (k = 0 ; k < 5 ; k++) {
+    PyObject * py_field = PyList_New(tree->n_nodes);
+    for (i = 0 ; i < tree->n_nodes ; i++)
+      PyList_SetItem(py_field, i, PyInt_FromLong(fields[k][i]));
+    PyList_SetItem(py_tree, k, py_field);
+  }
+
+  PyObject * py_result = PyList_New(2);
+  PyList_SetItem(py_result, 0, get_result(seg, n, nbks));
+  PyList_SetItem(py_result, 1, py_tree);
+
+  destroy_tadbit_output(seg);
+  destroy_tadbit_tree(tree);
+
+  return py_result;
+}
+
+/* The wrapper to tadbit_multires */
+static PyObject *_tadbit_multires_wrapper (PyObject *self, PyObject *args){
+  PyObject *py_obs;
+  PyObject *py_remove;
+  int n;
+  int m;
+  int n_threads;
+  const int verbose;
+  const int factor;
+  const int nbks;
+  /* output */
+  tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+
+  if (!PyArg_ParseTuple(args, "OOiiiiii:tadbit_multires", &py_obs, &py_remove,
+			&n, &m, &n_threads, &verbose, &factor, &nbks))
+    return NULL;
+  int **obs = get_obs(py_obs, n, m);
+  char *remove = get_remove(py_remove, n);
+
+  // run tadbit_multires
+  tadbit_multires(obs, remove, n, m, n_threads, verbose, factor, nbks, seg);
+
+  PyObject * py_result = get_result(seg, n, nbks);
+
+  free_obs(obs, m);
+  destroy_tadbit_output(seg);
+
+  return py_result;
+}
+
+/* The wrapper to tadbit_stream */
+static PyObject *_tadbit_stream_wrapper (PyObject *self, PyObject *args){
+  PyObject *py_paths;
+  PyObject *py_remove;
+  int window;
+  int overlap;
+  int n_threads;
+  int n_windows;
+  const int verbose;
+  const int max_tad_size;
+  const int do_not_use_heuristic;
+  /* output */
+  tadbit_stream_output *seg =
+    (tadbit_stream_output *) malloc(sizeof(tadbit_stream_output));
+
+  if (!PyArg_ParseTuple(args, "OOiiiiiii:tadbit_stream", &py_paths, &py_remove,
+			&window, &overlap, &n_threads, &n_windows, &verbose,
+			&max_tad_size, &do_not_use_heuristic))
+    return NULL;
+  int i;
+  int m = PyList_Size(py_paths);
+  char **paths = (char **) malloc(m * sizeof(char *));
+  for (i = 0 ; i < m ; i++)
+    paths[i] = PyString_AsString(PyList_GET_ITEM(py_paths, i));
+  char *remove = NULL;
+  if (py_remove != Py_None)
+    remove = get_remove(py_remove, PyTuple_Size(py_remove));
+
+  // run tadbit_stream (the window threads do not need the GIL)
+  int err;
+  Py_BEGIN_ALLOW_THREADS
+  err = tadbit_stream(paths, m, remove, window, overlap, n_threads, n_windows,
+		      verbose, max_tad_size, do_not_use_heuristic, seg);
+  Py_END_ALLOW_THREADS
+
+  free(paths);
+  free(remove);
+
+  if (err) {
+    free(seg);
+    PyErr_SetString(PyExc_IOError, "could not segment the matrices");
+    return NULL;
+  }
+
+  PyObject * py_bkpts = PyList_New(seg->n);
+  PyObject * py_passages = PyList_New(seg->n);
+  for(i = 0 ; i < seg->n; i++) {
+    PyList_SetItem(py_bkpts, i, PyInt_FromLong(seg->bkpts[i]));
+    PyList_SetItem(py_passages, i, PyFloat_FromDouble(seg->passages[i]));
+  }
+
+  PyObject * py_result = PyList_New(3);
+  PyList_SetItem(py_result, 0, PyInt_FromLong(seg->n));
+  PyList_SetItem(py_result, 1, py_passages);
+  PyList_SetItem(py_result, 2, py_bkpts);
+
+  destroy_tadbit_stream_output(seg);
+
+  return py_result;
+}
+
+/* The wrapper to tadbit_shard */
+static PyObject *_tadbit_shard_wrapper (PyObject *self, PyObject *args){
+  PyObject *py_obs;
+  PyObject *py_remove;
+  int n;
+  int m;
+  int n_threads;
+  const int verbose;
+  const int max_tad_size;
+  const int do_not_use_heuristic;
+  const int shard;
+  const int n_shards;
+  const char *outfile;
+
+  if (!PyArg_ParseTuple(args, "OOiiiiiiiis:tadbit_shard", &py_obs, &py_remove,
+			&n, &m, &n_threads, &verbose, &max_tad_size,
+			&do_not_use_heuristic, &shard, &n_shards, &outfile))
+    return NULL;
+  int **obs = get_obs(py_obs, n, m);
+  char *remove = get_remove(py_remove, n);
+
+  // run tadbit_shard
+  int err = tadbit_shard(obs, remove, n, m, n_threads, verbose, max_tad_size,
+			 do_not_use_heuristic, shard, n_shards, outfile);
+
+  free_obs(obs, m);
+
+  return PyInt_FromLong(err);
+}
+
+/* The wrapper to tadbit_mapped */
+static PyObject *_tadbit_mapped_wrapper (PyObject *self, PyObject *args){
+  PyObject *py_files;
+  PyObject *py_remove;
+  PyObject *py_bias;
+  int n_threads;
+  const int verbose;
+  int max_tad_size;
+  const int nbks;
+  const int do_not_use_heuristic;
+  const int bias_model;
+  int i;
+  int k;
+  int n = 0;
+
+  if (!PyArg_ParseTuple(args, "OOiiiiiiO:tadbit_mapped", &py_files,
+			&py_remove, &n_threads, &verbose, &max_tad_size,
+			&nbks, &do_not_use_heuristic, &bias_model, &py_bias))
+    return NULL;
+
+  // map the matrices (paths or file descriptors)
+  const int m = PyList_Size(py_files);
+  int **obs = (int **) calloc(m, sizeof(int *));
+  // size of each mapping, to unmap it with its own length
+  int *sizes = (int *) calloc(m, sizeof(int));
+  int err = m < 1;
+  for (k = 0 ; k < m && !err ; k++) {
+    PyObject *py_file = PyList_GetItem(py_files, k);
+    obs[k] = PyString_Check(py_file) ?
+      map_tadbit_matrix(PyString_AsString(py_file), &sizes[k]) :
+      map_tadbit_matrix_fd(PyInt_AsLong(py_file), &sizes[k]);
+    if (obs[k] == NULL || (k > 0 && sizes[k] != n)) err = 1;
+    if (k == 0) n = sizes[k];
+  }
+  if (err) {
+    for (k = 0 ; k < m ; k++) unmap_tadbit_matrix(obs[k], sizes[k]);
+    free(obs);
+    free(sizes);
+    PyErr_SetString(PyExc_IOError, "could not map the matrices");
+    return NULL;
   }
+
+  char *remove;
+  if (py_remove == Py_None) {
+    // remove the columns with 0 in the diagonal of the first matrix
+    remove = (char *) malloc(n * sizeof(char));
+    for (i = 0 ; i < n ; i++) remove[i] = obs[0][i+(size_t) i*n] == 0;
+  }
+  else {
+    remove = get_remove(py_remove, n);
+  }
+  double **bias = py_bias == Py_None ? NULL : get_bias(py_bias, n, m);
+  if (max_tad_size < 1) max_tad_size = n;
+
+  /* output */
+  tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+  tadbit_mapped(obs, remove, n, m, n_threads, verbose, max_tad_size, nbks,
+		do_not_use_heuristic, bias_model, bias, seg);
+
+  for (k = 0 ; k < m ; k++) unmap_tadbit_matrix(obs[k], sizes[k]);
   free(obs);
+  free(sizes);
+  if (bias) {
+    for (k = 0 ; k < m ; k++) free(bias[k]);
+    free(bias);
+  }
+
+  if (seg->maxbreaks < 0) {
+    free(seg);
+    PyErr_SetString(PyExc_ValueError, "too few rows/columns to segment");
+    return NULL;
+  }
+
+  PyObject * py_result = get_result(seg, n, nbks);
+  destroy_tadbit_output(seg);
+
+  return py_result;
+}
+
+/* The wrapper to tadbit_merge */
+static PyObject *_tadbit_merge_wrapper (PyObject *self, PyObject *args){
+  PyObject *py_obs;
+  PyObject *py_remove;
+  PyObject *py_files;
+  int n;
+  int m;
+  int n_threads;
+  const int verbose;
+  const int max_tad_size;
+  const int nbks;
+  const int do_not_use_heuristic;
+  /* output */
+  tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
 
+  if (!PyArg_ParseTuple(args, "OOiiiiiiiO:tadbit_merge", &py_obs, &py_remove,
+			&n, &m, &n_threads, &verbose, &max_tad_size, &nbks,
+			&do_not_use_heuristic, &py_files))
+    return NULL;
+  int i;
+  int n_files = PyList_Size(py_files);
+  char **files = (char **) malloc(n_files * sizeof(char *));
+  for (i = 0 ; i < n_files ; i++)
+    files[i] = PyString_AsString(PyList_GET_ITEM(py_files, i));
+  int **obs = get_obs(py_obs, n, m);
+  char *remove = get_remove(py_remove, n);
+
+  // run tadbit_merge
+  tadbit_merge(obs, remove, n, m, n_threads, verbose, max_tad_size, nbks,
+	       do_not_use_heuristic, n_files, files, seg);
+
+  free_obs(obs, m);
+  free(files);
+
+  if (seg->maxbreaks < 0) {
+    free(seg);
+    PyErr_SetString(PyExc_IOError, "could not merge the shard files");
+    return NULL;
+  }
+
+  PyObject * py_result = get_result(seg, n, nbks);
   destroy_tadbit_output(seg);
 
   return py_result;
 }
 
+/* The wrapper to write_tadbit_cmat */
+static PyObject *_cmat_write_wrapper (PyObject *self, PyObject *args){
+  const char *path;
+  PyObject *py_obs;
+  int n;
+  int band;
+  int block;
+  int compressed;
+  int resolution;
+  PyObject *py_chroms;
+  PyObject *py_bias;
+
+  if (!PyArg_ParseTuple(args, "sOiiiiiOO:write_tadbit_cmat", &path, &py_obs,
+			&n, &band, &block, &compressed, &resolution, &py_chroms,
+			&py_bias))
+    return NULL;
+  int i;
+  int *obs = (int *) malloc(n*n * sizeof(int));
+  for (i = 0 ; i < n*n ; i++)
+    obs[i] = PyInt_AsLong(PyTuple_GET_ITEM(py_obs, i));
+  int n_chrom = PyList_Size(py_chroms);
+  const char **names = (const char **) malloc(n_chrom * sizeof(char *));
+  int *sizes = (int *) malloc(n_chrom * sizeof(int));
+  for (i = 0 ; i < n_chrom ; i++) {
+    PyObject *chrom = PyList_GET_ITEM(py_chroms, i);
+    names[i] = PyString_AsString(PyTuple_GET_ITEM(chrom, 0));
+    sizes[i] = PyInt_AsLong(PyTuple_GET_ITEM(chrom, 1));
+  }
+  double *bias = NULL;
+  if (py_bias != Py_None) {
+    bias = (double *) malloc(n * sizeof(double));
+    for (i = 0 ; i < n ; i++)
+      bias[i] = PyFloat_AsDouble(PyTuple_GET_ITEM(py_bias, i));
+  }
+
+  int err = write_tadbit_cmat(path, obs, n, band, block, compressed,
+			      resolution, n_chrom, names, sizes, bias);
+
+  free(obs);
+  free(names);
+  free(sizes);
+  free(bias);
+
+  if (err) {
+    PyErr_SetString(PyExc_IOError, "could not write the container");
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static tadbit_cmat *open_cmat (const char *path){
+  tadbit_cmat *cm = open_tadbit_cmat(path);
+  if (cm == NULL)
+    PyErr_SetString(PyExc_IOError, "could not open the container");
+  return cm;
+}
+
+static PyObject *get_counts (const int *counts, int size){
+  int i;
+  PyObject * py_counts = PyTuple_New(size);
+  for (i = 0 ; i < size ; i++)
+    PyTuple_SET_ITEM(py_counts, i, PyInt_FromLong(counts[i]));
+  return py_counts;
+}
+
+/* The wrapper to read the metadata of the containers */
+static PyObject *_cmat_info_wrapper (PyObject *self, PyObject *args){
+  const char *path;
+
+  if (!PyArg_ParseTuple(args, "s:cmat_info", &path))
+    return NULL;
+  tadbit_cmat *cm = open_cmat(path);
+  if (cm == NULL)
+    return NULL;
+
+  int i;
+  PyObject * py_chroms = PyList_New(cm->n_chrom);
+  for (i = 0 ; i < cm->n_chrom ; i++)
+    PyList_SetItem(py_chroms, i, Py_BuildValue("(sii)", cm->chrom[i].name,
+					       cm->chrom[i].first,
+					       cm->chrom[i].size));
+  PyObject * py_bias = Py_None;
+  if (cm->bias != NULL) {
+    py_bias = PyList_New(cm->n);
+    for (i = 0 ; i < cm->n ; i++)
+      PyList_SetItem(py_bias, i, PyFloat_FromDouble(cm->bias[i]));
+  }
+  else
+    Py_INCREF(Py_None);
+
+  PyObject * py_result = PyList_New(5);
+  PyList_SetItem(py_result, 0, PyInt_FromLong(cm->n));
+  PyList_SetItem(py_result, 1, PyInt_FromLong(cm->band));
+  PyList_SetItem(py_result, 2, PyInt_FromLong(cm->resolution));
+  PyList_SetItem(py_result, 3, py_chroms);
+  PyList_SetItem(py_result, 4, py_bias);
+
+  close_tadbit_cmat(cm);
+
+  return py_result;
+}
+
+/* The wrapper to tadbit_cmat_fetch */
+static PyObject *_cmat_fetch_wrapper (PyObject *self, PyObject *args){
+  const char *path;
+  int row0;
+  int row1;
+  int col0;
+  int col1;
+
+  if (!PyArg_ParseTuple(args, "siiii:tadbit_cmat_fetch", &path, &row0, &row1,
+			&col0, &col1))
+    return NULL;
+  tadbit_cmat *cm = open_cmat(path);
+  if (cm == NULL)
+    return NULL;
+
+  int err = row1 < row0 || col1 < col0;
+  int *counts = NULL;
+  if (!err) {
+    counts = (int *) malloc((row1-row0+1)*(col1-col0+1) * sizeof(int));
+    Py_BEGIN_ALLOW_THREADS
+    err = tadbit_cmat_fetch(cm, row0, row1, col0, col1, counts);
+    Py_END_ALLOW_THREADS
+  }
+  close_tadbit_cmat(cm);
+
+  if (err) {
+    free(counts);
+    PyErr_SetString(PyExc_IndexError, "invalid rows/columns of the container");
+    return NULL;
+  }
+  PyObject * py_counts = get_counts(counts, (row1-row0+1)*(col1-col0+1));
+  free(counts);
+
+  return py_counts;
+}
+
+/* The wrapper to tadbit_cmat_diagonal */
+static PyObject *_cmat_diagonal_wrapper (PyObject *self, PyObject *args){
+  const char *path;
+  int d;
+
+  if (!PyArg_ParseTuple(args, "si:tadbit_cmat_diagonal", &path, &d))
+    return NULL;
+  tadbit_cmat *cm = open_cmat(path);
+  if (cm == NULL)
+    return NULL;
+
+  int err = d < 0 || d >= cm->n;
+  int size = err ? 0 : cm->n-d;
+  int *counts = NULL;
+  if (!err) {
+    counts = (int *) malloc(size * sizeof(int));
+    err = tadbit_cmat_diagonal(cm, d, 0, size-1, counts);
+  }
+  close_tadbit_cmat(cm);
+
+  if (err) {
+    free(counts);
+    PyErr_SetString(PyExc_IndexError, "invalid diagonal of the container");
+    return NULL;
+  }
+  PyObject * py_counts = get_counts(counts, size);
+  free(counts);
+
+  return py_counts;
+}
+
 /* A list of all the methods defined by this module. */
 /* The {NULL, NULL} entry indicates the end of the method definitions */
 static PyMethodDef tadbit_py_methods[] = {
 	{"_tadbit_wrapper",  _tadbit_wrapper, METH_VARARGS, _tadbit_wrapper__doc__},
+	{"_tadbit_bias_wrapper",  _tadbit_bias_wrapper, METH_VARARGS, _tadbit_bias_wrapper__doc__},
+	{"_tadbit_focus_wrapper",  _tadbit_focus_wrapper, METH_VARARGS, _tadbit_focus_wrapper__doc__},
+	{"_tadbit_nested_wrapper",  _tadbit_nested_wrapper, METH_VARARGS, _tadbit_nested_wrapper__doc__},
+	{"_tadbit_multires_wrapper",  _tadbit_multires_wrapper, METH_VARARGS, _tadbit_multires_wrapper__doc__},
+	{"_tadbit_stream_wrapper",  _tadbit_stream_wrapper, METH_VARARGS, _tadbit_stream_wrapper__doc__},
+	{"_tadbit_shard_wrapper",  _tadbit_shard_wrapper, METH_VARARGS, _tadbit_shard_wrapper__doc__},
+	{"_tadbit_mapped_wrapper",  _tadbit_mapped_wrapper, METH_VARARGS, _tadbit_mapped_wrapper__doc__},
+	{"_tadbit_merge_wrapper",  _tadbit_merge_wrapper, METH_VARARGS, _tadbit_merge_wrapper__doc__},
+	{"_cmat_write_wrapper",  _cmat_write_wrapper, METH_VARARGS, _cmat_write_wrapper__doc__},
+	{"_cmat_info_wrapper",  _cmat_info_wrapper, METH_VARARGS, _cmat_info_wrapper__doc__},
+	{"_cmat_fetch_wrapper",  _cmat_fetch_wrapper, METH_VARARGS, _cmat_fetch_wrapper__doc__},
+	{"_cmat_diagonal_wrapper",  _cmat_diagonal_wrapper, METH_VARARGS, _cmat_diagonal_wrapper__doc__},
 	{NULL, NULL}      /* sentinel */
 };
 
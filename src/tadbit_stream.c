@@ -0,0 +1,732 @@
+#include "tadbit_stream.h"
+
+// Maximum number of counts of the chunks of rows read at once from a
+// container.
+#define CMAT_CHUNK (1 << 22)
+
+
+// Window of the matrix segmented independently.
+typedef struct {
+   int start;
+   int size;
+   int **obs;
+   char *remove;
+   // Candidate boundaries (positions in the full matrix) and scores.
+   int ncand;
+   int *cand;
+   int *score;
+} stream_window;
+
+// Shared state of the window workers.
+typedef struct {
+   stream_window *windows;
+   int n;
+   int m;
+   int overlap;
+   int n_threads;
+   int verbose;
+   int max_tad_size;
+   int do_not_use_heuristic;
+   int n_ready;
+   int n_taken;
+   int in_flight;
+   int done;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+} stream_arg;
+
+
+int
+is_number(
+  const char *token
+){
+// SYNOPSIS:
+//   Check whether a token of a tab-separated line is a number.
+//
+   char *end;
+   if (*token == '\0' || *token == '\n') return 0;
+   strtod(token, &end);
+   return (end != token) && (*end == '\0' || *end == '\t' ||
+         *end == '\n' || *end == '\r');
+}
+
+
+int
+read_line(
+  tadbit_reader *reader
+){
+// SYNOPSIS:
+//   Read the next line of the file of 'reader' in 'reader->line',
+//   which is grown as needed.
+//
+// RETURN:
+//   0 on success, -1 at the end of the file.
+//
+
+   size_t used = 0;
+   if (reader->line == NULL) {
+      reader->len = 1 << 16;
+      reader->line = (char *) malloc(reader->len);
+   }
+   while (gzgets(reader->f, reader->line + used, reader->len - used)) {
+      used += strlen(reader->line + used);
+      if (reader->line[used-1] == '\n') return 0;
+      // The line did not fit.
+      reader->len *= 2;
+      reader->line = (char *) realloc(reader->line, reader->len);
+   }
+   return used > 0 ? 0 : -1;
+
+}
+
+
+tadbit_reader *
+open_tadbit_reader(
+  const char *path
+){
+// SYNOPSIS:
+//   Open a tab-separated matrix for row-streamed reading. Only one
+//   line is kept in memory at a time. The file can be compressed
+//   with gzip, or be a container (see 'tadbit_cmat.h').
+//
+// PARAMETERS:
+//   'path': path to the matrix file.
+//
+// RETURN:
+//   A new reader, or 'NULL' if the file cannot be read.
+//
+
+   if (is_tadbit_cmat(path)) {
+      tadbit_cmat *cm = open_tadbit_cmat(path);
+      if (cm == NULL) return NULL;
+      tadbit_reader *reader = (tadbit_reader *) malloc(sizeof(tadbit_reader));
+      reader->f = NULL;
+      reader->n = cm->n;
+      reader->row = 0;
+      reader->line = NULL;
+      reader->len = 0;
+      reader->pending = 0;
+      reader->cm = cm;
+      const int chunk = CMAT_CHUNK / cm->n > 0 ? CMAT_CHUNK / cm->n : 1;
+      reader->rows = (int *) malloc(chunk * cm->n * sizeof(int));
+      reader->rows_first = 0;
+      reader->rows_count = 0;
+      return reader;
+   }
+
+   // Plain files are read as they are by 'zlib'.
+   gzFile f = gzopen(path, "rb");
+   if (f == NULL) {
+      fprintf(stderr, "cannot open matrix file %s\n", path);
+      return NULL;
+   }
+   gzbuffer(f, 1 << 17);
+
+   tadbit_reader *reader = (tadbit_reader *) malloc(sizeof(tadbit_reader));
+   reader->f = f;
+   reader->n = 0;
+   reader->row = 0;
+   reader->line = NULL;
+   reader->len = 0;
+   reader->pending = 0;
+   reader->cm = NULL;
+   reader->rows = NULL;
+
+   if (read_line(reader)) {
+      fprintf(stderr, "empty matrix file %s\n", path);
+      close_tadbit_reader(reader);
+      return NULL;
+   }
+
+   // Count the fields of the first line. If the second field is a
+   // number, there is no header and the line is the first row.
+   int nfields = 0;
+   int nnames = 0;
+   int second_is_number = 0;
+   char *token = reader->line;
+   while (token != NULL) {
+      if (nfields == 1) second_is_number = is_number(token);
+      if (*token != '\t' && *token != '\n' && *token != '\r') nnames++;
+      nfields++;
+      token = strchr(token, '\t');
+      if (token != NULL) token++;
+   }
+
+   if (second_is_number) {
+      reader->n = is_number(reader->line) ? nfields : nfields-1;
+      reader->pending = 1;
+   }
+   else {
+      // Header of column names (possibly after an empty field).
+      reader->n = nnames;
+   }
+
+   return reader;
+
+}
+
+
+int
+read_tadbit_row(
+  tadbit_reader *reader,
+  int *row
+){
+// SYNOPSIS:
+//   Read the next row of a matrix opened with 'open_tadbit_reader'.
+//
+// PARAMETERS:
+//   'reader': the reader.
+//        -- output arguments --
+//   'row': the counts of the row ('reader->n' values).
+//
+// RETURN:
+//   0 on success, -1 at the end of the file or if the row is invalid.
+//
+
+   if (reader->cm != NULL) {
+      const int n = reader->n;
+      const int i = reader->row;
+      if (i >= n) return -1;
+      if (i >= reader->rows_first + reader->rows_count) {
+         // Next chunk of rows.
+         const int chunk = CMAT_CHUNK / n > 0 ? CMAT_CHUNK / n : 1;
+         const int last = i+chunk-1 < n-1 ? i+chunk-1 : n-1;
+         if (tadbit_cmat_fetch(reader->cm, i, last, 0, n-1, reader->rows)) {
+            fprintf(stderr, "corrupt container at row %d\n", i+1);
+            return -1;
+         }
+         reader->rows_first = i;
+         reader->rows_count = last-i+1;
+      }
+      memcpy(row, reader->rows + (i-reader->rows_first)*n, n * sizeof(int));
+      reader->row++;
+      return 0;
+   }
+
+   if (!reader->pending && read_line(reader)) {
+      return -1;
+   }
+   reader->pending = 0;
+
+   int i = 0;
+   char *token = reader->line;
+   char *end;
+   // Skip the row name.
+   if (!is_number(token)) {
+      token = strchr(token, '\t');
+      if (token != NULL) token++;
+   }
+   // A single conversion per value: the token is a number if the
+   // conversion stops at a separator.
+   while (token != NULL && i < reader->n) {
+      double value = strtod(token, &end);
+      if (end == token || (*end != '\t' && *end != '\n' &&
+               *end != '\r' && *end != '\0')) break;
+      row[i++] = (int) value;
+      token = *end == '\t' ? end+1 : NULL;
+   }
+
+   if (i != reader->n) {
+      fprintf(stderr, "row %d has %d values instead of %d\n",
+            reader->row+1, i, reader->n);
+      return -1;
+   }
+
+   reader->row++;
+   return 0;
+
+}
+
+
+void
+close_tadbit_reader(
+  tadbit_reader *reader
+){
+   if (reader->cm != NULL) close_tadbit_cmat(reader->cm);
+   else gzclose(reader->f);
+   free(reader->line);
+   free(reader->rows);
+   free(reader);
+}
+
+
+int *
+read_tadbit_matrix(
+  const char *path,
+  int *n
+){
+// SYNOPSIS:
+//   Read a whole tab-separated matrix (plain or gzip) with a
+//   row-streamed reader, or a whole container.
+//
+// PARAMETERS:
+//   'path': path to the matrix file.
+//        -- output arguments --
+//   'n': number of rows/columns of the matrix.
+//
+// RETURN:
+//   The linearized matrix (row 'i' starts at 'i*n'), or 'NULL' if the
+//   file cannot be read or is not a square matrix.
+//
+
+   if (is_tadbit_cmat(path)) {
+      tadbit_cmat *cm = open_tadbit_cmat(path);
+      if (cm == NULL) return NULL;
+      int *obs = (int *) malloc((size_t) cm->n*cm->n * sizeof(int));
+      if (obs == NULL) {
+         fprintf(stderr, "cannot allocate memory for %s\n", path);
+         close_tadbit_cmat(cm);
+         return NULL;
+      }
+      if (tadbit_cmat_fetch(cm, 0, cm->n-1, 0, cm->n-1, obs)) {
+         fprintf(stderr, "corrupt container %s\n", path);
+         free(obs);
+         obs = NULL;
+      }
+      *n = cm->n;
+      close_tadbit_cmat(cm);
+      return obs;
+   }
+
+   tadbit_reader *reader = open_tadbit_reader(path);
+   if (reader == NULL) return NULL;
+
+   const int N = reader->n;
+   int *obs = (int *) malloc((size_t) N*N * sizeof(int));
+   if (obs == NULL) {
+      fprintf(stderr, "cannot allocate memory for %s\n", path);
+      close_tadbit_reader(reader);
+      return NULL;
+   }
+   int i;
+   for (i = 0 ; i < N ; i++) {
+      if (read_tadbit_row(reader, obs + (size_t) i*N)) {
+         fprintf(stderr, "matrix %s truncated at row %d\n", path, i);
+         free(obs);
+         close_tadbit_reader(reader);
+         return NULL;
+      }
+   }
+   close_tadbit_reader(reader);
+
+   *n = N;
+   return obs;
+
+}
+
+
+void
+destroy_tadbit_stream_output(
+  tadbit_stream_output *seg
+){
+   free(seg->bkpts);
+   free(seg->passages);
+   free(seg);
+}
+
+
+void
+segment_window(
+  stream_arg *arg,
+  stream_window *win
+){
+// SYNOPSIS:
+//   Run 'tadbit' on a window and keep the boundaries that are far
+//   enough from the cuts of the window.
+//
+// SIDE-EFFECTS:
+//   Free the window matrices and fill the candidates of 'win'.
+//
+
+   const int n = arg->n;
+   const int size = win->size;
+   const int start = win->start;
+   // Boundaries close to a cut are not reliable. The middle half of
+   // each overlap is trusted by both windows. The last bin of the
+   // window is always a boundary and is never a candidate.
+   const int margin = arg->overlap / 4;
+   const int lo = start > 0 ? start + margin : 0;
+   const int hi = start + size < n ? start + size - margin : n;
+
+   int i;
+   int k;
+
+   tadbit_output *seg = (tadbit_output *) malloc(sizeof(tadbit_output));
+   tadbit(win->obs, win->remove, size, arg->m, arg->n_threads, 0,
+         arg->max_tad_size, 0, arg->do_not_use_heuristic, seg);
+
+   for (k = 0 ; k < arg->m ; k++) free(win->obs[k]);
+   free(win->obs);
+   win->obs = NULL;
+   // 'tadbit' has freed 'remove'.
+   win->remove = NULL;
+
+   win->ncand = 0;
+   if (seg->maxbreaks < 0) {
+      // Too few rows/columns in the window.
+      free(seg);
+      return;
+   }
+
+   const int *bkpts = seg->bkpts + seg->nbreaks_opt*size;
+   for (i = 0 ; i < size ; i++) {
+      const int pos = start + i;
+      if (bkpts[i] && pos >= lo && pos < hi && i < size-1) win->ncand++;
+   }
+   win->cand = (int *) malloc(win->ncand * sizeof(int));
+   win->score = (int *) malloc(win->ncand * sizeof(int));
+   for (k = 0, i = 0 ; i < size ; i++) {
+      const int pos = start + i;
+      if (bkpts[i] && pos >= lo && pos < hi && i < size-1) {
+         win->cand[k] = pos;
+         win->score[k] = seg->passages[i];
+         k++;
+      }
+   }
+
+   destroy_tadbit_output(seg);
+
+}
+
+
+void *
+stream_worker(
+  void *arg
+){
+// SYNOPSIS:
+//   Thread function that segments the windows as they are read.
+//
+
+   stream_arg *myargs = (stream_arg *) arg;
+
+   while (1) {
+      pthread_mutex_lock(&myargs->lock);
+      while (myargs->n_taken == myargs->n_ready && !myargs->done) {
+         pthread_cond_wait(&myargs->cond, &myargs->lock);
+      }
+      if (myargs->n_taken == myargs->n_ready) {
+         // No window left.
+         pthread_mutex_unlock(&myargs->lock);
+         break;
+      }
+      stream_window *win = myargs->windows + myargs->n_taken;
+      myargs->n_taken++;
+      pthread_mutex_unlock(&myargs->lock);
+
+      if (myargs->verbose) {
+         fprintf(stderr, "segmenting window %d-%d\n",
+               win->start+1, win->start+win->size);
+      }
+      segment_window(myargs, win);
+
+      pthread_mutex_lock(&myargs->lock);
+      myargs->in_flight--;
+      pthread_cond_broadcast(&myargs->cond);
+      pthread_mutex_unlock(&myargs->lock);
+   }
+
+   return NULL;
+
+}
+
+
+int
+stitch_windows(
+  const stream_window *windows,
+  const int nw,
+  const int n,
+  tadbit_stream_output *seg
+){
+// SYNOPSIS:
+//   Reconcile the boundaries of the windows by dynamic programming.
+//   Every candidate boundary has the weight of its score (summed if
+//   several windows agree on the position), and the set of
+//   boundaries of maximum weight with no two boundaries closer than
+//   'STITCH_MIN_GAP' is kept. Outside of the overlaps, the boundaries
+//   of a window are always kept because 'tadbit' never places them
+//   closer than that.
+//
+// RETURN:
+//   The number of breakpoints.
+//
+
+   int i;
+   int j;
+   int w;
+
+   // Merge the candidates by position (the windows are ordered).
+   int *weight = (int *) malloc(n * sizeof(int));
+   int *best = (int *) malloc(n * sizeof(int));
+   for (i = 0 ; i < n ; i++) weight[i] = best[i] = 0;
+   for (w = 0 ; w < nw ; w++) {
+      for (i = 0 ; i < windows[w].ncand ; i++) {
+         const int pos = windows[w].cand[i];
+         weight[pos] += windows[w].score[i];
+         if (windows[w].score[i] > best[pos]) best[pos] = windows[w].score[i];
+      }
+   }
+
+   int ncand = 0;
+   for (i = 0 ; i < n ; i++) ncand += weight[i] > 0;
+   int *pos = (int *) malloc((ncand+1) * sizeof(int));
+   for (j = 0, i = 0 ; i < n ; i++) if (weight[i] > 0) pos[j++] = i;
+
+   // 'f[c+1]' is the best weight using the first 'c+1' candidates.
+   long *f = (long *) malloc((ncand+1) * sizeof(long));
+   int *prev = (int *) malloc((ncand+1) * sizeof(int));
+   f[0] = 0;
+   for (i = 0, j = 0 ; i < ncand ; i++) {
+      // 'j' is the number of candidates compatible with 'pos[i]'.
+      while (pos[j] <= pos[i] - STITCH_MIN_GAP) j++;
+      prev[i] = j;
+      const long take = weight[pos[i]] + f[j];
+      f[i+1] = take > f[i] ? take : f[i];
+   }
+
+   for (i = 0 ; i < n ; i++) seg->bkpts[i] = seg->passages[i] = 0;
+   int nbreaks = 0;
+   for (i = ncand-1 ; i >= 0 ; ) {
+      if (weight[pos[i]] + f[prev[i]] >= f[i]) {
+         seg->bkpts[pos[i]] = 1;
+         seg->passages[pos[i]] = best[pos[i]];
+         nbreaks++;
+         i = prev[i]-1;
+      }
+      else {
+         i--;
+      }
+   }
+
+   free(weight);
+   free(best);
+   free(pos);
+   free(f);
+   free(prev);
+
+   return nbreaks;
+
+}
+
+
+int
+tadbit_stream
+(
+  // input //
+  char **paths,
+  const int m,
+  const char *remove,
+  const int window,
+  const int overlap,
+  int n_threads,
+  int n_windows,
+  const int verbose,
+  const int max_tad_size,
+  const int do_not_use_heuristic,
+  // output //
+  tadbit_stream_output *seg
+)
+// SYNOPSIS:
+//   Segment a whole chromosome by windows. The matrices are read row
+//   by row, and every overlapping window of 'window' bins is segmented
+//   with 'tadbit' as soon as its last row is read. Only the rows of
+//   the current windows (restricted to the band of width 'window'
+//   around the diagonal) are kept in memory, so the peak memory is
+//   bounded by the window size. The boundaries in the overlaps are
+//   reconciled by a stitching dynamic programming
+//   (see 'stitch_windows').
+//
+// ARGUMENTS:
+//   'paths': (m) paths to the tab-separated matrices (replicates).
+//   'm': number of matrices.
+//   'remove': rows/columns to leave out (if 'NULL', those with 0 on
+//      the diagonal of the first matrix).
+//   'window': number of bins of the windows.
+//   'overlap': number of bins shared by consecutive windows.
+//   'n_threads': total number of threads (0 for all the processors).
+//   'n_windows': number of windows segmented in parallel (each with
+//      'n_threads/n_windows' threads).
+//   'verbose': whether to display progress.
+//   'max_tad_size': maximum TAD size (see 'tadbit').
+//   'do_not_use_heuristic': whether to compute all the slices.
+//        -- output arguments --
+//   'seg': output struct.
+//
+// RETURN:
+//   0 on success, -1 otherwise.
+//
+{
+
+   int i;
+   int j;
+   int k;
+   int r;
+   int w;
+
+   if (window < 6 || overlap < 0 || overlap >= window) {
+      fprintf(stderr, "invalid window (%d) or overlap (%d)\n",
+            window, overlap);
+      return -1;
+   }
+
+   if (n_threads < 1) n_threads = tadbit_cpu_count();
+   if (n_windows < 1) n_windows = 1;
+   if (n_windows > n_threads) n_windows = n_threads;
+
+   tadbit_reader **readers =
+      (tadbit_reader **) malloc(m * sizeof(tadbit_reader *));
+   for (k = 0 ; k < m ; k++) {
+      readers[k] = open_tadbit_reader(paths[k]);
+      if (readers[k] == NULL ||
+            (k > 0 && readers[k]->n != readers[0]->n)) {
+         if (readers[k] != NULL) {
+            fprintf(stderr, "matrices of different sizes\n");
+            k++;
+         }
+         while (k-- > 0) close_tadbit_reader(readers[k]);
+         free(readers);
+         return -1;
+      }
+   }
+
+   const int n = readers[0]->n;
+   const int W = window < n ? window : n;
+   const int step = W - overlap;
+
+   // Start of the windows (the last one ends with the matrix).
+   int nw = 1;
+   for (i = 0 ; i+W < n ; nw++) i = i+step+W > n ? n-W : i+step;
+   stream_window *windows =
+      (stream_window *) malloc(nw * sizeof(stream_window));
+   for (w = 0, i = 0 ; w < nw ; w++) {
+      windows[w].start = i;
+      windows[w].size = W;
+      windows[w].ncand = 0;
+      windows[w].cand = NULL;
+      windows[w].score = NULL;
+      i = i+step+W > n ? n-W : i+step;
+   }
+
+   // Ring buffers of the last 'W' rows, restricted to the band of
+   // columns [r-W+1, r+W-1] around the diagonal.
+   const int band = 2*W-1;
+   int **ring = (int **) malloc(m * sizeof(int *));
+   for (k = 0 ; k < m ; k++) {
+      ring[k] = (int *) malloc(W*band * sizeof(int));
+      for (i = 0 ; i < W*band ; i++) ring[k][i] = 0;
+   }
+   int *row = (int *) malloc(n * sizeof(int));
+
+   stream_arg arg = {
+      .windows = windows,
+      .n = n,
+      .m = m,
+      .overlap = overlap,
+      .n_threads = n_threads / n_windows,
+      .verbose = verbose,
+      .max_tad_size = max_tad_size,
+      .do_not_use_heuristic = do_not_use_heuristic,
+      .n_ready = 0,
+      .n_taken = 0,
+      .in_flight = 0,
+      .done = 0,
+   };
+   pthread_mutex_init(&arg.lock, NULL);
+   pthread_cond_init(&arg.cond, NULL);
+
+   pthread_t *tid = (pthread_t *) malloc(n_windows * sizeof(pthread_t));
+   for (i = 0 ; i < n_windows ; i++) {
+      if (create_worker(&(tid[i]), i, n_windows, &stream_worker, &arg)) {
+         fprintf(stderr, "error creating thread\n");
+         n_windows = i;
+         break;
+      }
+   }
+
+   int err = n_windows ? 0 : -1;
+   for (w = 0, r = 0 ; r < n && w < nw && !err ; r++) {
+
+      for (k = 0 ; k < m ; k++) {
+         if (read_tadbit_row(readers[k], row)) {
+            if (readers[k]->row < n) {
+               fprintf(stderr, "matrix %s truncated at row %d\n",
+                     paths[k], readers[k]->row);
+            }
+            err = -1;
+            break;
+         }
+         int *dest = ring[k] + (r % W)*band;
+         for (j = r-W+1 ; j < r+W ; j++)
+            dest[j-r+W-1] = (j >= 0 && j < n) ? row[j] : 0;
+      }
+      if (err) break;
+
+      // Dispatch the windows that end with this row.
+      while (w < nw && windows[w].start + W - 1 == r) {
+         stream_window *win = windows + w;
+
+         // Wait for a free slot to bound the memory.
+         pthread_mutex_lock(&arg.lock);
+         while (arg.in_flight >= n_windows) {
+            pthread_cond_wait(&arg.cond, &arg.lock);
+         }
+         arg.in_flight++;
+         pthread_mutex_unlock(&arg.lock);
+
+         const int s = win->start;
+         win->obs = (int **) malloc(m * sizeof(int *));
+         for (k = 0 ; k < m ; k++) {
+            win->obs[k] = (int *) malloc(W*W * sizeof(int));
+            for (j = 0 ; j < W ; j++)
+            for (i = 0 ; i < W ; i++)
+               win->obs[k][i+j*W] = ring[k][((s+i) % W)*band + j-i+W-1];
+         }
+         win->remove = (char *) malloc(W * sizeof(char));
+         for (i = 0 ; i < W ; i++) {
+            win->remove[i] = remove != NULL ?
+               remove[s+i] : win->obs[0][i+i*W] == 0;
+         }
+
+         pthread_mutex_lock(&arg.lock);
+         arg.n_ready++;
+         pthread_cond_broadcast(&arg.cond);
+         pthread_mutex_unlock(&arg.lock);
+         w++;
+      }
+
+   }
+
+   // Let the workers finish the windows in the queue.
+   pthread_mutex_lock(&arg.lock);
+   arg.done = 1;
+   pthread_cond_broadcast(&arg.cond);
+   pthread_mutex_unlock(&arg.lock);
+   for (i = 0 ; i < n_windows ; i++) {
+      pthread_join(tid[i], NULL);
+   }
+   pthread_mutex_destroy(&arg.lock);
+   pthread_cond_destroy(&arg.cond);
+
+   if (!err) {
+      seg->n = n;
+      seg->bkpts = (int *) malloc(n * sizeof(int));
+      seg->passages = (int *) malloc(n * sizeof(int));
+      seg->nbreaks = stitch_windows(windows, nw, n, seg);
+   }
+
+   for (w = 0 ; w < nw ; w++) {
+      free(windows[w].cand);
+      free(windows[w].score);
+   }
+   free(windows);
+   for (k = 0 ; k < m ; k++) {
+      free(ring[k]);
+      close_tadbit_reader(readers[k]);
+   }
+   free(ring);
+   free(readers);
+   free(row);
+   free(tid);
+
+   return err;
+
+}
@@ -0,0 +1,87 @@
+#include <zlib.h>
+#include "tadbit.h"
+#include "tadbit_cmat.h"
+
+#ifndef _TADBIT_STREAM_LOADED
+#define _TADBIT_STREAM_LOADED
+
+// Boundaries of different windows closer than 'STITCH_MIN_GAP' bins
+// are mutually exclusive in the stitching (this is also the minimum
+// TAD size of 'tadbit').
+#define STITCH_MIN_GAP 5
+
+// Row-streamed reader of tab-separated matrices (plain or gzip): an
+// optional header line with the column names, then one line per row
+// with an optional row name followed by the counts. Containers (see
+// 'tadbit_cmat.h') are read by chunks of rows.
+typedef struct {
+   gzFile f;
+   int n;
+   int row;
+   char *line;
+   size_t len;
+   int pending;
+   tadbit_cmat *cm;
+   int *rows;                  // Chunk of rows of the container.
+   int rows_first;
+   int rows_count;
+} tadbit_reader;
+
+// 'tadbit_stream' output struct.
+typedef struct {
+   int n;
+   int nbreaks;
+   int *bkpts;
+   int *passages;
+} tadbit_stream_output;
+
+
+tadbit_reader *
+open_tadbit_reader(
+  const char *path
+);
+
+
+int
+read_tadbit_row(
+  tadbit_reader *reader,
+  int *row
+);
+
+
+void
+close_tadbit_reader(
+  tadbit_reader *reader
+);
+
+
+int *
+read_tadbit_matrix(
+  const char *path,
+  int *n
+);
+
+
+int
+tadbit_stream(
+  /* input */
+  char **paths,
+  const int m,
+  const char *remove,
+  const int window,
+  const int overlap,
+  int n_threads,
+  int n_windows,
+  const int verbose,
+  const int max_tad_size,
+  const int do_not_use_heuristic,
+  /* output */
+  tadbit_stream_output *seg
+);
+
+
+void
+destroy_tadbit_stream_output(
+  tadbit_stream_output *seg
+);
+#endif
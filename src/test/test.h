@@ -6,10 +6,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 #include "tadbit.h"
-
-int _max_cache_index;
-int *_cache_index;
+#include "tadbit_stream.h"
 
 double
 ll
@@ -41,3 +40,37 @@ fastlog_init
 (
 		int prec
 );
+
+double
+DPconfidence
+(
+  const double *llikmat,
+  const int n,
+  const int nbreaks,
+  int n_threads,
+  double *alt_llik
+);
+
+void
+DPwalk
+(
+  const double *llikmat,
+  const int n,
+  const int MAXBREAKS,
+  int n_threads,
+  double *mllik,
+  int *breakpoints
+);
+
+void
+DPupdate
+(
+  const double *llikmat,
+  const char *skip,
+  const int n,
+  const int MAXBREAKS,
+  int n_threads,
+  dp_table *table,
+  double *mllik,
+  int *breakpoints
+);
@@ -196,6 +196,566 @@ test_tadbit
    
 }
 
+void
+test_tadbit_bias
+(void)
+{
+
+   int *obs[1];
+   int obs0[400];
+   memcpy(obs0, ideal_matrix_20x20, 400 * sizeof(int));
+   obs[0] = obs0;
+
+   // Row sums as external biases: same result as 'tadbit'.
+   double bias0[20] = {0};
+   double *bias[1] = {bias0};
+   for (int j = 0 ; j < 20 ; j++)
+   for (int i = 0 ; i < 20 ; i++)
+      bias0[i] += ideal_matrix_20x20[i+j*20];
+
+   char *remove = calloc(20, sizeof(char));
+   tadbit_output *seg = malloc(sizeof(tadbit_output));
+   tadbit(obs, remove, 20, 1, 1, 0, 20, 0, 1, seg);
+
+   remove = calloc(20, sizeof(char));
+   tadbit_output *bseg = malloc(sizeof(tadbit_output));
+   tadbit_bias(obs, remove, 20, 1, 1, 0, 20, 0, 1, TADBIT_BIAS_VECTORS,
+         bias, bseg);
+
+   g_assert_cmpint(bseg->nbreaks_opt, ==, seg->nbreaks_opt);
+   g_assert(!memcmp(bseg->llikmat, seg->llikmat, 400 * sizeof(double)));
+   g_assert(!memcmp(bseg->bkpts, seg->bkpts,
+         20*seg->maxbreaks * sizeof(int)));
+   destroy_tadbit_output(bseg);
+
+   // A row without valid bias is removed.
+   bias0[19] = NAN;
+   remove = calloc(20, sizeof(char));
+   bseg = malloc(sizeof(tadbit_output));
+   tadbit_bias(obs, remove, 20, 1, 1, 0, 20, 0, 1, TADBIT_BIAS_VECTORS,
+         bias, bseg);
+   g_assert(isnan(bseg->llikmat[0+19*20]));
+   destroy_tadbit_output(bseg);
+
+   // The block structure is found without bias.
+   remove = calloc(20, sizeof(char));
+   bseg = malloc(sizeof(tadbit_output));
+   tadbit_bias(obs, remove, 20, 1, 1, 0, 20, 0, 1, TADBIT_BIAS_NONE,
+         NULL, bseg);
+   g_assert_cmpint(bseg->nbreaks_opt, ==, 1);
+   for (int i = 0 ; i < 20 ; i++) {
+      g_assert_cmpint(bseg->bkpts[i+1*20], == , i == 9);
+   }
+   destroy_tadbit_output(bseg);
+   destroy_tadbit_output(seg);
+
+}
+
+void
+test_tadbit_focus
+(void)
+{
+
+   int *obs[1];
+   int obs0[400];
+   memcpy(obs0, ideal_matrix_20x20, 400 * sizeof(int));
+   obs[0] = obs0;
+
+   // The whole matrix as region: same result as 'tadbit'.
+   char *remove = calloc(20, sizeof(char));
+   tadbit_output *seg = malloc(sizeof(tadbit_output));
+   tadbit(obs, remove, 20, 1, 1, 0, 20, 0, 0, seg);
+
+   remove = calloc(20, sizeof(char));
+   tadbit_output *fseg = malloc(sizeof(tadbit_output));
+   tadbit_focus(obs, remove, 20, 1, 1, 0, 20, 0, 0, TADBIT_BIAS_ROWSUMS,
+         NULL, 0, 19, fseg);
+   g_assert_cmpint(fseg->nbreaks_opt, ==, seg->nbreaks_opt);
+   g_assert(!memcmp(fseg->llikmat, seg->llikmat, 400 * sizeof(double)));
+   g_assert(!memcmp(fseg->bkpts, seg->bkpts,
+         20*seg->maxbreaks * sizeof(int)));
+   destroy_tadbit_output(fseg);
+   destroy_tadbit_output(seg);
+
+   // The break is found in a region (with a removed row outside).
+   remove = calloc(20, sizeof(char));
+   remove[0] = 1;
+   fseg = malloc(sizeof(tadbit_output));
+   tadbit_focus(obs, remove, 20, 1, 1, 0, 20, 0, 1, TADBIT_BIAS_ROWSUMS,
+         NULL, 4, 17, fseg);
+   g_assert_cmpint(fseg->maxbreaks, ==, 2);
+   g_assert_cmpint(fseg->nbreaks_opt, ==, 1);
+   for (int i = 0 ; i < 14 ; i++) {
+      g_assert_cmpint(fseg->bkpts[i+1*14], == , i == 5);
+   }
+   destroy_tadbit_output(fseg);
+
+   // Invalid region.
+   remove = calloc(20, sizeof(char));
+   fseg = malloc(sizeof(tadbit_output));
+   tadbit_focus(obs, remove, 20, 1, 1, 0, 20, 0, 1, TADBIT_BIAS_ROWSUMS,
+         NULL, 10, 25, fseg);
+   g_assert_cmpint(fseg->maxbreaks, ==, -1);
+   free(fseg);
+
+}
+
+void
+test_tadbit_mapped
+(void)
+{
+
+   const char *path = "/tmp/tadbit_test_mapped";
+
+   int n;
+   int *obs0 = read_tadbit_matrix("../../test/20Kb/chrT/chrT_A.tsv", &n);
+   g_assert(obs0 != NULL);
+   FILE *f = fopen(path, "wb");
+   g_assert(f != NULL);
+   g_assert_cmpint(fwrite(obs0, sizeof(int), n*n, f), ==, n*n);
+   fclose(f);
+
+   int N;
+   int *map = map_tadbit_matrix(path, &N);
+   g_assert(map != NULL);
+   g_assert_cmpint(N, ==, n);
+   g_assert(!memcmp(map, obs0, n*n * sizeof(int)));
+
+   int *obs[1] = {obs0};
+   int *mobs[1] = {map};
+   double bias0[100];
+   double *bias[1] = {bias0};
+   for (int i = 0 ; i < n ; i++) bias0[i] = i == 50 ? 0.0 : 1.0 + i%7;
+
+   // Same result as 'tadbit_bias' for each bias model, with and
+   // without the heuristic, with removed rows/columns.
+   const int models[3] = {
+      TADBIT_BIAS_ROWSUMS, TADBIT_BIAS_NONE, TADBIT_BIAS_VECTORS
+   };
+   for (int t = 0 ; t < 3 ; t++) {
+      char *remove = calloc(n, sizeof(char));
+      remove[3] = remove[40] = remove[41] = 1;
+      tadbit_output *seg = malloc(sizeof(tadbit_output));
+      tadbit_bias(obs, remove, n, 1, 2, 0, n, 0, t == 1, models[t], bias,
+            seg);
+
+      remove = calloc(n, sizeof(char));
+      remove[3] = remove[40] = remove[41] = 1;
+      tadbit_output *mseg = malloc(sizeof(tadbit_output));
+      tadbit_mapped(mobs, remove, n, 1, 2, 0, n, 0, t == 1, models[t], bias,
+            mseg);
+
+      g_assert_cmpint(mseg->maxbreaks, ==, seg->maxbreaks);
+      g_assert_cmpint(mseg->nbreaks_opt, ==, seg->nbreaks_opt);
+      g_assert(!memcmp(mseg->passages, seg->passages, n * sizeof(int)));
+      g_assert(!memcmp(mseg->mllik, seg->mllik,
+            seg->maxbreaks * sizeof(double)));
+      g_assert(!memcmp(mseg->llikmat, seg->llikmat, n*n * sizeof(double)));
+      g_assert(!memcmp(mseg->bkpts, seg->bkpts,
+            n*seg->maxbreaks * sizeof(int)));
+      destroy_tadbit_output(mseg);
+      destroy_tadbit_output(seg);
+   }
+
+   // Too few rows/columns.
+   char *remove = malloc(n * sizeof(char));
+   memset(remove, 1, n);
+   tadbit_output *mseg = malloc(sizeof(tadbit_output));
+   tadbit_mapped(mobs, remove, n, 1, 1, 0, n, 0, 1, TADBIT_BIAS_ROWSUMS,
+         NULL, mseg);
+   g_assert_cmpint(mseg->maxbreaks, ==, -1);
+   free(mseg);
+
+   unmap_tadbit_matrix(map, N);
+   free(obs0);
+
+   // Not a square matrix.
+   f = fopen(path, "wb");
+   fwrite(bias0, sizeof(double), 3, f);
+   fclose(f);
+   g_assert(map_tadbit_matrix(path, &N) == NULL);
+   unlink(path);
+
+}
+
+void
+test_tadbit_threads
+(void)
+{
+
+   const int n_cpus = tadbit_cpu_count();
+   g_assert_cmpint(n_cpus, >=, 1);
+   g_assert_cmpint(n_cpus, <=, (int) sysconf(_SC_NPROCESSORS_ONLN));
+
+   int n;
+   int *obs0 = read_tadbit_matrix("../../test/20Kb/chrT/chrT_A.tsv", &n);
+   g_assert(obs0 != NULL);
+   int *obs[1] = {obs0};
+
+   // Same result with pinned workers (more workers than CPUs), with
+   // and without the heuristic.
+   for (int h = 0 ; h < 2 ; h++) {
+      char *remove = calloc(n, sizeof(char));
+      tadbit_output *seg = malloc(sizeof(tadbit_output));
+      tadbit(obs, remove, n, 1, 1, 0, n, 0, h, seg);
+
+      setenv("TADBIT_PIN_THREADS", "1", 1);
+      remove = calloc(n, sizeof(char));
+      tadbit_output *pseg = malloc(sizeof(tadbit_output));
+      tadbit(obs, remove, n, 1, 2*n_cpus+1, 0, n, 0, h, pseg);
+      unsetenv("TADBIT_PIN_THREADS");
+
+      g_assert_cmpint(pseg->nbreaks_opt, ==, seg->nbreaks_opt);
+      g_assert(!memcmp(pseg->bkpts, seg->bkpts,
+            n*seg->maxbreaks * sizeof(int)));
+      g_assert(!memcmp(pseg->llikmat, seg->llikmat, n*n * sizeof(double)));
+      destroy_tadbit_output(pseg);
+      destroy_tadbit_output(seg);
+   }
+
+   free(obs0);
+
+}
+
+void
+test_tadbit_nested
+(void)
+{
+
+   // Two TADs of 20 bins, each made of two sub-TADs of 10 bins.
+   int obs0[1600];
+   int *obs[1] = {obs0};
+   double bias0[40] = {0};
+   double *bias[1] = {bias0};
+   for (int j = 0 ; j < 40 ; j++)
+   for (int i = 0 ; i < 40 ; i++) {
+      int v = 2 + (i/20 == j/20 ? 8 : 0) + (i/10 == j/10 ? 5 : 0);
+      obs0[i+j*40] = v*10 / (abs(i-j)+1);
+      bias0[i] += obs0[i+j*40];
+   }
+
+   char *remove = calloc(40, sizeof(char));
+   tadbit_output *seg = malloc(sizeof(tadbit_output));
+   tadbit(obs, remove, 40, 1, 2, 0, 40, 0, 1, seg);
+
+   remove = calloc(40, sizeof(char));
+   tadbit_output *nseg = malloc(sizeof(tadbit_output));
+   tadbit_tree *tree = malloc(sizeof(tadbit_tree));
+   tadbit_nested(obs, remove, 40, 1, 2, 0, 40, 0, 1, TADBIT_BIAS_ROWSUMS,
+         NULL, 2, nseg, tree);
+
+   // The first level is the output of 'tadbit'.
+   g_assert_cmpint(nseg->nbreaks_opt, ==, seg->nbreaks_opt);
+   g_assert(!memcmp(nseg->bkpts, seg->bkpts,
+         40*seg->maxbreaks * sizeof(int)));
+   g_assert_cmpint(tree->n_nodes, ==, 7);
+   g_assert_cmpint(tree->end[1], ==, 19);
+   g_assert_cmpint(tree->level[2], ==, 1);
+
+   // Same sub-TADs as 'tadbit' on the sub-matrix with the same bias.
+   int sub0[400];
+   int *sub[1] = {sub0};
+   for (int j = 0 ; j < 20 ; j++)
+   for (int i = 0 ; i < 20 ; i++)
+      sub0[i+j*20] = obs0[i+j*40];
+   destroy_tadbit_output(seg);
+   seg = malloc(sizeof(tadbit_output));
+   remove = calloc(20, sizeof(char));
+   tadbit_bias(sub, remove, 20, 1, 1, 0, 20, 0, 1, TADBIT_BIAS_VECTORS,
+         bias, seg);
+   g_assert_cmpint(seg->nbreaks_opt, ==, 1);
+   for (int i = 0 ; i < 20 ; i++) {
+      g_assert_cmpint(seg->bkpts[i+1*20], == , i == 9);
+   }
+   for (int k = 3 ; k < 7 ; k++) {
+      g_assert_cmpint(tree->parent[k], ==, k < 5 ? 1 : 2);
+      g_assert_cmpint(tree->level[k], ==, 2);
+      g_assert_cmpint(tree->start[k], ==, 10*(k-3));
+      g_assert_cmpint(tree->end[k], ==, 10*(k-3)+9);
+      g_assert_cmpint(tree->score[k] > 0, ==, k % 2);
+   }
+
+   destroy_tadbit_output(seg);
+   destroy_tadbit_output(nseg);
+   destroy_tadbit_tree(tree);
+
+}
+
+void
+test_tadbit_multires
+(void)
+{
+
+   int *obs[2];
+   int obs0[400];
+   int obs1[400];
+   memcpy(obs0, ideal_matrix_20x20, 400 * sizeof(int));
+   memcpy(obs1, ideal_matrix_20x20, 400 * sizeof(int));
+   obs[0] = obs0;
+   obs[1] = obs1;
+
+   tadbit_output *seg = malloc(sizeof(tadbit_output));
+   char *remove = (char *) calloc(20, sizeof(char));
+
+   tadbit_multires(obs, remove, 20, 2, 1, 0, 2, 0, seg);
+
+   // Same break as 'test_tadbit'.
+   g_assert_cmpint(seg->maxbreaks, ==, 4);
+   g_assert_cmpint(seg->nbreaks_opt, ==, 1);
+   for (int i = 0 ; i < 20 ; i++) {
+      g_assert_cmpint(seg->bkpts[i+1*20], == , i == 9);
+   }
+
+   destroy_tadbit_output(seg);
+
+}
+
+void
+test_tadbit_shard
+(void)
+{
+
+   const int n_shards = 3;
+   char *files[3] = {
+      "/tmp/tadbit_test_shard_0",
+      "/tmp/tadbit_test_shard_1",
+      "/tmp/tadbit_test_shard_2",
+   };
+
+   int *obs[2];
+   int obs0[400];
+   int obs1[400];
+   char *remove;
+
+   // Compute the shards in separate processes.
+   for (int s = 0 ; s < n_shards ; s++) {
+      pid_t pid = fork();
+      g_assert(pid >= 0);
+      if (pid == 0) {
+         memcpy(obs0, ideal_matrix_20x20, 400 * sizeof(int));
+         memcpy(obs1, ideal_matrix_20x20, 400 * sizeof(int));
+         obs[0] = obs0;
+         obs[1] = obs1;
+         remove = (char *) calloc(20, sizeof(char));
+         _exit(tadbit_shard(obs, remove, 20, 2, 1, 0, 20, 1,
+                  s, n_shards, files[s]) ? 1 : 0);
+      }
+   }
+   for (int s = 0 ; s < n_shards ; s++) {
+      int status;
+      wait(&status);
+      g_assert(WIFEXITED(status));
+      g_assert_cmpint(WEXITSTATUS(status), ==, 0);
+   }
+
+   // Merge the shards.
+   memcpy(obs0, ideal_matrix_20x20, 400 * sizeof(int));
+   memcpy(obs1, ideal_matrix_20x20, 400 * sizeof(int));
+   obs[0] = obs0;
+   obs[1] = obs1;
+   tadbit_output *merged = malloc(sizeof(tadbit_output));
+   remove = (char *) calloc(20, sizeof(char));
+   tadbit_merge(obs, remove, 20, 2, 1, 0, 20, 0, 1, n_shards, files,
+         merged);
+
+   // Single-process reference.
+   memcpy(obs0, ideal_matrix_20x20, 400 * sizeof(int));
+   memcpy(obs1, ideal_matrix_20x20, 400 * sizeof(int));
+   tadbit_output *seg = malloc(sizeof(tadbit_output));
+   remove = (char *) calloc(20, sizeof(char));
+   tadbit(obs, remove, 20, 2, 1, 0, 20, 0, 1, seg);
+
+   // The output must be identical bit for bit.
+   g_assert_cmpint(merged->maxbreaks, ==, seg->maxbreaks);
+   g_assert_cmpint(merged->nbreaks_opt, ==, seg->nbreaks_opt);
+   g_assert(!memcmp(merged->llikmat, seg->llikmat, 400 * sizeof(double)));
+   g_assert(!memcmp(merged->mllik, seg->mllik,
+            seg->maxbreaks * sizeof(double)));
+   g_assert(!memcmp(merged->bkpts, seg->bkpts,
+            20*seg->maxbreaks * sizeof(int)));
+   g_assert(!memcmp(merged->passages, seg->passages, 20 * sizeof(int)));
+
+   // A missing shard is computed by the merge step.
+   memcpy(obs0, ideal_matrix_20x20, 400 * sizeof(int));
+   memcpy(obs1, ideal_matrix_20x20, 400 * sizeof(int));
+   destroy_tadbit_output(merged);
+   merged = malloc(sizeof(tadbit_output));
+   remove = (char *) calloc(20, sizeof(char));
+   tadbit_merge(obs, remove, 20, 2, 1, 0, 20, 0, 1, 1, files, merged);
+   g_assert(!memcmp(merged->llikmat, seg->llikmat, 400 * sizeof(double)));
+
+   // Shards of another matrix of the same size are rejected.
+   memcpy(obs0, ideal_matrix_20x20, 400 * sizeof(int));
+   memcpy(obs1, ideal_matrix_20x20, 400 * sizeof(int));
+   obs0[21] += 5;
+   tadbit_output *other = malloc(sizeof(tadbit_output));
+   remove = (char *) calloc(20, sizeof(char));
+   tadbit_merge(obs, remove, 20, 2, 1, 0, 20, 0, 1, n_shards, files,
+         other);
+   g_assert_cmpint(other->maxbreaks, ==, -1);
+   free(other);
+
+   for (int s = 0 ; s < n_shards ; s++) unlink(files[s]);
+   destroy_tadbit_output(merged);
+   destroy_tadbit_output(seg);
+
+}
+
+void
+test_tadbit_stream
+(void)
+{
+
+   char *paths[1] = {"../../test/20Kb/chrT/chrT_A.tsv"};
+
+   // Read the whole matrix with the row reader.
+   tadbit_reader *reader = open_tadbit_reader(paths[0]);
+   g_assert(reader != NULL);
+   const int n = reader->n;
+   g_assert_cmpint(n, ==, 100);
+   int *obs[1];
+   obs[0] = malloc(n*n * sizeof(int));
+   int *row = malloc(n * sizeof(int));
+   for (int i = 0 ; i < n ; i++) {
+      g_assert_cmpint(read_tadbit_row(reader, row), ==, 0);
+      for (int j = 0 ; j < n ; j++) obs[0][i+j*n] = row[j];
+   }
+   g_assert_cmpint(read_tadbit_row(reader, row), ==, -1);
+   close_tadbit_reader(reader);
+
+   char *remove = malloc(n * sizeof(char));
+   for (int i = 0 ; i < n ; i++) remove[i] = obs[0][i+i*n] == 0;
+   tadbit_output *seg = malloc(sizeof(tadbit_output));
+   tadbit(obs, remove, n, 1, 1, 0, n, 0, 0, seg);
+
+   // With a single window, the breakpoints are those of 'tadbit'.
+   tadbit_stream_output *sseg = malloc(sizeof(tadbit_stream_output));
+   g_assert_cmpint(tadbit_stream(paths, 1, NULL, 200, 20, 1, 1, 0, 200,
+            0, sseg), ==, 0);
+   g_assert_cmpint(sseg->n, ==, n);
+   g_assert_cmpint(sseg->nbreaks, ==, seg->nbreaks_opt);
+   for (int i = 0 ; i < n ; i++) {
+      g_assert_cmpint(sseg->bkpts[i], ==, seg->bkpts[i+seg->nbreaks_opt*n]);
+      g_assert_cmpint(sseg->passages[i], ==, seg->passages[i]);
+   }
+   destroy_tadbit_stream_output(sseg);
+
+   // Overlapping windows segmented in parallel.
+   sseg = malloc(sizeof(tadbit_stream_output));
+   g_assert_cmpint(tadbit_stream(paths, 1, NULL, 50, 20, 2, 2, 0, 50,
+            0, sseg), ==, 0);
+   int last = -STITCH_MIN_GAP;
+   int nbreaks = 0;
+   for (int i = 0 ; i < n ; i++) {
+      if (!sseg->bkpts[i]) continue;
+      g_assert_cmpint(i - last, >=, STITCH_MIN_GAP);
+      g_assert_cmpint(sseg->passages[i], >, 0);
+      last = i;
+      nbreaks++;
+   }
+   g_assert_cmpint(nbreaks, ==, sseg->nbreaks);
+   g_assert_cmpint(abs(nbreaks - seg->nbreaks_opt), <, 3);
+   destroy_tadbit_stream_output(sseg);
+
+   destroy_tadbit_output(seg);
+   free(obs[0]);
+   free(row);
+
+}
+
+void
+test_tadbit_cmat
+(void)
+{
+
+   const char *path = "../../test/20Kb/chrT/chrT_A.tsv";
+   char *files[2] = {
+      "/tmp/tadbit_test_cmat_0",
+      "/tmp/tadbit_test_cmat_1",
+   };
+
+   int n;
+   int *obs = read_tadbit_matrix(path, &n);
+   g_assert(obs != NULL);
+   g_assert_cmpint(n, ==, 100);
+
+   double *bias = malloc(n * sizeof(double));
+   for (int i = 0 ; i < n ; i++) bias[i] = 1.0 + i;
+   const char *names[2] = {"chrT", "chrU"};
+   const int sizes[2] = {60, 40};
+
+   // All the diagonals, uncompressed, with small blocks.
+   g_assert_cmpint(write_tadbit_cmat(files[0], obs, n, 0, 7, 0, 20000,
+            2, names, sizes, bias), ==, 0);
+   // A band of 30 diagonals, compressed.
+   g_assert_cmpint(write_tadbit_cmat(files[1], obs, n, 30, 16, 1, 20000,
+            0, NULL, NULL, NULL), ==, 0);
+   g_assert(is_tadbit_cmat(files[0]));
+   g_assert(!is_tadbit_cmat(path));
+
+   tadbit_cmat *cm = open_tadbit_cmat(files[0]);
+   g_assert(cm != NULL);
+   g_assert_cmpint(cm->n, ==, n);
+   g_assert_cmpint(cm->band, ==, n);
+   g_assert_cmpint(cm->resolution, ==, 20000);
+   g_assert_cmpint(cm->n_chrom, ==, 2);
+   g_assert_cmpstr(cm->chrom[1].name, ==, "chrU");
+   g_assert_cmpint(cm->chrom[1].first, ==, 60);
+   g_assert_cmpint(cm->chrom[1].size, ==, 40);
+   g_assert(cm->bias != NULL);
+   g_assert_cmpfloat(cm->bias[99], ==, 100.0);
+
+   // Direct access to a diagonal.
+   const int *diag = tadbit_cmat_band(cm, 3);
+   g_assert(diag != NULL);
+   for (int i = 0 ; i < n-3 ; i++) {
+      g_assert_cmpint(diag[i], ==, obs[i*n+i+3]);
+   }
+
+   // The whole matrix and an off-diagonal rectangle.
+   int *out = malloc(n*n * sizeof(int));
+   g_assert_cmpint(tadbit_cmat_fetch(cm, 0, n-1, 0, n-1, out), ==, 0);
+   for (int i = 0 ; i < n*n ; i++) g_assert_cmpint(out[i], ==, obs[i]);
+   g_assert_cmpint(tadbit_cmat_fetch(cm, 40, 49, 5, 24, out), ==, 0);
+   for (int i = 40 ; i < 50 ; i++)
+   for (int j = 5 ; j < 25 ; j++) {
+      g_assert_cmpint(out[(i-40)*20+j-5], ==, obs[i*n+j]);
+   }
+   g_assert_cmpint(tadbit_cmat_fetch(cm, 0, n, 0, 10, out), ==, -1);
+   close_tadbit_cmat(cm);
+
+   // Outside of the band the counts are 0.
+   cm = open_tadbit_cmat(files[1]);
+   g_assert(cm != NULL);
+   g_assert_cmpint(cm->band, ==, 30);
+   g_assert(cm->bias == NULL);
+   g_assert(tadbit_cmat_band(cm, 0) == NULL);
+   g_assert_cmpint(tadbit_cmat_fetch(cm, 10, 69, 10, 69, out), ==, 0);
+   for (int i = 10 ; i < 70 ; i++)
+   for (int j = 10 ; j < 70 ; j++) {
+      g_assert_cmpint(out[(i-10)*60+j-10], ==,
+            abs(i-j) < 30 ? obs[i*n+j] : 0);
+   }
+   close_tadbit_cmat(cm);
+
+   // The row reader gives the same rows.
+   tadbit_reader *reader = open_tadbit_reader(files[0]);
+   g_assert(reader != NULL);
+   g_assert_cmpint(reader->n, ==, n);
+   for (int i = 0 ; i < n ; i++) {
+      g_assert_cmpint(read_tadbit_row(reader, out), ==, 0);
+      for (int j = 0 ; j < n ; j++) g_assert_cmpint(out[j], ==, obs[i*n+j]);
+   }
+   g_assert_cmpint(read_tadbit_row(reader, out), ==, -1);
+   close_tadbit_reader(reader);
+
+   for (int s = 0 ; s < 2 ; s++) unlink(files[s]);
+   free(obs);
+   free(out);
+   free(bias);
+
+}
+
 void
 test_ll
 (void)
@@ -207,17 +767,12 @@ test_ll
    double w[400] = {[0 ... 399] = 1.0};
    //double d[400];
    int dp[20];
-   int C[400];
-
-   _cache_index = C;
-   _max_cache_index = 21;
 
    for (int j = 0 ; j < 20 ; j++) {
-      for (int i = 0 ; i < 20 ; i++) {
-         //d[i+j*20] = log(abs(j-i));
-    	 dp[j] = j;
-         C[i+j*20] = abs(j-i);
-      }
+      //for (int i = 0 ; i < 20 ; i++) {
+      //   d[i+j*20] = log(abs(j-i));
+      //}
+      dp[j] = j;
    }
 
    fastlog_init(16);
@@ -248,6 +803,192 @@ test_ll
 }
 
 
+void
+test_DPupdate
+(void)
+{
+
+   const int n = 40;
+   const int MAXBREAKS = 8;
+   double llikmat[40*40];
+   double values[40*40];
+   char skip[40*40];
+   double mllik[8];
+   double expected_mllik[8];
+   int bkpts[40*8];
+   int expected_bkpts[40*8];
+
+   dp_table table = {
+      .n = n,
+      .nlayers = 0,
+      .llik = malloc(n*MAXBREAKS * sizeof(double)),
+      .bkpt = malloc(n*MAXBREAKS * sizeof(int)),
+   };
+
+   // Random log-likelihoods (with ties), revealed in three steps.
+   srand(123);
+   for (int i = 0 ; i < n*n ; i++) {
+      values[i] = (i % n) > (i / n) ? NAN : -(rand() % 50);
+      llikmat[i] = NAN;
+   }
+
+   for (int step = 0 ; step < 3 ; step++) {
+      for (int i = 0 ; i < n*n ; i++) {
+         skip[i] = 1;
+         if (isnan(llikmat[i]) && !isnan(values[i]) && rand() % 3 == 0) {
+            llikmat[i] = values[i];
+            skip[i] = 0;
+         }
+      }
+      DPupdate(llikmat, skip, n, MAXBREAKS - step, 2, &table,
+            mllik, bkpts);
+      DPwalk(llikmat, n, MAXBREAKS - step, 1, expected_mllik,
+            expected_bkpts);
+      for (int i = 1 ; i < MAXBREAKS - step ; i++) {
+         g_assert_cmpfloat(mllik[i], ==, expected_mllik[i]);
+      }
+      g_assert(!memcmp(bkpts, expected_bkpts,
+            n*(MAXBREAKS - step) * sizeof(int)));
+   }
+
+   free(table.llik);
+   free(table.bkpt);
+
+}
+
+void
+test_DPwalk
+(void)
+{
+
+   // The pruned DP gives the segmentations of the plain recurrence
+   // (first start point on ties), with missing slices.
+   const int n = 90;
+   const int MAXBREAKS = 18;
+   double *llikmat = malloc(n*n * sizeof(double));
+   double mllik[18];
+   int *bkpts = malloc(n*MAXBREAKS * sizeof(int));
+   double *llik = malloc(n*MAXBREAKS * sizeof(double));
+   int *prev = malloc(n*MAXBREAKS * sizeof(int));
+
+   srand(321);
+   for (int j = 0 ; j < n ; j++)
+   for (int i = 0 ; i < n ; i++) {
+      llikmat[i+j*n] = i > j || rand() % 7 == 0 ? NAN :
+         -(double) ((j-i)/8 + rand() % 3);
+   }
+   DPwalk(llikmat, n, MAXBREAKS, 2, mllik, bkpts);
+
+   for (int j = 0 ; j < n ; j++) {
+      llik[j] = llikmat[j*n];
+      prev[j] = -1;
+   }
+   for (int nbreaks = 1 ; nbreaks < MAXBREAKS ; nbreaks++) {
+      for (int j = 0 ; j < n ; j++) {
+         double best = -INFINITY;
+         int bkpt = -1;
+         if (j < 3 * nbreaks + 2) best = llik[j+(nbreaks-1)*n];
+         for (int i = 3 * nbreaks ; i < j-3 ; i++) {
+            double tmp = llik[i-1+(nbreaks-1)*n] + llikmat[i+j*n];
+            if (tmp > best) {
+               best = tmp;
+               bkpt = i-1;
+            }
+         }
+         llik[j+nbreaks*n] = best;
+         prev[j+nbreaks*n] = bkpt;
+      }
+      g_assert_cmpfloat(mllik[nbreaks], ==, llik[n-1+nbreaks*n]);
+      for (int l = nbreaks, j = n-1 ; l > 0 ; l--) {
+         if (prev[j+l*n] < 0) continue;
+         g_assert_cmpint(bkpts[prev[j+l*n]+nbreaks*n], ==, 1);
+         j = prev[j+l*n];
+      }
+   }
+
+   free(llikmat);
+   free(bkpts);
+   free(llik);
+   free(prev);
+
+}
+
+void
+brute_force_segmentations
+(
+  const double *llikmat,
+  const int n,
+  const int nTADs,
+  const int layer,
+  const int start,
+  const double llik,
+  char *isbreak,
+  double *opt,
+  double *alt_llik
+)
+// Enumerate all the segmentations allowed by 'DPwalk' and record
+// the best log-likelihood, and the best one without break per position.
+{
+
+   if (layer == nTADs) {
+      if (start != n) return;
+      if (llik > *opt) *opt = llik;
+      for (int i = 0 ; i < n ; i++) {
+         if (!isbreak[i] && llik > alt_llik[i]) alt_llik[i] = llik;
+      }
+      return;
+   }
+   if (layer > 0 && start < 3*layer) return;
+   for (int j = start + (layer ? 4 : 0) ; j < n ; j++) {
+      double tmp = llikmat[start+j*n];
+      if (isnan(tmp)) continue;
+      isbreak[j] = 1;
+      brute_force_segmentations(llikmat, n, nTADs, layer+1, j+1,
+            llik + tmp, isbreak, opt, alt_llik);
+      isbreak[j] = 0;
+   }
+
+}
+
+void
+test_DPconfidence
+(void)
+{
+
+   const int n = 24;
+   double llikmat[24*24];
+   double alt_llik[24];
+   double expected[24];
+   char isbreak[24] = {0};
+
+   // Random log-likelihoods with a band of undefined values.
+   srand(123);
+   for (int i = 0 ; i < n*n ; i++) {
+      llikmat[i] = (i % n) > (i / n) || (i / n) - (i % n) > 14 ?
+         NAN : -100.0 * rand() / RAND_MAX;
+   }
+
+   for (int nbreaks = 1 ; nbreaks < 5 ; nbreaks++) {
+      double opt = -INFINITY;
+      for (int i = 0 ; i < n ; i++) expected[i] = -INFINITY;
+      brute_force_segmentations(llikmat, n, nbreaks+1, 0, 0, 0.0,
+            isbreak, &opt, expected);
+
+      double mllik = DPconfidence(llikmat, n, nbreaks, 3, alt_llik);
+      g_assert_cmpfloat(fabs(mllik-opt), <, 1e-9);
+      for (int i = 0 ; i < n-1 ; i++) {
+         if (expected[i] == -INFINITY) {
+            g_assert_cmpfloat(alt_llik[i], ==, -INFINITY);
+         }
+         else {
+            g_assert_cmpfloat(fabs(alt_llik[i]-expected[i]), <, 1e-9);
+         }
+      }
+   }
+
+}
+
+
 void
 test_tadbit_on_real_input
 (void)
@@ -323,7 +1064,19 @@ main(
    g_test_init(&argc, &argv, NULL);
    g_test_add_func("/ll", test_ll);
    g_test_add_func("/enforce_symmetry", test_enforce_symmetry);
+   g_test_add_func("/DPupdate", test_DPupdate);
+   g_test_add_func("/DPwalk", test_DPwalk);
+   g_test_add_func("/DPconfidence", test_DPconfidence);
    g_test_add_func("/tadbit", test_tadbit);
+   g_test_add_func("/tadbit_bias", test_tadbit_bias);
+   g_test_add_func("/tadbit_focus", test_tadbit_focus);
+   g_test_add_func("/tadbit_nested", test_tadbit_nested);
+   g_test_add_func("/tadbit_multires", test_tadbit_multires);
+   g_test_add_func("/tadbit_shard", test_tadbit_shard);
+   g_test_add_func("/tadbit_stream", test_tadbit_stream);
+   g_test_add_func("/tadbit_cmat", test_tadbit_cmat);
+   g_test_add_func("/tadbit_mapped", test_tadbit_mapped);
+   g_test_add_func("/tadbit_threads", test_tadbit_threads);
    if (g_test_thorough()) {
       g_test_add_func("/tadbit_on_real_input", test_tadbit_on_real_input);
    }
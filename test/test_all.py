@@ -10,23 +10,36 @@ matplotlib.use('Agg')
 import unittest
 from pytadbit                             import Chromosome, load_chromosome
 from pytadbit                             import tadbit, batch_tadbit
+from pytadbit                             import tadbit_nested
+from pytadbit                             import tadbit_shard, tadbit_merge
+from pytadbit                             import tadbit_stream, tadbit_mapped
 from pytadbit.tad_clustering.tad_cmo      import optimal_cmo
 from pytadbit.modelling.structuralmodels        import load_structuralmodels
 from pytadbit.modelling.impmodel                import load_impmodel_from_cmm
 from pytadbit.eqv_rms_drms                import rmsdRMSD_wrapper
+from pytadbit.centroid                    import centroid_wrapper
+from pytadbit.centroid                    import centroids_wrapper
+from pytadbit.consistency                 import consistency_wrapper
+from pytadbit.contacts                    import contact_map_wrapper
+from pytadbit.contacts                    import interactions_wrapper
 from pytadbit.parsers.genome_parser       import parse_fasta
 from pytadbit.mapping.restriction_enzymes import map_re_sites, RESTRICTION_ENZYMES
 from pytadbit.parsers.hic_parser          import load_hic_data_from_reads, read_matrix
+from pytadbit.parsers.cmat_parser         import write_cmat, read_cmat
+from pytadbit.parsers.cmat_parser         import write_raw_matrix
 from pytadbit.mapping.analyze             import hic_map, plot_distance_vs_interactions
 from pytadbit.mapping.analyze             import insert_sizes, plot_iterative_mapping
 from pytadbit.mapping.analyze             import correlate_matrices, eig_correlate_matrices
 from pytadbit.mapping.filter              import filter_reads, apply_filter
 
-from random                               import random, seed
+from random                               import random, seed, gauss
+from math                                 import cos, sin, isnan
 from os                                   import system, path, chdir
 from re                                   import finditer
 from warnings                             import warn, catch_warnings, simplefilter
 from distutils.spawn                      import find_executable
+from numpy                                import frombuffer, float32, int32
+from scipy.spatial.distance               import squareform
 
 import sys
 
@@ -46,6 +59,23 @@ def check_hic(hic, size):
     return True
 
 
+def random_walk_models(nmodels, nloci, step=50., noise=0.):
+    """
+    x, y and z coordinates of models that are a random walk (the same for
+    all the models) plus gaussian noise
+    """
+    walk = [[0., 0., 0.]]
+    for _ in xrange(nloci - 1):
+        walk.append([c + gauss(0, step) for c in walk[-1]])
+    xs, ys, zs = [], [], []
+    for _ in xrange(nmodels):
+        model = [[c + gauss(0, noise) for c in p] for p in walk]
+        xs.append([p[0] for p in model])
+        ys.append([p[1] for p in model])
+        zs.append([p[2] for p in model])
+    return xs, ys, zs
+
+
 class TestTadbit(unittest.TestCase):
     """
     test main tadbit functions
@@ -78,7 +108,7 @@ class TestTadbit(unittest.TestCase):
         #breaks = [0, 4, 10, 15, 23, 29, 38, 45]
         #scores = [7.0, 7.0, 5.0, 7.0, 4.0, 6.0, 8.0, None]
         breaks = [0, 4, 10, 15, 20, 25, 31, 36, 45]
-        scores = [7.0, 7.0, 4.0, 4.0, 4.0, 4.0, 4.0, 7.0, None]
+        scores = [5.0, 5.0, 4.0, 4.0, 4.0, 4.0, 4.0, 5.0, None]
         self.assertEqual(exp1['start'], breaks)
         self.assertEqual(exp1['score'], scores)
 
@@ -86,6 +116,137 @@ class TestTadbit(unittest.TestCase):
             print '1', time() - t0
 
 
+    def test_01_tadbit_shards(self):
+        """
+        same result with the slices computed in shards (uses test_01)
+        """
+        if ONLY and ONLY != '01':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        shards = [tadbit_shard(PATH + '/40Kb/chrT/chrT_A.tsv', i, 3,
+                               'lala_shard%d' % i, verbose=False)
+                  for i in xrange(3)]
+        exp1_merged = tadbit_merge(PATH + '/40Kb/chrT/chrT_A.tsv', shards,
+                                   verbose=False, n_cpus='max')
+        system('rm -f lala_shard*')
+        self.assertEqual(exp1_merged, exp1)
+
+        if CHKTIME:
+            print '1', time() - t0
+
+
+    def test_01_tadbit_multires(self):
+        """
+        same boundaries when refining the TADs found at 80Kb (uses test_01)
+        """
+        if ONLY and ONLY != '01':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        exp2_multires = tadbit(PATH + '/20Kb/chrT/chrT_B.tsv',
+                               coarse_factor=4, verbose=False, n_cpus='max')
+        self.assertEqual(exp2_multires['start'], exp2['start'])
+
+        if CHKTIME:
+            print '1', time() - t0
+
+
+    def test_01_tadbit_stream(self):
+        """
+        same result streaming the matrix in a single window (uses test_01)
+        """
+        if ONLY and ONLY != '01':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        exp2_stream = tadbit_stream(PATH + '/20Kb/chrT/chrT_B.tsv',
+                                    window=200, verbose=False)
+        self.assertEqual(exp2_stream, exp2)
+
+        if CHKTIME:
+            print '1', time() - t0
+
+
+    def test_01_tadbit_biases(self):
+        """
+        same result with the row sums given as precomputed biases (uses test_01)
+        """
+        if ONLY and ONLY != '01':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        rows = [map(float, l.split()[1:]) for l in
+                open(PATH + '/40Kb/chrT/chrT_A.tsv').readlines()[1:]]
+        exp1_biased = tadbit(PATH + '/40Kb/chrT/chrT_A.tsv',
+                             biases=[sum(r) for r in rows], verbose=False,
+                             no_heuristic=False, n_cpus='max')
+        self.assertEqual(exp1_biased, exp1)
+
+        if CHKTIME:
+            print '1', time() - t0
+
+
+    def test_01_tadbit_nested(self):
+        """
+        the first level of the boundary tree are the TADs (uses test_01)
+        """
+        if ONLY and ONLY != '01':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        tree = tadbit_nested(PATH + '/40Kb/chrT/chrT_A.tsv', max_level=2,
+                             verbose=False, n_cpus='max')
+        first = [i for i, l in enumerate(tree['level']) if l == 1]
+        self.assertEqual([tree['start'][i] for i in first], exp1['start'])
+        self.assertEqual([tree['score'][i] for i in first], exp1['score'])
+
+        if CHKTIME:
+            print '1', time() - t0
+
+
+    def test_01_tadbit_focus(self):
+        """
+        same TADs inside a region segmented alone (uses test_01)
+        """
+        if ONLY and ONLY != '01':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        exp1_focus = tadbit(PATH + '/40Kb/chrT/chrT_A.tsv', focus=(10, 35),
+                            verbose=False, n_cpus='max')
+        self.assertEqual(exp1_focus['start'], [10, 15, 20, 25, 31])
+
+        if CHKTIME:
+            print '1', time() - t0
+
+
+    def test_01_tadbit_mapped(self):
+        """
+        same result with the matrix mapped in memory (uses test_01)
+        """
+        if ONLY and ONLY != '01':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        write_raw_matrix(read_matrix(PATH + '/40Kb/chrT/chrT_A.tsv'),
+                         'lala_mapped')
+        exp1_mapped = tadbit_mapped('lala_mapped', verbose=False,
+                                    no_heuristic=False, n_cpus='max')
+        system('rm -f lala_mapped')
+        self.assertEqual(exp1_mapped, exp1)
+
+        if CHKTIME:
+            print '1', time() - t0
+
+
     def test_02_batch_tadbit(self):
         if ONLY and ONLY != '02':
             return
@@ -97,7 +258,7 @@ class TestTadbit(unittest.TestCase):
                                  verbose=False, no_heuristic=True)
         # Breaks and scores with square root normalization.
         breaks = [0, 4, 14, 19, 34, 39, 44, 50, 62, 67, 72, 90, 95]
-        scores = [4.0, 6.0, 5.0, 5.0, 4.0, 8.0, 5.0, 4.0, 6.0, 5.0,
+        scores = [2.0, 3.0, 3.0, 7.0, 7.0, 10.0, 4.0, 4.0, 6.0, 6.0,
                   6.0, 6.0, None]
         self.assertEqual(batch_exp['start'], breaks)
         self.assertEqual(batch_exp['score'], scores)
@@ -463,22 +624,93 @@ class TestTadbit(unittest.TestCase):
 
         avg = models.average_model()
         nmd = len(models)
-        dev = rmsdRMSD_wrapper(
+        dev, names = rmsdRMSD_wrapper(
             [models[m]['x'] for m in xrange(nmd)] + [avg['x']],
             [models[m]['y'] for m in xrange(nmd)] + [avg['y']],
             [models[m]['z'] for m in xrange(nmd)] + [avg['z']],
             models._zeros,
             models.nloci, 200, range(len(models)+1),
             len(models)+1, int(False), 'rmsd', 0)
+        dev = squareform(frombuffer(dev, dtype=float32))
+        self.assertEqual(names, range(len(models)+1))
         centroid = models[models.centroid_model()]
         # find closest
-        model = min([(k, dev[(k, nmd)] )
+        model = min([(k, dev[k, nmd])
                      for k in range(nmd)], key=lambda x: x[1])[0]
         self.assertEqual(centroid['rand_init'], models[model]['rand_init'])
         if CHKTIME:
             print '13', time() - t0
 
 
+    def test_13_3d_procrustes_average(self):
+        """
+        average model by generalised Procrustes analysis
+        """
+        if ONLY and ONLY != '13':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        seed(2)
+        nloci = 25
+        zeros = tuple([True] * nloci)
+        # rigid copies of a model (rotated around z and translated) are
+        # all superposed onto their average
+        xs, ys, zs = random_walk_models(1, nloci)
+        for k in xrange(1, 6):
+            c, s = cos(0.7 * k), sin(0.7 * k)
+            xs.append([c * x - s * y + 100 * k for x, y in zip(xs[0], ys[0])])
+            ys.append([s * x + c * y for x, y in zip(xs[0], ys[0])])
+            zs.append([z - 50 * k for z in zs[0]])
+        _, rmsds, _ = centroids_wrapper(xs, ys, zs, zeros, nloci, 6,
+                                        [range(6)], 1, 100, 1e-3)[0]
+        self.assertTrue(max(rmsds) < 0.01)
+        # noisy models fit the Procrustes average at least as well as the
+        # average of the models superposed onto the first one
+        xs, ys, zs = random_walk_models(8, nloci, noise=30.)
+        _, gpa, _ = centroids_wrapper(xs, ys, zs, zeros, nloci, 8,
+                                      [range(8)], 1, 100, 1e-3)[0]
+        _, ref, _ = centroids_wrapper(xs, ys, zs, zeros, nloci, 8,
+                                      [range(8)], 0, 0, 0.)[0]
+        self.assertTrue(sum(r**2 for r in gpa) <=
+                        sum(r**2 for r in ref) * (1 + 1e-4))
+        if CHKTIME:
+            print '13', time() - t0
+
+
+    def test_13_3d_centroids_by_group(self):
+        """
+        centroids and averages of groups of models in one call, against one
+        call per group
+        """
+        if ONLY and ONLY != '13':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        seed(3)
+        nloci = 30
+        xs, ys, zs = random_walk_models(12, nloci, noise=30.)
+        zeros = tuple([i % 5 != 2 for i in xrange(nloci)])
+        groups = [range(0, 12, 2), [1, 3, 5, 7], [11]]
+        results = centroids_wrapper(xs, ys, zs, zeros, nloci, 12, groups,
+                                    0, 0, 0., 2)
+        for group, (centroid, rmsds, avg) in zip(groups, results):
+            gxs = [xs[m] for m in group]
+            gys = [ys[m] for m in group]
+            gzs = [zs[m] for m in group]
+            self.assertEqual(centroid, group[centroid_wrapper(
+                gxs, gys, gzs, zeros, nloci, len(group), 0, 0)])
+            self.assertEqual(centroid, group[rmsds.index(min(rmsds))])
+            ref = centroid_wrapper(gxs, gys, gzs, zeros, nloci, len(group),
+                                   0, 1)
+            for coords, ref_coords in zip(avg, ref):
+                for c, r in zip(coords, ref_coords):
+                    self.assertAlmostEqual(c, r, places=3)
+        if CHKTIME:
+            print '13', time() - t0
+
+
     def test_14_3d_clustering(self):
         """
         """
@@ -534,7 +766,7 @@ class TestTadbit(unittest.TestCase):
         cmap = models.get_contact_matrix(cutoff=300)
         self.assertEqual(round(
             round(sum([i if i >=0 else 0 for i in
-                       reduce(lambda x, y: x+y, cmap)])/10, 0),
+                       [v for row in cmap for v in row]])/10, 0),
             3), 8)
         # define best models
         models.define_best_models(10)
@@ -618,6 +850,85 @@ class TestTadbit(unittest.TestCase):
             print '15', time() - t0
 
 
+    def test_15_3d_consistency_cutoffs(self):
+        """
+        consistency of the models for all the cutoffs in one call, against
+        one call per cutoff
+        """
+        if ONLY and ONLY != '15':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        seed(4)
+        nloci = 30
+        xs, ys, zs = random_walk_models(10, nloci, noise=40.)
+        zeros = tuple([i % 6 != 4 for i in xrange(nloci)])
+        cutoffs = [50., 100., 150., 200.]
+        counts = consistency_wrapper(xs, ys, zs, zeros, nloci, cutoffs,
+                                     range(10), 10, 2)
+        self.assertEqual(len(counts), len(cutoffs))
+        for cutoff, count in zip(cutoffs, counts):
+            self.assertEqual(count, consistency_wrapper(
+                xs, ys, zs, zeros, nloci, [cutoff], range(10), 10)[0])
+        self.assertTrue(0 < sum(counts[0]) < sum(counts[-1]))
+        if CHKTIME:
+            print '15', time() - t0
+
+
+    def test_15_3d_contacts(self):
+        """
+        contact maps and interactions of the models, against the distances
+        computed in python
+        """
+        if ONLY and ONLY != '15':
+            return
+        if CHKTIME:
+            t0 = time()
+
+        seed(5)
+        nloci = 40
+        nmodels = 6
+        xs, ys, zs = random_walk_models(nmodels, nloci, noise=40.)
+        zeros = tuple([i % 7 != 3 for i in xrange(nloci)])
+        cutoffs = [60., 150.]
+        def square_dist(m, i, j):
+            return ((xs[m][i] - xs[m][j])**2 + (ys[m][i] - ys[m][j])**2 +
+                    (zs[m][i] - zs[m][j])**2)
+        maps = frombuffer(contact_map_wrapper(
+            xs, ys, zs, zeros, nloci, nmodels, cutoffs, 2)).reshape(
+                len(cutoffs), nloci, nloci)
+        counts = frombuffer(interactions_wrapper(
+            xs, ys, zs, nloci, nmodels, cutoffs, 2), dtype=int32).reshape(
+                len(cutoffs), nmodels, nloci)
+        for c, cutoff in enumerate(cutoffs):
+            for i in xrange(nloci):
+                for j in xrange(nloci):
+                    if i == j or not zeros[i] or not zeros[j]:
+                        self.assertTrue(isnan(maps[c][i][j]))
+                        continue
+                    val = sum(square_dist(m, i, j) <= cutoff**2
+                              for m in xrange(nmodels))
+                    self.assertAlmostEqual(maps[c][i][j],
+                                           float(val) / nmodels)
+            for m in xrange(nmodels):
+                for i in xrange(nloci):
+                    self.assertEqual(counts[c][m][i], sum(
+                        square_dist(m, i, j) < cutoff**2
+                        for j in xrange(nloci) if j != i))
+        # particles exactly one cutoff apart are in contact in the maps,
+        # but do not interact
+        line = [[100. * i for i in xrange(5)]]
+        maps = frombuffer(contact_map_wrapper(
+            line, [[0.] * 5], [[0.] * 5], (1,) * 5, 5, 1, [100.])).reshape(5, 5)
+        self.assertEqual([maps[i][i + 1] for i in xrange(4)], [1.] * 4)
+        counts = frombuffer(interactions_wrapper(
+            line, [[0.] * 5], [[0.] * 5], 5, 1, [100.]), dtype=int32)
+        self.assertEqual(list(counts), [0] * 5)
+        if CHKTIME:
+            print '15', time() - t0
+
+
     def test_16_models_stats(self):
         if ONLY and ONLY != '16':
             return
@@ -761,6 +1072,12 @@ class TestTadbit(unittest.TestCase):
 
         hic_data1 = read_matrix('20Kb/chrT/chrT_A.tsv', resolution=20000)
         hic_data2 = read_matrix('20Kb/chrT/chrT_B.tsv', resolution=20000)
+
+        # binary container, whole and by region
+        write_cmat(hic_data1, 'lala.tcm~', block=16)
+        self.assertEqual(read_matrix('lala.tcm~'), hic_data1)
+        self.assertEqual(read_cmat('lala.tcm~', focus=(11, 30)).get_matrix(),
+                         hic_data1.get_matrix(focus=(11, 30)))
         
         corr = correlate_matrices(hic_data1, hic_data2)
         corr =  [round(i,3) for i in corr[0]]